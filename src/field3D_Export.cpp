@@ -64,6 +64,7 @@
 #include <string>
 #include <list>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -73,7 +74,11 @@
 #include <Field3D/Field3DFile.h>
 #include <Field3D/InitIO.h>
 
+#include <boost/thread/mutex.hpp>
+
 #include "field3D_Tools.h"
+#include "field3D_SeqIndex.h"
+#include "field3D_FilePool.h"
 
 #include <maya/MComputation.h>
 
@@ -178,14 +183,6 @@ exportF3d::exportF3d()
   m_end = 1;
   m_verbose = false;
   
-  m_hasDensity = false;
-  m_hasTemperature = false;
-  m_hasFuel = false;    
-  m_hasColor = false;
-  m_hasVelocity = false;
-  m_hasPressure = false;
-  m_hasTexture = false;
-  m_hasFalloff = false;
   
   m_ignoreDensity = false;
   m_ignoreTemperature = false;
@@ -201,12 +198,20 @@ exportF3d::exportF3d()
   
   m_sparse = false;
   m_sparseBlockOrder = 4;
+  m_autoBlockOrder = false;
+  m_blockOrderInterval = 0;
   m_sparseThreshold = Field3DTools::SPARSE_THRESHOLD;
   m_sparseScalarDefault = 0.0;
   m_sparseVectorDefault[0] = 0.0;
   m_sparseVectorDefault[1] = 0.0;
   m_sparseVectorDefault[2] = 0.0;
+  m_sparseUniform = -1.0;
   m_format = Field3DTools::HALF;
+  m_framesInFlight = 2;
+  
+  m_maskThreshold = Field3DTools::SPARSE_THRESHOLD;
+  m_maskDilate = 0;
+  m_maskBlocks = false;
 }
 
 //----------------------------------------------------------------------------//
@@ -236,11 +241,19 @@ MSyntax exportF3d::newSyntax()
   stat = syntax.addFlag("-xml", "-genXML", MSyntax::kNoArg); ERRCHK;
   stat = syntax.addFlag("-sp",  "-sparse", MSyntax::kNoArg); ERRCHK;
   stat = syntax.addFlag("-spt", "-sparseThreshold", MSyntax::kDouble); ERRCHK;
-  stat = syntax.addFlag("-sbo", "-sparseBlockOrder", MSyntax::kLong); ERRCHK;
+  stat = syntax.addFlag("-sbo", "-sparseBlockOrder", MSyntax::kString); ERRCHK;
+  stat = syntax.addFlag("-sbi", "-sparseBlockOrderInterval", MSyntax::kLong); ERRCHK;
   stat = syntax.addFlag("-ssd", "-sparseScalarDefault", MSyntax::kDouble); ERRCHK;
   stat = syntax.addFlag("-svd", "-sparseVectorDefault", MSyntax::kDouble, MSyntax::kDouble, MSyntax::kDouble); ERRCHK;
+  stat = syntax.addFlag("-sm",  "-sparseMask", MSyntax::kString); ERRCHK;
+  stat = syntax.addFlag("-su",  "-sparseUniform", MSyntax::kDouble); ERRCHK;
+  stat = syntax.addFlag("-mc",  "-maskChannel", MSyntax::kString); ERRCHK;
+  stat = syntax.addFlag("-mt",  "-maskThreshold", MSyntax::kDouble); ERRCHK;
+  stat = syntax.addFlag("-md",  "-maskDilate", MSyntax::kLong); ERRCHK;
+  stat = syntax.addFlag("-mb",  "-maskBlocks", MSyntax::kNoArg); ERRCHK;
   stat = syntax.addFlag("-fmt", "-format", MSyntax::kString); ERRCHK;
   stat = syntax.addFlag("-rc",  "-remapChannels", MSyntax::kString); ERRCHK;
+  stat = syntax.addFlag("-fif", "-framesInFlight", MSyntax::kLong); ERRCHK;
   
   stat = syntax.addFlag("-d", "-debug");ERRCHK; 
   syntax.addFlag("-h", "-help");
@@ -282,11 +295,26 @@ MStatus exportF3d::parseArgs( const MArgList &args )
       "    -sp    -sparse                       Output sparse field\n"
       "    -spt   -sparseThreshold     float    Sparse field threshold (0.0000001 by default)\n"
       "    -sbo   -sparseBlockOrder    int      Sparse block order (4 by default for blocks of up to 16x16x16 voxels)\n"
+      "                                           'auto' picks the cheapest order of each channel on the first frame\n"
+      "    -sbi   -sparseBlockOrderInterval int Frames between two automatic block order picks (0 by default, first\n"
+      "                                           frame only)\n"
       "    -ssd   -sparseScalarDefault float    Sparse block default value for scalar fields (0 by default)\n"
       "    -svd   -sparseVectorDefault float3   Sparse block default value for vector fields (0, 0, 0 by default)\n"
-      "    -fmt   -format              string   Output format (half|float|double, half by default)\n"
+      "    -sm    -sparseMask          string   Channels deciding the sparse blocks of all the channels (',' separated\n"
+      "                                           list of density, temperature, fuel, pressure, falloff, color, texture)\n"
+      "    -su    -sparseUniform       float    Store the blocks whose voxels are all equal up to this tolerance\n"
+      "                                           as a single value (disabled by default)\n"
+      "    -mc    -maskChannel         string   Zero all the channels where this one is below -maskThreshold\n"
+      "                                           (density, temperature, fuel, pressure or falloff)\n"
+      "    -mt    -maskThreshold       float    Mask channel threshold (0.0000001 by default)\n"
+      "    -md    -maskDilate          int      Grow the mask by N voxels (0 by default)\n"
+      "    -mb    -maskBlocks                   With -sparse, keep or drop whole blocks instead of voxels\n"
+      "    -fmt   -format              string   Output format (half|float|double|quant8|quant16, half by default)\n"
+      "                                           quant8/16 store sparse 8/16 bits codes with a range per block\n"
       "    -rc    -remapChannels       string   Remap fluid channels (',' separated list of oldName=newName)\n"
       "                                           (default is 'velocity=v_mac,color=Cd,texture=coord'\n"
+      "    -fif   -framesInFlight      int      Frames written in the background while the next ones are\n"
+      "                                           simulated (2 by default, 0 writes each frame before moving on)\n"
       "    -xml   -genXML                       Generate an XML file usable to import using maya fluid cache\n"
       "    -d     -debug\n"
       "    -h     -help\n"
@@ -332,6 +360,9 @@ MStatus exportF3d::parseArgs( const MArgList &args )
   m_ignoreFalloff = argData.isFlagSet("-ignoreFalloff");
   m_xml = argData.isFlagSet("-genXML");
   m_sparse = argData.isFlagSet("-sparse");
+  m_sparseMask.clear();
+  m_sparseUniform = -1.0;
+  m_autoBlockOrder = false;
   m_remapChannels.clear();
   
   MString outFile;
@@ -361,6 +392,31 @@ MStatus exportF3d::parseArgs( const MArgList &args )
     }
   }
   
+  if (argData.isFlagSet("-format"))
+  {
+    MString fmt = "half";
+    argData.getFlagArgument("-format", 0, fmt);
+    if (fmt == "double")
+    {
+      m_format = Field3DTools::DOUBLE;
+    }
+    else if (fmt == "float")
+    {
+      m_format = Field3DTools::FLOAT;
+    }
+    else if (fmt == "quant8" || fmt == "quant16")
+    {
+      // the codes are stored per sparse block
+      m_format = (fmt == "quant8" ? Field3DTools::QUANT8 : Field3DTools::QUANT16);
+      m_sparse = true;
+    }
+    else
+    {
+      MGlobal::displayInfo("exportF3d: Invalid format \"" + fmt + "\", defaulting to \"half\"");
+      m_format = Field3DTools::HALF;
+    }
+  }
+  
   if (m_sparse)
   {
     if (argData.isFlagSet("-sparseThreshold"))
@@ -369,7 +425,32 @@ MStatus exportF3d::parseArgs( const MArgList &args )
     }
     if (argData.isFlagSet("-sparseBlockOrder"))
     {
-      argData.getFlagArgument("-sparseBlockOrder", 0, m_sparseBlockOrder);
+      MString sarg;
+      
+      argData.getFlagArgument("-sparseBlockOrder", 0, sarg);
+      
+      if (sarg == "auto")
+      {
+        m_autoBlockOrder = true;
+      }
+      else if (sarg.isInt() && sarg.asInt() > 0)
+      {
+        m_sparseBlockOrder = sarg.asInt();
+      }
+      else
+      {
+        MGlobal::displayError("exportF3d: Invalid sparse block order \"" + sarg + "\"");
+        return MS::kFailure;
+      }
+    }
+    if (argData.isFlagSet("-sparseBlockOrderInterval"))
+    {
+      argData.getFlagArgument("-sparseBlockOrderInterval", 0, m_blockOrderInterval);
+      if (m_blockOrderInterval < 0)
+      {
+        m_blockOrderInterval = 0;
+        MGlobal::displayWarning("sparseBlockOrderInterval can't be less than zero, setting it to 0");
+      }
     }
     if (argData.isFlagSet("-sparseScalarDefault"))
     {
@@ -381,24 +462,107 @@ MStatus exportF3d::parseArgs( const MArgList &args )
       argData.getFlagArgument("-sparseVectorDefault", 1, m_sparseVectorDefault[1]);
       argData.getFlagArgument("-sparseVectorDefault", 2, m_sparseVectorDefault[2]);
     }
+    if (argData.isFlagSet("-sparseUniform"))
+    {
+      argData.getFlagArgument("-sparseUniform", 0, m_sparseUniform);
+      if (m_sparseUniform < 0.0)
+      {
+        m_sparseUniform = -1.0;
+        MGlobal::displayWarning("sparseUniform can't be less than zero, uniform blocks are not detected");
+      }
+    }
+    if (argData.isFlagSet("-sparseMask"))
+    {
+      MString sarg;
+      
+      argData.getFlagArgument("-sparseMask", 0, sarg);
+      
+      std::vector<std::string> items;
+      
+      Split(sarg.asChar(), ',', items, true);
+      
+      for (size_t i=0; i<items.size(); ++i)
+      {
+        if (items[i] != "density" && items[i] != "temperature" && items[i] != "fuel" &&
+            items[i] != "pressure" && items[i] != "falloff" && items[i] != "color" && items[i] != "texture")
+        {
+          MGlobal::displayError(MString("exportF3d: Invalid sparse mask channel \"") + items[i].c_str() + "\"");
+          return MS::kFailure;
+        }
+        
+        m_sparseMask.insert(items[i]);
+      }
+    }
   }
   
-  if (argData.isFlagSet("-format"))
+  m_maskChannel = "";
+  m_maskDilate = 0;
+  m_maskBlocks = argData.isFlagSet("-maskBlocks");
+  
+  if (argData.isFlagSet("-maskChannel"))
   {
-    MString fmt = "half";
-    argData.getFlagArgument("-format", 0, fmt);
-    if (fmt == "double")
+    MString sarg;
+    
+    argData.getFlagArgument("-maskChannel", 0, sarg);
+    
+    m_maskChannel = sarg.asChar();
+    
+    StripWS(m_maskChannel);
+    
+    if (m_maskChannel != "density" && m_maskChannel != "temperature" && m_maskChannel != "fuel" &&
+        m_maskChannel != "pressure" && m_maskChannel != "falloff")
     {
-      m_format = Field3DTools::DOUBLE;
+      MGlobal::displayError(MString("exportF3d: Invalid mask channel \"") + sarg + "\"");
+      return MS::kFailure;
     }
-    else if (fmt == "float")
+  }
+  
+  if (argData.isFlagSet("-maskThreshold"))
+  {
+    argData.getFlagArgument("-maskThreshold", 0, m_maskThreshold);
+  }
+  
+  if (argData.isFlagSet("-maskDilate"))
+  {
+    argData.getFlagArgument("-maskDilate", 0, m_maskDilate);
+    if (m_maskDilate < 0)
     {
-      m_format = Field3DTools::FLOAT;
+      m_maskDilate = 0;
+      MGlobal::displayWarning("maskDilate can't be less than zero, setting it to 0");
     }
-    else
+  }
+  
+  // the quantized fill stores every block of a channel with its range
+  if (Field3DTools::quantizedBits(m_format) > 0)
+  {
+    if (argData.isFlagSet("-sparseMask"))
     {
-      MGlobal::displayInfo("exportF3d: Invalid format \"" + fmt + "\", defaulting to \"half\"");
-      m_format = Field3DTools::HALF;
+      m_sparseMask.clear();
+      MGlobal::displayWarning("exportF3d: sparseMask doesn't apply to quantized formats, ignored");
+    }
+    if (m_maskBlocks)
+    {
+      m_maskBlocks = false;
+      MGlobal::displayWarning("exportF3d: maskBlocks doesn't apply to quantized formats, the mask channel zeroes voxels");
+    }
+    if (argData.isFlagSet("-sparseUniform"))
+    {
+      m_sparseUniform = -1.0;
+      MGlobal::displayWarning("exportF3d: sparseUniform doesn't apply to quantized formats, ignored");
+    }
+    if (argData.isFlagSet("-sparseThreshold") && !m_autoBlockOrder)
+    {
+      MGlobal::displayWarning("exportF3d: sparseThreshold only drives the automatic block order of quantized formats, ignored");
+    }
+  }
+  
+  if (argData.isFlagSet("-framesInFlight"))
+  {
+    argData.getFlagArgument("-framesInFlight", 0, m_framesInFlight);
+    if (m_framesInFlight < 0)
+    {
+      m_framesInFlight = 0;
+      MGlobal::displayWarning("framesInFlight can't be less than zero, setting it to 0");
     }
   }
   
@@ -444,12 +608,6 @@ MStatus exportF3d::parseArgs( const MArgList &args )
     return status;
   }
   
-  // Get the selected Fluid Systems
-  if (m_slist.length() > 1)
-  {
-    MGlobal::displayWarning("[exportF3d]: only first fluid object is used to export");
-  }
-  
   return MS::kSuccess;
 }
 
@@ -460,6 +618,346 @@ const std::string& exportF3d::remapChannel(const std::string &name) const
   return (rit == m_remapChannels.end() ? name : rit->second);
 }
 
+//----------------------------------------------------------------------------//
+
+FluidSnapshot::FluidSnapshot()
+  : res(0)
+  , offset(0.0f)
+  , dimension(0.0f)
+{
+  clear();
+}
+
+void FluidSnapshot::clear()
+{
+  partition = "";
+  
+  for (int c=0; c<NumChannels; ++c)
+  {
+    has[c] = false;
+  }
+}
+
+void FluidSnapshot::copy(Channel c, const float *src, size_t n)
+{
+  has[c] = (src != 0 && n > 0);
+  
+  if (has[c])
+  {
+    // assign() reuses the capacity of the previous frame
+    data[c].assign(src, src + n);
+  }
+}
+
+const float* FluidSnapshot::channel(Channel c) const
+{
+  return (has[c] ? &(data[c][0]) : 0);
+}
+
+size_t FluidSnapshot::bytes() const
+{
+  size_t n = 0;
+  
+  for (int c=0; c<NumChannels; ++c)
+  {
+    if (has[c])
+    {
+      n += data[c].size() * sizeof(float);
+    }
+  }
+  
+  return n;
+}
+
+FrameSnapshot::FrameSnapshot()
+  : chooseBlockOrders(false)
+{
+}
+
+size_t FrameSnapshot::bytes() const
+{
+  size_t n = 0;
+  
+  for (size_t i=0; i<fluids.size(); ++i)
+  {
+    n += fluids[i].bytes();
+  }
+  
+  return n;
+}
+
+ExportFluid::ExportFluid()
+  : ignoreDensity(false)
+  , ignoreTemperature(false)
+  , ignoreFuel(false)
+  , ignoreColor(false)
+  , ignoreVelocity(false)
+  , ignorePressure(false)
+  , ignoreTexture(false)
+  , ignoreFalloff(false)
+  , hasDensity(false)
+  , hasTemperature(false)
+  , hasFuel(false)
+  , hasColor(false)
+  , hasVelocity(false)
+  , hasPressure(false)
+  , hasTexture(false)
+  , hasFalloff(false)
+{
+}
+
+bool ExportFluid::exports(const std::string &channel) const
+{
+  if (channel == "density")     return !ignoreDensity;
+  if (channel == "temperature") return !ignoreTemperature;
+  if (channel == "fuel")        return !ignoreFuel;
+  if (channel == "color")       return !ignoreColor;
+  if (channel == "velocity")    return !ignoreVelocity;
+  if (channel == "pressure")    return !ignorePressure;
+  if (channel == "texture")     return !ignoreTexture;
+  if (channel == "falloff")     return !ignoreFalloff;
+  return false;
+}
+
+// first snapshot channel of a fluid channel
+static FluidSnapshot::Channel SnapshotChannel(const std::string &name)
+{
+  if (name == "density")     return FluidSnapshot::Density;
+  if (name == "temperature") return FluidSnapshot::Temperature;
+  if (name == "fuel")        return FluidSnapshot::Fuel;
+  if (name == "pressure")    return FluidSnapshot::Pressure;
+  if (name == "falloff")     return FluidSnapshot::Falloff;
+  if (name == "color")       return FluidSnapshot::Red;
+  if (name == "texture")     return FluidSnapshot::U;
+  return FluidSnapshot::VelocityX;
+}
+
+//----------------------------------------------------------------------------//
+
+// Sparse block orders picked by -sparseBlockOrder auto, per partition and
+// channel. Kept from one frame to the next.
+class BlockOrderTable
+{
+public:
+  
+  bool find(const std::string &partition, int channel, int &order) const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    
+    std::map<std::pair<std::string, int>, int>::const_iterator it = m_orders.find(std::make_pair(partition, channel));
+    
+    if (it == m_orders.end())
+    {
+      return false;
+    }
+    
+    order = it->second;
+    
+    return true;
+  }
+  
+  void set(const std::string &partition, int channel, int order)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    
+    m_orders[std::make_pair(partition, channel)] = order;
+  }
+  
+private:
+  
+  mutable boost::mutex m_mutex;
+  std::map<std::pair<std::string, int>, int> m_orders;
+};
+
+// Frames handed to the write behind worker. Snapshots are recycled once
+// written, failures and timings are reported back to the export loop.
+class ExportPipeline
+{
+public:
+  
+  ExportPipeline()
+    : m_frames(0)
+    , m_fillTime(0.0)
+    , m_writeTime(0.0)
+  {
+  }
+  
+  // all jobs must have run
+  ~ExportPipeline()
+  {
+    for (size_t i=0; i<m_free.size(); ++i)
+    {
+      delete m_free[i];
+    }
+  }
+  
+  // one snapshot per exported fluid
+  FrameSnapshot* acquire(size_t numFluids)
+  {
+    FrameSnapshot *snap = 0;
+    
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      
+      if (!m_free.empty())
+      {
+        snap = m_free.back();
+        m_free.pop_back();
+      }
+    }
+    
+    if (!snap)
+    {
+      snap = new FrameSnapshot();
+    }
+    
+    snap->fluids.resize(numFluids);
+    snap->chooseBlockOrders = false;
+    
+    for (size_t i=0; i<numFluids; ++i)
+    {
+      snap->fluids[i].clear();
+    }
+    
+    return snap;
+  }
+  
+  void release(FrameSnapshot *snap)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    
+    m_free.push_back(snap);
+  }
+  
+  void done(const std::string &path, bool ok, double fillTime, double writeTime)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    
+    if (!ok)
+    {
+      m_failed.push_back(path);
+    }
+    
+    m_frames += 1;
+    m_fillTime += fillTime;
+    m_writeTime += writeTime;
+  }
+  
+  // paths of the frames that couldn't be written
+  std::vector<std::string> failed() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    
+    return m_failed;
+  }
+  
+  BlockOrderTable& blockOrders()
+  {
+    return m_blockOrders;
+  }
+  
+  void times(size_t &frames, double &fillTime, double &writeTime) const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    
+    frames = m_frames;
+    fillTime = m_fillTime;
+    writeTime = m_writeTime;
+  }
+  
+private:
+  
+  mutable boost::mutex m_mutex;
+  std::vector<FrameSnapshot*> m_free;
+  std::vector<std::string> m_failed;
+  BlockOrderTable m_blockOrders;
+  size_t m_frames;
+  double m_fillTime;
+  double m_writeTime;
+};
+
+template <typename FField, typename VField, typename MField>
+class ExportFrameJob : public WriteBehind::Job
+{
+public:
+  
+  ExportFrameJob(const exportF3d *cmd, ExportPipeline *pipeline, FrameSnapshot *snap,
+                 const std::string &outputPath, const std::string &indexFile)
+    : WriteBehind::Job(snap->bytes(), pipeline)
+    , m_cmd(cmd)
+    , m_pipeline(pipeline)
+    , m_snap(snap)
+    , m_outputPath(outputPath)
+    , m_indexFile(indexFile)
+  {
+  }
+  
+  virtual bool run()
+  {
+    double fillTime = 0.0;
+    double writeTime = 0.0;
+    
+    SeqIndex::FrameHeader header;
+    
+    bool ok = m_cmd->writeSnapshot<FField, VField, MField>(*m_snap, m_pipeline->blockOrders(), m_outputPath, header, fillTime, writeTime);
+    
+    // keep the sequence index in sync with the written frames
+    if (ok)
+    {
+      SeqIndex::record(m_indexFile, m_outputPath, header);
+    }
+    
+    m_pipeline->done(m_outputPath, ok, fillTime, writeTime);
+    m_pipeline->release(m_snap);
+    
+    return ok;
+  }
+  
+private:
+  
+  const exportF3d *m_cmd;
+  ExportPipeline *m_pipeline;
+  FrameSnapshot *m_snap;
+  std::string m_outputPath;
+  std::string m_indexFile;
+};
+
+WriteBehind::Job* exportF3d::frameJob(ExportPipeline *pipeline, FrameSnapshot *snap,
+                                      const std::string &outputPath, const std::string &indexFile) const
+{
+  if (m_sparse)
+  {
+    switch (m_format)
+    {
+    case Field3DTools::DOUBLE:
+      return new ExportFrameJob<SparseFieldd, SparseField3d, MACField3d>(this, pipeline, snap, outputPath, indexFile);
+    case Field3DTools::FLOAT:
+      return new ExportFrameJob<SparseFieldf, SparseField3f, MACField3f>(this, pipeline, snap, outputPath, indexFile);
+    case Field3DTools::HALF:
+    case Field3DTools::QUANT8:
+    case Field3DTools::QUANT16:
+    default:
+      // quantized channels are written as empty half placeholders
+      return new ExportFrameJob<SparseFieldh, SparseField3h, MACField3h>(this, pipeline, snap, outputPath, indexFile);
+    }
+  }
+  else
+  {
+    switch (m_format)
+    {
+    case Field3DTools::DOUBLE:
+      return new ExportFrameJob<DenseFieldd, DenseField3d, MACField3d>(this, pipeline, snap, outputPath, indexFile);
+    case Field3DTools::FLOAT:
+      return new ExportFrameJob<DenseFieldf, DenseField3f, MACField3f>(this, pipeline, snap, outputPath, indexFile);
+    case Field3DTools::HALF:
+    default:
+      return new ExportFrameJob<DenseFieldh, DenseField3h, MACField3h>(this, pipeline, snap, outputPath, indexFile);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 MStatus exportF3d::doIt(const MArgList& args)
 {
   MStatus status;
@@ -477,8 +975,9 @@ MStatus exportF3d::doIt(const MArgList& args)
 
   MItSelectionList selListIter(m_slist, MFn::kFluid, &status);  
   
-  // ToDo: support multiple shape export
-  //       -> generate one XML file per shape
+  // all the selected fluids are exported from the same simulation pass,
+  // each in its own partition of the frame files
+  std::vector<ExportFluid> fluids;
   
   for (; !selListIter.isDone(); selListIter.next())
   {
@@ -508,377 +1007,364 @@ MStatus exportF3d::doIt(const MArgList& args)
       std::cout << std::endl << std::endl;
     }      
        
+    ExportFluid fluid;
+    
+    fluid.dagPath = dagPath;
+    fluid.shapeName = fluidFn.name().asChar();
+    
+    size_t p = fluid.shapeName.rfind(':');
+    if (p != std::string::npos)
+    {
+      fluid.shapeName = fluid.shapeName.substr(p + 1);
+    }
+    
+    fluid.ignoreDensity = m_ignoreDensity;
+    fluid.ignoreTemperature = m_ignoreTemperature;
+    fluid.ignoreFuel = m_ignoreFuel;
+    fluid.ignoreColor = m_ignoreColor;
+    fluid.ignoreVelocity = m_ignoreVelocity;
+    fluid.ignorePressure = m_ignorePressure;
+    fluid.ignoreTexture = m_ignoreTexture;
+    fluid.ignoreFalloff = m_ignoreFalloff;
+    
     MFnFluid::FluidMethod method;
     MFnFluid::FluidGradient gradient;
     
-    if (!m_ignoreDensity)
+    if (!fluid.ignoreDensity)
     {
       status = fluidFn.getDensityMode(method, gradient);
-      m_ignoreDensity = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
+      fluid.ignoreDensity = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
     }
     
-    if (!m_ignoreTemperature)
+    if (!fluid.ignoreTemperature)
     {
       status = fluidFn.getTemperatureMode(method, gradient);
-      m_ignoreTemperature = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
+      fluid.ignoreTemperature = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
     }
     
-    if (!m_ignoreFuel)
+    if (!fluid.ignoreFuel)
     {
       status = fluidFn.getFuelMode(method, gradient);
-      m_ignoreFuel = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
+      fluid.ignoreFuel = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
     }
     
-    if (!m_ignoreVelocity)
+    if (!fluid.ignoreVelocity)
     {
       status = fluidFn.getVelocityMode(method, gradient);
-      m_ignoreVelocity = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
+      fluid.ignoreVelocity = (status.error() || (method != MFnFluid::kStaticGrid && method != MFnFluid::kDynamicGrid));
     }
 
-    if (!m_ignoreColor)
+    if (!fluid.ignoreColor)
     {
       MFnFluid::ColorMethod colorMethod;
       status = fluidFn.getColorMode(colorMethod);
-      m_ignoreColor = (status.error() || colorMethod == MFnFluid::kUseShadingColor);
+      fluid.ignoreColor = (status.error() || colorMethod == MFnFluid::kUseShadingColor);
     }
 
-    if (!m_ignorePressure && m_ignoreVelocity)
+    if (!fluid.ignorePressure && fluid.ignoreVelocity)
     {
       // The pressure data only exists if the velocity method is kStaticGrid or kDynamicGrid
-      m_ignorePressure = true;
+      fluid.ignorePressure = true;
     }
     
-    if (!m_ignoreTexture)
+    if (!fluid.ignoreTexture)
     {
       MFnFluid::CoordinateMethod coordMode;
       status = fluidFn.getCoordinateMode(coordMode);
-      m_ignoreTexture = (status.error() || coordMode != MFnFluid::kGrid);
+      fluid.ignoreTexture = (status.error() || coordMode != MFnFluid::kGrid);
     }
 
-    if (!m_ignoreFalloff)
+    if (!fluid.ignoreFalloff)
     {
       MFnFluid::FalloffMethod falloffMethod;
       status = fluidFn.getFalloffMode(falloffMethod);
-      m_ignoreFalloff = (status.error() || falloffMethod != MFnFluid::kNoFalloffGrid);
+      fluid.ignoreFalloff = (status.error() || falloffMethod != MFnFluid::kNoFalloffGrid);
     }
     
     if (m_verbose)
     {
       MGlobal::displayInfo("Ignore");
-      MGlobal::displayInfo(MString("  density: ") + (m_ignoreDensity ? "true" : "false"));
-      MGlobal::displayInfo(MString("  temperature: ") + (m_ignoreTemperature ? "true" : "false"));
-      MGlobal::displayInfo(MString("  fuel: ") + (m_ignoreFuel ? "true" : "false"));
-      MGlobal::displayInfo(MString("  velocity: ") + (m_ignoreVelocity ? "true" : "false"));
-      MGlobal::displayInfo(MString("  color: ") + (m_ignoreColor ? "true" : "false"));
-      MGlobal::displayInfo(MString("  pressure: ") + (m_ignorePressure ? "true" : "false"));
-      MGlobal::displayInfo(MString("  texture: ") + (m_ignoreTexture ? "true" : "false"));
-      MGlobal::displayInfo(MString("  falloff: ") + (m_ignoreFalloff ? "true" : "false"));
-    }
-
-    // Pre-process file base name
-    MString fluidPath;
-    std::string fluidName;
-    bool hasFramePattern = false;
-    char tmp[4096];
-    size_t p = 0;
-    
-    std::string shapeName = fluidFn.name().asChar();
-    p = shapeName.rfind(':');
-    if (p != std::string::npos)
-    {
-      shapeName = shapeName.substr(p + 1);
+      MGlobal::displayInfo(MString("  density: ") + (fluid.ignoreDensity ? "true" : "false"));
+      MGlobal::displayInfo(MString("  temperature: ") + (fluid.ignoreTemperature ? "true" : "false"));
+      MGlobal::displayInfo(MString("  fuel: ") + (fluid.ignoreFuel ? "true" : "false"));
+      MGlobal::displayInfo(MString("  velocity: ") + (fluid.ignoreVelocity ? "true" : "false"));
+      MGlobal::displayInfo(MString("  color: ") + (fluid.ignoreColor ? "true" : "false"));
+      MGlobal::displayInfo(MString("  pressure: ") + (fluid.ignorePressure ? "true" : "false"));
+      MGlobal::displayInfo(MString("  texture: ") + (fluid.ignoreTexture ? "true" : "false"));
+      MGlobal::displayInfo(MString("  falloff: ") + (fluid.ignoreFalloff ? "true" : "false"));
     }
     
-    // setup output base name
-    if (m_outputName.length() > 0)
-    {
-      fluidName = m_outputName.asChar();
-    }
-    else
+    if (m_maskChannel.length() > 0 && !fluid.exports(m_maskChannel))
     {
-      fluidName = shapeName;
+      MGlobal::displayWarning(MString("exportF3d: \"") + m_maskChannel.c_str() + "\" isn't exported for " +
+                              dagPath.partialPathName() + ", its channels won't be masked");
     }
     
-    // remove .f3d extension if any
-    p = fluidName.rfind('.');
-    if (p != std::string::npos && fluidName.substr(p) == ".f3d")
+    // the partition is named after the shape without its namespace,
+    //   the layers of one fluid would overwrite the other's
+    for (size_t i=0; i<fluids.size(); ++i)
     {
-      fluidName = fluidName.substr(0, p);
+      if (fluids[i].shapeName == fluid.shapeName)
+      {
+        MGlobal::displayError(MString("exportF3d: Fluids \"") + fluids[i].dagPath.partialPathName() + "\" and \"" +
+                              dagPath.partialPathName() + "\" share the same partition, export them separately");
+        return MS::kFailure;
+      }
     }
     
-    // check for %d or %0xd pattern
-    p = fluidName.rfind('%');
-    if (p != std::string::npos)
-    {
-      size_t n = fluidName.length();
-      size_t p1 = p + 1;
-      
-      while (p1 < n && fluidName[p1] != 'd')
+    fluids.push_back(fluid);
+  }
+  
+  if (fluids.empty())
+  {
+    MGlobal::displayError("exportF3d: No fluid to export");
+    return MS::kFailure;
+  }
+  
+  // Pre-process file base name
+  MString fluidPath;
+  std::string fluidName;
+  bool hasFramePattern = false;
+  char tmp[4096];
+  size_t p = 0;
+  
+  // setup output base name
+  if (m_outputName.length() > 0)
+  {
+    fluidName = m_outputName.asChar();
+  }
+  else
+  {
+    fluidName = fluids[0].shapeName;
+  }
+  
+  // remove .f3d extension if any
+  p = fluidName.rfind('.');
+  if (p != std::string::npos && fluidName.substr(p) == ".f3d")
+  {
+    fluidName = fluidName.substr(0, p);
+  }
+  
+  // check for %d or %0xd pattern
+  p = fluidName.rfind('%');
+  if (p != std::string::npos)
+  {
+    size_t n = fluidName.length();
+    size_t p1 = p + 1;
+    
+    while (p1 < n && fluidName[p1] != 'd')
+    {
+      if (fluidName[p1] < '0'  || fluidName[p1] > '9')
       {
-        if (fluidName[p1] < '0'  || fluidName[p1] > '9')
-        {
-          break;
-        }
-        ++p1;
+        break;
       }
-      
-      hasFramePattern = (p1 < n && fluidName[p1] == 'd');
+      ++p1;
     }
-    // check for # pattern and replace by printf-like one
-    if (!hasFramePattern)
+    
+    hasFramePattern = (p1 < n && fluidName[p1] == 'd');
+  }
+  // check for # pattern and replace by printf-like one
+  if (!hasFramePattern)
+  {
+    p = fluidName.rfind('#');
+    
+    if (p != std::string::npos)
     {
-      p = fluidName.rfind('#');
+      size_t p1 = fluidName.find_last_not_of("#", p);
       
-      if (p != std::string::npos)
+      if (p1 != std::string::npos)
       {
-        size_t p1 = fluidName.find_last_not_of("#", p);
+        size_t n = p - p1;
+        
+        std::string tail = fluidName.substr(p + 1);
+        
+        fluidName = fluidName.substr(0, p1 + 1);
         
-        if (p1 != std::string::npos)
+        if (n > 1)
         {
-          size_t n = p - p1;
-          
-          std::string tail = fluidName.substr(p + 1);
-          
-          fluidName = fluidName.substr(0, p1 + 1);
-          
-          if (n > 1)
-          {
-            sprintf(tmp, "%%0%lud", n);
-            fluidName += tmp;
-          }
-          else
-          {
-            fluidName += "%d";
-          }
-          
-          fluidName += tail;
-          
-          hasFramePattern = true;
+          sprintf(tmp, "%%0%lud", n);
+          fluidName += tmp;
+        }
+        else
+        {
+          fluidName += "%d";
         }
+        
+        fluidName += tail;
+        
+        hasFramePattern = true;
       }
     }
-    
-    // remove trailing '.' if any
-    size_t n = fluidName.length() - 1;
-    if (fluidName[n] == '.')
+  }
+  
+  // remove trailing '.' if any
+  size_t n = fluidName.length() - 1;
+  if (fluidName[n] == '.')
+  {
+    fluidName = fluidName.substr(0, n);
+  }
+  
+  // setup file pattern
+  std::string filePattern = fluidName;
+  
+  if (!hasFramePattern)
+  {
+    sprintf(tmp, "%s.%%04d.f3d", fluidName.c_str());
+    filePattern = tmp;
+  }
+  else
+  {
+    filePattern += ".f3d";
+  }
+  
+  std::string indexFile = SeqIndex::indexPath(std::string(m_outputDir.asChar()) + "/" + filePattern);
+  
+  // Go through the selected frame range
+  MComputation computation;
+  computation.beginComputation();
+  
+  double step = 1.0 / (1.0 + m_numOversample);
+  
+  int numOversample = 0;
+  double dt = 1.0;
+  
+  MTime ct = MAnimControl::currentTime();
+  
+  MTime t(double(m_start) - 1.0, MTime::uiUnit());
+  
+  ExportPipeline pipeline;
+  
+  bool interrupted = false;
+  
+  ParallelTools::Timer exportTimer;
+  
+  for (int frame=m_start; frame<=m_end; ++frame)
+  {
+    if (computation.isInterruptRequested())
     {
-      fluidName = fluidName.substr(0, n);
+      interrupted = true;
+      break;
     }
     
-    // setup file pattern
-    std::string filePattern = fluidName;
-    
-    if (!hasFramePattern)
+    if (!pipeline.failed().empty())
     {
-      sprintf(tmp, "%s.%%04d.f3d", fluidName.c_str());
-      filePattern = tmp;
+      // stop simulating frames that won't be written
+      break;
     }
-    else
+     
+    for (int s=0; s<numOversample; ++s)
     {
-      filePattern += ".f3d";
+      t.setValue(t.value() + dt);
+      MAnimControl::setCurrentTime(t);
+      // Do we need to force grid evaluation?
     }
     
-    // Go through the selected frame range
-    MComputation computation;
-    computation.beginComputation();
+    t.setValue(t.value() + dt);
+    status = MAnimControl::setCurrentTime(t);
+    // Do we need to force grid evaluation?
+    
+    fluidPath = m_outputDir + "/";
     
-    double step = 1.0 / (1.0 + m_numOversample);
+    sprintf(tmp, filePattern.c_str(), frame);
     
-    int numOversample = 0;
-    double dt = 1.0;
+    fluidPath += tmp;
     
-    MTime ct = MAnimControl::currentTime();
+    MGlobal::displayInfo(MString("Writting: ") + fluidPath);
     
-    MTime t(double(m_start) - 1.0, MTime::uiUnit());
+    // the fields are filled and written in the background while the
+    // solver computes the next frame
+    FrameSnapshot *snap = pipeline.acquire(fluids.size());
     
-    for (int frame=m_start; frame<=m_end; ++frame)
+    // block orders are picked on the first frame, then every interval
+    int frameIndex = frame - m_start;
+    
+    snap->chooseBlockOrders = (m_autoBlockOrder &&
+                               (frameIndex == 0 || (m_blockOrderInterval > 0 && frameIndex % m_blockOrderInterval == 0)));
+    
+    size_t snapped = 0;
+    
+    for (size_t i=0; i<fluids.size(); ++i)
     {
-      if (computation.isInterruptRequested())
-      {
-        break;
-      }
-       
-      for (int s=0; s<numOversample; ++s)
-      {
-        t.setValue(t.value() + dt);
-        MAnimControl::setCurrentTime(t);
-        // Do we need to force grid evaluation?
-      }
+      MFnFluid fluidFn(fluids[i].dagPath);
       
-      t.setValue(t.value() + dt);
-      status = MAnimControl::setCurrentTime(t);
-      // Do we need to force grid evaluation?
-      
-      fluidPath = m_outputDir + "/";
-      
-      sprintf(tmp, filePattern.c_str(), frame);
-      
-      fluidPath += tmp;
-      
-      MGlobal::displayInfo(MString("Writting: ") + fluidPath);
-      
-      if (m_sparse)
+      if (snapshot(fluidFn, fluids[i], snap->fluids[i]))
       {
-        switch (m_format)
-        {
-        case Field3DTools::DOUBLE:
-          setF3dField<SparseFieldd, SparseField3d, MACField3d>(fluidFn, fluidPath.asChar(), dagPath);
-          break;
-        case Field3DTools::FLOAT:
-          setF3dField<SparseFieldf, SparseField3f, MACField3f>(fluidFn, fluidPath.asChar(), dagPath);
-          break;
-        case Field3DTools::HALF:
-        default:
-          setF3dField<SparseFieldh, SparseField3h, MACField3h>(fluidFn, fluidPath.asChar(), dagPath);
-        }
+        ++snapped;
       }
-      else
-      {
-        switch (m_format)
-        {
-        case Field3DTools::DOUBLE:
-          setF3dField<DenseFieldd, DenseField3d, MACField3d>(fluidFn, fluidPath.asChar(), dagPath);
-          break;
-        case Field3DTools::FLOAT:
-          setF3dField<DenseFieldf, DenseField3f, MACField3f>(fluidFn, fluidPath.asChar(), dagPath);
-          break;
-        case Field3DTools::HALF:
-        default:
-          setF3dField<DenseFieldh, DenseField3h, MACField3h>(fluidFn, fluidPath.asChar(), dagPath);
-        }
-      }
-      
-      // past first frame, numOversample and dt match m_numOversample and step
-      numOversample = m_numOversample;
-      dt = step;
     }
+    
+    if (snapped > 0)
+    {
+      WriteBehind::pushBounded(frameJob(&pipeline, snap, fluidPath.asChar(), indexFile), size_t(m_framesInFlight));
+    }
+    else
+    {
+      pipeline.release(snap);
+    }
+    
+    // past first frame, numOversample and dt match m_numOversample and step
+    numOversample = m_numOversample;
+    dt = step;
+  }
 
-    computation.endComputation(); 
+  // frames already simulated are written, even when interrupted
+  ParallelTools::Timer flushTimer;
+  
+  bool flushed = WriteBehind::flush(&pipeline);
+  
+  double flushTime = flushTimer.elapsed();
+  
+  computation.endComputation(); 
+  
+  MAnimControl::setCurrentTime(ct);
+  
+  if (m_verbose)
+  {
+    size_t frames = 0;
+    double fillTime = 0.0;
+    double writeTime = 0.0;
     
-    MAnimControl::setCurrentTime(ct);
+    pipeline.times(frames, fillTime, writeTime);
     
-    // generate .xml for nCache compatible output
-    if (m_xml)
+    sprintf(tmp, "exportF3d: %lu frame(s) in %.3f ms, fill %.3f ms, write %.3f ms, %.3f ms waiting for the last writes",
+            frames, exportTimer.elapsed(), fillTime, writeTime, flushTime);
+    MGlobal::displayInfo(tmp);
+  }
+  
+  if (interrupted)
+  {
+    MGlobal::displayWarning("exportF3d: Interrupted, the frames simulated so far were written");
+  }
+  
+  std::vector<std::string> failed = pipeline.failed();
+  
+  if (!flushed || !failed.empty())
+  {
+    for (size_t i=0; i<failed.size(); ++i)
     {
-      if (m_verbose)
-      {
-        MGlobal::displayInfo("Generating nCache XML");
-        MGlobal::displayInfo(MString("  density: ") + (m_hasDensity ? "true" : "false"));
-        MGlobal::displayInfo(MString("  temperature: ") + (m_hasTemperature ? "true" : "false"));
-        MGlobal::displayInfo(MString("  fuel: ") + (m_hasFuel ? "true" : "false"));
-        MGlobal::displayInfo(MString("  velocity: ") + (m_hasVelocity ? "true" : "false"));
-        MGlobal::displayInfo(MString("  color: ") + (m_hasColor ? "true" : "false"));
-        MGlobal::displayInfo(MString("  pressure: ") + (m_hasPressure ? "true" : "false"));
-        MGlobal::displayInfo(MString("  texture: ") + (m_hasTexture ? "true" : "false"));
-        MGlobal::displayInfo(MString("  falloff: ") + (m_hasFalloff ? "true" : "false"));
-      }
-      
-      std::string xmlPath = m_outputDir.asChar();
-      
-      xmlPath += "/";
-      xmlPath += shapeName;
-      xmlPath += ".xml";
-      
-      FILE *f = fopen(xmlPath.c_str(), "w");
-      
-      MTime t(1, MTime::uiUnit());
-      
-      int TimePerFrame = int(floor(t.asUnits(MTime::k6000FPS)));
-      
-      t.setValue(m_start);  
-      int StartTime = int(floor(t.asUnits(MTime::k6000FPS)));
-      
-      t.setValue(m_end);
-      int EndTime = int(floor(t.asUnits(MTime::k6000FPS)));
-      
-      std::string fmt = "half";
-      switch (m_format)
-      {
-      case Field3DTools::DOUBLE:
-        fmt = "double";
-        break;
-      case Field3DTools::FLOAT:
-        fmt = "double";
-      default:
-        break;
-      }
-      
-      fprintf(f, "<?xml version=\"1.0\"?>\n");
-      fprintf(f, "<Autodesk_Cache_File>\n");
-      fprintf(f, "  <cacheType Type=\"OneFilePerFrame\" Format=\"f3d_%s_%s\"/>\n", (m_sparse ? "sparse" : "dense"), fmt.c_str());
-      fprintf(f, "  <time Range=\"%d-%d\"/>\n", StartTime, EndTime);
-      fprintf(f, "  <cacheTimePerFrame TimePerFrame=\"%d\"/>\n", TimePerFrame);
-      fprintf(f, "  <cacheVersion Version=\"2.0\"/>\n");
-      fprintf(f, "  <extra>f3d.file=%s</extra>\n", filePattern.c_str());
-      for (std::map<std::string, std::string>::const_iterator rit = m_remapChannels.begin(); rit != m_remapChannels.end(); ++rit)
-      {
-        if (m_exportedChannels.find(rit->first) != m_exportedChannels.end())
-        {
-          fprintf(f, "  <extra>f3d.remap=%s:%s</extra>\n", rit->first.c_str(), rit->second.c_str());
-        }
-      }
-      fprintf(f, "  <Channels>\n");
-      
-      int d = 0;
-      
-      if (m_hasDensity)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_density\" ChannelType=\"FloatArray\" ChannelInterpretation=\"density\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasVelocity)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_velocity\" ChannelType=\"FloatArray\" ChannelInterpretation=\"velocity\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasTemperature)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_temperature\" ChannelType=\"FloatArray\" ChannelInterpretation=\"temperature\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasFuel)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_fuel\" ChannelType=\"FloatArray\" ChannelInterpretation=\"fuel\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasPressure)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_pressure\" ChannelType=\"FloatArray\" ChannelInterpretation=\"pressure\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasFalloff)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_falloff\" ChannelType=\"FloatArray\" ChannelInterpretation=\"falloff\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasColor)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_color\" ChannelType=\"FloatArray\" ChannelInterpretation=\"color\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      if (m_hasTexture)
-      {
-        fprintf(f, "    <channel%d ChannelName=\"%s_texture\" ChannelType=\"FloatArray\" ChannelInterpretation=\"texture\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-                d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      }
-      
-      // Dummy fields (implicit in Field3D format)
-      fprintf(f, "    <channel%d ChannelName=\"%s_resolution\" ChannelType=\"FloatArray\" ChannelInterpretation=\"resolution\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-              d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      
-      fprintf(f, "    <channel%d ChannelName=\"%s_offset\" ChannelType=\"FloatArray\" ChannelInterpretation=\"offset\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
-              d++, dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
-      
-      fprintf(f, "  </Channels>\n");
-      fprintf(f, "</Autodesk_Cache_File>\n");
-      fprintf(f, "\n");
-      
-      fclose(f);
+      MGlobal::displayError(MString("exportF3d: Couldn't write ") + failed[i].c_str());
     }
     
-    break;
+    if (failed.empty())
+    {
+      // a frame job failed before reporting its frame
+      MGlobal::displayError("exportF3d: Some frames couldn't be written, see the log for an explanation");
+    }
+    
+    MAnimControl::setCurrentTime(currentFrame);
+    
+    return MS::kFailure;
   }
-
+  
+  // generate .xml for nCache compatible output, one per shape
+  if (m_xml)
+  {
+    for (size_t i=0; i<fluids.size(); ++i)
+    {
+      writeXML(fluids[i], filePattern);
+    }
+  }
+  
   setResult(result);
   MAnimControl::setCurrentTime(currentFrame);
     
@@ -890,470 +1376,843 @@ MStatus exportF3d::doIt(const MArgList& args)
 /////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////
 
-template <typename FField, typename VField, typename MField>
-void exportF3d::setF3dField(MFnFluid &fluidFn, const char *outputPath, 
-                            const MDagPath &dagPath)
+bool exportF3d::snapshot(MFnFluid &fluidFn, ExportFluid &fluid, FluidSnapshot &snap)
 {
-  try
+  MStatus stat;
+  
+  unsigned int xres = 0, yres = 0, zres = 0;
+  double xdim, ydim, zdim;
+  
+  // Get the resolution of the fluid container      
+  stat = fluidFn.getResolution(xres, yres, zres);
+  stat = fluidFn.getDimensions(xdim, ydim, zdim);
+  
+  V3d size(xdim, ydim, zdim);
+  
+  /// get the transform and rotation
+  fluidFn.parent(0, &stat);
+  if (stat != MS::kSuccess)
+  {
+    MGlobal::displayError("Can't find fluid's parent node");
+    return false;
+  }
+  
+  MDagPath parentPath = fluid.dagPath;
+  parentPath.pop();
+  MTransformationMatrix tmatFn(fluid.dagPath.inclusiveMatrix());
+  
+  MFnTransform fnXform(parentPath, &stat);
+  if (stat != MS::kSuccess)
+  {
+    MGlobal::displayError("Can't create a MFnTransform from fluid's parent node");
+    return false;
+  }
+  
+  fluid.hasDensity = false;
+  fluid.hasTemperature = false;
+  fluid.hasFuel = false;
+  fluid.hasColor = false;
+  fluid.hasVelocity = false;
+  fluid.hasPressure = false;
+  fluid.hasTexture = false;
+  fluid.hasFalloff = false;
+  fluid.exportedChannels.clear();
+  
+  bool hasAnyField = false;
+  
+  float *density = 0;
+  float *temp = 0;
+  float *fuel = 0;
+  float *pressure = 0;
+  float *falloff = 0;
+  float *r = 0;
+  float *g = 0;
+  float *b = 0;
+  float *u = 0;
+  float *v = 0;
+  float *w = 0;
+  float *Xvel = 0;
+  float *Yvel = 0;
+  float *Zvel = 0;
+  
+  if (!fluid.ignoreDensity)
+  {
+    density = fluidFn.density(&stat);
+    fluid.hasDensity = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasDensity;
+  }
+  
+  if (!fluid.ignoreTemperature)
+  {
+    temp = fluidFn.temperature(&stat);
+    fluid.hasTemperature = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasTemperature;
+  }
+  
+  if (!fluid.ignoreFuel)
+  {
+    fuel = fluidFn.fuel(&stat);
+    fluid.hasFuel = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasFuel;
+  }
+  
+  if (!fluid.ignorePressure)
   { 
-    MStatus stat;
+    pressure = fluidFn.pressure(&stat);
+    fluid.hasPressure = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasPressure;
+  }
+  
+  if (!fluid.ignoreFalloff)
+  {
+    falloff = fluidFn.falloff(&stat);
+    fluid.hasFalloff = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasFalloff;
+  }
+  
+  if (!fluid.ignoreColor)
+  {
+    stat = fluidFn.getColors(r, b, g);
+    fluid.hasColor = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasColor;
+  }
     
-    bool ssparse = Field3DTools::FieldTraits<FField>::IsSparse;
-    bool vsparse = Field3DTools::FieldTraits<VField>::IsSparse;
+  if (!fluid.ignoreTexture)
+  {
+    stat = fluidFn.getCoordinates(u, v, w);
+    fluid.hasTexture = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasTexture;
+  }
+  
+  /// velocity info
+  if (!fluid.ignoreVelocity)
+  {
+    stat = fluidFn.getVelocity(Xvel, Yvel, Zvel);
+    fluid.hasVelocity = !stat.error();
+    hasAnyField = hasAnyField || fluid.hasVelocity;
+  }
+  
+  if (!hasAnyField)
+  {
+    MGlobal::displayError(MString("No fluid attributes found for writing on ") + fluid.dagPath.partialPathName() + ", please check fluids settings");
+    return false;
+  }
+  
+  MPlug autoResizePlug = fluidFn.findPlug("autoResize", &stat); 
+  bool autoResize;
+  autoResizePlug.getValue(autoResize);
+  
+  // maya's fluid transformation
+  V3d dynamicOffset(0);
+  M44d localToWorld;
+  
+  M44d fluid_mat(tmatFn.asMatrix().matrix);
+  
+  if (autoResize)
+  {      
+    fluidFn.findPlug("dofx").getValue(dynamicOffset[0]);
+    fluidFn.findPlug("dofy").getValue(dynamicOffset[1]);
+    fluidFn.findPlug("dofz").getValue(dynamicOffset[2]);
+  }
+  
+  localToWorld.setScale(size);
+  localToWorld *= M44d().setTranslation( -0.5 * size );
+  localToWorld *= M44d().setTranslation( dynamicOffset );
+  localToWorld *= fluid_mat;
+  
+  // shape name without namespace
+  snap.partition = fluid.shapeName;
+  
+  snap.res = V3i(xres, yres, zres);
+  snap.localToWorld = localToWorld;
+  snap.offset = Field3D::V3f(dynamicOffset.x, dynamicOffset.y, dynamicOffset.z);
+  snap.dimension = Field3D::V3f(xdim, ydim, zdim);
+  
+  size_t nvoxels = size_t(xres) * size_t(yres) * size_t(zres);
+  
+  if (fluid.hasDensity)
+  {
+    snap.copy(FluidSnapshot::Density, density, nvoxels);
+    fluid.exportedChannels.insert("density");
+  }
+  
+  if (fluid.hasTemperature)
+  {
+    snap.copy(FluidSnapshot::Temperature, temp, nvoxels);
+    fluid.exportedChannels.insert("temperature");
+  }
+  
+  if (fluid.hasFuel)
+  {
+    snap.copy(FluidSnapshot::Fuel, fuel, nvoxels);
+    fluid.exportedChannels.insert("fuel");
+  }
+  
+  if (fluid.hasPressure)
+  {
+    snap.copy(FluidSnapshot::Pressure, pressure, nvoxels);
+    fluid.exportedChannels.insert("pressure");
+  }
+  
+  if (fluid.hasFalloff)
+  {
+    snap.copy(FluidSnapshot::Falloff, falloff, nvoxels);
+    fluid.exportedChannels.insert("falloff");
+  }
+  
+  if (fluid.hasColor)
+  {
+    snap.copy(FluidSnapshot::Red, r, nvoxels);
+    snap.copy(FluidSnapshot::Green, g, nvoxels);
+    snap.copy(FluidSnapshot::Blue, b, nvoxels);
+    fluid.exportedChannels.insert("color");
+  }
+  
+  if (fluid.hasTexture)
+  {
+    // can be a 2D fluid
+    snap.copy(FluidSnapshot::U, u, nvoxels);
+    snap.copy(FluidSnapshot::V, v, nvoxels);
+    snap.copy(FluidSnapshot::W, w, nvoxels);
+    fluid.exportedChannels.insert("texture");
+  }
+  
+  if (fluid.hasVelocity)
+  {
+    snap.copy(FluidSnapshot::VelocityX, Xvel, size_t(xres + 1) * yres * zres);
+    snap.copy(FluidSnapshot::VelocityY, Yvel, size_t(xres) * (yres + 1) * zres);
+    snap.copy(FluidSnapshot::VelocityZ, Zvel, size_t(xres) * yres * (zres + 1));
+    fluid.exportedChannels.insert("velocity");
+  }
+  
+  return true;
+}
 
-    unsigned int i, xres = 0, yres = 0, zres = 0;
-    double xdim, ydim, zdim;
-    
-    // Get the resolution of the fluid container      
-    stat = fluidFn.getResolution(xres, yres, zres);
-    stat = fluidFn.getDimensions(xdim, ydim, zdim);
-    
-    V3d size(xdim, ydim, zdim);
-    const V3i res(xres, yres, zres);
-    
-    //int psizeTot = fluidFn.gridSize();
+//----------------------------------------------------------------------------//
 
-    /// get the transform and rotation
-    MObject parentObj = fluidFn.parent(0, &stat);
-    if (stat != MS::kSuccess)
-    {
-      MGlobal::displayError("Can't find fluid's parent node");
-      return;
-    }
+template <typename FieldType>
+typename FieldType::Ptr NewExportField(const FluidSnapshot &snap, MatrixFieldMapping::Ptr mapping,
+                                       int blockOrder, const typename FieldType::value_type &blockDefault,
+                                       bool recordBlockOrder=false)
+{
+  typename FieldType::Ptr field = new FieldType;
+  
+  field->setSize(snap.res);
+  field->setMapping(mapping);
+  field->metadata().setVecFloatMetadata("Offset", snap.offset);
+  field->metadata().setVecFloatMetadata("Dimension", snap.dimension);
+  
+  if (Field3DTools::FieldTraits<FieldType>::IsSparse)
+  {
+    Field3DTools::FieldTraits<FieldType>::SetSparseBlockOrder(field, blockOrder);
+    Field3DTools::FieldTraits<FieldType>::SetSparseBlockDefault(field, blockDefault);
     
-    MDagPath parentPath = dagPath;
-    parentPath.pop();
-    MTransformationMatrix tmatFn(dagPath.inclusiveMatrix());
-    if (stat != MS::kSuccess)
+    if (recordBlockOrder)
     {
-      MGlobal::displayError("Failed to get transformation matrix of fluid's parent node");
-      return;
+      field->metadata().setIntMetadata(Field3DTools::SPARSE_BLOCK_ORDER_METADATA, blockOrder);
     }
+  }
+  
+  return field;
+}
+
+int exportF3d::blockOrder(const FluidSnapshot &snap, FluidSnapshot::Channel c, size_t valueSize,
+                          bool choose, BlockOrderTable &orders) const
+{
+  int order = m_sparseBlockOrder;
+  
+  if (!m_autoBlockOrder || (!choose && orders.find(snap.partition, c, order)))
+  {
+    return order;
+  }
+  
+  if (c == FluidSnapshot::Red || c == FluidSnapshot::U)
+  {
+    order = Field3DTools::chooseBlockOrder(snap.res, snap.channel(c), snap.channel(FluidSnapshot::Channel(c + 1)),
+                                           snap.channel(FluidSnapshot::Channel(c + 2)), m_sparseThreshold, valueSize);
+  }
+  else
+  {
+    order = Field3DTools::chooseBlockOrder(snap.res, snap.channel(c), (const float*) 0, (const float*) 0,
+                                           m_sparseThreshold, valueSize);
+  }
+  
+  orders.set(snap.partition, c, order);
+  
+  LOG("exportF3d: block order " << order << " for channel " << int(c) << " of " << snap.partition);
+  
+  return order;
+}
+
+FluidSnapshot::Channel exportF3d::sparseMaskChannel(const FluidSnapshot &snap) const
+{
+  for (std::set<std::string>::const_iterator it = m_sparseMask.begin(); it != m_sparseMask.end(); ++it)
+  {
+    FluidSnapshot::Channel c = SnapshotChannel(*it);
     
-    MFnTransform fnXform(parentPath, &stat);
-    if (stat != MS::kSuccess)
+    if (snap.has[c])
     {
-      MGlobal::displayError("Can't create a MFnTransform from fluid's parent node");
-      return;
+      return c;
     }
-    
-    m_hasDensity = false;
-    m_hasTemperature = false;
-    m_hasFuel = false;
-    m_hasColor = false;
-    m_hasVelocity = false;
-    m_hasPressure = false;
-    m_hasTexture = false;
-    m_hasFalloff = false;
-    m_exportedChannels.clear();
-    
-    bool hasAnyField = false;
+  }
+  
+  return FluidSnapshot::NumChannels;
+}
 
-    float *density = 0;
-    float *temp = 0;
-    float *fuel = 0;
-    float *pressure = 0;
-    float *falloff = 0;
-    float *r = 0;
-    float *g = 0;
-    float *b = 0;
-    float *u = 0;
-    float *v = 0;
-    float *w = 0;
-    float *Xvel = 0;
-    float *Yvel = 0;
-    float *Zvel = 0;
+const Field3DTools::BlockMask* exportF3d::buildMask(const FluidSnapshot &snap, int order, Field3DTools::BlockMask &mask) const
+{
+  mask.reset(snap.res, order);
+  
+  bool masked = false;
+  
+  for (std::set<std::string>::const_iterator it = m_sparseMask.begin(); it != m_sparseMask.end(); ++it)
+  {
+    FluidSnapshot::Channel c = SnapshotChannel(*it);
     
-    if (!m_ignoreDensity)
+    if (!snap.has[c])
     {
-      density = fluidFn.density(&stat);
-      m_hasDensity = !stat.error();
-      hasAnyField = hasAnyField || m_hasDensity;
+      continue;
     }
     
-    if (!m_ignoreTemperature)
+    if (c == FluidSnapshot::Red || c == FluidSnapshot::U)
     {
-      temp = fluidFn.temperature(&stat);
-      m_hasTemperature = !stat.error();
-      hasAnyField = hasAnyField || m_hasTemperature;
+      mask.addVector(snap.channel(c), snap.channel(FluidSnapshot::Channel(c + 1)),
+                     snap.channel(FluidSnapshot::Channel(c + 2)), m_sparseThreshold);
     }
-    
-    if (!m_ignoreFuel)
+    else
     {
-      fuel = fluidFn.fuel(&stat);
-      m_hasFuel = !stat.error();
-      hasAnyField = hasAnyField || m_hasFuel;
-    }
-    
-    if (!m_ignorePressure)
-    { 
-      pressure = fluidFn.pressure(&stat);
-      m_hasPressure = !stat.error();
-      hasAnyField = hasAnyField || m_hasPressure;
+      mask.addScalar(snap.channel(c), m_sparseThreshold);
     }
     
-    if (!m_ignoreFalloff)
-    {
-      falloff = fluidFn.falloff(&stat);
-      m_hasFalloff = !stat.error();
-      hasAnyField = hasAnyField || m_hasFalloff;
-    }
+    masked = true;
+  }
+  
+  // none of the mask channels is exported : each channel decides its blocks
+  return (masked ? &mask : 0);
+}
 
-    if (!m_ignoreColor)
-    {
-      stat = fluidFn.getColors(r, b, g);
-      m_hasColor = !stat.error();
-      hasAnyField = hasAnyField || m_hasColor;
-    }
-      
-    if (!m_ignoreTexture)
+const Field3DTools::BlockMask* exportF3d::applyMask(FluidSnapshot &snap, int order, Field3DTools::BlockMask &mask, bool blocks) const
+{
+  FluidSnapshot::Channel mc = SnapshotChannel(m_maskChannel);
+  
+  if (!snap.has[mc])
+  {
+    return 0;
+  }
+  
+  Field3DTools::VoxelMask voxels;
+  
+  voxels.build(snap.res, snap.channel(mc), m_maskThreshold);
+  voxels.dilate(m_maskDilate);
+  
+  if (blocks)
+  {
+    mask.reset(snap.res, order);
+    mask.addVoxels(voxels);
+    return &mask;
+  }
+  
+  // the velocity is left as is : its faces are stored densely
+  for (int c=0; c<FluidSnapshot::VelocityX; ++c)
+  {
+    if (snap.has[c])
     {
-      stat = fluidFn.getCoordinates(u, v, w);
-      m_hasTexture = !stat.error();
-      hasAnyField = hasAnyField || m_hasTexture;
+      voxels.apply(&(snap.data[c][0]));
     }
+  }
+  
+  return 0;
+}
 
-    /// velocity info
-    if (!m_ignoreVelocity)
-    {
-      stat = fluidFn.getVelocity(Xvel, Yvel, Zvel);
-      m_hasVelocity = !stat.error();
-      hasAnyField = hasAnyField || m_hasVelocity;
-    }
-    
+// fields of one fluid of a frame
+template <typename FField, typename VField, typename MField>
+struct ExportFields
+{
+  typename FField::Ptr density, temperature, fuel, pressure, falloff;
+  typename VField::Ptr color, texture;
+  typename MField::Ptr velocity;
+  std::map<std::string, Field3DTools::QuantizedField> quantized; //<- codes of the quantized channels, by maya name
+  
+  FieldRes::Ptr layer(const std::string &name) const
+  {
+    if (name == "density") return density;
+    if (name == "temperature") return temperature;
+    if (name == "fuel") return fuel;
+    if (name == "pressure") return pressure;
+    if (name == "falloff") return falloff;
+    if (name == "color") return color;
+    if (name == "texture") return texture;
+    return velocity;
+  }
+};
 
-    if (!hasAnyField)
-    {
-      MGlobal::displayError("No fluid attributes found for writing, please check fluids settings");
-      return;
-    }
-            
-    /// Fields 
-    typename FField::Ptr densityFld, tempFld, fuelFld, pressureFld, falloffFld;
-    typename VField::Ptr CdFld, uvwFld;
-    typename MField::Ptr vMac;
-    
+// quantized fill of channel c of snap, and of the two next channels for a vector
+template <typename FieldType>
+Field3DTools::ChannelFill* NewQuantizedFill(Field3DTools::QuantizedField &quantized, typename FieldType::Ptr field,
+                                            const FluidSnapshot &snap, FluidSnapshot::Channel c, bool isVector, int bits)
+{
+  const float *b = (isVector ? snap.channel(FluidSnapshot::Channel(c + 1)) : 0);
+  const float *d = (isVector ? snap.channel(FluidSnapshot::Channel(c + 2)) : 0);
+  
+  return new Field3DTools::QuantizedChannelFill(quantized, snap.channel(c), b, d, snap.res, bits,
+                                                Field3DTools::FieldTraits<FieldType>::BlockOrder(field));
+}
+
+template <typename FField, typename VField, typename MField>
+bool exportF3d::writeSnapshot(FrameSnapshot &frame, BlockOrderTable &orders, const std::string &outputPath,
+                              SeqIndex::FrameHeader &header, double &fillTime, double &writeTime) const
+{
+  // runs on the write behind worker : errors go to the log, the export loop
+  // reports the frames that failed
+  try
+  { 
     typedef typename FField::value_type ScalarType;
     typedef typename VField::value_type VectorType;
     typedef typename VectorType::BaseType ComponentType;
     
     ScalarType sBlockDefault = (ScalarType) m_sparseScalarDefault;
+    
+    // velocity stays a half MAC field
+    int qbits = Field3DTools::quantizedBits(m_format);
+    
+    // bytes per voxel the automatic block orders are priced with : codes for quantized channels
+    size_t sValueSize = (qbits > 0 ? size_t(qbits / 8) : sizeof(ScalarType));
+    size_t vValueSize = (qbits > 0 ? size_t(3 * qbits / 8) : sizeof(VectorType));
+    
     VectorType vBlockDefault = VectorType((ComponentType) m_sparseVectorDefault[0],
                                           (ComponentType) m_sparseVectorDefault[1],
                                           (ComponentType) m_sparseVectorDefault[2]);
     
+    ParallelTools::Timer timer;
     
-    MPlug autoResizePlug = fluidFn.findPlug("autoResize", &stat); 
-    bool autoResize;
-    autoResizePlug.getValue(autoResize);
-
-    // maya's fluid transformation
-    V3d dynamicOffset(0);
-    M44d localToWorld;
-    MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping());
-
-    M44d fluid_mat(tmatFn.asMatrix().matrix);
-
-    if (autoResize)
-    {      
-      fluidFn.findPlug("dofx").getValue(dynamicOffset[0]);
-      fluidFn.findPlug("dofy").getValue(dynamicOffset[1]);
-      fluidFn.findPlug("dofz").getValue(dynamicOffset[2]);
-    }
-
-    Box3i extents;
-    extents.max = res - V3i(1);
-    extents.min = V3i(0);
-    mapping->setExtents(extents);
-  
-    localToWorld.setScale(size);
-    localToWorld *= M44d().setTranslation( -0.5 * size );
-    localToWorld *= M44d().setTranslation( dynamicOffset );
-    localToWorld *= fluid_mat;
+    /// Fields 
+    std::vector<ExportFields<FField, VField, MField> > fields(frame.fluids.size());
+    
+    // sparse blocks shared by the channels of a fluid
+    std::vector<Field3DTools::BlockMask> masks(frame.fluids.size());
     
-    Field3D::V3f Offset(Field3D::V3f(dynamicOffset.x, dynamicOffset.y, dynamicOffset.z));
-    Field3D::V3f Dimension(xdim, ydim, zdim);
+    // every channel of every fluid, and every z slab of a channel, is filled
+    // as an independent task : only the layer writes below are serialised
+    Field3DTools::ChannelFillList fills;
+    size_t sliceSize = 0;
     
-    mapping->setLocalToWorld(localToWorld);  
+    for (size_t i=0; i<frame.fluids.size(); ++i)
+    {
+      FluidSnapshot &snap = frame.fluids[i];
+      ExportFields<FField, VField, MField> &fld = fields[i];
       
-    if (m_hasDensity)
-    {
-      densityFld = new FField;
-      densityFld->setSize(res);
-      densityFld->setMapping(mapping);
-      densityFld->metadata().setVecFloatMetadata("Offset", Offset);
-      densityFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (ssparse)
+      if (snap.partition.empty())
       {
-        Field3DTools::FieldTraits<FField>::SetSparseBlockOrder(densityFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<FField>::SetSparseBlockDefault(densityFld, sBlockDefault);
+        // fluid couldn't be read at this frame
+        continue;
       }
       
-      m_exportedChannels.insert("density");
-    }
-    
-    if (m_hasFuel)
-    {
-      fuelFld = new FField;
-      fuelFld->setSize(res); 
-      fuelFld->setMapping(mapping);
-      fuelFld->metadata().setVecFloatMetadata("Offset", Offset);
-      fuelFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (ssparse)
+      const V3i &res = snap.res;
+      
+      MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping());
+      
+      Box3i extents;
+      extents.max = res - V3i(1);
+      extents.min = V3i(0);
+      mapping->setExtents(extents);
+      mapping->setLocalToWorld(snap.localToWorld);
+      
+      const bool sparse = Field3DTools::FieldTraits<FField>::IsSparse;
+      const bool choose = frame.chooseBlockOrders;
+      
+      const Field3DTools::BlockMask *mask = 0;
+      
+      // a shared mask has the block order of its channel
+      if (m_maskChannel.length() > 0)
       {
-        Field3DTools::FieldTraits<FField>::SetSparseBlockOrder(fuelFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<FField>::SetSparseBlockDefault(fuelFld, sBlockDefault);
+        FluidSnapshot::Channel mc = SnapshotChannel(m_maskChannel);
+        bool blocks = (sparse && m_maskBlocks && snap.has[mc]);
+        
+        mask = applyMask(snap, (blocks ? blockOrder(snap, mc, sValueSize, choose, orders) : 0), masks[i], blocks);
       }
       
-      m_exportedChannels.insert("fuel");
-    }
-    
-    if (m_hasTemperature)
-    {
-      tempFld = new FField;
-      tempFld->setSize(res);
-      tempFld->setMapping(mapping);
-      tempFld->metadata().setVecFloatMetadata("Offset", Offset);
-      tempFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (ssparse)
+      if (!mask && sparse && !m_sparseMask.empty())
       {
-        Field3DTools::FieldTraits<FField>::SetSparseBlockOrder(tempFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<FField>::SetSparseBlockDefault(tempFld, sBlockDefault);
+        FluidSnapshot::Channel mc = sparseMaskChannel(snap);
+        
+        if (mc != FluidSnapshot::NumChannels)
+        {
+          size_t valueSize = ((mc == FluidSnapshot::Red || mc == FluidSnapshot::U) ? vValueSize : sValueSize);
+          
+          mask = buildMask(snap, blockOrder(snap, mc, valueSize, choose, orders), masks[i]);
+        }
       }
       
-      m_exportedChannels.insert("temperature");
-    }
-    
-    if (m_hasPressure)
-    {
-      pressureFld = new FField;
-      pressureFld->setSize(res);
-      pressureFld->setMapping(mapping);
-      pressureFld->metadata().setVecFloatMetadata("Offset", Offset);
-      pressureFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (ssparse)
+      // block orders of the channels
+      int order[FluidSnapshot::NumChannels];
+      
+      for (int c=0; c<FluidSnapshot::NumChannels; ++c)
       {
-        Field3DTools::FieldTraits<FField>::SetSparseBlockOrder(pressureFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<FField>::SetSparseBlockDefault(pressureFld, sBlockDefault);
+        order[c] = m_sparseBlockOrder;
+        
+        if (mask)
+        {
+          order[c] = mask->blockOrder();
+        }
+        else if (sparse && snap.has[c] && c < FluidSnapshot::VelocityX &&
+                 c != FluidSnapshot::Green && c != FluidSnapshot::Blue && c != FluidSnapshot::V && c != FluidSnapshot::W)
+        {
+          size_t valueSize = ((c == FluidSnapshot::Red || c == FluidSnapshot::U) ? vValueSize : sValueSize);
+          
+          order[c] = blockOrder(snap, FluidSnapshot::Channel(c), valueSize, choose, orders);
+        }
       }
       
-      m_exportedChannels.insert("pressure");
-    }
-    
-    if (m_hasFalloff)
-    {
-      falloffFld = new FField;
-      falloffFld->setSize(res);
-      falloffFld->setMapping(mapping);
-      falloffFld->metadata().setVecFloatMetadata("Offset", Offset);
-      falloffFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (ssparse)
+      if (snap.has[FluidSnapshot::Density])
       {
-        Field3DTools::FieldTraits<FField>::SetSparseBlockOrder(falloffFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<FField>::SetSparseBlockDefault(falloffFld, sBlockDefault);
+        fld.density = NewExportField<FField>(snap, mapping, order[FluidSnapshot::Density], sBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
+        {
+          fills.add(NewQuantizedFill<FField>(fld.quantized["density"], fld.density, snap, FluidSnapshot::Density, false, qbits));
+        }
+        else
+        {
+          fills.add(new Field3DTools::ScalarChannelFill<FField>(fld.density, snap.channel(FluidSnapshot::Density), res, m_sparseThreshold, mask, m_sparseUniform));
+        }
       }
       
-      m_exportedChannels.insert("falloff");
-    }
-    
-    if (m_hasVelocity)
-    {
-      vMac = new MField;
-      vMac->setSize(res);
-      vMac->setMapping(mapping);
-      vMac->metadata().setVecFloatMetadata("Offset", Offset);
-      vMac->metadata().setVecFloatMetadata("Dimension", Dimension);
-      
-      m_exportedChannels.insert("velocity");
-    }
-    
-    if (m_hasColor)
-    {
-      CdFld = new VField;
-      CdFld->setSize(res);
-      CdFld->setMapping(mapping);
-      CdFld->metadata().setVecFloatMetadata("Offset", Offset);
-      CdFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (vsparse)
+      if (snap.has[FluidSnapshot::Temperature])
       {
-        Field3DTools::FieldTraits<VField>::SetSparseBlockOrder(CdFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<VField>::SetSparseBlockDefault(CdFld, vBlockDefault);
+        fld.temperature = NewExportField<FField>(snap, mapping, order[FluidSnapshot::Temperature], sBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
+        {
+          fills.add(NewQuantizedFill<FField>(fld.quantized["temperature"], fld.temperature, snap, FluidSnapshot::Temperature, false, qbits));
+        }
+        else
+        {
+          fills.add(new Field3DTools::ScalarChannelFill<FField>(fld.temperature, snap.channel(FluidSnapshot::Temperature), res, m_sparseThreshold, mask, m_sparseUniform));
+        }
       }
       
-      m_exportedChannels.insert("color");
-    } 
-    
-    if (m_hasTexture)
-    {
-      uvwFld = new VField;
-      uvwFld->setSize(res);
-      uvwFld->setMapping(mapping);
-      uvwFld->metadata().setVecFloatMetadata("Offset", Offset);
-      uvwFld->metadata().setVecFloatMetadata("Dimension", Dimension);
-      if (vsparse)
+      if (snap.has[FluidSnapshot::Fuel])
       {
-        Field3DTools::FieldTraits<VField>::SetSparseBlockOrder(uvwFld, m_sparseBlockOrder);
-        Field3DTools::FieldTraits<VField>::SetSparseBlockDefault(uvwFld, vBlockDefault);
+        fld.fuel = NewExportField<FField>(snap, mapping, order[FluidSnapshot::Fuel], sBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
+        {
+          fills.add(NewQuantizedFill<FField>(fld.quantized["fuel"], fld.fuel, snap, FluidSnapshot::Fuel, false, qbits));
+        }
+        else
+        {
+          fills.add(new Field3DTools::ScalarChannelFill<FField>(fld.fuel, snap.channel(FluidSnapshot::Fuel), res, m_sparseThreshold, mask, m_sparseUniform));
+        }
       }
       
-      m_exportedChannels.insert("texture");
-    } 
-        
-    size_t iX, iY, iZ;      
-    for ( iZ = 0; iZ < zres; iZ++ ) 
-    {
-      for ( iX = 0; iX < xres; iX++ )
+      if (snap.has[FluidSnapshot::Pressure])
       {
-        for ( iY = 0; iY < yres ; iY++ ) 
+        fld.pressure = NewExportField<FField>(snap, mapping, order[FluidSnapshot::Pressure], sBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
         {
-          /// data is in x major but we are writting in z major order
-          i = fluidFn.index(iX, iY, iZ);
-            
-          if (m_hasDensity && (!ssparse || density[i] > m_sparseThreshold))
-          {
-            densityFld->fastLValue(iX, iY, iZ) = (ScalarType) density[i];
-          }
-          
-          if (m_hasTemperature && (!ssparse || temp[i] > m_sparseThreshold))
-          {
-            tempFld->fastLValue(iX, iY, iZ) = (ScalarType) temp[i];
-          }
-          
-          if (m_hasFuel && (!ssparse || fuel[i] > m_sparseThreshold))
-          {
-            fuelFld->fastLValue(iX, iY, iZ) = (ScalarType) fuel[i];
-          }
-          
-          if (m_hasPressure && (!ssparse || pressure[i] > m_sparseThreshold))
-          {
-            pressureFld->fastLValue(iX, iY, iZ) = (ScalarType) pressure[i];
-          }
-          
-          if (m_hasFalloff && (!ssparse || falloff[i] > m_sparseThreshold))
-          {
-            falloffFld->fastLValue(iX, iY, iZ) = (ScalarType) falloff[i];
-          }
-          
-          if (m_hasColor && (!vsparse || (r[i]*r[i] + g[i]*g[i] + b[i]*b[i] > m_sparseThreshold)))
-          {
-            CdFld->fastLValue(iX, iY, iZ) = VectorType((ComponentType)r[i], (ComponentType)g[i], (ComponentType)b[i]);
-          }
-          
-          if (m_hasTexture && (!vsparse || (u[i]*u[i] + v[i]*v[i] + (w ? w[i]*w[i] : 0.0f) > m_sparseThreshold)))
-          {
-            // can be a 2D fluid
-            uvwFld->fastLValue(iX, iY, iZ) = VectorType((ComponentType)u[i], (ComponentType)v[i], (ComponentType)(w ? w[i] : 0.0f));
-          }
+          fills.add(NewQuantizedFill<FField>(fld.quantized["pressure"], fld.pressure, snap, FluidSnapshot::Pressure, false, qbits));
         }
-      }      
-    }
-    
-    if (m_hasVelocity)
-    {
-      unsigned x, y, z;
+        else
+        {
+          fills.add(new Field3DTools::ScalarChannelFill<FField>(fld.pressure, snap.channel(FluidSnapshot::Pressure), res, m_sparseThreshold, mask, m_sparseUniform));
+        }
+      }
       
-      for (z=0; z<zres; ++z)
+      if (snap.has[FluidSnapshot::Falloff])
       {
-        for (y=0; y<yres; ++y)
+        fld.falloff = NewExportField<FField>(snap, mapping, order[FluidSnapshot::Falloff], sBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
+        {
+          fills.add(NewQuantizedFill<FField>(fld.quantized["falloff"], fld.falloff, snap, FluidSnapshot::Falloff, false, qbits));
+        }
+        else
         {
-          for (x=0; x<xres+1; ++x)
-          {
-            vMac->u(x, y, z) = (ComponentType) Xvel[fluidFn.index(x, y, z, xres+1, yres, zres)];
-          }
+          fills.add(new Field3DTools::ScalarChannelFill<FField>(fld.falloff, snap.channel(FluidSnapshot::Falloff), res, m_sparseThreshold, mask, m_sparseUniform));
         }
       }
       
-      for (z=0; z<zres; ++z)
+      if (snap.has[FluidSnapshot::Red])
       {
-        for (y=0; y<yres+1; ++y)
+        fld.color = NewExportField<VField>(snap, mapping, order[FluidSnapshot::Red], vBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
+        {
+          fills.add(NewQuantizedFill<VField>(fld.quantized["color"], fld.color, snap, FluidSnapshot::Red, true, qbits));
+        }
+        else
         {
-          for (x=0; x<xres; ++x)
-          {
-            vMac->v(x, y, z) = (ComponentType) Yvel[fluidFn.index(x, y, z, xres, yres+1, zres)];
-          }
+          fills.add(new Field3DTools::VectorChannelFill<VField>(fld.color, snap.channel(FluidSnapshot::Red), snap.channel(FluidSnapshot::Green),
+                                                                snap.channel(FluidSnapshot::Blue), res, m_sparseThreshold, mask, m_sparseUniform));
         }
       }
       
-      for (z=0; z<zres+1; ++z)
+      if (snap.has[FluidSnapshot::U])
       {
-        for (y=0; y<yres; ++y)
+        fld.texture = NewExportField<VField>(snap, mapping, order[FluidSnapshot::U], vBlockDefault, m_autoBlockOrder);
+        if (qbits > 0)
+        {
+          fills.add(NewQuantizedFill<VField>(fld.quantized["texture"], fld.texture, snap, FluidSnapshot::U, true, qbits));
+        }
+        else
         {
-          for (x=0; x<xres; ++x) 
-          {
-            vMac->w(x, y, z) = (ComponentType) (Zvel ? Zvel[fluidFn.index(x, y, z, xres, yres, zres+1)] : 0.0f);
-          }
+          fills.add(new Field3DTools::VectorChannelFill<VField>(fld.texture, snap.channel(FluidSnapshot::U), snap.channel(FluidSnapshot::V),
+                                                                snap.channel(FluidSnapshot::W), res, m_sparseThreshold, mask, m_sparseUniform));
         }
       }
-    } 
-     
-    Field3DOutputFile out;
-    
-    if (!out.create(outputPath))
-    {
-      MGlobal::displayError("Couldn't create file: "+ MString(outputPath));
-      return;
+      
+      if (snap.has[FluidSnapshot::VelocityX])
+      {
+        fld.velocity = NewExportField<MField>(snap, mapping, 0, typename MField::value_type());
+        fills.add(new Field3DTools::MACChannelFill<MField>(fld.velocity, snap.channel(FluidSnapshot::VelocityX), res, 0));
+        fills.add(new Field3DTools::MACChannelFill<MField>(fld.velocity, snap.channel(FluidSnapshot::VelocityY), res, 1));
+        fills.add(new Field3DTools::MACChannelFill<MField>(fld.velocity, snap.channel(FluidSnapshot::VelocityZ), res, 2));
+      }
+      
+      sliceSize = std::max(sliceSize, size_t(res.x) * size_t(res.y));
     }
     
-    std::string partition(fluidFn.name().asChar());
+    fills.run(sliceSize);
     
-    // strip namespace from shape name to use as partition name
-    size_t p = partition.rfind(':');
-    if (p != std::string::npos)
+    for (size_t i=0; i<fields.size(); ++i)
     {
-      partition = partition.substr(p + 1);
+      const ExportFields<FField, VField, MField> &fld = fields[i];
+      
+      for (std::map<std::string, Field3DTools::QuantizedField>::const_iterator qit = fld.quantized.begin(); qit != fld.quantized.end(); ++qit)
+      {
+        Field3DTools::setQuantizedMetadata(fld.layer(qit->first), qit->second);
+      }
     }
     
-    if (m_hasDensity)
-    {
-      out.writeScalarLayer<typename FField::value_type>(partition, remapChannel("density"), densityFld);
-    }
+    fillTime = timer.elapsed();
     
-    if (m_hasFuel)
-    { 
-      out.writeScalarLayer<typename FField::value_type>(partition, remapChannel("fuel"), fuelFld);
-    }
+    timer.reset();
     
-    if (m_hasTemperature)
-    {
-      out.writeScalarLayer<typename FField::value_type>(partition, remapChannel("temperature"), tempFld);
-    }
+    FilePool::close(outputPath);
     
-    if (m_hasColor)
-    {
-      out.writeVectorLayer<typename VField::value_type::BaseType>(partition, remapChannel("color"), CdFld);
-    }
+    Field3DTools::IOLock lock;
     
-    if (m_hasVelocity)
-    {
-      out.writeVectorLayer<typename MField::real_t>(partition, remapChannel("velocity"), vMac);      
-    }
+    Field3DOutputFile out;
     
-    if (m_hasTexture)
+    if (!out.create(outputPath))
     {
-      out.writeVectorLayer<typename VField::value_type::BaseType>(partition, remapChannel("texture"), uvwFld);
+      ERROR("Couldn't create file: " << outputPath);
+      return false;
     }
     
-    if (m_hasFalloff)
+    // one partition per fluid
+    for (size_t i=0; i<frame.fluids.size(); ++i)
     {
-      out.writeScalarLayer<typename FField::value_type>(partition, remapChannel("falloff"), falloffFld);
+      const std::string &partition = frame.fluids[i].partition;
+      const ExportFields<FField, VField, MField> &fld = fields[i];
+      
+      if (fld.density)
+      {
+        out.writeScalarLayer<ScalarType>(partition, remapChannel("density"), fld.density);
+        SeqIndex::addLayer(header, partition, remapChannel("density"), fld.density);
+      }
+      
+      if (fld.fuel)
+      { 
+        out.writeScalarLayer<ScalarType>(partition, remapChannel("fuel"), fld.fuel);
+        SeqIndex::addLayer(header, partition, remapChannel("fuel"), fld.fuel);
+      }
+      
+      if (fld.temperature)
+      {
+        out.writeScalarLayer<ScalarType>(partition, remapChannel("temperature"), fld.temperature);
+        SeqIndex::addLayer(header, partition, remapChannel("temperature"), fld.temperature);
+      }
+      
+      if (fld.color)
+      {
+        out.writeVectorLayer<ComponentType>(partition, remapChannel("color"), fld.color);
+        SeqIndex::addLayer(header, partition, remapChannel("color"), fld.color);
+      }
+      
+      if (fld.velocity)
+      {
+        out.writeVectorLayer<typename MField::real_t>(partition, remapChannel("velocity"), fld.velocity);      
+        SeqIndex::addLayer(header, partition, remapChannel("velocity"), fld.velocity);
+      }
+      
+      if (fld.texture)
+      {
+        out.writeVectorLayer<ComponentType>(partition, remapChannel("texture"), fld.texture);
+        SeqIndex::addLayer(header, partition, remapChannel("texture"), fld.texture);
+      }
+      
+      if (fld.falloff)
+      {
+        out.writeScalarLayer<ScalarType>(partition, remapChannel("falloff"), fld.falloff);
+        SeqIndex::addLayer(header, partition, remapChannel("falloff"), fld.falloff);
+      }
+      
+      if (fld.pressure)
+      {
+        out.writeScalarLayer<ScalarType>(partition, remapChannel("pressure"), fld.pressure);
+        SeqIndex::addLayer(header, partition, remapChannel("pressure"), fld.pressure);
+      }
     }
     
-    if (m_hasPressure)
+    out.close(); 
+    
+    // the codes go next to the placeholder layers
+    for (size_t i=0; i<frame.fluids.size(); ++i)
     {
-      out.writeScalarLayer<typename FField::value_type>(partition, remapChannel("pressure"), pressureFld);
+      const std::string &partition = frame.fluids[i].partition;
+      const ExportFields<FField, VField, MField> &fld = fields[i];
+      
+      for (std::map<std::string, Field3DTools::QuantizedField>::const_iterator qit = fld.quantized.begin(); qit != fld.quantized.end(); ++qit)
+      {
+        if (!Field3DTools::writeQuantizedLayer(outputPath, partition, remapChannel(qit->first), qit->second))
+        {
+          ERROR("Couldn't write the codes of " << partition << "." << remapChannel(qit->first) << " to " << outputPath);
+          return false;
+        }
+        
+        LOG("exportF3d: " << partition << "." << remapChannel(qit->first) << " quantized to " << qit->second.bits()
+            << " bits, error bound " << qit->second.errorBound() << ", max error " << qit->second.maxError());
+      }
     }
-
-    out.close(); 
-
+    
+    writeTime = timer.elapsed();
   }
   catch (const std::exception &e)
   {
-
-    MGlobal::displayError(MString(e.what()));
-    return;
+    ERROR("Couldn't write " << outputPath << " : " << e.what());
+    return false;
   }
+  
+  return true;
+}
 
+//----------------------------------------------------------------------------//
 
+void exportF3d::writeXML(const ExportFluid &fluid, const std::string &filePattern) const
+{
+  if (m_verbose)
+  {
+    MGlobal::displayInfo(MString("Generating nCache XML for ") + fluid.dagPath.partialPathName());
+    MGlobal::displayInfo(MString("  density: ") + (fluid.hasDensity ? "true" : "false"));
+    MGlobal::displayInfo(MString("  temperature: ") + (fluid.hasTemperature ? "true" : "false"));
+    MGlobal::displayInfo(MString("  fuel: ") + (fluid.hasFuel ? "true" : "false"));
+    MGlobal::displayInfo(MString("  velocity: ") + (fluid.hasVelocity ? "true" : "false"));
+    MGlobal::displayInfo(MString("  color: ") + (fluid.hasColor ? "true" : "false"));
+    MGlobal::displayInfo(MString("  pressure: ") + (fluid.hasPressure ? "true" : "false"));
+    MGlobal::displayInfo(MString("  texture: ") + (fluid.hasTexture ? "true" : "false"));
+    MGlobal::displayInfo(MString("  falloff: ") + (fluid.hasFalloff ? "true" : "false"));
+  }
+  
+  std::string xmlPath = m_outputDir.asChar();
+  
+  xmlPath += "/";
+  xmlPath += fluid.shapeName;
+  xmlPath += ".xml";
+  
+  FILE *f = fopen(xmlPath.c_str(), "w");
+  
+  if (!f)
+  {
+    MGlobal::displayError(MString("exportF3d: Couldn't write ") + xmlPath.c_str());
+    return;
+  }
+  
+  MTime t(1, MTime::uiUnit());
+  
+  int TimePerFrame = int(floor(t.asUnits(MTime::k6000FPS)));
+  
+  t.setValue(m_start);  
+  int StartTime = int(floor(t.asUnits(MTime::k6000FPS)));
+  
+  t.setValue(m_end);
+  int EndTime = int(floor(t.asUnits(MTime::k6000FPS)));
+  
+  std::string fmt = "half";
+  switch (m_format)
+  {
+  case Field3DTools::DOUBLE:
+    fmt = "double";
+    break;
+  case Field3DTools::FLOAT:
+    fmt = "float";
+    break;
+  case Field3DTools::QUANT8:
+    fmt = "quant8";
+    break;
+  case Field3DTools::QUANT16:
+    fmt = "quant16";
+    break;
+  default:
+    break;
+  }
+  
+  fprintf(f, "<?xml version=\"1.0\"?>\n");
+  fprintf(f, "<Autodesk_Cache_File>\n");
+  fprintf(f, "  <cacheType Type=\"OneFilePerFrame\" Format=\"f3d_%s_%s\"/>\n", (m_sparse ? "sparse" : "dense"), fmt.c_str());
+  fprintf(f, "  <time Range=\"%d-%d\"/>\n", StartTime, EndTime);
+  fprintf(f, "  <cacheTimePerFrame TimePerFrame=\"%d\"/>\n", TimePerFrame);
+  fprintf(f, "  <cacheVersion Version=\"2.0\"/>\n");
+  fprintf(f, "  <extra>f3d.file=%s</extra>\n", filePattern.c_str());
+  for (std::map<std::string, std::string>::const_iterator rit = m_remapChannels.begin(); rit != m_remapChannels.end(); ++rit)
+  {
+    if (fluid.exportedChannels.find(rit->first) != fluid.exportedChannels.end())
+    {
+      fprintf(f, "  <extra>f3d.remap=%s:%s</extra>\n", rit->first.c_str(), rit->second.c_str());
+    }
+  }
+  fprintf(f, "  <Channels>\n");
+  
+  int d = 0;
+  
+  if (fluid.hasDensity)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_density\" ChannelType=\"FloatArray\" ChannelInterpretation=\"density\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasVelocity)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_velocity\" ChannelType=\"FloatArray\" ChannelInterpretation=\"velocity\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasTemperature)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_temperature\" ChannelType=\"FloatArray\" ChannelInterpretation=\"temperature\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasFuel)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_fuel\" ChannelType=\"FloatArray\" ChannelInterpretation=\"fuel\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasPressure)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_pressure\" ChannelType=\"FloatArray\" ChannelInterpretation=\"pressure\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasFalloff)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_falloff\" ChannelType=\"FloatArray\" ChannelInterpretation=\"falloff\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasColor)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_color\" ChannelType=\"FloatArray\" ChannelInterpretation=\"color\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  if (fluid.hasTexture)
+  {
+    fprintf(f, "    <channel%d ChannelName=\"%s_texture\" ChannelType=\"FloatArray\" ChannelInterpretation=\"texture\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+            d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  }
+  
+  // Dummy fields (implicit in Field3D format)
+  fprintf(f, "    <channel%d ChannelName=\"%s_resolution\" ChannelType=\"FloatArray\" ChannelInterpretation=\"resolution\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+          d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  
+  fprintf(f, "    <channel%d ChannelName=\"%s_offset\" ChannelType=\"FloatArray\" ChannelInterpretation=\"offset\" SamplingType=\"Regular\" SamplingRate=\"%d\" StartTime=\"%d\" EndTime=\"%d\"/>\n",
+          d++, fluid.dagPath.partialPathName().asChar(), TimePerFrame, StartTime, EndTime);
+  
+  fprintf(f, "  </Channels>\n");
+  fprintf(f, "</Autodesk_Cache_File>\n");
+  fprintf(f, "\n");
+  
+  fclose(f);
 }
 
 /////////////////////////////////////////////////////////////////////
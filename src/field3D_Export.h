@@ -10,7 +10,101 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 #include "field3D_Tools.h"
+#include "field3D_WriteBehind.h"
+#include "field3D_SeqIndex.h"
+
+// Copy of the channels of a fluid at a given frame, so that its fields can
+// be filled and written while the simulation moves on
+struct FluidSnapshot
+{
+  enum Channel
+  {
+    Density = 0,
+    Temperature,
+    Fuel,
+    Pressure,
+    Falloff,
+    Red,
+    Green,
+    Blue,
+    U,
+    V,
+    W,
+    VelocityX,
+    VelocityY,
+    VelocityZ,
+    NumChannels
+  };
+  
+  std::string partition;
+  Field3D::V3i res;
+  Field3D::M44d localToWorld;
+  Field3D::V3f offset;
+  Field3D::V3f dimension;
+  bool has[NumChannels];
+  std::vector<float> data[NumChannels];
+  
+  FluidSnapshot();
+  
+  // keeps the buffers for the next frame
+  void clear();
+  
+  // src may be 0 (channel not exported or missing component of a 2D fluid)
+  void copy(Channel c, const float *src, size_t n);
+  
+  // 0 if not exported
+  const float* channel(Channel c) const;
+  
+  size_t bytes() const;
+};
+
+// All the exported fluids of a frame, written to the same file
+struct FrameSnapshot
+{
+  std::vector<FluidSnapshot> fluids;
+  bool chooseBlockOrders; //<- -sparseBlockOrder auto evaluates the orders again
+  
+  FrameSnapshot();
+  
+  size_t bytes() const;
+};
+
+// A selected fluid shape and the channels it exports
+struct ExportFluid
+{
+  MDagPath dagPath;
+  std::string shapeName; //<- partition name, without namespace
+  bool ignoreDensity;
+  bool ignoreTemperature;
+  bool ignoreFuel;
+  bool ignoreColor;
+  bool ignoreVelocity;
+  bool ignorePressure;
+  bool ignoreTexture;
+  bool ignoreFalloff;
+  bool hasDensity;
+  bool hasTemperature;
+  bool hasFuel;
+  bool hasColor;
+  bool hasVelocity;
+  bool hasPressure;
+  bool hasTexture;
+  bool hasFalloff;
+  std::set<std::string> exportedChannels;
+  
+  ExportFluid();
+  
+  // false if the channel is ignored
+  bool exports(const std::string &channel) const;
+};
+
+class ExportPipeline;
+class BlockOrderTable;
+
+template <typename FField, typename VField, typename MField>
+class ExportFrameJob;
 
 class exportF3d : public MPxCommand
 {
@@ -27,7 +121,38 @@ public:
 private:
   
   template <typename FField, typename VField, typename MField>
-  void setF3dField(MFnFluid &fluidFn, const char *outputPath, const MDagPath &dagPath);
+  friend class ExportFrameJob;
+  
+  // main thread : reads the fluid channels
+  bool snapshot(MFnFluid &fluidFn, ExportFluid &fluid, FluidSnapshot &snap);
+  
+  // any thread : fills and writes the fields of all the fluids of a frame,
+  //   the headers of the written layers are added to header
+  template <typename FField, typename VField, typename MField>
+  bool writeSnapshot(FrameSnapshot &frame, BlockOrderTable &orders, const std::string &outputPath,
+                     SeqIndex::FrameHeader &header, double &fillTime, double &writeTime) const;
+  
+  // job writing a frame with the field types of the export options
+  WriteBehind::Job* frameJob(ExportPipeline *pipeline, FrameSnapshot *snap,
+                             const std::string &outputPath, const std::string &indexFile) const;
+  
+  // sparse block order of a channel, picked from its occupancy with
+  // -sparseBlockOrder auto when choose is set or it wasn't picked yet
+  int blockOrder(const FluidSnapshot &snap, FluidSnapshot::Channel c, size_t valueSize,
+                 bool choose, BlockOrderTable &orders) const;
+  
+  // first -sparseMask channel of a fluid, NumChannels if none is exported
+  FluidSnapshot::Channel sparseMaskChannel(const FluidSnapshot &snap) const;
+  
+  // sparse blocks of a fluid from the -sparseMask channels, 0 if none is exported
+  const Field3DTools::BlockMask* buildMask(const FluidSnapshot &snap, int order, Field3DTools::BlockMask &mask) const;
+  
+  // zeroes the channels of a fluid outside of the -maskChannel voxels, or
+  // with blocks, returns the blocks of the mask. 0 if there are no blocks
+  const Field3DTools::BlockMask* applyMask(FluidSnapshot &snap, int order, Field3DTools::BlockMask &mask, bool blocks) const;
+  
+  // nCache description of one fluid shape
+  void writeXML(const ExportFluid &fluid, const std::string &filePattern) const;
   
   MStatus parseArgs(const MArgList& args);
   
@@ -41,14 +166,6 @@ private:
   MSelectionList m_slist;
   int m_start; //<-start of simulation
   int m_end; //<-end of simulation
-  bool m_hasDensity; //<- export densiyt as well
-  bool m_hasTemperature; //<- export temprature as well
-  bool m_hasFuel; //<- export fuel as well
-  bool m_hasColor; //<- export color as well
-  bool m_hasVelocity; //<- export velocity as well
-  bool m_hasPressure; //<- export presurre as well
-  bool m_hasTexture; //<- export texture as well
-  bool m_hasFalloff; //<- export falloff as well
   int m_numOversample; //<- oversamples the fluids but only writes out on whole frames
   bool m_xml;
   bool m_ignoreDensity;
@@ -63,10 +180,18 @@ private:
   Field3DTools::FieldDataTypeEnum m_format;
   double m_sparseThreshold;
   int m_sparseBlockOrder;
+  bool m_autoBlockOrder; //<- picks the block order of each channel from its occupancy
+  int m_blockOrderInterval; //<- frames between two picks, 0 for the first frame only
   double m_sparseScalarDefault;
   double m_sparseVectorDefault[3];
+  std::set<std::string> m_sparseMask; //<- channels deciding the sparse blocks of all the channels
+  double m_sparseUniform; //<- blocks equal up to this tolerance are stored as one value, < 0 if disabled
+  std::string m_maskChannel; //<- all the channels are dropped where this one is below m_maskThreshold
+  double m_maskThreshold;
+  int m_maskDilate;
+  bool m_maskBlocks;
+  int m_framesInFlight; //<- frames written in the background while the simulation goes on
   std::map<std::string, std::string> m_remapChannels;
-  std::set<std::string> m_exportedChannels;
 };
 
 
@@ -0,0 +1,283 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include "field3D_FilePool.h"
+#include "file_Tools.h"
+
+#include <list>
+#include <map>
+#include <vector>
+#include <cstdlib>
+
+#include <boost/thread/mutex.hpp>
+
+namespace FilePool
+{
+
+struct Entry
+{
+   std::string path;
+   FileTools::FileStamp stamp;
+   FilePtr file;
+};
+
+// most recently used first
+typedef std::list<Entry> EntryList;
+typedef std::map<std::string, EntryList::iterator> EntryMap;
+
+static boost::mutex gMutex;
+static EntryList gEntries;
+static EntryMap gIndex;
+static size_t gCapacity = 0;
+static bool gCapacitySet = false;
+static size_t gOpens = 0;
+static size_t gReuses = 0;
+static size_t gEvictions = 0;
+
+// HDF5 isn't thread safe, files are closed with the IO lock held
+struct CloseFile
+{
+   void operator()(Field3D::Field3DInputFile *file) const
+   {
+      Field3DTools::IOLock lock;
+      
+      delete file;
+   }
+};
+
+static size_t defaultCapacity()
+{
+   const char *env = getenv("FIELD3D_MAYA_FILE_POOL");
+   
+   if (env)
+   {
+      int v = atoi(env);
+      
+      if (v >= 0)
+      {
+         return size_t(v);
+      }
+      
+      WARNING("Invalid FIELD3D_MAYA_FILE_POOL value \"" << env << "\", using default");
+   }
+   
+   return 8;
+}
+
+// gMutex must be held
+static size_t lockedCapacity()
+{
+   if (!gCapacitySet)
+   {
+      gCapacity = defaultCapacity();
+      gCapacitySet = true;
+   }
+   return gCapacity;
+}
+
+// gMutex must be held, dropped handles are returned so that files get
+// closed once the mutex is unlocked
+static void lockedEvict(size_t maxEntries, std::vector<FilePtr> &dropped)
+{
+   while (gEntries.size() > maxEntries)
+   {
+      Entry &entry = gEntries.back();
+      
+      dropped.push_back(entry.file);
+      
+      gIndex.erase(entry.path);
+      gEntries.pop_back();
+      
+      ++gEvictions;
+   }
+}
+
+// gMutex must be held
+static void lockedErase(EntryMap::iterator it, std::vector<FilePtr> &dropped)
+{
+   dropped.push_back(it->second->file);
+   
+   gEntries.erase(it->second);
+   gIndex.erase(it);
+}
+
+size_t capacity()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   return lockedCapacity();
+}
+
+void setCapacity(size_t files)
+{
+   std::vector<FilePtr> dropped;
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gCapacity = files;
+   gCapacitySet = true;
+   
+   lockedEvict(gCapacity, dropped);
+}
+
+FilePtr open(const std::string &path)
+{
+   std::vector<FilePtr> dropped;
+   
+   FileTools::FileStamp stamp;
+   
+   if (!FileTools::getFileStamp(path, stamp))
+   {
+      return FilePtr();
+   }
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      EntryMap::iterator it = gIndex.find(path);
+      
+      if (it != gIndex.end())
+      {
+         if (it->second->stamp == stamp)
+         {
+            // move to front
+            gEntries.splice(gEntries.begin(), gEntries, it->second);
+            
+            ++gReuses;
+            
+            return it->second->file;
+         }
+         
+         // file was rewritten
+         lockedErase(it, dropped);
+      }
+   }
+   
+   // open outside of the pool lock
+   Field3D::Field3DInputFile *in = new Field3D::Field3DInputFile();
+   
+   {
+      Field3DTools::IOLock lock;
+      
+      if (!in->open(path))
+      {
+         delete in;
+         return FilePtr();
+      }
+   }
+   
+   FilePtr file(in, CloseFile());
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   ++gOpens;
+   
+   if (lockedCapacity() == 0)
+   {
+      return file;
+   }
+   
+   EntryMap::iterator it = gIndex.find(path);
+   
+   if (it != gIndex.end())
+   {
+      // opened concurrently, keep the pooled one
+      dropped.push_back(file);
+      
+      gEntries.splice(gEntries.begin(), gEntries, it->second);
+      
+      return it->second->file;
+   }
+   
+   Entry entry;
+   
+   entry.path = path;
+   entry.stamp = stamp;
+   entry.file = file;
+   
+   gEntries.push_front(entry);
+   gIndex[path] = gEntries.begin();
+   
+   lockedEvict(gCapacity, dropped);
+   
+   return file;
+}
+
+void close(const std::string &path)
+{
+   std::vector<FilePtr> dropped;
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   EntryMap::iterator it = gIndex.find(path);
+   
+   if (it != gIndex.end())
+   {
+      lockedErase(it, dropped);
+   }
+}
+
+Stats stats()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   Stats s;
+   
+   s.opens = gOpens;
+   s.reuses = gReuses;
+   s.evictions = gEvictions;
+   s.entries = gEntries.size();
+   s.capacity = lockedCapacity();
+   
+   return s;
+}
+
+void clear()
+{
+   std::vector<FilePtr> dropped;
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   for (EntryList::iterator it = gEntries.begin(); it != gEntries.end(); ++it)
+   {
+      dropped.push_back(it->file);
+   }
+   
+   gEntries.clear();
+   gIndex.clear();
+   gOpens = 0;
+   gReuses = 0;
+   gEvictions = 0;
+}
+
+}
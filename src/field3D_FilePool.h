@@ -0,0 +1,83 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef FIELD3D_MAYA_FILEPOOL
+#define FIELD3D_MAYA_FILEPOOL
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include "field3D_Tools.h"
+
+// Process wide pool of open input files shared by the cache formats, the
+// prefetcher, the commands and the header scans, so a frame file is opened
+// once for all of them. Handles are reference counted : a file evicted from
+// the pool (least recently used first) is only closed once its last user
+// releases it. Pooled files are reopened when their size or modification
+// time change.
+//
+// Reading from a pooled file requires the IO lock, as for any HDF5 call.
+namespace FilePool
+{
+
+typedef boost::shared_ptr<Field3D::Field3DInputFile> FilePtr;
+
+struct Stats
+{
+   size_t opens;
+   size_t reuses;
+   size_t evictions;
+   size_t entries;
+   size_t capacity;
+};
+
+// Maximum number of pooled files.
+//   Defaults to the FIELD3D_MAYA_FILE_POOL environment variable, 8 if not
+//   set. 0 disables pooling (files are closed when released).
+size_t capacity();
+void setCapacity(size_t files);
+
+// Returns an open file for path, or an empty pointer if it can't be opened
+FilePtr open(const std::string &path);
+
+// Drops the pooled handle of path, must be called before writing the file
+void close(const std::string &path);
+
+Stats stats();
+
+// Drops all pooled handles and resets the counters
+void clear();
+
+}
+
+#endif
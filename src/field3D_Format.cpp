@@ -32,6 +32,12 @@
 
 #include "field3D_Format.h"
 #include "maya_Tools.h"
+#include "field3D_FrameCache.h"
+#include "field3D_WriteBehind.h"
+#include "field3D_OneFile.h"
+#include "field3D_SeqIndex.h"
+#include "field3D_FilePool.h"
+#include "file_Tools.h"
 #include "tinyLogger.h"
 
 #include <maya/MArgList.h>
@@ -49,6 +55,8 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <cmath>
+#include <cstdlib>
 
 static std::string extractFluidName(const MString &name)
 {
@@ -87,6 +95,17 @@ static std::string extractChannelName(const MString &name)
   return nameStr.substr(pos+1);
 }
 
+// single file caches index chunks by 6000fps ticks
+static long timeToTicks(const MTime &t)
+{
+  return long(floor(t.as(MTime::k6000FPS) + 0.5));
+}
+
+static MTime ticksToTime(long ticks)
+{
+  return MTime(double(ticks), MTime::k6000FPS);
+}
+
 template <typename T>
 static std::string display3(T tab[3])
 {
@@ -112,6 +131,8 @@ struct OffsetAndDimension
 {
    Field3D::V3f off;
    Field3D::V3f dim;
+   // layers written to the frame, for the sequence index (may be null)
+   SeqIndex::FrameHeader *header;
 };
 
 static void WriteOffsetAndDimension(Field3D::FieldRes::Ptr field, void *userData)
@@ -122,9 +143,442 @@ static void WriteOffsetAndDimension(Field3D::FieldRes::Ptr field, void *userData
       
       field->metadata().setVecFloatMetadata("Offset", offAndDim->off); 
       field->metadata().setVecFloatMetadata("Dimension", offAndDim->dim);
+      
+      if (offAndDim->header)
+      {
+         // the layers of a frame may be written by the main thread and the write behind worker
+         Field3DTools::IOLock lock;
+         
+         SeqIndex::addLayer(*(offAndDim->header), field->name, field->attribute, field);
+      }
+   }
+}
+
+// Channel masking the others when writing, read from FIELD3D_MAYA_MASK
+//   ("channel[:threshold[:dilate]]", e.g. "density:0.001:2")
+static void readOutputMask(std::string &channel, double &threshold, int &dilate)
+{
+   channel = "";
+   threshold = Field3DTools::SPARSE_THRESHOLD;
+   dilate = 0;
+   
+   const char *env = getenv("FIELD3D_MAYA_MASK");
+   
+   if (!env || env[0] == '\0')
+   {
+      return;
+   }
+   
+   std::string spec = env;
+   size_t p = spec.find(':');
+   
+   channel = spec.substr(0, p);
+   
+   if (p != std::string::npos)
+   {
+      std::string rest = spec.substr(p + 1);
+      
+      threshold = atof(rest.c_str());
+      
+      p = rest.find(':');
+      
+      if (p != std::string::npos)
+      {
+         dilate = std::max(0, atoi(rest.c_str() + p + 1));
+      }
+   }
+   
+   if (channel != "density" && channel != "temperature" && channel != "fuel" &&
+       channel != "pressure" && channel != "falloff")
+   {
+      WARNING("Invalid FIELD3D_MAYA_MASK channel \"" << channel << "\", masking disabled");
+      channel = "";
+   }
+}
+
+static const float* fluidChannel(MFnFluid &fluid, const std::string &name)
+{
+   MStatus stat;
+   float *data = 0;
+   
+   if (name == "density")
+   {
+      data = fluid.density(&stat);
+   }
+   else if (name == "temperature")
+   {
+      data = fluid.temperature(&stat);
+   }
+   else if (name == "fuel")
+   {
+      data = fluid.fuel(&stat);
+   }
+   else if (name == "pressure")
+   {
+      data = fluid.pressure(&stat);
+   }
+   else if (name == "falloff")
+   {
+      data = fluid.falloff(&stat);
+   }
+   
+   return (stat.error() ? 0 : data);
+}
+
+// Sparse block order of the written fields, read from
+//   FIELD3D_MAYA_BLOCK_ORDER : an order, "auto" to pick the cheapest order
+//   of each channel on the first frame, or "auto:N" to pick it again every N
+//   frames. -1 leaves Field3D's default.
+static void readOutputBlockOrder(int &order, bool &autoOrder, int &interval)
+{
+   order = -1;
+   autoOrder = false;
+   interval = 0;
+   
+   const char *env = getenv("FIELD3D_MAYA_BLOCK_ORDER");
+   
+   if (!env || env[0] == '\0')
+   {
+      return;
+   }
+   
+   std::string spec = env;
+   
+   if (spec.compare(0, 4, "auto") == 0)
+   {
+      autoOrder = true;
+      
+      if (spec.length() > 5 && spec[4] == ':')
+      {
+         interval = std::max(0, atoi(spec.c_str() + 5));
+      }
+      return;
+   }
+   
+   order = atoi(env);
+   
+   if (order <= 0)
+   {
+      WARNING("Invalid FIELD3D_MAYA_BLOCK_ORDER value \"" << env << "\", using the default block order");
+      order = -1;
+   }
+}
+
+// Sparse blocks whose voxels all are within FIELD3D_MAYA_UNIFORM of each
+//   other are stored unallocated with that value as their empty value.
+//   -1 if not set.
+static double readOutputUniformTolerance()
+{
+   const char *env = getenv("FIELD3D_MAYA_UNIFORM");
+   
+   if (!env || env[0] == '\0')
+   {
+      return -1.0;
+   }
+   
+   char *end = 0;
+   double tolerance = strtod(env, &end);
+   
+   if (end == env || *end != '\0' || tolerance < 0.0)
+   {
+      WARNING("Invalid FIELD3D_MAYA_UNIFORM value \"" << env << "\", uniform blocks are not detected");
+      return -1.0;
+   }
+   
+   return tolerance;
+}
+
+// ------------------------------------------- FIELD WRITERS
+
+template <class Array>
+struct FieldWriter
+{
+   typedef bool (*Func)(Field3D::Field3DOutputFile *out,
+                        const std::string &fluidName,
+                        const std::string &fieldName,
+                        unsigned int res[3],
+                        double transform[4][4],
+                        const Array &data,
+                        int blockOrder,
+                        double uniformTolerance,
+                        Field3DTools::writeMetadataFunc writeMetadata,
+                        void *writeMetadataUser);
+};
+
+// dense and MAC fields have no blocks, the sparse block order and uniform
+//   tolerance are ignored
+template <typename ExportType, class Array>
+static bool writeDenseScalar(Field3D::Field3DOutputFile *out,
+                             const std::string &fluidName,
+                             const std::string &fieldName,
+                             unsigned int res[3],
+                             double transform[4][4],
+                             const Array &data,
+                             int,
+                             double,
+                             Field3DTools::writeMetadataFunc writeMetadata,
+                             void *writeMetadataUser)
+{
+   return Field3DTools::writeDenseScalarField<ExportType, Array>(out, fluidName, fieldName, res, transform, data, writeMetadata, writeMetadataUser);
+}
+
+template <typename ExportType, class Array>
+static bool writeDenseVector(Field3D::Field3DOutputFile *out,
+                             const std::string &fluidName,
+                             const std::string &fieldName,
+                             unsigned int res[3],
+                             double transform[4][4],
+                             const Array &data,
+                             int,
+                             double,
+                             Field3DTools::writeMetadataFunc writeMetadata,
+                             void *writeMetadataUser)
+{
+   return Field3DTools::writeDenseVectorField<ExportType, Array>(out, fluidName, fieldName, res, transform, data, writeMetadata, writeMetadataUser);
+}
+
+template <typename ExportType, class Array>
+static bool writeMACVector(Field3D::Field3DOutputFile *out,
+                           const std::string &fluidName,
+                           const std::string &fieldName,
+                           unsigned int res[3],
+                           double transform[4][4],
+                           const Array &data,
+                           int,
+                           double,
+                           Field3DTools::writeMetadataFunc writeMetadata,
+                           void *writeMetadataUser)
+{
+   return Field3DTools::writeMACVectorField<ExportType, Array>(out, fluidName, fieldName, res, transform, data, writeMetadata, writeMetadataUser);
+}
+
+template <class Array>
+static typename FieldWriter<Array>::Func selectFieldWriter(Field3DTools::FieldTypeEnum fieldType,
+                                                           Field3DTools::FieldDataTypeEnum dataType,
+                                                           const std::string &channel)
+{
+   // quantized channels are written by FieldWriteJob, velocity and the
+   // unbuffered fallback use half
+   if (Field3DTools::quantizedBits(dataType) > 0)
+   {
+      dataType = Field3DTools::HALF;
+   }
+   
+   // Test the type of array
+   bool isVectorField = (channel == "velocity" ||
+                         channel == "color" ||
+                         channel == "texture");
+   
+   if (!isVectorField)
+   {
+      // select the propers function
+      if (dataType == Field3DTools::HALF)
+      {
+         if (fieldType == Field3DTools::SPARSE)
+         {
+           return Field3DTools::writeSparseScalarField<Field3D::half, Array> ;
+         }
+         else
+         {
+           return writeDenseScalar<Field3D::half, Array> ;
+         }
+      }
+      else if (dataType == Field3DTools::FLOAT)
+      {
+         if (fieldType == Field3DTools::SPARSE)
+         {
+           return Field3DTools::writeSparseScalarField<float, Array>;
+         }
+         else
+         {
+           return writeDenseScalar<float, Array>;
+         }
+      }
+      else if (dataType == Field3DTools::DOUBLE)
+      {
+         if (fieldType == Field3DTools::SPARSE)
+         {
+           return Field3DTools::writeSparseScalarField<double, Array>;
+         }
+         else
+         {
+           return writeDenseScalar<double, Array>;
+         }
+      }
+   }
+   else
+   {
+      bool isVel = (channel == "velocity");
+    
+      if (dataType == Field3DTools::HALF)
+      {
+         if (isVel)
+         {
+           return writeMACVector<Field3D::half, Array> ;
+         }
+         else if (fieldType == Field3DTools::SPARSE)
+         {
+           return Field3DTools::writeSparseVectorField<Field3D::half, Array> ;
+         }
+         else
+         {
+           return writeDenseVector<Field3D::half, Array> ;
+         }
+      }
+      else if (dataType == Field3DTools::FLOAT)
+      {
+         if (isVel)
+         {
+           return writeMACVector<float, Array> ;
+         }
+         else if (fieldType == Field3DTools::SPARSE)
+         {
+           return Field3DTools::writeSparseVectorField<float, Array> ;
+         }
+         else
+         {
+           return writeDenseVector<float, Array> ;
+         }
+      }
+      else if (dataType == Field3DTools::DOUBLE)
+      {
+         if (isVel)
+         {
+           return writeMACVector<double, Array> ;
+         }
+         else if (fieldType == Field3DTools::SPARSE)
+         {
+           return Field3DTools::writeSparseVectorField<double, Array> ;
+         }
+         else
+         {
+           return writeDenseVector<double, Array> ;
+         }
+      }
    }
+   
+   return 0;
 }
 
+// element type of the maya arrays handed to writeArray
+template <class T>
+struct ArrayElement;
+
+template <>
+struct ArrayElement<const MFloatArray>
+{
+   typedef float Type;
+};
+
+template <>
+struct ArrayElement<const MDoubleArray>
+{
+   typedef double Type;
+};
+
+// Deferred write of a copied maya array (see WriteBehind)
+template <typename E>
+class FieldWriteJob : public WriteBehind::Job
+{
+public:
+   
+   typedef Field3DTools::ArrayView<E> Array;
+   
+   FieldWriteJob(typename FieldWriter<Array>::Func writer,
+                 Field3D::Field3DOutputFile *out,
+                 const std::string &partition,
+                 const std::string &channel,
+                 unsigned int res[3],
+                 double transform[4][4],
+                 const OffsetAndDimension &offAndDim,
+                 WriteBehind::Buffer *buffer,
+                 unsigned int length,
+                 int blockOrder,
+                 double uniformTolerance)
+      : WriteBehind::Job(buffer->size(), out)
+      , m_writer(writer)
+      , m_out(out)
+      , m_partition(partition)
+      , m_channel(channel)
+      , m_offAndDim(offAndDim)
+      , m_buffer(buffer)
+      , m_length(length)
+      , m_blockOrder(blockOrder)
+      , m_uniformTolerance(uniformTolerance)
+      , m_bits(0)
+   {
+      for (int i=0; i<3; ++i)
+      {
+         m_res[i] = res[i];
+      }
+      for (int i=0; i<4; ++i)
+      {
+         for (int j=0; j<4; ++j)
+         {
+            m_transform[i][j] = transform[i][j];
+         }
+      }
+   }
+   
+   virtual ~FieldWriteJob()
+   {
+      WriteBehind::releaseBuffer(m_buffer);
+   }
+   
+   // writes the channel quantized to bits instead, path is the file m_out writes to
+   void quantize(const std::string &path, int bits)
+   {
+      m_path = path;
+      m_bits = bits;
+   }
+   
+   virtual bool run()
+   {
+      const E *values = (const E*) &((*m_buffer)[0]);
+      
+      if (m_bits > 0)
+      {
+         bool isVector = (m_channel == "color" || m_channel == "texture");
+         
+         if (!Field3DTools::writeQuantizedField(m_out, m_path, m_partition, m_channel, m_res, m_transform,
+                                                values, m_length, isVector, m_bits, m_blockOrder,
+                                                WriteOffsetAndDimension, &m_offAndDim))
+         {
+            ERROR( "Writing of " + m_channel + " file failed : Unknown reason ( see above for an explanation ? )");
+            return false;
+         }
+         
+         return true;
+      }
+      
+      Array data(values, m_length);
+      
+      if (!m_writer(m_out, m_partition, m_channel, m_res, m_transform, data, m_blockOrder, m_uniformTolerance, WriteOffsetAndDimension, &m_offAndDim))
+      {
+         ERROR( "Writing of " + m_channel + " file failed : Unknown reason ( see above for an explanation ? )");
+         return false;
+      }
+      
+      return true;
+   }
+   
+private:
+   
+   typename FieldWriter<Array>::Func m_writer;
+   Field3D::Field3DOutputFile *m_out;
+   std::string m_partition;
+   std::string m_channel;
+   unsigned int m_res[3];
+   double m_transform[4][4];
+   OffsetAndDimension m_offAndDim;
+   WriteBehind::Buffer *m_buffer;
+   unsigned int m_length;
+   int m_blockOrder;
+   double m_uniformTolerance;
+   std::string m_path;
+   int m_bits;
+};
+
 // ------------------------------------------- CONSTRUCTOR - DESTRUCTOR
 
 Field3dCacheFormat::Field3dCacheFormat(Field3DTools::FieldTypeEnum type,
@@ -133,23 +587,33 @@ Field3dCacheFormat::Field3dCacheFormat(Field3DTools::FieldTypeEnum type,
   , m_fieldType(type)
   , m_dataType(data_type)
   , m_mode((FileAccessMode)-1)
-  , m_inFile(0)
+  , m_inFile()
+  , m_inOneFile(false)
   , m_outFile(0)
+  , m_outOneFile(false)
+  , m_outTicks(0)
+  , m_outMaskThreshold(0.0)
+  , m_outMaskDilate(0)
+  , m_outBlockOrder(-1)
+  , m_outAutoBlockOrder(false)
+  , m_outBlockOrderInterval(0)
+  , m_outChunk(-1)
+  , m_outUniformTolerance(-1.0)
+  , m_prefetchWindow(0)
 {
+   m_inSeq.reset(new MayaTools::FrameFileMap());
+   m_inCurFile = m_inSeq->end();
+   
    Field3D::initIO();
 }
 
 Field3dCacheFormat::~Field3dCacheFormat()
 {
-   if (m_inFile)
-   {
-      delete m_inFile;
-   }
+   closeOutputFile();
    
-   if (m_outFile)
-   {
-      delete m_outFile;
-   }
+   Field3DTools::IOLock lock;
+   
+   m_inFile.reset();
 }
 
 bool Field3dCacheFormat::identifyPath(const MString &path, MString &dirname, MString &basename, MString &frame, MTime &t, MString &ext)
@@ -281,85 +745,16 @@ bool Field3dCacheFormat::identifyPath(const MString &path, MString &dirname, MSt
    return timeFound;
 }
 
-unsigned long Field3dCacheFormat::fillCacheFiles(const MString &path)
+unsigned long Field3dCacheFormat::fillCacheFiles(const MString &dirname, const MString &basename)
 {
-   MString dirname, basename, frame, ext;
-   MTime t;
-   
-   identifyPath(path, dirname, basename, frame, t, ext);
-   return fillCacheFiles(dirname, basename, ext);
-}
-
-unsigned long Field3dCacheFormat::fillCacheFiles(const MString &dirname, const MString &basename, const MString &ext)
-{
-   MStringArray tmp;
-   
-   std::string dn = dirname.asChar();
-   if (dn.length() > 0)
-   {
-      char lc = dn[dn.length()-1];
-      
-      #ifdef _WIN32
-      if (lc != '\\' && lc != '/')
-      #else
-      if (lc != '/')
-      #endif
-      {
-         dn.push_back('/');
-      }
-   }
-   else
-   {
-      dn = "./";
-   }
-   
-   MString mdn = dn.c_str();
-   
-   MGlobal::executeCommand("getFileList -folder \"" + mdn + "\" -filespec \"" + basename + "*." + ext + "\"", tmp);
-   
-   m_inSeq.clear();
-   
-   MString _dn, _bn, _fn, _e;
-   MTime t;
-   int f, sf;
-   
-   for (unsigned long i=0; i<tmp.length(); ++i)
-   {
-      // MGlobal::displayInfo("Found file " + tmp[i]);
-      
-      if (m_inDesc.filePattern.length() > 0)
-      {
-         if (m_inDesc.useSubFrames)
-         {
-            if (sscanf(tmp[i].asChar(), m_inDesc.filePattern.c_str(), &f, &sf) != 2)
-            {
-               // MGlobal::displayWarning(MString("File doesn't match pattern with subframe ") + m_inDesc.filePattern.c_str() + ": \"" + tmp[i] + "\"");
-               continue;
-            }
-         }
-         else
-         {
-            if (sscanf(tmp[i].asChar(), m_inDesc.filePattern.c_str(), &f) != 1)
-            {
-               // MGlobal::displayWarning(MString("File doesn't match pattern ") + m_inDesc.filePattern.c_str() + ": \"" + tmp[i] + "\"");
-               continue;
-            }
-         }
-      }
-      
-      if (identifyPath(tmp[i], _dn, _bn, _fn, t, _e))
-      {
-         m_inSeq[t] = mdn + tmp[i];
-      }
-      else
-      {
-         // MGlobal::displayWarning("Could not identify file " + tmp[i]);
-      }
-   }
+   // the frame times come from the names matched once per directory change
+   MayaTools::FrameFiles files = MayaTools::listFrameFiles(dirname.asChar(), basename.asChar(),
+                                                           m_inDesc.filePattern, m_inDesc.useSubFrames);
    
-   m_inCurFile = m_inSeq.end();
+   m_inSeq = (files ? files : MayaTools::FrameFiles(new MayaTools::FrameFileMap()));
+   m_inCurFile = m_inSeq->end();
    
-   return (unsigned long) m_inSeq.size();
+   return (unsigned long) m_inSeq->size();
 }
 
 void Field3dCacheFormat::resetInputFile()
@@ -375,26 +770,40 @@ void Field3dCacheFormat::resetInputFile()
    m_inOffset = Field3D::V3f(0.0f, 0.0f, 0.0f);
    m_inDimension = Field3D::V3f(1.0f, 1.0f, 1.0f);
    
+   m_inPrefetched.clear();
+   
    if (m_inFile)
    {
-      delete m_inFile;
-      m_inFile = 0;
+      Field3DTools::IOLock lock;
+      
+      m_inFile.reset();
    }
    
-   m_inCurFile = m_inSeq.end();
+   m_inCurFile = m_inSeq->end();
 }
 
 MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
 {
+   MString dn, bn, frm, ext;
+   MTime t;
+   
+   // single file caches have no frame number in their name
+   bool hasTime = identifyPath(fileName, dn, bn, frm, t, ext);
+   bool oneFile = (!hasTime && ext == "f3d");
+   bool append = (oneFile && mode == kReadWrite);
+   
+   if (append)
+   {
+      // appending chunks, nothing to read
+      mode = kWrite;
+   }
+   
    m_mode = mode;
    
    if (mode == kRead || mode == kReadWrite)
    {
       // Note: this may be called several time for the same frame
-      MString dn, bn, frm, ext;
-      MTime t;
-      
-      if (!identifyPath(fileName, dn, bn, frm, t, ext))
+      if (!hasTime && !oneFile)
       {
          return MS::kFailure;
       }
@@ -411,6 +820,18 @@ MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
          readDescription(inDescFile, m_inDesc);
          
          m_inDescFile = inDescFile;
+         
+         m_prefetchWindow = (m_inDesc.prefetch >= 0 ? size_t(m_inDesc.prefetch) : Field3dPrefetcher::defaultWindow());
+         
+         if (m_prefetchWindow == 0)
+         {
+            m_prefetcher.clear();
+         }
+      }
+      
+      if (oneFile)
+      {
+         return openOneFile(fileName.asChar());
       }
       
       if (m_inDesc.dir.length() > 0)
@@ -432,17 +853,21 @@ MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
          // this is a difference file sequence
          resetInputFile();
          
+         m_prefetcher.clear();
+         m_inUsedLayers.clear();
+         
          m_inFilename = inFilename;
+         m_inOneFile = false;
          
          // don't use fileName as directory may have changed
          // basename should stay identical whatever the frame pattern is
          
-         fillCacheFiles(dn, bn, ext);
+         fillCacheFiles(dn, bn);
       }
       
-      std::map<MTime, MString>::iterator it = m_inSeq.find(t);
+      MayaTools::FrameFileMap::const_iterator it = m_inSeq->find(t);
       
-      if (it == m_inSeq.end())
+      if (it == m_inSeq->end())
       {
          // not a valid frame file
          resetInputFile();
@@ -456,12 +881,25 @@ MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
             resetInputFile();
          }
          
+         if (!m_inFile && m_prefetchWindow > 0)
+         {
+            Field3dPrefetcher::Frame *frame = m_prefetcher.take(it->second);
+            
+            if (frame)
+            {
+               m_inFile = frame->file;
+               m_inPrefetched.swap(frame->fields);
+               
+               Field3dPrefetcher::release(frame);
+            }
+         }
+         
          if (!m_inFile)
          {
-            // frame not yet read
-            m_inFile = new Field3DInputFile();
+            // frame not yet read (or closed since it was)
+            m_inFile = FilePool::open(it->second);
             
-            if (!m_inFile->open(it->second.asChar()))
+            if (!m_inFile)
             {
                ERROR(std::string("Opening of") +  fileName.asChar() + "failed : Unknown reason");
                resetInputFile();
@@ -473,6 +911,11 @@ MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
          // at this point, if open was called for same frame as currently loaded one
          // nothing should have changed (it == m_inCurFile)
          
+         if (it != m_inCurFile)
+         {
+            prefetchFrom(it);
+         }
+         
          m_inCurFile = it;
          m_inCurField = m_inFields.end();
          m_inNextField = m_inFields.begin();
@@ -481,11 +924,35 @@ MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
    
    if (mode == kWrite || mode == kReadWrite)
    {
-      if (m_outFile)
+      closeOutputFile();
+      
+      readOutputMask(m_outMaskChannel, m_outMaskThreshold, m_outMaskDilate);
+      m_outMaskPartition = "";
+      
+      readOutputBlockOrder(m_outBlockOrder, m_outAutoBlockOrder, m_outBlockOrderInterval);
+      m_outUniformTolerance = readOutputUniformTolerance();
+      
+      if (oneFile)
       {
-         delete m_outFile;
+         // chunks are written in a file shared by all the cache format
+         // instances, it is kept open until read back (see OneFile)
+         m_outFile = OneFile::openWriter(fileName.asChar(), append, &m_outWritePath);
+         
+         if (!m_outFile)
+         {
+            return MS::kFailure;
+         }
+         
+         m_outOneFile = true;
+         m_outFilename = fileName.asChar();
+         
+         return MS::kSuccess;
       }
       
+      FilePool::close(fileName.asChar());
+      
+      Field3DTools::IOLock lock;
+      
       m_outFile = new Field3DOutputFile();
       
       // create the file
@@ -499,6 +966,9 @@ MStatus Field3dCacheFormat::open(const MString &fileName, FileAccessMode mode)
       }
       
       m_outFilename = fileName.asChar();
+      m_outWritePath = m_outFilename;
+      m_outIndexFile = (hasTime ? SeqIndex::indexPath(dn.asChar(), bn.asChar()) : std::string());
+      m_outHeader.layers.clear();
    }
    
    return MS::kSuccess;
@@ -508,11 +978,42 @@ void Field3dCacheFormat::close()
 {
    // don't close m_inFile as this method may be called several times for the same frame
    
-   if (m_outFile)
+   closeOutputFile();
+}
+
+void Field3dCacheFormat::closeOutputFile()
+{
+   if (!m_outFile)
+   {
+      return;
+   }
+   
+   // pending writes still reference the file
+   if (!WriteBehind::flush(m_outFile))
+   {
+      ERROR(std::string("Writing of ") + m_outFilename + " failed : see above for an explanation");
+   }
+   
+   if (m_outOneFile)
    {
+      // shared file, stays open for the next chunks
+      OneFile::releaseWriter(m_outFilename);
+      m_outOneFile = false;
+      m_outFile = 0;
+      return;
+   }
+   
+   {
+      Field3DTools::IOLock lock;
+      
       delete m_outFile;
       m_outFile = 0;
    }
+   
+   if (!m_outIndexFile.empty() && !SeqIndex::record(m_outIndexFile, m_outFilename, m_outHeader))
+   {
+      WARNING(std::string("Could not update sequence index ") + m_outIndexFile);
+   }
 }
 
 MStatus Field3dCacheFormat::isValid()
@@ -538,7 +1039,11 @@ MStatus Field3dCacheFormat::isValid()
 
 MStatus Field3dCacheFormat::rewind()
 {
-   // Never called
+   if (m_inOneFile && m_inFile && !m_inSeq->empty())
+   {
+      setChunk(m_inSeq->begin());
+   }
+   
    return MS::kSuccess;
 }
 
@@ -556,12 +1061,23 @@ MStatus Field3dCacheFormat::writeHeader(const MString &, MTime &, MTime &)
 
 void Field3dCacheFormat::beginWriteChunk()
 {
+   // the mask is computed again for the new frame
+   m_outMaskPartition = "";
+   
+   ++m_outChunk;
 }
 
 MStatus Field3dCacheFormat::writeTime(MTime &time)
 {
-   // Never called
-   return MS::kFailure;
+   // Only called for single file caches
+   if (!m_outOneFile)
+   {
+      return MS::kFailure;
+   }
+   
+   m_outTicks = timeToTicks(time);
+   
+   return MS::kSuccess;
 }
 
 MStatus Field3dCacheFormat::writeChannelName(const MString &name)
@@ -573,6 +1089,11 @@ MStatus Field3dCacheFormat::writeChannelName(const MString &name)
       m_outChannel = extractChannelName(name);
       m_outPartition = partitionName(fluidName);
       
+      if (m_outOneFile && !m_outPartition.empty())
+      {
+         m_outPartition = OneFile::chunkPartition(m_outPartition, m_outTicks);
+      }
+      
       if (m_outPartition.empty() || m_outChannel.empty())
       {
          return MS::kFailure;
@@ -678,123 +1199,83 @@ MStatus Field3dCacheFormat::writeArray(T &array)
    MMatrix resTransf = mapTo01Transf * autoResizeTransf * parentTransf;
    resTransf.get(transform);
    
-   bool (*writeField)(Field3D::Field3DOutputFile *out,
-                      const std::string &fluidName,
-                      const std::string &fieldName,
-                      unsigned int res[3],
-                      double transform[4][4],
-                      const T &data,
-                      Field3DTools::writeMetadataFunc writeMetadata,
-                      void *writeMetadataUser);
+   // field metadata
+   OffsetAndDimension offAndDim;
    
-   // Test the type of array
-   bool isVectorField = (m_outChannel == "velocity" ||
-                         m_outChannel == "color" ||
-                         m_outChannel == "texture");
+   offAndDim.off = Field3D::V3f(m_outOffset[0], m_outOffset[1], m_outOffset[2]);
+   offAndDim.dim = Field3D::V3f(dimension[0], dimension[1], dimension[2]);
+   offAndDim.header = (m_outIndexFile.empty() ? 0 : &m_outHeader);
    
-   if (!isVectorField)
+   const Field3DTools::VoxelMask *mask = outputMask(resolution);
+   
+   // the automatic block order is picked from a copy of the array
+   bool autoBlockOrder = (m_outAutoBlockOrder && m_fieldType == Field3DTools::SPARSE);
+   
+   // quantized channels are encoded from a copy of the array too
+   int quantizedBits = (m_outChannel != "velocity" ? Field3DTools::quantizedBits(m_dataType) : 0);
+   
+   if ((WriteBehind::isEnabled() || mask || autoBlockOrder || quantizedBits > 0) && array.length() > 0)
    {
-      // select the propers function
-      if (m_dataType == Field3DTools::HALF)
-      {
-         if (m_fieldType == Field3DTools::SPARSE)
-         {
-           writeField = Field3DTools::writeSparseScalarField<Field3D::half, T> ;
-         }
-         else
-         {
-           writeField = Field3DTools::writeDenseScalarField<Field3D::half, T> ;
-         }
-      }
-      else if (m_dataType == Field3DTools::FLOAT)
-      {
-         if (m_fieldType == Field3DTools::SPARSE)
-         {
-           writeField = Field3DTools::writeSparseScalarField<float, T>;
-         }
-         else
-         {
-           writeField = Field3DTools::writeDenseScalarField<float, T>;
-         }
-      }
-      else if (m_dataType == Field3DTools::DOUBLE)
-      {
-         if (m_fieldType == Field3DTools::SPARSE)
-         {
-           writeField = Field3DTools::writeSparseScalarField<double, T>;
-         }
-         else
-         {
-           writeField = Field3DTools::writeDenseScalarField<double, T>;
-         }
-      }
-      else
+      // copy the array and let the write behind worker convert and write it
+      typedef typename ArrayElement<T>::Type ElementType;
+      typedef typename FieldWriteJob<ElementType>::Array ViewType;
+      
+      typename FieldWriter<ViewType>::Func writeView = selectFieldWriter<ViewType>(m_fieldType, m_dataType, m_outChannel);
+      
+      if (!writeView)
       {
          ERROR( "Writing of " + m_outChannel + " file failed : Unknown Types");
          return MS::kFailure;
       }
-   }
-   else
-   {
-      bool isVel = (m_outChannel == "velocity");
-    
-      if (m_dataType == Field3DTools::HALF)
-      {
-         if (isVel)
-         {
-           writeField = Field3DTools::writeMACVectorField<Field3D::half, T> ;
-         }
-         else if (m_fieldType == Field3DTools::SPARSE)
-         {
-           writeField = Field3DTools::writeSparseVectorField<Field3D::half, T> ;
-         }
-         else
-         {
-           writeField = Field3DTools::writeDenseVectorField<Field3D::half, T> ;
-         }
-      }
-      else if (m_dataType == Field3DTools::FLOAT)
-      {
-         if (isVel)
-         {
-           writeField = Field3DTools::writeMACVectorField<float, T> ;
-         }
-         else if (m_fieldType == Field3DTools::SPARSE)
-         {
-           writeField = Field3DTools::writeSparseVectorField<float, T> ;
-         }
-         else
-         {
-           writeField = Field3DTools::writeDenseVectorField<float, T> ;
-         }
-      }
-      else if (m_dataType == Field3DTools::DOUBLE)
+      
+      WriteBehind::Buffer *buffer = WriteBehind::acquireBuffer(array.length() * sizeof(ElementType));
+      
+      array.get((ElementType*) &((*buffer)[0]));
+      
+      if (mask)
       {
-         if (isVel)
-         {
-           writeField = Field3DTools::writeMACVectorField<double, T> ;
-         }
-         else if (m_fieldType == Field3DTools::SPARSE)
-         {
-           writeField = Field3DTools::writeSparseVectorField<double, T> ;
-         }
-         else
+         // vector channels are planar : one component after the other
+         size_t nvoxels = size_t(resolution[0]) * size_t(resolution[1]) * size_t(resolution[2]);
+         
+         for (size_t first=0; first+nvoxels<=array.length(); first+=nvoxels)
          {
-           writeField = Field3DTools::writeDenseVectorField<double, T> ;
+            mask->apply((ElementType*) &((*buffer)[0]) + first);
          }
       }
-      else
+      
+      int blockOrder = outputBlockOrder((const ElementType*) &((*buffer)[0]), array.length(), resolution);
+      
+      if (!WriteBehind::isEnabled())
       {
-         ERROR( "Writing of " + m_outChannel + " file failed : Unknown Types");
-         return MS::kFailure;
+         FieldWriteJob<ElementType> job(writeView, m_outFile,
+                                        m_outPartition, m_outChannel,
+                                        resolution, transform,
+                                        offAndDim, buffer, array.length(), blockOrder, m_outUniformTolerance);
+         
+         job.quantize(m_outWritePath, quantizedBits);
+         
+         return (job.run() ? MS::kSuccess : MS::kFailure);
       }
+      
+      FieldWriteJob<ElementType> *job = new FieldWriteJob<ElementType>(writeView, m_outFile,
+                                                                       m_outPartition, m_outChannel,
+                                                                       resolution, transform,
+                                                                       offAndDim, buffer, array.length(), blockOrder, m_outUniformTolerance);
+      
+      job->quantize(m_outWritePath, quantizedBits);
+      
+      WriteBehind::push(job);
+      
+      return MS::kSuccess;
    }
    
-   // field metadata
-   OffsetAndDimension offAndDim;
+   typename FieldWriter<T>::Func writeField = selectFieldWriter<T>(m_fieldType, m_dataType, m_outChannel);
    
-   offAndDim.off = Field3D::V3f(m_outOffset[0], m_outOffset[1], m_outOffset[2]);
-   offAndDim.dim = Field3D::V3f(dimension[0], dimension[1], dimension[2]);
+   if (!writeField)
+   {
+      ERROR( "Writing of " + m_outChannel + " file failed : Unknown Types");
+      return MS::kFailure;
+   }
    
    // write this field
    bool res = writeField(m_outFile,
@@ -803,6 +1284,8 @@ MStatus Field3dCacheFormat::writeArray(T &array)
                          resolution,
                          transform,
                          array,
+                         m_outBlockOrder,
+                         m_outUniformTolerance,
                          WriteOffsetAndDimension,
                          &offAndDim);
    
@@ -815,6 +1298,97 @@ MStatus Field3dCacheFormat::writeArray(T &array)
    return MS::kSuccess;
 }
 
+const Field3DTools::VoxelMask* Field3dCacheFormat::outputMask(unsigned int resolution[3])
+{
+   // the velocity faces are stored densely
+   if (m_outMaskChannel.empty() || m_outChannel == "velocity")
+   {
+      return 0;
+   }
+   
+   if (m_outMaskPartition != m_outPartition)
+   {
+      // once per fluid and frame, straight from the fluid as the mask
+      // channel may not have been written yet
+      m_outMaskPartition = m_outPartition;
+      
+      const float *data = fluidChannel(m_outFluid, m_outMaskChannel);
+      
+      if (data)
+      {
+         m_outMask.build(Field3D::V3i(resolution[0], resolution[1], resolution[2]), data, m_outMaskThreshold);
+         m_outMask.dilate(m_outMaskDilate);
+      }
+      else
+      {
+         m_outMask = Field3DTools::VoxelMask();
+      }
+   }
+   
+   if (m_outMask.empty() || m_outMask.res() != Field3D::V3i(resolution[0], resolution[1], resolution[2]))
+   {
+      return 0;
+   }
+   
+   return &m_outMask;
+}
+
+template <typename E>
+int Field3dCacheFormat::outputBlockOrder(const E *data, unsigned int length, unsigned int resolution[3])
+{
+   if (!m_outAutoBlockOrder || m_fieldType != Field3DTools::SPARSE || m_outChannel == "velocity")
+   {
+      return m_outBlockOrder;
+   }
+   
+   bool isVector = (m_outChannel == "color" || m_outChannel == "texture");
+   size_t nvoxels = size_t(resolution[0]) * size_t(resolution[1]) * size_t(resolution[2]);
+   
+   if (nvoxels == 0 || length < (isVector ? 2 : 1) * nvoxels)
+   {
+      return m_outBlockOrder;
+   }
+   
+   std::string key = std::string(m_outFluid.name().asChar()) + "." + m_outChannel;
+   
+   std::map<std::string, int>::iterator it = m_outBlockOrders.find(key);
+   
+   bool choose = (it == m_outBlockOrders.end() ||
+                  (m_outBlockOrderInterval > 0 && m_outChunk % m_outBlockOrderInterval == 0));
+   
+   if (!choose)
+   {
+      return it->second;
+   }
+   
+   size_t valueSize = (m_dataType == Field3DTools::HALF ? 2 : (m_dataType == Field3DTools::FLOAT ? 4 : 8));
+   
+   if (Field3DTools::quantizedBits(m_dataType) > 0)
+   {
+      valueSize = Field3DTools::quantizedBits(m_dataType) / 8;
+   }
+   Field3D::V3i res(resolution[0], resolution[1], resolution[2]);
+   
+   int order = 0;
+   
+   if (isVector)
+   {
+      order = Field3DTools::chooseBlockOrder(res, data, data + nvoxels, (length >= 3 * nvoxels ? data + 2 * nvoxels : 0),
+                                             Field3DTools::SPARSE_THRESHOLD, 3 * valueSize);
+   }
+   else
+   {
+      order = Field3DTools::chooseBlockOrder(res, data, (const E*) 0, (const E*) 0,
+                                             Field3DTools::SPARSE_THRESHOLD, valueSize);
+   }
+   
+   m_outBlockOrders[key] = order;
+   
+   LOG("Block order " << order << " for " << key);
+   
+   return order;
+}
+
 void Field3dCacheFormat::endWriteChunk()
 {
    // Noop
@@ -829,6 +1403,12 @@ MStatus Field3dCacheFormat::readHeader()
 
 MStatus Field3dCacheFormat::beginReadChunk()
 {
+   if (m_inOneFile)
+   {
+      m_inCurField = m_inFields.end();
+      m_inNextField = m_inFields.begin();
+   }
+   
    return MS::kSuccess;
 }
 
@@ -841,17 +1421,50 @@ void Field3dCacheFormat::initFields(const std::string &partition)
    m_inOffset = Field3D::V3f(0.0f, 0.0f, 0.0f);
    m_inDimension = Field3D::V3f(1.0f, 1.0f, 1.0f);
    
-   // read all fields
+   // only read the layers header, voxel data is loaded on demand (see loadField)
+   Field3DTools::IOLock lock;
+   
    std::vector<std::string> fields;
    
-   Field3DTools::getFieldNames(m_inFile, partition, fields);
+   std::string frameFile = (m_inCurFile != m_inSeq->end() ? m_inCurFile->second : std::string());
+   
+   Field3DTools::getFieldNames(m_inFile.get(), partition, fields);
+   
+   // identify the types from the layers header so readArraySize doesn't need the data
+   std::map<std::string, Field3DTools::SupportedFieldTypeEnum> types;
+   
+   if (!frameFile.empty())
+   {
+      Field3DTools::probeFieldTypes(frameFile, partition, types);
+   }
    
    for (size_t i=0; i<fields.size(); ++i)
    {
       Field3DTools::Fld field;
       
-      if (Field3DTools::getFieldValueType(m_inFile, partition, fields[i], field))
+      // Note: readProxyLayer ignores the base type
+      Field3D::EmptyField<Field3D::half>::Vec sl = Field3DTools::readProxyScalarLayers<Field3D::half>(m_inFile.get(), partition, fields[i]);
+      
+      if (sl.size() > 0)
+      {
+         field.baseField = sl[0];
+      }
+      else
+      {
+         Field3D::EmptyField<Field3D::V3h>::Vec vl = Field3DTools::readProxyVectorLayers<Field3D::half>(m_inFile.get(), partition, fields[i]);
+         
+         if (vl.size() > 0)
+         {
+            field.baseField = vl[0];
+         }
+      }
+      
+      if (field.baseField)
       {
+         std::map<std::string, Field3DTools::SupportedFieldTypeEnum>::const_iterator type = types.find(fields[i]);
+         
+         field.fieldType = (type != types.end() ? type->second : Field3DTools::TypeUnsupported);
+         
          m_inFields[fields[i]] = field;
          
          // supposes all field in a given partition have the same resolution, offset and dimension
@@ -896,6 +1509,208 @@ void Field3dCacheFormat::initFields(const std::string &partition)
    m_inNextField = m_inFields.begin();
 }
 
+bool Field3dCacheFormat::loadField(const std::string &name, Field3DTools::Fld &field)
+{
+   if (field.isLoaded())
+   {
+      return true;
+   }
+   
+   if (!field.baseField || !m_inFile)
+   {
+      // 'resolution' and 'offset' dummy fields
+      return false;
+   }
+   
+   Field3dPrefetcher::LayerId layer(m_inPartition, name);
+   
+   m_inUsedLayers.insert(layer);
+   
+   std::string frameFile = (m_inCurFile != m_inSeq->end() ? m_inCurFile->second : std::string());
+   
+   Field3dPrefetcher::LayerMap::iterator it = m_inPrefetched.find(layer);
+   
+   if (it != m_inPrefetched.end())
+   {
+      // decoded by the prefetcher
+      field = it->second;
+      m_inPrefetched.erase(it);
+      
+      FrameCache::insert(frameFile, m_inPartition, name, field);
+      
+      return true;
+   }
+   
+   if (FrameCache::find(frameFile, m_inPartition, name, field))
+   {
+      // decoded earlier (possibly by another cache format instance)
+      return true;
+   }
+   
+   Field3DTools::IOLock lock;
+   
+   Field3DTools::Fld loaded;
+   
+   bool success = false;
+   
+   if (field.fieldType != Field3DTools::TypeUnsupported)
+   {
+      success = Field3DTools::getFieldValueType(m_inFile.get(), m_inPartition, name, field.fieldType, loaded);
+   }
+   else
+   {
+      // the probe failed, try all types
+      success = Field3DTools::getFieldValueType(m_inFile.get(), m_inPartition, name, loaded);
+   }
+   
+   if (success)
+   {
+      // codes of a quantized channel are stored aside its layer
+      success = Field3DTools::loadQuantizedLayer(frameFile, m_inPartition, name, loaded);
+   }
+   
+   if (!success)
+   {
+      ERROR(std::string("Could not load field ") + m_inPartition + "." + name);
+      return false;
+   }
+   
+   field = loaded;
+   
+   FrameCache::insert(frameFile, m_inPartition, name, field);
+   
+   return true;
+}
+
+void Field3dCacheFormat::prefetchFrom(MayaTools::FrameFileMap::const_iterator it)
+{
+   if (m_prefetchWindow == 0)
+   {
+      return;
+   }
+   
+   // guess the playback direction from the previously opened frame
+   bool forward = !(it->first < m_inLastTime);
+   
+   m_inLastTime = it->first;
+   
+   std::vector<std::string> files;
+   
+   if (forward)
+   {
+      MayaTools::FrameFileMap::const_iterator next = it;
+      
+      for (++next; next != m_inSeq->end() && files.size() < m_prefetchWindow; ++next)
+      {
+         files.push_back(next->second);
+      }
+   }
+   else
+   {
+      MayaTools::FrameFileMap::const_iterator prev = it;
+      
+      while (prev != m_inSeq->begin() && files.size() < m_prefetchWindow)
+      {
+         --prev;
+         files.push_back(prev->second);
+      }
+   }
+   
+   // when scrubbing, frames out of the new window are dropped
+   m_prefetcher.schedule(files, m_inUsedLayers);
+}
+
+MStatus Field3dCacheFormat::openOneFile(const std::string &path)
+{
+   if (m_inOneFile && path == m_inFilename && m_inFile)
+   {
+      // already opened, stay on the current chunk
+      m_inCurField = m_inFields.end();
+      m_inNextField = m_inFields.begin();
+      
+      return MS::kSuccess;
+   }
+   
+   MGlobal::displayInfo(MString("Single file cache changed to ") + path.c_str());
+   
+   resetInputFile();
+   
+   m_prefetcher.clear();
+   m_inUsedLayers.clear();
+   
+   MayaTools::FrameFileMap *chunks = new MayaTools::FrameFileMap();
+   
+   m_inSeq.reset(chunks);
+   m_inCurFile = m_inSeq->end();
+   
+   m_inFilename = path;
+   m_inOneFile = true;
+   
+   // chunks written in this session are only visible once the file is finalized
+   if (!OneFile::finalize(path))
+   {
+      ERROR(std::string("Writing of ") + path + " failed : see above for an explanation");
+   }
+   
+   std::vector<long> ticks;
+   
+   if (!OneFile::readTimeIndex(path, ticks) || ticks.empty())
+   {
+      ERROR(std::string("Opening of ") + path + " failed : no chunk found");
+      m_inFilename = "";
+      return MS::kFailure;
+   }
+   
+   for (size_t i=0; i<ticks.size(); ++i)
+   {
+      (*chunks)[ticksToTime(ticks[i])] = path;
+   }
+   
+   m_inFile = FilePool::open(path);
+   
+   if (!m_inFile)
+   {
+      ERROR(std::string("Opening of ") + path + " failed : Unknown reason");
+      resetInputFile();
+      m_inFilename = "";
+      
+      return MS::kFailure;
+   }
+   
+   // chunks are read in the same file, no prefetch
+   setChunk(m_inSeq->begin());
+   
+   return MS::kSuccess;
+}
+
+void Field3dCacheFormat::setChunk(MayaTools::FrameFileMap::const_iterator it)
+{
+   m_inCurFile = it;
+   
+   if (m_inFluidName.length() > 0)
+   {
+      // reload the fields of the current fluid for this chunk
+      m_inPartition = inputPartition(m_inFluidName);
+      
+      initFields(m_inPartition);
+   }
+   
+   m_inCurField = m_inFields.end();
+   m_inNextField = m_inFields.begin();
+}
+
+std::string Field3dCacheFormat::inputPartition(const std::string &fluidName)
+{
+   std::string partition = partitionName(fluidName);
+   
+   if (m_inOneFile && m_inCurFile != m_inSeq->end())
+   {
+      partition = OneFile::chunkPartition(partition, timeToTicks(m_inCurFile->first));
+   }
+   
+   return partition;
+}
+
 MStatus Field3dCacheFormat::findChannelName(const MString &name)
 {
    if (!m_inFile)
@@ -905,7 +1720,7 @@ MStatus Field3dCacheFormat::findChannelName(const MString &name)
    
    std::string fluidName = extractFluidName(name);
    std::string channel = extractChannelName(name);
-   std::string partition = partitionName(fluidName);
+   std::string partition = inputPartition(fluidName);
    
    if (m_inPartition != partition)
    {
@@ -973,20 +1788,64 @@ void Field3dCacheFormat::endReadChunk()
 
 MStatus Field3dCacheFormat::readTime(MTime &time)
 {
-   // Never called
-   return MS::kFailure;
+   // Only called for single file caches
+   if (!m_inOneFile || m_inCurFile == m_inSeq->end())
+   {
+      return MS::kFailure;
+   }
+   
+   time = m_inCurFile->first;
+   
+   return MS::kSuccess;
 }
 
 MStatus Field3dCacheFormat::findTime(MTime &time, MTime &foundTime)
 {
-   // Never called
-   return MS::kFailure;
+   // Only called for single file caches : seek to the last chunk at or before time
+   if (!m_inOneFile || m_inSeq->empty())
+   {
+      return MS::kFailure;
+   }
+   
+   MayaTools::FrameFileMap::const_iterator it = m_inSeq->upper_bound(ticksToTime(timeToTicks(time)));
+   
+   if (it == m_inSeq->begin())
+   {
+      return MS::kFailure;
+   }
+   
+   --it;
+   
+   if (it != m_inCurFile)
+   {
+      setChunk(it);
+   }
+   
+   foundTime = it->first;
+   
+   return MS::kSuccess;
 }
 
 MStatus Field3dCacheFormat::readNextTime(MTime &foundTime)
 {
-   // Never called
-   return MS::kFailure;
+   // Only called for single file caches
+   if (!m_inOneFile || m_inCurFile == m_inSeq->end())
+   {
+      return MS::kFailure;
+   }
+   
+   MayaTools::FrameFileMap::const_iterator it = m_inCurFile;
+   
+   if (++it == m_inSeq->end())
+   {
+      return MS::kFailure;
+   }
+   
+   setChunk(it);
+   
+   foundTime = it->first;
+   
+   return MS::kSuccess;
 }
 
 unsigned Field3dCacheFormat::readArraySize()
@@ -999,7 +1858,8 @@ unsigned Field3dCacheFormat::readArraySize()
       {
          rv = 3;
       }
-      else if (m_inCurField->second.baseField)
+      else if (m_inCurField->second.fieldType != Field3DTools::TypeUnsupported ||
+               loadField(m_inCurField->first, m_inCurField->second))
       {
          Field3DTools::Fld &fld = m_inCurField->second;
          
@@ -1025,9 +1885,10 @@ unsigned Field3dCacheFormat::readArraySize()
             break;
          case Field3DTools::MACField_Half:
          case Field3DTools::MACField_Float:
+         case Field3DTools::MACField_Double:
             rv = ((res.x + 1) * res.y * res.z) +
                  (res.x * (res.y + 1) * res.z) +
-                 (res.y * res.y * (res.z + 1));
+                 (res.x * res.y * (res.z + 1));
             break;
          default:
             break;
@@ -1105,6 +1966,17 @@ MStatus Field3dCacheFormat::readArray(T &array, unsigned long arraySize)
    
    Field3DTools::Fld &field = m_inCurField->second;
    
+   if (!loadField(m_inCurField->first, field))
+   {
+      return MS::kFailure;
+   }
+   
+   if (field.quantized)
+   {
+      // the placeholder layer holds no value
+      return (Field3DTools::readQuantizedField(*field.quantized, array) ? MS::kSuccess : MS::kFailure);
+   }
+   
    // pointer to the read function we'll call based on the dynamic type
    bool success = false;
    
@@ -1112,40 +1984,40 @@ MStatus Field3dCacheFormat::readArray(T &array, unsigned long arraySize)
    switch (field.fieldType)
    {
    case Field3DTools::DenseScalarField_Half:
-      success = Field3DTools::readScalarField<Field3D::half, T>(field.dhScalarField, array);
+      success = Field3DTools::readDenseScalarField<Field3D::half, T>(field.dhScalarField, array);
       break;
    case Field3DTools::DenseScalarField_Float:
-      success = Field3DTools::readScalarField<float, T>(field.dfScalarField, array);
+      success = Field3DTools::readDenseScalarField<float, T>(field.dfScalarField, array);
       break;
    case Field3DTools::DenseScalarField_Double:
-      success = Field3DTools::readScalarField<double, T>(field.ddScalarField, array);
+      success = Field3DTools::readDenseScalarField<double, T>(field.ddScalarField, array);
       break;
    case Field3DTools::SparseScalarField_Half:
-      success = Field3DTools::readScalarField<Field3D::half, T>(field.shScalarField, array);
+      success = Field3DTools::readSparseScalarField<Field3D::half, T>(field.shScalarField, array);
       break;
    case Field3DTools::SparseScalarField_Float:
-      success = Field3DTools::readScalarField<float, T>(field.sfScalarField, array);
+      success = Field3DTools::readSparseScalarField<float, T>(field.sfScalarField, array);
       break;
    case Field3DTools::SparseScalarField_Double:
-      success = Field3DTools::readScalarField<double, T>(field.sdScalarField, array);
+      success = Field3DTools::readSparseScalarField<double, T>(field.sdScalarField, array);
       break;
    case Field3DTools::DenseVectorField_Half:
-      success = Field3DTools::readVectorField<Field3D::half, T>(field.dhVectorField, array);
+      success = Field3DTools::readDenseVectorField<Field3D::half, T>(field.dhVectorField, array);
       break;
    case Field3DTools::DenseVectorField_Float:
-      success = Field3DTools::readVectorField<float, T>(field.dfVectorField, array);
+      success = Field3DTools::readDenseVectorField<float, T>(field.dfVectorField, array);
       break;
    case Field3DTools::DenseVectorField_Double:
-      success = Field3DTools::readVectorField<double, T>(field.ddVectorField, array);
+      success = Field3DTools::readDenseVectorField<double, T>(field.ddVectorField, array);
       break;
    case Field3DTools::SparseVectorField_Half:
-      success = Field3DTools::readVectorField<Field3D::half, T>(field.shVectorField, array);
+      success = Field3DTools::readSparseVectorField<Field3D::half, T>(field.shVectorField, array);
       break;
    case Field3DTools::SparseVectorField_Float:
-      success = Field3DTools::readVectorField<float, T>(field.sfVectorField, array);
+      success = Field3DTools::readSparseVectorField<float, T>(field.sfVectorField, array);
       break;
    case Field3DTools::SparseVectorField_Double:
-      success = Field3DTools::readVectorField<double, T>(field.sdVectorField, array);
+      success = Field3DTools::readSparseVectorField<double, T>(field.sdVectorField, array);
       break;
    case Field3DTools::MACField_Half:
       success = Field3DTools::readMACField<Field3D::half, T>(field.mhField, array);
@@ -1281,7 +2153,25 @@ bool Field3dCacheFormat::readDescription(const std::string &xmlPath, Field3dCach
                // f3d.remap=velocity:v_mac
                p = extra.find("f3d.remap=");
                
-               if (p != std::string::npos)
+               size_t pp = extra.find("f3d.prefetch=");
+               
+               if (pp != std::string::npos)
+               {
+                  // f3d.prefetch=4
+                  desc.prefetch = atoi(extra.substr(pp + strlen("f3d.prefetch=")).c_str());
+                  
+                  if (desc.prefetch < 0)
+                  {
+                     desc.prefetch = -1;
+                  }
+                  else
+                  {
+                     std::ostringstream oss;
+                     oss << "  Prefetch " << desc.prefetch << " frame(s)";
+                     MGlobal::displayInfo(oss.str().c_str());
+                  }
+               }
+               else if (p != std::string::npos)
                {
                   std::string remap = extra.substr(p + strlen("f3d.remap="));
                   p = remap.find(':');
@@ -62,10 +62,15 @@
 #include <Field3D/InitIO.h>
 
 #include <deque>
+#include <set>
 
 using namespace Field3D;
 
 #include "field3D_Tools.h"
+#include "field3D_Prefetch.h"
+#include "field3D_FilePool.h"
+#include "field3D_SeqIndex.h"
+#include "maya_Tools.h"
 
 class Field3dCacheFormat : public MPxCacheFormat
 {
@@ -78,6 +83,9 @@ public:
    static void *SHCreator() { return new Field3dCacheFormat(Field3DTools::SPARSE, Field3DTools::HALF); }
    static void *SFCreator() { return new Field3dCacheFormat(Field3DTools::SPARSE, Field3DTools::FLOAT); }
    static void *SDCreator() { return new Field3dCacheFormat(Field3DTools::SPARSE, Field3DTools::DOUBLE); }
+   // SQ = Sparse, 8 or 16 bits quantized
+   static void *SQ8Creator() { return new Field3dCacheFormat(Field3DTools::SPARSE, Field3DTools::QUANT8); }
+   static void *SQ16Creator() { return new Field3dCacheFormat(Field3DTools::SPARSE, Field3DTools::QUANT16); }
    
 public:
    
@@ -144,11 +152,13 @@ private:
       std::string basename;
       std::string filePattern;
       bool useSubFrames;
+      int prefetch; // frames to read ahead, -1 if not set
       std::map<std::string, std::string> mapChannels; // maya name -> field3d name
       std::map<std::string, std::string> unmapChannels; // field3d name -> maya name
       
       SequenceDesc()
          : useSubFrames(false)
+         , prefetch(-1)
       {
       }
       
@@ -160,12 +170,15 @@ private:
          basename = "";
          filePattern = "";
          useSubFrames = false;
+         prefetch = -1;
       }
    };
    
-   std::map<MTime, MString> m_inSeq;
-   std::map<MTime, MString>::iterator m_inCurFile;
-   Field3DInputFile *m_inFile;
+   // frame files (shared by the cache formats reading the sequence), or the
+   // chunks of a single file cache (all mapped to the same file), never null
+   MayaTools::FrameFiles m_inSeq;
+   MayaTools::FrameFileMap::const_iterator m_inCurFile;
+   FilePool::FilePtr m_inFile;
    std::string m_inDescFile;
    std::string m_inFilename;
    std::string m_inFluidName;
@@ -175,23 +188,56 @@ private:
    Field3D::V3f m_inOffset;
    Field3D::V3f m_inDimension;
    SequenceDesc m_inDesc;
+   bool m_inOneFile;
    std::map<std::string, Field3DTools::Fld>::iterator m_inCurField;
    std::map<std::string, Field3DTools::Fld>::iterator m_inNextField;
    
    Field3DOutputFile *m_outFile;
    std::string m_outFilename;
+   std::string m_outWritePath; // file actually written, differs from m_outFilename when appending chunks
+   std::string m_outIndexFile;
+   SeqIndex::FrameHeader m_outHeader; // layers written to m_outFile, recorded in m_outIndexFile
    std::string m_outPartition;
    std::string m_outChannel;
    MFnFluid m_outFluid;
    float m_outOffset[3];
+   bool m_outOneFile;
+   long m_outTicks;
+   std::string m_outMaskChannel; // FIELD3D_MAYA_MASK, empty if not masked
+   double m_outMaskThreshold;
+   int m_outMaskDilate;
+   std::string m_outMaskPartition; // partition the mask was computed for
+   Field3DTools::VoxelMask m_outMask;
+   int m_outBlockOrder; // FIELD3D_MAYA_BLOCK_ORDER, -1 for Field3D's default
+   bool m_outAutoBlockOrder;
+   int m_outBlockOrderInterval; // chunks between two automatic picks, 0 for the first only
+   long m_outChunk;
+   std::map<std::string, int> m_outBlockOrders; // "fluid.channel" -> picked order
+   double m_outUniformTolerance; // FIELD3D_MAYA_UNIFORM, -1 if uniform blocks aren't detected
+   
+   Field3dPrefetcher m_prefetcher;
+   size_t m_prefetchWindow;
+   std::set<Field3dPrefetcher::LayerId> m_inUsedLayers;
+   Field3dPrefetcher::LayerMap m_inPrefetched;
+   MTime m_inLastTime;
    
    bool readDescription(const std::string &xmlPath, SequenceDesc &desc);
    bool identifyPath(const MString &path, MString &dirname, MString &basename, MString &frame, MTime &t, MString &ext);
-   unsigned long fillCacheFiles(const MString &path);
-   unsigned long fillCacheFiles(const MString &dirname, const MString &basename, const MString &ext);
+   unsigned long fillCacheFiles(const MString &dirname, const MString &basename);
    
    void resetInputFile();
+   void closeOutputFile();
+   const Field3DTools::VoxelMask* outputMask(unsigned int resolution[3]);
+   
+   template <typename E>
+   int outputBlockOrder(const E *data, unsigned int length, unsigned int resolution[3]);
+
+   MStatus openOneFile(const std::string &path);
+   void setChunk(MayaTools::FrameFileMap::const_iterator it);
+   std::string inputPartition(const std::string &fluidName);
    void initFields(const std::string &partition);
+   bool loadField(const std::string &name, Field3DTools::Fld &field);
+   void prefetchFrom(MayaTools::FrameFileMap::const_iterator it);
 };
 
 #endif
@@ -0,0 +1,296 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include "field3D_FrameCache.h"
+
+#include <list>
+#include <map>
+#include <cstdlib>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <boost/thread/mutex.hpp>
+
+namespace FrameCache
+{
+
+struct Key
+{
+   std::string path;
+   time_t mtime;
+   std::string partition;
+   std::string layer;
+   
+   bool operator<(const Key &rhs) const
+   {
+      if (path != rhs.path)
+      {
+         return (path < rhs.path);
+      }
+      if (mtime != rhs.mtime)
+      {
+         return (mtime < rhs.mtime);
+      }
+      if (partition != rhs.partition)
+      {
+         return (partition < rhs.partition);
+      }
+      return (layer < rhs.layer);
+   }
+};
+
+struct Entry
+{
+   Key key;
+   Field3DTools::Fld fld;
+   size_t bytes;
+};
+
+// most recently used first
+typedef std::list<Entry> EntryList;
+typedef std::map<Key, EntryList::iterator> EntryMap;
+
+static boost::mutex gMutex;
+static EntryList gEntries;
+static EntryMap gIndex;
+static size_t gBytes = 0;
+static size_t gBudget = 0;
+static bool gBudgetSet = false;
+static size_t gHits = 0;
+static size_t gMisses = 0;
+static size_t gEvictions = 0;
+
+static size_t defaultBudget()
+{
+   const char *env = getenv("FIELD3D_MAYA_CACHE_MB");
+   
+   if (env)
+   {
+      int v = atoi(env);
+      
+      if (v >= 0)
+      {
+         return size_t(v) * 1024 * 1024;
+      }
+      
+      WARNING("Invalid FIELD3D_MAYA_CACHE_MB value \"" << env << "\", cache disabled");
+   }
+   
+   return 0;
+}
+
+// gMutex must be held
+static size_t lockedBudget()
+{
+   if (!gBudgetSet)
+   {
+      gBudget = defaultBudget();
+      gBudgetSet = true;
+   }
+   return gBudget;
+}
+
+// gMutex must be held, evicted fields are returned so they get released
+// once the mutex is unlocked
+static void lockedEvict(size_t maxBytes, std::vector<Field3DTools::Fld> &evicted)
+{
+   while (gBytes > maxBytes && !gEntries.empty())
+   {
+      Entry &entry = gEntries.back();
+      
+      evicted.push_back(entry.fld);
+      
+      gBytes -= entry.bytes;
+      gIndex.erase(entry.key);
+      gEntries.pop_back();
+      
+      ++gEvictions;
+   }
+}
+
+static bool makeKey(const std::string &path, const std::string &partition, const std::string &layer, Key &key)
+{
+   struct stat st;
+   
+   if (stat(path.c_str(), &st) != 0)
+   {
+      return false;
+   }
+   
+   key.path = path;
+   key.mtime = st.st_mtime;
+   key.partition = partition;
+   key.layer = layer;
+   
+   return true;
+}
+
+size_t budget()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   return lockedBudget();
+}
+
+void setBudget(size_t bytes)
+{
+   std::vector<Field3DTools::Fld> evicted;
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gBudget = bytes;
+   gBudgetSet = true;
+   
+   lockedEvict(gBudget, evicted);
+}
+
+bool find(const std::string &path, const std::string &partition, const std::string &layer, Field3DTools::Fld &fld)
+{
+   if (!isEnabled())
+   {
+      return false;
+   }
+   
+   Key key;
+   
+   if (!makeKey(path, partition, layer, key))
+   {
+      return false;
+   }
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   EntryMap::iterator it = gIndex.find(key);
+   
+   if (it == gIndex.end())
+   {
+      ++gMisses;
+      return false;
+   }
+   
+   // move to front
+   gEntries.splice(gEntries.begin(), gEntries, it->second);
+   
+   fld = it->second->fld;
+   
+   ++gHits;
+   
+   return true;
+}
+
+void insert(const std::string &path, const std::string &partition, const std::string &layer, const Field3DTools::Fld &fld)
+{
+   if (!isEnabled() || !fld.isLoaded())
+   {
+      return;
+   }
+   
+   Key key;
+   
+   if (!makeKey(path, partition, layer, key))
+   {
+      return;
+   }
+   
+   size_t bytes = size_t(fld.baseField->memSize()) + (fld.quantized ? fld.quantized->bytes() : 0);
+   
+   std::vector<Field3DTools::Fld> evicted;
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   if (bytes > lockedBudget())
+   {
+      // would evict everything else
+      return;
+   }
+   
+   EntryMap::iterator it = gIndex.find(key);
+   
+   if (it != gIndex.end())
+   {
+      gBytes -= it->second->bytes;
+      evicted.push_back(it->second->fld);
+      gEntries.erase(it->second);
+      gIndex.erase(it);
+   }
+   
+   Entry entry;
+   
+   entry.key = key;
+   entry.fld = fld;
+   entry.bytes = bytes;
+   
+   gEntries.push_front(entry);
+   gIndex[key] = gEntries.begin();
+   gBytes += bytes;
+   
+   lockedEvict(gBudget, evicted);
+}
+
+Stats stats()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   Stats s;
+   
+   s.hits = gHits;
+   s.misses = gMisses;
+   s.evictions = gEvictions;
+   s.entries = gEntries.size();
+   s.bytes = gBytes;
+   s.budget = lockedBudget();
+   
+   return s;
+}
+
+void clear()
+{
+   std::vector<Field3DTools::Fld> evicted;
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   for (EntryList::iterator it = gEntries.begin(); it != gEntries.end(); ++it)
+   {
+      evicted.push_back(it->fld);
+   }
+   
+   gEntries.clear();
+   gIndex.clear();
+   gBytes = 0;
+   gHits = 0;
+   gMisses = 0;
+   gEvictions = 0;
+}
+
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#ifndef FIELD3D_MAYA_FRAMECACHE
+#define FIELD3D_MAYA_FRAMECACHE
+
+#include <string>
+
+#include "field3D_Tools.h"
+
+// Process wide cache of decoded layers, shared by all cache format instances
+// and the Field3DInfo nodes. Entries are keyed by file path, file modification
+// time, partition and layer names and evicted in least recently used order
+// when the memory budget is exceeded.
+namespace FrameCache
+{
+
+struct Stats
+{
+   size_t hits;
+   size_t misses;
+   size_t evictions;
+   size_t entries;
+   size_t bytes;
+   size_t budget;
+};
+
+// Memory budget in bytes.
+//   Defaults to the FIELD3D_MAYA_CACHE_MB environment variable (in megabytes),
+//   0 (the default) disables the cache. setBudget evicts entries as needed.
+size_t budget();
+void setBudget(size_t bytes);
+
+inline bool isEnabled()
+{
+   return (budget() > 0);
+}
+
+// Looks up a decoded layer, fld is left untouched on a miss
+bool find(const std::string &path, const std::string &partition, const std::string &layer, Field3DTools::Fld &fld);
+
+// Adds a decoded layer (fld.isLoaded() must be true)
+void insert(const std::string &path, const std::string &partition, const std::string &layer, const Field3DTools::Fld &fld);
+
+Stats stats();
+
+// Drops all entries and resets the counters
+void clear();
+
+}
+
+#endif
@@ -0,0 +1,228 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include "field3D_HeaderCache.h"
+
+#include <list>
+#include <map>
+#include <cstdlib>
+
+#include <boost/thread/mutex.hpp>
+
+namespace HeaderCache
+{
+
+struct Entry
+{
+   std::string path;
+   HeaderPtr header;
+};
+
+// most recently used first
+typedef std::list<Entry> EntryList;
+typedef std::map<std::string, EntryList::iterator> EntryMap;
+
+static boost::mutex gMutex;
+static EntryList gEntries;
+static EntryMap gIndex;
+static size_t gCapacity = 0;
+static bool gCapacitySet = false;
+static size_t gHits = 0;
+static size_t gMisses = 0;
+static size_t gEvictions = 0;
+
+static size_t defaultCapacity()
+{
+   const char *env = getenv("FIELD3D_MAYA_HEADER_CACHE");
+   
+   if (env)
+   {
+      int v = atoi(env);
+      
+      if (v >= 0)
+      {
+         return size_t(v);
+      }
+      
+      WARNING("Invalid FIELD3D_MAYA_HEADER_CACHE value \"" << env << "\", using default");
+   }
+   
+   return 10000;
+}
+
+// gMutex must be held
+static size_t lockedCapacity()
+{
+   if (!gCapacitySet)
+   {
+      gCapacity = defaultCapacity();
+      gCapacitySet = true;
+   }
+   return gCapacity;
+}
+
+// gMutex must be held
+static void lockedEvict(size_t maxEntries)
+{
+   while (gEntries.size() > maxEntries)
+   {
+      gIndex.erase(gEntries.back().path);
+      gEntries.pop_back();
+      
+      ++gEvictions;
+   }
+}
+
+static HeaderPtr find(const std::string &path, const FileTools::FileStamp &stamp)
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   EntryMap::iterator it = gIndex.find(path);
+   
+   if (it == gIndex.end() || it->second->header->stamp != stamp)
+   {
+      ++gMisses;
+      return HeaderPtr();
+   }
+   
+   // move to front
+   gEntries.splice(gEntries.begin(), gEntries, it->second);
+   
+   ++gHits;
+   
+   return it->second->header;
+}
+
+static void insert(const std::string &path, const HeaderPtr &header)
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   if (lockedCapacity() == 0)
+   {
+      return;
+   }
+   
+   EntryMap::iterator it = gIndex.find(path);
+   
+   if (it != gIndex.end())
+   {
+      gEntries.erase(it->second);
+      gIndex.erase(it);
+   }
+   
+   Entry entry;
+   
+   entry.path = path;
+   entry.header = header;
+   
+   gEntries.push_front(entry);
+   gIndex[path] = gEntries.begin();
+   
+   lockedEvict(gCapacity);
+}
+
+size_t capacity()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   return lockedCapacity();
+}
+
+void setCapacity(size_t frames)
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gCapacity = frames;
+   gCapacitySet = true;
+   
+   lockedEvict(gCapacity);
+}
+
+HeaderPtr read(const std::string &path, const std::string &indexFile)
+{
+   FileTools::FileStamp stamp;
+   
+   if (!FileTools::getFileStamp(path, stamp))
+   {
+      return HeaderPtr();
+   }
+   
+   HeaderPtr header = find(path, stamp);
+   
+   if (header)
+   {
+      return header;
+   }
+   
+   SeqIndex::FrameHeader *frame = new SeqIndex::FrameHeader();
+   
+   header = HeaderPtr(frame);
+   
+   if (!(indexFile.length() > 0 && SeqIndex::lookup(indexFile, path, *frame)) &&
+       !SeqIndex::scanFile(path, *frame))
+   {
+      return HeaderPtr();
+   }
+   
+   insert(path, header);
+   
+   return header;
+}
+
+Stats stats()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   Stats s;
+   
+   s.hits = gHits;
+   s.misses = gMisses;
+   s.evictions = gEvictions;
+   s.entries = gEntries.size();
+   s.capacity = lockedCapacity();
+   
+   return s;
+}
+
+void clear()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gEntries.clear();
+   gIndex.clear();
+   gHits = 0;
+   gMisses = 0;
+   gEvictions = 0;
+}
+
+}
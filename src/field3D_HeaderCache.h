@@ -0,0 +1,78 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef FIELD3D_MAYA_HEADERCACHE
+#define FIELD3D_MAYA_HEADERCACHE
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include "field3D_SeqIndex.h"
+
+// Process wide cache of frame headers (partitions, layers, resolution,
+// mapping, bounds and metadata) keyed by resolved file path, shared by all
+// the Field3DInfo nodes. Entries are checked against the size and
+// modification time of their file and evicted in least recently used order.
+namespace HeaderCache
+{
+
+typedef boost::shared_ptr<const SeqIndex::FrameHeader> HeaderPtr;
+
+struct Stats
+{
+   size_t hits;
+   size_t misses;
+   size_t evictions;
+   size_t entries;
+   size_t capacity;
+};
+
+// Maximum number of frames.
+//   Defaults to the FIELD3D_MAYA_HEADER_CACHE environment variable,
+//   10000 if not set, 0 disables the cache.
+size_t capacity();
+void setCapacity(size_t frames);
+
+// Header of frame file path : from the cache, the sequence index indexFile
+//   (may be empty) or the file itself. Returns an empty pointer if the file
+//   can't be read.
+HeaderPtr read(const std::string &path, const std::string &indexFile);
+
+Stats stats();
+
+// Drops all entries and resets the counters
+void clear();
+
+}
+
+#endif
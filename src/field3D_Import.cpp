@@ -1,4 +1,7 @@
 #include "field3D_Import.h"
+#include "field3D_Tools.h"
+#include "field3D_SeqIndex.h"
+#include "field3D_FilePool.h"
 #include <maya/MDagModifier.h>
 #include <maya/MNamespace.h>
 #include <maya/MGlobal.h>
@@ -82,6 +85,7 @@ MSyntax importF3d::newSyntax()
   syntax.addFlag("-v", "-verbose", MSyntax::kNoArg);
   syntax.addFlag("-rs", "-recacheSparse", MSyntax::kBoolean);
   syntax.addFlag("-rf", "-recacheFormat", MSyntax::kString);
+  syntax.addFlag("-bi", "-buildIndex", MSyntax::kNoArg);
   
   syntax.setMinObjects(0);
   syntax.setMaxObjects(0);
@@ -271,9 +275,26 @@ MStatus importF3d::doIt(const MArgList &argList)
     }
   }
   
-  Field3D::Field3DInputFile f3d;
+  if (args.isFlagSet("-buildIndex"))
+  {
+    // for the Field3DInfo node created below
+    size_t count = SeqIndex::build(SeqIndex::indexPath(pat), files);
+    
+    if (verbose)
+    {
+      MGlobal::displayInfo(MString("importF3d: Indexed ") + int(count) + " frame(s) in " + SeqIndex::indexPath(pat).c_str());
+    }
+  }
+  
+  SeqIndex::FrameHeader header;
+  
+  bool indexed = SeqIndex::lookup(SeqIndex::indexPath(pat), files[0], header);
   
-  if (f3d.open(files[0]))
+  Field3DTools::IOLock lock;
+  
+  FilePool::FilePtr f3d;
+  
+  if (indexed || (f3d = FilePool::open(files[0])))
   {
     std::set<std::string> scalarChannelNames;
     std::set<std::string> vectorChannelNames;
@@ -291,7 +312,14 @@ MStatus importF3d::doIt(const MArgList &argList)
     // read fields from first file in sequence only?
     std::vector<std::string> partitions;
     
-    f3d.getPartitionNames(partitions);
+    if (indexed)
+    {
+      header.partitionNames(partitions);
+    }
+    else
+    {
+      f3d->getPartitionNames(partitions);
+    }
     
     for (size_t i=0; i<partitions.size(); ++i)
     {
@@ -388,7 +416,14 @@ MStatus importF3d::doIt(const MArgList &argList)
       std::map<std::string, FieldInfo> channels;
       std::map<std::string, FieldInfo>::iterator channelIt;
       
-      f3d.getScalarLayerNames(layerNames, partition);
+      if (indexed)
+      {
+        header.layerNames(partition, true, false, layerNames);
+      }
+      else
+      {
+        f3d->getScalarLayerNames(layerNames, partition);
+      }
       for (size_t i=0; i<layerNames.size(); ++i)
       {
         FieldInfo info;
@@ -407,15 +442,18 @@ MStatus importF3d::doIt(const MArgList &argList)
         
         if (channelIt == channels.end())
         {
-          // type doesn't really matter
-          Field3D::EmptyField<Field3D::half>::Vec fields = f3d.readProxyLayer<Field3D::half>(partition, info.name, false);
-          if (fields.empty())
+          if (!indexed)
           {
-            continue;
+            // type doesn't really matter
+            Field3D::EmptyField<Field3D::half>::Vec fields = f3d->readProxyLayer<Field3D::half>(partition, info.name, false);
+            if (fields.empty())
+            {
+              continue;
+            }
+            
+            info.field = fields[0];
           }
           
-          info.field = fields[0];
-          
           channels[channel] = info;
         }
         else if (channelIt->second.name != info.name)
@@ -426,7 +464,14 @@ MStatus importF3d::doIt(const MArgList &argList)
       }
       
       layerNames.clear();
-      f3d.getVectorLayerNames(layerNames, partition);
+      if (indexed)
+      {
+        header.layerNames(partition, false, true, layerNames);
+      }
+      else
+      {
+        f3d->getVectorLayerNames(layerNames, partition);
+      }
       for (size_t i=0; i<layerNames.size(); ++i)
       {
         FieldInfo info;
@@ -445,15 +490,18 @@ MStatus importF3d::doIt(const MArgList &argList)
         
         if (channelIt == channels.end())
         {
-          // type doesn't matter for EmptyField, use any
-          Field3D::EmptyField<Field3D::V3h>::Vec fields = f3d.readProxyLayer<Field3D::V3h>(partition, info.name, true);
-          if (fields.empty())
+          if (!indexed)
           {
-            continue;
+            // type doesn't matter for EmptyField, use any
+            Field3D::EmptyField<Field3D::V3h>::Vec fields = f3d->readProxyLayer<Field3D::V3h>(partition, info.name, true);
+            if (fields.empty())
+            {
+              continue;
+            }
+            
+            info.field = fields[0];
           }
           
-          info.field = fields[0];
-          
           channels[channel] = info;
         }
         else if (channelIt->second.name != info.name)
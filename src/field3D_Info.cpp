@@ -1,5 +1,7 @@
 #include "field3D_Info.h"
 #include "maya_Tools.h"
+#include "field3D_HeaderCache.h"
+#include "parallel_Tools.h"
 #include <maya/MFnNumericAttribute.h>
 #include <maya/MFnTypedAttribute.h>
 #include <maya/MFnCompoundAttribute.h>
@@ -11,6 +13,7 @@
 #include <maya/MArrayDataBuilder.h>
 #include <cmath>
 #include <limits>
+#include <boost/thread/mutex.hpp>
 
 using namespace Field3D;
 
@@ -417,6 +420,22 @@ MStatus Field3DInfo::initialize()
   return MStatus::kSuccess;
 }
 
+// update counters of all the nodes (compute may run in parallel)
+static boost::mutex gStatsMutex;
+static Field3DInfo::Stats gStats;
+
+static void addStats(const Field3DInfo::Stats &delta)
+{
+  boost::mutex::scoped_lock lock(gStatsMutex);
+  
+  gStats.updates += delta.updates;
+  gStats.refreshes += delta.refreshes;
+  gStats.boxLayers += delta.boxLayers;
+  gStats.updateTime += delta.updateTime;
+  gStats.headerTime += delta.headerTime;
+  gStats.boxTime += delta.boxTime;
+}
+
 Field3DInfo::Field3DInfo()
    : MPxNode()
    , mBuffer(0)
@@ -425,7 +444,7 @@ Field3DInfo::Field3DInfo()
    , mLastForceDimension(false)
    , mLastDimension(1, 1, 1)
    , mLastTransformMode(Field3DInfo::TM_raw)
-   , mFile(0)
+   , mHasLayer(false)
 {
   reset();
 }
@@ -456,13 +475,9 @@ void Field3DInfo::resetFile()
   mPartitions.clear();
   mFields.clear();
   
-  mField = 0;
+  mHasLayer = false;
   
-  if (mFile)
-  {
-    delete mFile;
-    mFile = 0;
-  }
+  mHeader.reset();
 }
 
 void Field3DInfo::resetBox()
@@ -521,23 +536,63 @@ void Field3DInfo::resetTransform()
   mFluidMatrixInverse.setToIdentity();
 }
 
+Field3DInfo::Stats Field3DInfo::stats()
+{
+  boost::mutex::scoped_lock lock(gStatsMutex);
+  
+  return gStats;
+}
+
+void Field3DInfo::resetStats()
+{
+  boost::mutex::scoped_lock lock(gStatsMutex);
+  
+  gStats = Stats();
+}
+
+void Field3DInfo::getFieldNames(const std::string &partition, std::vector<std::string> &names)
+{
+  if (mHeader)
+  {
+    mHeader->layerNames(partition, true, true, names);
+  }
+}
+
+bool Field3DInfo::readLayers(const std::string &partition, const std::string &name, std::vector<SeqIndex::LayerHeader> &layers)
+{
+  layers.clear();
+  
+  for (size_t i=0; mHeader && i<mHeader->layers.size(); ++i)
+  {
+    if (mHeader->layers[i].partition == partition && mHeader->layers[i].name == name)
+    {
+      layers.push_back(mHeader->layers[i]);
+    }
+  }
+  
+  return !layers.empty();
+}
+
+void Field3DInfo::extendBox(Field3D::Box3d &box, const SeqIndex::LayerHeader &layer)
+{
+  box.extendBy(Field3D::V3d(layer.boxMin[0], layer.boxMin[1], layer.boxMin[2]));
+  box.extendBy(Field3D::V3d(layer.boxMax[0], layer.boxMax[1], layer.boxMax[2]));
+}
+
 void Field3DInfo::update(const MString &filename, MTime t,
                          const MString &partition, const MString &field,
                          bool forceDimension, const MPoint &dimension,
                          TransformMode transformMode,
                          double eps)
 {
+  ParallelTools::Timer updateTimer;
+  Stats delta;
+  
   bool forceUpdate = mFirstUpdate;
   
   if (filename != mLastFilename ||
       fabs(mLastTime.as(MTime::uiUnit()) - t.as(MTime::uiUnit())) > eps)
   {
-    if (mFile)
-    {
-      delete mFile;
-      mFile = 0;
-    }
-    
     int fullframe = int(floor(t.as(MTime::uiUnit()) + 0.5));
     
     if (filename != mLastFilename)
@@ -603,6 +658,8 @@ void Field3DInfo::update(const MString &filename, MTime t,
       // Do directory mapping ourselves
       MayaTools::dirmap(mFramePattern);
       
+      mIndexFile = SeqIndex::indexPath(mFramePattern);
+      
       // MGlobal::displayInfo(MString("Use frame pattern: ") + mFramePattern.c_str());
     }
     
@@ -610,23 +667,23 @@ void Field3DInfo::update(const MString &filename, MTime t,
     {
       sprintf(mBuffer, mFramePattern.c_str(), fullframe);
       
-      Field3D::Field3DInputFile *f3dIn = new Field3D::Field3DInputFile();
+      // shared by all nodes, only read once per frame file
+      ParallelTools::Timer headerTimer;
       
-      if (f3dIn->open(mBuffer))
-      {
-        //MGlobal::displayWarning(MString("Invalid f3d file \"") + mBuffer + "\"");
-        mFile = f3dIn;
-      }
-      else
+      HeaderCache::HeaderPtr header = HeaderCache::read(mBuffer, mIndexFile);
+      
+      delta.headerTime = headerTimer.elapsed();
+      
+      // sub-frame steps resolve to the same (unchanged) file, nothing to refresh
+      if (header != mHeader || filename != mLastFilename)
       {
-        delete f3dIn;
+        mHeader = header;
+        forceUpdate = true;
       }
     }
-    
-    forceUpdate = true;
   }
   
-  if (mFile)
+  if (mHeader)
   {
     if (forceUpdate || partition != mLastPartition)
     {
@@ -634,7 +691,7 @@ void Field3DInfo::update(const MString &filename, MTime t,
       
       if (partition.length() == 0)
       {
-        mFile->getPartitionNames(mPartitions);
+        mHeader->partitionNames(mPartitions);
       }
       else
       {
@@ -652,7 +709,7 @@ void Field3DInfo::update(const MString &filename, MTime t,
       {
         if (!mPartitions.empty())
         {
-          Field3DTools::getFieldNames(mFile, mPartitions[0], mFields);
+          getFieldNames(mPartitions[0], mFields);
         }
       }
       else
@@ -663,115 +720,67 @@ void Field3DInfo::update(const MString &filename, MTime t,
       forceUpdate = true;
     }
     
-    // Get pointer to target field
+    // Get header of target field
     
     if (forceUpdate)
     {
-      mField = 0;
+      mHasLayer = false;
       
       if (!mPartitions.empty() && !mFields.empty())
       {
-        Field3D::EmptyField<float>::Vec sl = mFile->readProxyLayer<float>(mPartitions[0], mFields[0], false);
+        std::vector<SeqIndex::LayerHeader> layers;
         
-        if (sl.empty())
+        if (readLayers(mPartitions[0], mFields[0], layers))
         {
-          sl = mFile->readProxyLayer<float>(mPartitions[0], mFields[0], true);
-          
-          if (!sl.empty())
-          {
-            mField = sl[0];
-          }
-        }
-        else
-        {
-          mField = sl[0];
+          mLayer = layers[0];
+          mHasLayer = true;
         }
       }
     }
     
-    if (mField)
+    if (mHasLayer)
     {
-      static Field3D::V3f dv(std::numeric_limits<float>::max(),
-                             std::numeric_limits<float>::max(),
-                             std::numeric_limits<float>::max());
-      
       if (forceUpdate)
       {
         // refresh field resolution and offset
         
-        Field3D::V3i res = mField->dataResolution();
-        mResolution = MPoint(res.x, res.y, res.z);
+        mResolution = MPoint(mLayer.resolution[0], mLayer.resolution[1], mLayer.resolution[2]);
         
-        Field3D::V3f o = mField->metadata().vecFloatMetadata("Offset", dv);
-        mHasOffset = (o != dv);
-        mOffset = (mHasOffset ? MPoint(o.x, o.y, o.z) : MPoint(0, 0, 0));
+        mHasOffset = mLayer.hasOffset;
+        mOffset = (mHasOffset ? MPoint(mLayer.offset[0], mLayer.offset[1], mLayer.offset[2]) : MPoint(0, 0, 0));
+        
+        // refresh box from the bounds of the header layers (single pass)
+        ParallelTools::Timer boxTimer;
         
-        // refresh box
         Field3D::Box3d wBox;
-        Field3D::V3d wCorner;
-        Field3D::V3d lCorners[8];
-          
-        lCorners[0] = Field3D::V3d(0, 0, 0);
-        lCorners[1] = Field3D::V3d(0, 0, 1);
-        lCorners[2] = Field3D::V3d(0, 1, 0);
-        lCorners[3] = Field3D::V3d(0, 1, 1);
-        lCorners[4] = Field3D::V3d(1, 0, 0);
-        lCorners[5] = Field3D::V3d(1, 0, 1);
-        lCorners[6] = Field3D::V3d(1, 1, 0);
-        lCorners[7] = Field3D::V3d(1, 1, 1);
         
         resetBox();
         
         if (partition.length() > 0 && field.length() > 0)
         {
-          for (size_t c=0; c<8; ++c)
-          {
-            mField->mapping()->localToWorld(lCorners[c], wCorner);
-            wBox.extendBy(wCorner);
-          }
+          extendBox(wBox, mLayer);
+          ++delta.boxLayers;
         }
         else
         {
-          std::vector<std::string> fieldNames;
-          Field3D::EmptyField<float>::Vec fields;
-          bool readFieldNames = (field.length() == 0);
+          std::string partitionName = partition.asChar();
+          std::string fieldName = field.asChar();
           
-          if (!readFieldNames)
+          for (size_t i=0; i<mHeader->layers.size(); ++i)
           {
-            fieldNames.push_back(field.asChar());
-          }
-          
-          for (size_t i=0; i<mPartitions.size(); ++i)
-          {
-            if (readFieldNames)
-            {
-              fieldNames.clear();
-              Field3DTools::getFieldNames(mFile, mPartitions[i], fieldNames);
-            }
+            const SeqIndex::LayerHeader &layer = mHeader->layers[i];
             
-            for (size_t j=0; j<fieldNames.size(); ++j)
+            if ((partitionName.empty() || layer.partition == partitionName) &&
+                (fieldName.empty() || layer.name == fieldName))
             {
-              fields = mFile->readProxyLayer<float>(mPartitions[i], fieldNames[j], false);
-              if (fields.empty())
-              {
-                fields = mFile->readProxyLayer<float>(mPartitions[i], fieldNames[j], true);
-              }
-              
-              if (!fields.empty())
-              {
-                for (size_t k=0; k<fields.size(); ++k)
-                {
-                  for (size_t c=0; c<8; ++c)
-                  {
-                    fields[k]->mapping()->localToWorld(lCorners[c], wCorner);
-                    wBox.extendBy(wCorner);
-                  }
-                }
-              }
+              extendBox(wBox, layer);
+              ++delta.boxLayers;
             }
           }
         }
         
+        delta.boxTime = boxTimer.elapsed();
+        
         if (!wBox.isEmpty())
         {
           mBoxMin.x = wBox.min.x;
@@ -790,17 +799,14 @@ void Field3DInfo::update(const MString &filename, MTime t,
       {
         // refresh dimensions
         
-        Field3D::V3f d = mField->metadata().vecFloatMetadata("Dimension", dv);
-        mHasDimension = (d != dv);
-        mDimension = (mHasDimension ? MPoint(d.x, d.y, d.z) : MPoint(1, 1, 1));
+        mHasDimension = mLayer.hasDimension;
+        mDimension = (mHasDimension ? MPoint(mLayer.dimension[0], mLayer.dimension[1], mLayer.dimension[2]) : MPoint(1, 1, 1));
         
         // get raw matrix
         
-        Field3D::MatrixFieldMapping::Ptr mapping = field_dynamic_cast<Field3D::MatrixFieldMapping>(mField->mapping());
-        
-        if (mapping)
+        if (mLayer.hasMatrix)
         {
-          mRawMatrix = MMatrix(mapping->localToWorld().x);
+          mRawMatrix = MMatrix(mLayer.localToWorld);
         }
         else
         {
@@ -894,7 +900,7 @@ void Field3DInfo::update(const MString &filename, MTime t,
     }
     else
     {
-      // only reset output that depends on mField
+      // only reset output that depends on the field
       resetBox();
       resetOffset();
       resetDimension();
@@ -913,6 +919,12 @@ void Field3DInfo::update(const MString &filename, MTime t,
   if (mDimension.y <= 0.0) mDimension.y = 1.0;
   if (mDimension.z <= 0.0) mDimension.z = 1.0;
   
+  delta.updates = 1;
+  delta.refreshes = (forceUpdate ? 1 : 0);
+  delta.updateTime = updateTimer.elapsed();
+  
+  addStats(delta);
+  
   mFirstUpdate = false;
   
   mLastFilename = filename;
@@ -11,6 +11,7 @@
 #include <vector>
 #include <string>
 #include "field3D_Tools.h"
+#include "field3D_HeaderCache.h"
 
 class Field3DInfo : public MPxNode
 {
@@ -99,6 +100,32 @@ public:
    static MObject aOutTranslateY;
    static MObject aOutTranslateZ;
 
+public:
+   
+   // update() counters of all the nodes, times in milliseconds
+   struct Stats
+   {
+      size_t updates;
+      size_t refreshes; // updates that recomputed the outputs
+      size_t boxLayers; // layers merged in the world box
+      double updateTime;
+      double headerTime; // getting the frame headers
+      double boxTime;
+      
+      Stats()
+         : updates(0)
+         , refreshes(0)
+         , boxLayers(0)
+         , updateTime(0.0)
+         , headerTime(0.0)
+         , boxTime(0.0)
+      {
+      }
+   };
+   
+   static Stats stats();
+   static void resetStats();
+   
 public:
    
    Field3DInfo();
@@ -133,19 +160,26 @@ private:
                TransformMode transformMode,
                double eps=0.0001);
    
+   // from the header of the current frame
+   void getFieldNames(const std::string &partition, std::vector<std::string> &names);
+   bool readLayers(const std::string &partition, const std::string &name, std::vector<SeqIndex::LayerHeader> &layers);
+   static void extendBox(Field3D::Box3d &box, const SeqIndex::LayerHeader &layer);
+   
    char *mBuffer;
    size_t mBufferLength;
    bool mFirstUpdate;
    MString mLastFilename;
    std::string mFramePattern;
+   std::string mIndexFile;
    MTime mLastTime;
    MString mLastPartition;
    MString mLastField;
    bool mLastForceDimension;
    MPoint mLastDimension;
    TransformMode mLastTransformMode;
-   Field3D::Field3DInputFile *mFile;
-   Field3D::EmptyField<float>::Ptr mField;
+   HeaderCache::HeaderPtr mHeader;
+   bool mHasLayer;
+   SeqIndex::LayerHeader mLayer; // header of the target field
    
    std::vector<std::string> mPartitions;
    std::vector<std::string> mFields;
@@ -0,0 +1,603 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+
+#include "field3D_OneFile.h"
+#include "field3D_WriteBehind.h"
+#include "field3D_FilePool.h"
+#include "file_Tools.h"
+
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <boost/thread/mutex.hpp>
+
+namespace OneFile
+{
+
+static const char *kIndexName = "f3d_maya_time_index";
+static const char *kGlobalMetadataName = "field3d_global_metadata";
+
+struct Writer
+{
+   Field3D::Field3DOutputFile *file;
+   std::string appendPath; // side file, empty when writing the cache file directly
+   int users; // cache format instances writing a chunk (see openWriter / releaseWriter)
+};
+
+static boost::mutex gMutex;
+static std::map<std::string, Writer> gWriters;
+
+std::string chunkPartition(const std::string &partition, long ticks)
+{
+   std::ostringstream oss;
+   
+   oss << partition << "@" << ticks;
+   
+   return oss.str();
+}
+
+bool splitChunkPartition(const std::string &name, std::string &partition, long &ticks)
+{
+   size_t p = name.rfind('@');
+   
+   if (p == std::string::npos || p + 1 >= name.length())
+   {
+      return false;
+   }
+   
+   const char *beg = name.c_str() + p + 1;
+   char *end = 0;
+   
+   long val = strtol(beg, &end, 10);
+   
+   if (end == beg || *end != '\0')
+   {
+      return false;
+   }
+   
+   partition = name.substr(0, p);
+   ticks = val;
+   
+   return true;
+}
+
+// strips Field3D's partition index ("<partition>.<digits>")
+static bool partitionFromGroupName(const std::string &groupName, std::string &partition)
+{
+   size_t p = groupName.rfind('.');
+   
+   if (p == std::string::npos || p == 0 || p + 1 >= groupName.length())
+   {
+      return false;
+   }
+   
+   if (groupName.find_first_not_of("0123456789", p + 1) != std::string::npos)
+   {
+      return false;
+   }
+   
+   partition = groupName.substr(0, p);
+   
+   return true;
+}
+
+// IO lock must be held
+static void rootNames(hid_t file, std::vector<std::string> &names)
+{
+   names.clear();
+   
+   H5G_info_t rootInfo;
+   
+   if (H5Gget_info(file, &rootInfo) < 0)
+   {
+      return;
+   }
+   
+   std::vector<char> name;
+   
+   for (hsize_t i=0; i<rootInfo.nlinks; ++i)
+   {
+      ssize_t len = H5Lget_name_by_idx(file, ".", H5_INDEX_NAME, H5_ITER_INC, i, NULL, 0, H5P_DEFAULT);
+      if (len <= 0)
+      {
+         continue;
+      }
+      
+      name.resize(len + 1);
+      H5Lget_name_by_idx(file, ".", H5_INDEX_NAME, H5_ITER_INC, i, &name[0], len + 1, H5P_DEFAULT);
+      
+      names.push_back(&name[0]);
+   }
+}
+
+// IO lock must be held
+static void scanChunks(hid_t file, std::vector<long> &ticks)
+{
+   std::vector<std::string> names;
+   std::set<long> times;
+   
+   rootNames(file, names);
+   
+   for (size_t i=0; i<names.size(); ++i)
+   {
+      std::string partition, fluid;
+      long t = 0;
+      
+      if (partitionFromGroupName(names[i], partition) &&
+          splitChunkPartition(partition, fluid, t))
+      {
+         times.insert(t);
+      }
+   }
+   
+   ticks.assign(times.begin(), times.end());
+}
+
+// IO lock must be held
+static bool writeIndex(const std::string &path)
+{
+   hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+   
+   if (file < 0)
+   {
+      H5Eclear2(H5E_DEFAULT);
+      ERROR("Could not open " << path << " to write its time index");
+      return false;
+   }
+   
+   std::vector<long> ticks;
+   
+   scanChunks(file, ticks);
+   
+   if (H5Lexists(file, kIndexName, H5P_DEFAULT) > 0)
+   {
+      H5Ldelete(file, kIndexName, H5P_DEFAULT);
+   }
+   
+   bool rv = false;
+   
+   hsize_t dims[1] = {hsize_t(ticks.size())};
+   
+   hid_t space = H5Screate_simple(1, dims, NULL);
+   
+   if (space >= 0)
+   {
+      hid_t dset = H5Dcreate2(file, kIndexName, H5T_STD_I64LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+      
+      if (dset >= 0)
+      {
+         rv = (ticks.empty() || H5Dwrite(dset, H5T_NATIVE_LONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ticks[0]) >= 0);
+         
+         H5Dclose(dset);
+      }
+      
+      H5Sclose(space);
+   }
+   
+   H5Fclose(file);
+   
+   if (!rv)
+   {
+      ERROR("Could not write the time index of " << path);
+   }
+   
+   return rv;
+}
+
+// Copies a root attribute (Field3D's version number) to the file in data
+static herr_t copyRootAttribute(hid_t loc, const char *name, const H5A_info_t *, void *data)
+{
+   hid_t dst = *((hid_t*) data);
+   
+   hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+   if (attr < 0)
+   {
+      return -1;
+   }
+   
+   hid_t type = H5Aget_type(attr);
+   hid_t space = H5Aget_space(attr);
+   hssize_t n = (space >= 0 ? H5Sget_simple_extent_npoints(space) : -1);
+   
+   herr_t rv = -1;
+   
+   if (type >= 0 && n >= 0)
+   {
+      std::vector<char> buffer(H5Tget_size(type) * size_t(n > 0 ? n : 1));
+      
+      hid_t copy = H5Acreate2(dst, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+      
+      if (copy >= 0)
+      {
+         rv = ((H5Aread(attr, type, &buffer[0]) >= 0 && H5Awrite(copy, type, &buffer[0]) >= 0) ? 0 : -1);
+         
+         H5Aclose(copy);
+      }
+   }
+   
+   if (space >= 0)
+   {
+      H5Sclose(space);
+   }
+   if (type >= 0)
+   {
+      H5Tclose(type);
+   }
+   H5Aclose(attr);
+   
+   return rv;
+}
+
+// Copies the root objects of src except the ones in skip. IO lock must be held.
+static bool copyRootObjects(hid_t src, const std::vector<std::string> &names, const std::set<std::string> &skip,
+                            hid_t dst, const std::string &path)
+{
+   bool rv = true;
+   
+   for (size_t i=0; i<names.size(); ++i)
+   {
+      if (skip.find(names[i]) != skip.end())
+      {
+         continue;
+      }
+      
+      if (H5Ocopy(src, names[i].c_str(), dst, names[i].c_str(), H5P_DEFAULT, H5P_DEFAULT) < 0)
+      {
+         H5Eclear2(H5E_DEFAULT);
+         ERROR("Could not append " << names[i] << " to " << path);
+         rv = false;
+      }
+   }
+   
+   return rv;
+}
+
+// Copies the chunks of a side file into the cache file, replacing the
+//   chunks written again. HDF5 doesn't reclaim the space of unlinked
+//   objects : when chunks are replaced the cache is rewritten in a new file
+//   instead of growing. IO lock must be held.
+static bool merge(const std::string &path, const std::string &appendPath)
+{
+   hid_t dst = H5Fopen(path.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+   
+   if (dst < 0)
+   {
+      H5Eclear2(H5E_DEFAULT);
+      ERROR("Could not open " << path << " to append chunks");
+      return false;
+   }
+   
+   hid_t src = H5Fopen(appendPath.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+   
+   if (src < 0)
+   {
+      H5Eclear2(H5E_DEFAULT);
+      H5Fclose(dst);
+      ERROR("Could not open " << appendPath << " to append chunks");
+      return false;
+   }
+   
+   std::vector<std::string> srcNames, dstNames;
+   std::set<std::string> partitions;
+   std::string partition;
+   
+   rootNames(src, srcNames);
+   rootNames(dst, dstNames);
+   
+   for (size_t i=0; i<srcNames.size(); ++i)
+   {
+      if (partitionFromGroupName(srcNames[i], partition))
+      {
+         partitions.insert(partition);
+      }
+   }
+   
+   // all the partition indices of the rewritten chunks, and the time index
+   //   (written again once merged)
+   std::set<std::string> replaced;
+   
+   for (size_t i=0; i<dstNames.size(); ++i)
+   {
+      if (partitionFromGroupName(dstNames[i], partition) &&
+          partitions.find(partition) != partitions.end())
+      {
+         replaced.insert(dstNames[i]);
+      }
+   }
+   
+   std::set<std::string> skipSrc;
+   
+   skipSrc.insert(kIndexName);
+   skipSrc.insert(kGlobalMetadataName);
+   
+   if (replaced.empty())
+   {
+      // new chunks only : appended in place
+      bool rv = copyRootObjects(src, srcNames, skipSrc, dst, path);
+      
+      H5Fclose(src);
+      H5Fclose(dst);
+      
+      return rv;
+   }
+   
+   std::string mergePath = path + ".merge";
+   
+   hid_t out = H5Fcreate(mergePath.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+   
+   if (out < 0)
+   {
+      H5Eclear2(H5E_DEFAULT);
+      H5Fclose(src);
+      H5Fclose(dst);
+      ERROR("Could not create " << mergePath << " to rewrite " << path);
+      return false;
+   }
+   
+   replaced.insert(kIndexName);
+   
+   bool rv = (H5Aiterate2(dst, H5_INDEX_NAME, H5_ITER_INC, NULL, copyRootAttribute, &out) >= 0);
+   
+   if (!rv)
+   {
+      H5Eclear2(H5E_DEFAULT);
+      ERROR("Could not copy the attributes of " << path);
+   }
+   
+   rv = copyRootObjects(dst, dstNames, replaced, out, path) && rv;
+   rv = copyRootObjects(src, srcNames, skipSrc, out, path) && rv;
+   
+   H5Fclose(out);
+   H5Fclose(src);
+   H5Fclose(dst);
+   
+   if (!rv || !FileTools::replaceFile(mergePath, path))
+   {
+      ERROR("Could not rewrite " << path << " with the appended chunks");
+      remove(mergePath.c_str());
+      return false;
+   }
+   
+   return true;
+}
+
+static bool isCacheFile(const std::string &path)
+{
+   struct stat st;
+   
+   if (stat(path.c_str(), &st) != 0)
+   {
+      return false;
+   }
+   
+   Field3DTools::ScopedSilentErrors silent;
+   
+   return (H5Fis_hdf5(path.c_str()) > 0);
+}
+
+Field3D::Field3DOutputFile* openWriter(const std::string &path, bool append, std::string *filename)
+{
+   if (!append && !finalize(path))
+   {
+      // the previous cache gets overwritten, not while it is written
+      ERROR("Could not truncate " << path);
+      return 0;
+   }
+   
+   // pooled readers of the cache would keep the file from being rewritten
+   FilePool::close(path);
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   std::map<std::string, Writer>::iterator it = gWriters.find(path);
+   
+   if (it != gWriters.end())
+   {
+      if (filename)
+      {
+         *filename = (it->second.appendPath.empty() ? path : it->second.appendPath);
+      }
+      it->second.users += 1;
+      return it->second.file;
+   }
+   
+   Field3DTools::IOLock ioLock;
+   
+   Writer writer;
+   
+   writer.appendPath = ((append && isCacheFile(path)) ? path + ".append" : "");
+   writer.file = new Field3D::Field3DOutputFile();
+   writer.users = 1;
+   
+   std::string outname = (writer.appendPath.empty() ? path : writer.appendPath);
+   
+   if (!writer.file->create(outname, Field3D::Field3DOutputFile::OverwriteMode))
+   {
+      ERROR("Creation of " << outname << " failed : Unknown reason");
+      delete writer.file;
+      return 0;
+   }
+   
+   gWriters[path] = writer;
+   
+   if (filename)
+   {
+      *filename = outname;
+   }
+   
+   return writer.file;
+}
+
+bool finalize(const std::string &path)
+{
+   Writer writer;
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      std::map<std::string, Writer>::iterator it = gWriters.find(path);
+      
+      if (it == gWriters.end())
+      {
+         return true;
+      }
+      
+      if (it->second.users > 0)
+      {
+         // another instance is in the middle of a chunk
+         ERROR("Could not close " << path << " : it is still being written");
+         return false;
+      }
+      
+      writer = it->second;
+      
+      gWriters.erase(it);
+   }
+   
+   // queued layers still reference the file
+   bool rv = WriteBehind::flush(writer.file);
+   
+   FilePool::close(path);
+   
+   Field3DTools::IOLock ioLock;
+   
+   Field3DTools::ScopedSilentErrors silent;
+   
+   delete writer.file;
+   
+   if (!writer.appendPath.empty())
+   {
+      rv = merge(path, writer.appendPath) && rv;
+      
+      remove(writer.appendPath.c_str());
+   }
+   
+   rv = writeIndex(path) && rv;
+   
+   return rv;
+}
+
+void releaseWriter(const std::string &path)
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   std::map<std::string, Writer>::iterator it = gWriters.find(path);
+   
+   if (it != gWriters.end() && it->second.users > 0)
+   {
+      it->second.users -= 1;
+   }
+}
+
+void finalizeAll()
+{
+   std::vector<std::string> paths;
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      std::map<std::string, Writer>::iterator it = gWriters.begin();
+      
+      while (it != gWriters.end())
+      {
+         paths.push_back(it->first);
+         ++it;
+      }
+   }
+   
+   for (size_t i=0; i<paths.size(); ++i)
+   {
+      finalize(paths[i]);
+   }
+}
+
+bool readTimeIndex(const std::string &path, std::vector<long> &ticks)
+{
+   ticks.clear();
+   
+   Field3DTools::IOLock lock;
+   
+   Field3DTools::ScopedSilentErrors silent;
+   
+   hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+   
+   if (file < 0)
+   {
+      H5Eclear2(H5E_DEFAULT);
+      return false;
+   }
+   
+   bool indexed = false;
+   
+   if (H5Lexists(file, kIndexName, H5P_DEFAULT) > 0)
+   {
+      hid_t dset = H5Dopen2(file, kIndexName, H5P_DEFAULT);
+      
+      if (dset >= 0)
+      {
+         hid_t space = H5Dget_space(dset);
+         hssize_t n = (space >= 0 ? H5Sget_simple_extent_npoints(space) : -1);
+         
+         if (n >= 0)
+         {
+            ticks.resize(size_t(n));
+            
+            indexed = (n == 0 || H5Dread(dset, H5T_NATIVE_LONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ticks[0]) >= 0);
+         }
+         
+         if (space >= 0)
+         {
+            H5Sclose(space);
+         }
+         H5Dclose(dset);
+      }
+   }
+   
+   if (!indexed)
+   {
+      WARNING("No time index in " << path << ", scanning partitions");
+      scanChunks(file, ticks);
+   }
+   
+   H5Fclose(file);
+   
+   return true;
+}
+
+}
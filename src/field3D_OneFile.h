@@ -0,0 +1,82 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+
+#ifndef FIELD3D_MAYA_ONEFILE
+#define FIELD3D_MAYA_ONEFILE
+
+#include <string>
+#include <vector>
+
+#include "field3D_Tools.h"
+
+// Single file caches : every frame of the sequence goes into one f3d file,
+// each fluid being written in a "<partition>@<ticks>" partition (ticks are
+// 1/6000th of a second). The sorted times are stored in the
+// "f3d_maya_time_index" root dataset, which Field3D ignores, so readers can
+// seek without opening every partition.
+//
+// Field3D can't append to an existing file, so the output file is shared by
+// all the cache format instances and stays open between chunks until it is
+// finalized : when the file is read back, rewritten or the plugin unloaded.
+// Appending to a finalized file writes the new chunks in a side file that is
+// merged when finalized.
+namespace OneFile
+{
+
+std::string chunkPartition(const std::string &partition, long ticks);
+
+// false if name is not a chunk partition name
+bool splitChunkPartition(const std::string &name, std::string &partition, long &ticks);
+
+// Returns the shared output file for path, creating it if needed, to be
+//   released once the chunk is written. If append is false the file is
+//   truncated, which fails while another instance holds the writer.
+//   filename, if given, is set to the file actually written (chunks appended
+//   to a cache go to a side file).
+Field3D::Field3DOutputFile* openWriter(const std::string &path, bool append, std::string *filename=0);
+void releaseWriter(const std::string &path);
+
+// Closes the shared output file for path if any, merges the appended chunks
+//   and writes the time index. Fails while an instance holds the writer.
+//   Must not be called with the IO lock held.
+bool finalize(const std::string &path);
+void finalizeAll();
+
+// Sorted chunk times of a single file cache. Falls back to the partition
+//   names when the index is missing (file never finalized).
+bool readTimeIndex(const std::string &path, std::vector<long> &ticks);
+
+}
+
+#endif
@@ -0,0 +1,348 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include "field3D_Prefetch.h"
+#include "field3D_FrameCache.h"
+
+#include <cstdlib>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+size_t Field3dPrefetcher::defaultWindow()
+{
+   const char *env = getenv("FIELD3D_MAYA_PREFETCH");
+   
+   if (env)
+   {
+      int v = atoi(env);
+      
+      if (v >= 0)
+      {
+         return (size_t) v;
+      }
+      
+      WARNING("Invalid FIELD3D_MAYA_PREFETCH value \"" << env << "\", prefetch disabled");
+   }
+   
+   return 0;
+}
+
+void Field3dPrefetcher::release(Frame *frame)
+{
+   if (!frame)
+   {
+      return;
+   }
+   
+   Field3DTools::IOLock lock;
+   
+   frame->fields.clear();
+   frame->file.reset();
+   
+   delete frame;
+}
+
+Field3dPrefetcher::Field3dPrefetcher()
+   : m_thread(0)
+   , m_stop(false)
+{
+}
+
+Field3dPrefetcher::~Field3dPrefetcher()
+{
+   if (m_thread)
+   {
+      {
+         boost::mutex::scoped_lock lock(m_mutex);
+         m_stop = true;
+      }
+      
+      m_cond.notify_all();
+      
+      m_thread->join();
+      delete m_thread;
+      m_thread = 0;
+   }
+   
+   clear();
+}
+
+void Field3dPrefetcher::schedule(const std::vector<std::string> &files, const std::set<LayerId> &layers)
+{
+   std::vector<Frame*> dropped;
+   
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      
+      if (layers != m_layers)
+      {
+         // frames already read miss some layers (or have too many), start over
+         for (std::map<std::string, Frame*>::iterator it = m_ready.begin(); it != m_ready.end(); ++it)
+         {
+            dropped.push_back(it->second);
+         }
+         m_ready.clear();
+         
+         m_layers = layers;
+      }
+      
+      m_wanted.clear();
+      m_wanted.insert(files.begin(), files.end());
+      
+      std::map<std::string, Frame*>::iterator it = m_ready.begin();
+      
+      while (it != m_ready.end())
+      {
+         if (m_wanted.find(it->first) == m_wanted.end())
+         {
+            dropped.push_back(it->second);
+            m_ready.erase(it++);
+         }
+         else
+         {
+            ++it;
+         }
+      }
+      
+      m_pending.clear();
+      
+      for (size_t i=0; i<files.size(); ++i)
+      {
+         if (m_ready.find(files[i]) == m_ready.end() && files[i] != m_current)
+         {
+            m_pending.push_back(files[i]);
+         }
+      }
+      
+      if (!m_pending.empty() && !m_thread)
+      {
+         m_thread = new boost::thread(boost::bind(&Field3dPrefetcher::run, this));
+      }
+   }
+   
+   m_cond.notify_all();
+   
+   // closing files needs the IO lock, don't hold m_mutex
+   for (size_t i=0; i<dropped.size(); ++i)
+   {
+      release(dropped[i]);
+   }
+}
+
+Field3dPrefetcher::Frame* Field3dPrefetcher::take(const std::string &file)
+{
+   boost::mutex::scoped_lock lock(m_mutex);
+   
+   // the worker needs the IO lock to complete the frame
+   bool canWait = !Field3DTools::ioLockHeld();
+   
+   while (canWait && file == m_current)
+   {
+      m_cond.wait(lock);
+   }
+   
+   std::map<std::string, Frame*>::iterator it = m_ready.find(file);
+   
+   if (it == m_ready.end())
+   {
+      // will be read by the caller
+      m_pending.erase(std::remove(m_pending.begin(), m_pending.end(), file), m_pending.end());
+      m_wanted.erase(file);
+      return 0;
+   }
+   
+   Frame *frame = it->second;
+   
+   m_ready.erase(it);
+   m_wanted.erase(file);
+   
+   return frame;
+}
+
+void Field3dPrefetcher::clear()
+{
+   std::vector<Frame*> dropped;
+   
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      
+      for (std::map<std::string, Frame*>::iterator it = m_ready.begin(); it != m_ready.end(); ++it)
+      {
+         dropped.push_back(it->second);
+      }
+      
+      m_ready.clear();
+      m_pending.clear();
+      m_wanted.clear();
+      m_layers.clear();
+   }
+   
+   for (size_t i=0; i<dropped.size(); ++i)
+   {
+      release(dropped[i]);
+   }
+}
+
+bool Field3dPrefetcher::isWanted(const std::string &file)
+{
+   boost::mutex::scoped_lock lock(m_mutex);
+   
+   return (!m_stop && m_wanted.find(file) != m_wanted.end());
+}
+
+void Field3dPrefetcher::run()
+{
+   while (true)
+   {
+      std::string file;
+      std::set<LayerId> layers;
+      
+      {
+         boost::mutex::scoped_lock lock(m_mutex);
+         
+         while (!m_stop && m_pending.empty())
+         {
+            m_cond.wait(lock);
+         }
+         
+         if (m_stop)
+         {
+            break;
+         }
+         
+         file = m_pending.front();
+         m_pending.pop_front();
+         
+         m_current = file;
+         layers = m_layers;
+      }
+      
+      Frame *frame = read(file, layers);
+      
+      {
+         boost::mutex::scoped_lock lock(m_mutex);
+         
+         m_current = "";
+         
+         if (frame && !m_stop && layers == m_layers && m_wanted.find(file) != m_wanted.end())
+         {
+            m_ready[file] = frame;
+            frame = 0;
+         }
+      }
+      
+      m_cond.notify_all();
+      
+      // dropped while being read
+      release(frame);
+   }
+}
+
+Field3dPrefetcher::Frame* Field3dPrefetcher::read(const std::string &file, const std::set<LayerId> &layers)
+{
+   Frame *frame = new Frame();
+   
+   // shared with the cache formats
+   frame->file = FilePool::open(file);
+   
+   if (!frame->file)
+   {
+      delete frame;
+      return 0;
+   }
+   
+   // layer types of each partition, in a single pass over the file header
+   std::map<std::string, std::map<std::string, Field3DTools::SupportedFieldTypeEnum> > types;
+   
+   {
+      Field3DTools::IOLock lock;
+      
+      Field3DTools::ScopedSilentErrors silent;
+      
+      hid_t h5 = H5Fopen(file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      
+      if (h5 < 0)
+      {
+         H5Eclear2(H5E_DEFAULT);
+         release(frame);
+         return 0;
+      }
+      
+      for (std::set<LayerId>::const_iterator it = layers.begin(); it != layers.end(); ++it)
+      {
+         if (types.find(it->first) == types.end())
+         {
+            Field3DTools::probeFieldTypes(h5, it->first, types[it->first]);
+         }
+      }
+      
+      H5Fclose(h5);
+   }
+   
+   // release the IO lock between layers so the main thread isn't held for the whole frame
+   for (std::set<LayerId>::const_iterator it = layers.begin(); it != layers.end(); ++it)
+   {
+      if (!isWanted(file))
+      {
+         release(frame);
+         return 0;
+      }
+      
+      Field3DTools::Fld fld;
+      
+      if (FrameCache::find(file, it->first, it->second, fld))
+      {
+         frame->fields[*it] = fld;
+         continue;
+      }
+      
+      std::map<std::string, Field3DTools::SupportedFieldTypeEnum>::const_iterator type = types[it->first].find(it->second);
+      
+      if (type == types[it->first].end())
+      {
+         // layer not in this frame
+         continue;
+      }
+      
+      Field3DTools::IOLock lock;
+      
+      if (Field3DTools::getFieldValueType(frame->file.get(), it->first, it->second, type->second, fld) &&
+          Field3DTools::loadQuantizedLayer(file, it->first, it->second, fld))
+      {
+         frame->fields[*it] = fld;
+      }
+   }
+   
+   return frame;
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#ifndef FIELD3D_MAYA_PREFETCH
+#define FIELD3D_MAYA_PREFETCH
+
+#include <map>
+#include <set>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "field3D_Tools.h"
+#include "field3D_FilePool.h"
+
+// Reads the next frames of a cache sequence in a background thread while
+// Maya is busy with the current one. Frames are opened and the requested
+// layers decoded, then handed over to the cache format with take().
+class Field3dPrefetcher
+{
+public:
+   
+   // (partition, layer)
+   typedef std::pair<std::string, std::string> LayerId;
+   typedef std::map<LayerId, Field3DTools::Fld> LayerMap;
+   
+   struct Frame
+   {
+      FilePool::FilePtr file;
+      LayerMap fields;
+   };
+   
+   // Number of frames to read ahead, from the FIELD3D_MAYA_PREFETCH
+   //   environment variable (0, prefetch disabled, by default)
+   static size_t defaultWindow();
+   
+   // Releases the frame file and fields
+   static void release(Frame *frame);
+   
+public:
+   
+   Field3dPrefetcher();
+   ~Field3dPrefetcher();
+   
+   // Replaces the frames to read (in order of priority) and the layers to
+   //   decode in each of them. Frames read but not in the list anymore
+   //   are dropped, as are all frames when the layer list changes.
+   void schedule(const std::vector<std::string> &files, const std::set<LayerId> &layers);
+   
+   // Returns the prefetched frame for this file or 0 if it wasn't read yet.
+   //   Waits for the frame if it is being read. Ownership goes to the caller.
+   Frame* take(const std::string &file);
+   
+   // Drops all frames (read or not)
+   void clear();
+   
+private:
+   
+   void run();
+   Frame* read(const std::string &file, const std::set<LayerId> &layers);
+   bool isWanted(const std::string &file);
+   
+private:
+   
+   boost::mutex m_mutex;
+   boost::condition_variable m_cond;
+   boost::thread *m_thread;
+   bool m_stop;
+   
+   std::deque<std::string> m_pending;
+   std::set<std::string> m_wanted;
+   std::string m_current;
+   std::map<std::string, Frame*> m_ready;
+   std::set<LayerId> m_layers;
+};
+
+#endif
@@ -1,4 +1,12 @@
 #include "field3D_Query.h"
+#include "field3D_Tools.h"
+#include "field3D_FrameCache.h"
+#include "field3D_HeaderCache.h"
+#include "field3D_Info.h"
+#include "field3D_SeqIndex.h"
+#include "field3D_FilePool.h"
+#include "file_Tools.h"
+#include "maya_Tools.h"
 #include <maya/MGlobal.h>
 #include <maya/MString.h>
 #include <maya/MArgParser.h>
@@ -10,6 +18,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <cmath>
+#include <algorithm>
 
 // ---
 
@@ -59,30 +69,9 @@ size_t GetFileList(const std::string &filePattern, std::vector<std::string> &fil
   
   files.clear();
   
-  p0 = basename.find('%');
+  FileTools::FramePattern pattern(basename);
   
-  size_t p1 = std::string::npos;
-  
-  if (p0 != std::string::npos)
-  {
-    p1 = basename.find('d', p0);
-    
-    if (p1 != std::string::npos)
-    {
-      for (size_t p=p0+1; p<p1; ++p)
-      {
-        char c = basename[p];
-        
-        if (c < '0' || c > '9')
-        {
-          p1 = std::string::npos;
-          break;
-        }
-      }
-    }
-  }
-  
-  if (p1 == std::string::npos)
+  if (pattern.fields() != 1)
   {
     // no frame pattern
     
@@ -99,13 +88,6 @@ size_t GetFileList(const std::string &filePattern, std::vector<std::string> &fil
   }
   else
   {
-    // Build maya filespec string for using with getFileList
-    MString mayaSpec;
-    
-    mayaSpec += basename.substr(0, p0).c_str();
-    mayaSpec += "*";
-    mayaSpec += basename.substr(p1 + 1).c_str();
-    
     p0 = dirname.find('\\');
     while (p0 != std::string::npos)
     {
@@ -118,60 +100,28 @@ size_t GetFileList(const std::string &filePattern, std::vector<std::string> &fil
       dirname += "/";
     }
     
-    MStringArray allFiles;
-    std::map<int, std::string> frameFiles;
-    
-    MGlobal::executeCommand("getFileList -filespec \"" + mayaSpec + "\" -folder \"" + MString(dirname.c_str()) + "\"", allFiles);
-    
-    int frame = -1;
-    int sframe = 999999;
-    int eframe = -999999;
-    
-    for (unsigned int i=0; i<allFiles.length(); ++i)
-    {
-      if (sscanf(allFiles[i].asChar(), basename.c_str(), &frame) != 1)
-      {
-        MGlobal::displayWarning("queryF3d: File \"" + allFiles[i] + "\" doesn't match frame pattern");
-      }
-      else
-      {
-        if (frame < sframe)
-        {
-          sframe = frame;
-        }
-        else if (frame > eframe)
-        {
-          eframe = frame;
-        }
-        frameFiles[frame] = dirname + allFiles[i].asChar();
-      }
-    }
+    // shared with the cache formats, matched once per directory change
+    MayaTools::FrameFiles frameFiles = MayaTools::listFrameFiles(dirname, pattern.prefix(), basename, false);
     
-    if (frameFiles.size() > 0)
+    if (frameFiles && frameFiles->size() > 0)
     {
-      files.resize(frameFiles.size());
+      files.reserve(frameFiles->size());
       
-      size_t i = 0;
-      
-      for (std::map<int, std::string>::iterator it = frameFiles.begin(); it != frameFiles.end(); ++it, ++i)
+      for (MayaTools::FrameFileMap::const_iterator it = frameFiles->begin(); it != frameFiles->end(); ++it)
       {
-        files[i] = it->second;
+        files.push_back(it->second);
       }
     }
-    else
-    {
-      sframe = -1;
-      eframe = -1;
-    }
     
+    // the times are whole frames
     if (start)
     {
-      *start = sframe;
+      *start = (files.size() > 0 ? int(floor(frameFiles->begin()->first.value() + 0.5)) : -1);
     }
     
     if (end)
     {
-      *end = eframe;
+      *end = (files.size() > 0 ? int(floor(frameFiles->rbegin()->first.value() + 0.5)) : -1);
     }
   }
   
@@ -180,6 +130,79 @@ size_t GetFileList(const std::string &filePattern, std::vector<std::string> &fil
 
 // ---
 
+// Voxel order of the export loop before the strided traversal : y innermost,
+// one array index computed per voxel
+template <typename FieldType>
+void PerVoxelFill(typename FieldType::Ptr field, const float *data, const Field3D::V3i &res, bool sparse)
+{
+  for (int z=0; z<res.z; ++z)
+  {
+    for (int x=0; x<res.x; ++x)
+    {
+      for (int y=0; y<res.y; ++y)
+      {
+        size_t i = size_t(x) + size_t(res.x) * (size_t(y) + size_t(res.y) * size_t(z));
+        
+        if (!sparse || data[i] > Field3DTools::SPARSE_THRESHOLD)
+        {
+          field->fastLValue(x, y, z) = (typename FieldType::value_type) data[i];
+        }
+      }
+    }
+  }
+}
+
+// Times the per voxel and the strided fills of a half field from a n^3 maya
+// array, returns the number of voxels that differ between the two
+template <typename FieldType>
+size_t BenchmarkFill(const std::vector<float> &data, int n, double &perVoxelTime, double &stridedTime)
+{
+  Field3D::V3i res(n, n, n);
+  bool sparse = Field3DTools::FieldTraits<FieldType>::IsSparse;
+  
+  typename FieldType::Ptr f0 = new FieldType;
+  f0->setSize(res);
+  
+  ParallelTools::Timer timer;
+  
+  PerVoxelFill<FieldType>(f0, &data[0], res, sparse);
+  
+  perVoxelTime = timer.elapsed();
+  
+  typename FieldType::Ptr f1 = new FieldType;
+  f1->setSize(res);
+  
+  timer.reset();
+  
+  {
+    Field3DTools::ChannelFillList fills;
+    fills.add(new Field3DTools::ScalarChannelFill<FieldType>(f1, &data[0], res, Field3DTools::SPARSE_THRESHOLD));
+    fills.run(size_t(n) * size_t(n));
+  }
+  
+  stridedTime = timer.elapsed();
+  
+  size_t mismatches = 0;
+  
+  for (int z=0; z<n; ++z)
+  {
+    for (int y=0; y<n; ++y)
+    {
+      for (int x=0; x<n; ++x)
+      {
+        if (f0->fastValue(x, y, z) != f1->fastValue(x, y, z))
+        {
+          ++mismatches;
+        }
+      }
+    }
+  }
+  
+  return mismatches;
+}
+
+// ---
+
 void* QueryF3d::creator()
 {
   return new QueryF3d();
@@ -199,6 +222,17 @@ MSyntax QueryF3d::newSyntax()
   syntax.addFlag("-sc", "-scalar", MSyntax::kNoArg);
   syntax.addFlag("-vc", "-vector", MSyntax::kNoArg);
   syntax.addFlag("-res", "-resolution", MSyntax::kNoArg);
+  syntax.addFlag("-ft", "-fieldType", MSyntax::kNoArg);
+  syntax.addFlag("-qe", "-quantizationError", MSyntax::kNoArg);
+  syntax.addFlag("-bp", "-benchmarkProbe", MSyntax::kNoArg);
+  syntax.addFlag("-bf", "-benchmarkFill", MSyntax::kLong);
+  syntax.addFlag("-cs", "-cacheStats", MSyntax::kNoArg);
+  syntax.addFlag("-cc", "-cacheClear", MSyntax::kNoArg);
+  syntax.addFlag("-hcs", "-headerCacheStats", MSyntax::kNoArg);
+  syntax.addFlag("-fps", "-filePoolStats", MSyntax::kNoArg);
+  syntax.addFlag("-is", "-infoStats", MSyntax::kNoArg);
+  syntax.addFlag("-bi", "-buildIndex", MSyntax::kNoArg);
+  syntax.addFlag("-ni", "-noIndex", MSyntax::kNoArg);
   
   syntax.setMinObjects(0);
   syntax.setMaxObjects(0);
@@ -221,6 +255,209 @@ MStatus QueryF3d::doIt(const MArgList &argList)
   MArgParser args(syntax, argList);
   char msg[4096];
   
+  if (args.isFlagSet("-infoStats"))
+  {
+    // time spent in the Field3DInfo nodes updates
+    Field3DInfo::Stats stats = Field3DInfo::stats();
+    
+    if (args.isFlagSet("-verbose"))
+    {
+      sprintf(msg, "queryF3d: Field3DInfo %lu update(s), %lu refresh(es), %.3f ms (headers %.3f ms, box %.3f ms over %lu layer(s))",
+              stats.updates, stats.refreshes, stats.updateTime, stats.headerTime, stats.boxTime, stats.boxLayers);
+      MGlobal::displayInfo(msg);
+    }
+    
+    if (args.isFlagSet("-cacheClear"))
+    {
+      Field3DInfo::resetStats();
+    }
+    
+    MDoubleArray rv;
+    
+    rv.append(double(stats.updates));
+    rv.append(double(stats.refreshes));
+    rv.append(double(stats.boxLayers));
+    rv.append(stats.updateTime);
+    rv.append(stats.headerTime);
+    rv.append(stats.boxTime);
+    
+    setResult(rv);
+    
+    return MS::kSuccess;
+  }
+  
+  if (args.isFlagSet("-benchmarkFill"))
+  {
+    // Compare the per voxel export traversal with the strided one on a
+    // synthetic n^3 fluid (a smoke ball filling half of the container)
+    int n = 0;
+    
+    stat = args.getFlagArgument("-benchmarkFill", 0, n);
+    if (stat != MS::kSuccess || n <= 0)
+    {
+      MGlobal::displayError("queryF3d: -benchmarkFill expects a positive resolution");
+      return MS::kFailure;
+    }
+    
+    std::vector<float> data(size_t(n) * size_t(n) * size_t(n));
+    
+    float c = 0.5f * float(n);
+    float radius = 0.4f * float(n);
+    
+    size_t i = 0;
+    
+    for (int z=0; z<n; ++z)
+    {
+      for (int y=0; y<n; ++y)
+      {
+        for (int x=0; x<n; ++x, ++i)
+        {
+          float dx = float(x) - c;
+          float dy = float(y) - c;
+          float dz = float(z) - c;
+          float d = sqrtf(dx*dx + dy*dy + dz*dz) / radius;
+          
+          data[i] = (d < 1.0f ? 1.0f - d : 0.0f);
+        }
+      }
+    }
+    
+    // traversal only : single thread first, then all threads for the strided fill
+    size_t numThreads = ParallelTools::numThreads();
+    
+    double t[6];
+    size_t mismatches = 0;
+    
+    ParallelTools::setNumThreads(1);
+    
+    mismatches += BenchmarkFill<Field3D::DenseFieldh>(data, n, t[0], t[1]);
+    mismatches += BenchmarkFill<Field3D::SparseFieldh>(data, n, t[2], t[3]);
+    
+    ParallelTools::setNumThreads(numThreads);
+    
+    double unused;
+    
+    mismatches += BenchmarkFill<Field3D::DenseFieldh>(data, n, unused, t[4]);
+    mismatches += BenchmarkFill<Field3D::SparseFieldh>(data, n, unused, t[5]);
+    
+    sprintf(msg, "queryF3d: %d^3 dense fill, per voxel %.3f ms, strided %.3f ms (x%.2f), %lu thread(s) %.3f ms",
+            n, t[0], t[1], t[0] / std::max(t[1], 0.001), numThreads, t[4]);
+    MGlobal::displayInfo(msg);
+    
+    sprintf(msg, "queryF3d: %d^3 sparse fill, per voxel %.3f ms, block tiles %.3f ms (x%.2f), %lu thread(s) %.3f ms",
+            n, t[2], t[3], t[2] / std::max(t[3], 0.001), numThreads, t[5]);
+    MGlobal::displayInfo(msg);
+    
+    if (mismatches > 0)
+    {
+      sprintf(msg, "queryF3d: %lu voxel(s) differ between the per voxel and strided fills", mismatches);
+      MGlobal::displayWarning(msg);
+    }
+    
+    MDoubleArray rv;
+    
+    for (int i=0; i<6; ++i)
+    {
+      rv.append(t[i]);
+    }
+    
+    setResult(rv);
+    
+    return MS::kSuccess;
+  }
+  
+  if (args.isFlagSet("-headerCacheStats"))
+  {
+    // frame headers cache of the Field3DInfo nodes
+    HeaderCache::Stats stats = HeaderCache::stats();
+    
+    if (args.isFlagSet("-verbose"))
+    {
+      sprintf(msg, "queryF3d: Header cache %lu hit(s), %lu miss(es), %lu eviction(s), %lu / %lu frame(s)",
+              stats.hits, stats.misses, stats.evictions, stats.entries, stats.capacity);
+      MGlobal::displayInfo(msg);
+    }
+    
+    if (args.isFlagSet("-cacheClear"))
+    {
+      HeaderCache::clear();
+    }
+    
+    MDoubleArray rv;
+    
+    rv.append(double(stats.hits));
+    rv.append(double(stats.misses));
+    rv.append(double(stats.evictions));
+    rv.append(double(stats.entries));
+    rv.append(double(stats.capacity));
+    
+    setResult(rv);
+    
+    return MS::kSuccess;
+  }
+  
+  if (args.isFlagSet("-filePoolStats"))
+  {
+    // input files shared by the cache formats, the prefetcher and the commands
+    FilePool::Stats stats = FilePool::stats();
+    
+    if (args.isFlagSet("-verbose"))
+    {
+      sprintf(msg, "queryF3d: File pool %lu open(s), %lu reuse(s), %lu eviction(s), %lu / %lu file(s)",
+              stats.opens, stats.reuses, stats.evictions, stats.entries, stats.capacity);
+      MGlobal::displayInfo(msg);
+    }
+    
+    if (args.isFlagSet("-cacheClear"))
+    {
+      FilePool::clear();
+    }
+    
+    MDoubleArray rv;
+    
+    rv.append(double(stats.opens));
+    rv.append(double(stats.reuses));
+    rv.append(double(stats.evictions));
+    rv.append(double(stats.entries));
+    rv.append(double(stats.capacity));
+    
+    setResult(rv);
+    
+    return MS::kSuccess;
+  }
+  
+  if (args.isFlagSet("-cacheStats") || args.isFlagSet("-cacheClear"))
+  {
+    // decoded layers cache, doesn't need a file
+    FrameCache::Stats stats = FrameCache::stats();
+    
+    if (args.isFlagSet("-verbose"))
+    {
+      sprintf(msg, "queryF3d: Frame cache %lu hit(s), %lu miss(es), %lu eviction(s), %lu layer(s), %.1f / %.1f MB",
+              stats.hits, stats.misses, stats.evictions, stats.entries,
+              double(stats.bytes) / (1024.0 * 1024.0), double(stats.budget) / (1024.0 * 1024.0));
+      MGlobal::displayInfo(msg);
+    }
+    
+    if (args.isFlagSet("-cacheClear"))
+    {
+      FrameCache::clear();
+    }
+    
+    MDoubleArray rv;
+    
+    rv.append(double(stats.hits));
+    rv.append(double(stats.misses));
+    rv.append(double(stats.evictions));
+    rv.append(double(stats.entries));
+    rv.append(double(stats.bytes));
+    rv.append(double(stats.budget));
+    
+    setResult(rv);
+    
+    return MS::kSuccess;
+  }
+  
   if (!args.isFlagSet("-file"))
   {
     MGlobal::displayError("queryF3d: missing -f/-file flag");
@@ -277,18 +514,54 @@ MStatus QueryF3d::doIt(const MArgList &argList)
     
     return MS::kSuccess;
   }
+  else if (args.isFlagSet("-buildIndex"))
+  {
+    // only frames without an up to date record are read
+    size_t count = SeqIndex::build(SeqIndex::indexPath(pat), files);
+    
+    if (verbose)
+    {
+      sprintf(msg, "queryF3d: Indexed %lu of %lu frame(s) in \"%s\"", count, files.size(), SeqIndex::indexPath(pat).c_str());
+      MGlobal::displayInfo(msg);
+    }
+    
+    setResult(int(count));
+    
+    return (count > 0 ? MS::kSuccess : MS::kFailure);
+  }
   else
   {
-    Field3D::Field3DInputFile f3d;
+    // the sidecar index answers without opening the file (not for the benchmark)
+    SeqIndex::FrameHeader header;
+    
+    bool indexed = (!args.isFlagSet("-noIndex") &&
+                    !args.isFlagSet("-benchmarkProbe") &&
+                    SeqIndex::lookup(SeqIndex::indexPath(pat), files[0], header));
     
-    if (f3d.open(files[0]))
+    if (verbose && indexed)
+    {
+      MGlobal::displayInfo("queryF3d: Using index \"" + MString(SeqIndex::indexPath(pat).c_str()) + "\"");
+    }
+    
+    Field3DTools::IOLock lock;
+    
+    FilePool::FilePtr f3d;
+    
+    if (indexed || (f3d = FilePool::open(files[0])))
     {
       if (args.isFlagSet("-partitions"))
       {
         MStringArray rv;
         std::vector<std::string> names;
         
-        f3d.getPartitionNames(names);
+        if (indexed)
+        {
+          header.partitionNames(names);
+        }
+        else
+        {
+          f3d->getPartitionNames(names);
+        }
         
         if (verbose)
         {
@@ -337,7 +610,14 @@ MStatus QueryF3d::doIt(const MArgList &argList)
         
         if (scalar)
         {
-          f3d.getScalarLayerNames(names, partition);
+          if (indexed)
+          {
+            header.layerNames(partition, true, false, names);
+          }
+          else
+          {
+            f3d->getScalarLayerNames(names, partition);
+          }
           for (size_t i=0; i<names.size(); ++i)
           {
             rv.append(names[i].c_str());
@@ -348,7 +628,14 @@ MStatus QueryF3d::doIt(const MArgList &argList)
         {
           names.clear();
           
-          f3d.getVectorLayerNames(names, partition);
+          if (indexed)
+          {
+            header.layerNames(partition, false, true, names);
+          }
+          else
+          {
+            f3d->getVectorLayerNames(names, partition);
+          }
           for (size_t i=0; i<names.size(); ++i)
           {
             rv.append(names[i].c_str());
@@ -399,21 +686,35 @@ MStatus QueryF3d::doIt(const MArgList &argList)
         
         MIntArray rv;
         
-        // When reading proxy layers, the type doesn't actually matters
+        const SeqIndex::LayerHeader *layerHeader = (indexed ? header.find(partition, layer) : 0);
         
-        Field3D::EmptyField<Field3D::half>::Vec fields = f3d.readProxyLayer<Field3D::half>(partition, layer, false);
+        if (layerHeader)
+        {
+          rv.append(layerHeader->resolution[0]);
+          rv.append(layerHeader->resolution[1]);
+          rv.append(layerHeader->resolution[2]);
+          
+          setResult(rv);
+          
+          return MS::kSuccess;
+        }
         
-        if (fields.size() == 0)
+        if (indexed && !(f3d = FilePool::open(files[0])))
         {
-          fields = f3d.readProxyLayer<Field3D::half>(partition, layer, true);
-          if (verbose && fields.size() > 0)
-          {
-            MGlobal::displayInfo("(vector field)");
-          }
+          MGlobal::displayError("queryF3d: Could not open file \"" + MString(files[0].c_str()) + "\"");
+          return MS::kFailure;
         }
-        else if (verbose)
+        
+        // When reading proxy layers, the type doesn't actually matters
+        
+        Field3DTools::SupportedFieldTypeEnum type = Field3DTools::TypeUnsupported;
+        
+        Field3D::EmptyField<Field3D::half>::Vec fields = Field3DTools::readProbedProxyLayer<Field3D::half>(f3d.get(), files[0], partition, layer, &type);
+        
+        if (verbose && fields.size() > 0)
         {
-          MGlobal::displayInfo("(scalar field)");
+          sprintf(msg, "(%s)", Field3DTools::fieldTypeName(type));
+          MGlobal::displayInfo(msg);
         }
         
         if (fields.size() > 0)
@@ -433,6 +734,199 @@ MStatus QueryF3d::doIt(const MArgList &argList)
         
         return MS::kFailure;
       }
+      else if (args.isFlagSet("-fieldType"))
+      {
+        if (!args.isFlagSet("-partition"))
+        {
+          MGlobal::displayError("queryF3d: Please specify the partition with -p/-partition flag");
+          return MS::kFailure;
+        }
+        
+        if (!args.isFlagSet("-layer"))
+        {
+          MGlobal::displayError("queryF3d: Please specify the layer with -l/-layer flag");
+          return MS::kFailure;
+        }
+        
+        stat = args.getFlagArgument("-partition", 0, sarg);
+        if (stat != MS::kSuccess)
+        {
+          stat.perror("queryF3d");
+          return stat;
+        }
+        
+        std::string partition = sarg.asChar();
+        
+        stat = args.getFlagArgument("-layer", 0, sarg);
+        if (stat != MS::kSuccess)
+        {
+          stat.perror("queryF3d");
+          return stat;
+        }
+        
+        std::string layer = sarg.asChar();
+        
+        const SeqIndex::LayerHeader *layerHeader = (indexed ? header.find(partition, layer) : 0);
+        
+        // only reads the layer attributes
+        Field3DTools::SupportedFieldTypeEnum type = (layerHeader ? layerHeader->type : Field3DTools::probeFieldType(files[0], partition, layer));
+        
+        if (type == Field3DTools::TypeUnsupported)
+        {
+          MGlobal::displayWarning("queryF3d: Unsupported field type");
+          return MS::kFailure;
+        }
+        
+        setResult(Field3DTools::fieldTypeName(type));
+        
+        return MS::kSuccess;
+      }
+      else if (args.isFlagSet("-quantizationError"))
+      {
+        // [bits, error bound, max error] of a quantized layer, bits is 0 otherwise
+        
+        if (!args.isFlagSet("-partition"))
+        {
+          MGlobal::displayError("queryF3d: Please specify the partition with -p/-partition flag");
+          return MS::kFailure;
+        }
+        
+        if (!args.isFlagSet("-layer"))
+        {
+          MGlobal::displayError("queryF3d: Please specify the layer with -l/-layer flag");
+          return MS::kFailure;
+        }
+        
+        stat = args.getFlagArgument("-partition", 0, sarg);
+        if (stat != MS::kSuccess)
+        {
+          stat.perror("queryF3d");
+          return stat;
+        }
+        
+        std::string partition = sarg.asChar();
+        
+        stat = args.getFlagArgument("-layer", 0, sarg);
+        if (stat != MS::kSuccess)
+        {
+          stat.perror("queryF3d");
+          return stat;
+        }
+        
+        std::string layer = sarg.asChar();
+        
+        // the index doesn't record the layer metadata
+        if (indexed && !(f3d = FilePool::open(files[0])))
+        {
+          MGlobal::displayError("queryF3d: Could not open file \"" + MString(files[0].c_str()) + "\"");
+          return MS::kFailure;
+        }
+        
+        Field3D::EmptyField<Field3D::half>::Vec fields = Field3DTools::readProbedProxyLayer<Field3D::half>(f3d.get(), files[0], partition, layer);
+        
+        if (fields.size() == 0)
+        {
+          MGlobal::displayWarning("queryF3d: Unsupported field type");
+          return MS::kFailure;
+        }
+        
+        int bits = fields[0]->metadata().intMetadata(Field3DTools::QUANTIZED_BITS_METADATA, 0);
+        
+        MDoubleArray rv;
+        
+        rv.append(bits);
+        rv.append(bits > 0 ? fields[0]->metadata().floatMetadata(Field3DTools::QUANTIZED_ERROR_BOUND_METADATA, 0.0f) : 0.0);
+        rv.append(bits > 0 ? fields[0]->metadata().floatMetadata(Field3DTools::QUANTIZED_MAX_ERROR_METADATA, 0.0f) : 0.0);
+        
+        if (verbose)
+        {
+          sprintf(msg, "queryF3d: %s.%s : %d bits, error bound %g, max error %g", partition.c_str(), layer.c_str(), bits, rv[1], rv[2]);
+          MGlobal::displayInfo(msg);
+        }
+        
+        setResult(rv);
+        
+        return MS::kSuccess;
+      }
+      else if (args.isFlagSet("-benchmarkProbe"))
+      {
+        // Compare the type probe with a full read of each layer
+        
+        if (!args.isFlagSet("-partition"))
+        {
+          MGlobal::displayError("queryF3d: Please specify the partition with -p/-partition flag");
+          return MS::kFailure;
+        }
+        
+        stat = args.getFlagArgument("-partition", 0, sarg);
+        if (stat != MS::kSuccess)
+        {
+          stat.perror("queryF3d");
+          return stat;
+        }
+        
+        std::string partition = sarg.asChar();
+        std::vector<std::string> names;
+        
+        Field3DTools::getFieldNames(f3d.get(), partition, names);
+        
+        double readTime = 0.0;
+        size_t mismatches = 0;
+        
+        // all the layers are probed in a single pass
+        ParallelTools::Timer probeTimer;
+        
+        std::map<std::string, Field3DTools::SupportedFieldTypeEnum> types;
+        Field3DTools::probeFieldTypes(files[0], partition, types);
+        
+        double probeTime = probeTimer.elapsed();
+        
+        for (size_t i=0; i<names.size(); ++i)
+        {
+          std::map<std::string, Field3DTools::SupportedFieldTypeEnum>::const_iterator it = types.find(names[i]);
+          
+          Field3DTools::SupportedFieldTypeEnum type = (it != types.end() ? it->second : Field3DTools::TypeUnsupported);
+          
+          ParallelTools::Timer timer;
+          
+          Field3DTools::Fld fld;
+          Field3DTools::getFieldValueType(f3d.get(), partition, names[i], fld);
+          
+          double t1 = timer.elapsed();
+          
+          if (fld.fieldType != type)
+          {
+            ++mismatches;
+          }
+          
+          if (verbose)
+          {
+            sprintf(msg, "queryF3d: %s.%s %s (read %.3f ms)", partition.c_str(), names[i].c_str(),
+                    Field3DTools::fieldTypeName(type), t1);
+            MGlobal::displayInfo(msg);
+          }
+          
+          readTime += t1;
+        }
+        
+        sprintf(msg, "queryF3d: %lu layer(s), probe %.3f ms, read %.3f ms", names.size(), probeTime, readTime);
+        MGlobal::displayInfo(msg);
+        
+        if (mismatches > 0)
+        {
+          sprintf(msg, "queryF3d: %lu layer type(s) differ between probe and read", mismatches);
+          MGlobal::displayWarning(msg);
+        }
+        
+        MDoubleArray rv;
+        
+        rv.append(probeTime);
+        rv.append(readTime);
+        
+        setResult(rv);
+        
+        return MS::kSuccess;
+      }
       else
       {
         MGlobal::displayInfo("queryF3d: Nothing to query");
@@ -0,0 +1,894 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include "field3D_SeqIndex.h"
+#include "field3D_FilePool.h"
+
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <algorithm>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <Field3D/Field3DFile.h>
+#include <Field3D/EmptyField.h>
+#include <Field3D/FieldMapping.h>
+
+namespace SeqIndex
+{
+
+// File layout (native byte order) :
+//   "F3DX" <version>
+//   { <record size> <frame record> }*
+// a truncated last record (interrupted write) is ignored
+static const char kMagic[4] = {'F', '3', 'D', 'X'};
+static const unsigned int kVersion = 1;
+
+struct Index
+{
+   FileTools::FileStamp stamp; // of the index file when loaded
+   time_t loadTime;
+   size_t records;
+   std::map<std::string, FrameHeader> frames;
+};
+
+typedef boost::shared_ptr<const Index> IndexPtr;
+
+static boost::mutex gMutex;
+static std::map<std::string, IndexPtr> gIndices;
+
+// ---
+
+class Encoder
+{
+public:
+   
+   Encoder(std::string &buffer)
+      : m_buffer(buffer)
+   {
+   }
+   
+   void put(const void *data, size_t size)
+   {
+      m_buffer.append((const char*) data, size);
+   }
+   
+   void putBool(bool val)
+   {
+      unsigned char c = (val ? 1 : 0);
+      put(&c, 1);
+   }
+   
+   void putInt(int val) { put(&val, sizeof(int)); }
+   void putLong(long long val) { put(&val, sizeof(long long)); }
+   void putFloat(float val) { put(&val, sizeof(float)); }
+   void putDouble(double val) { put(&val, sizeof(double)); }
+   
+   void putString(const std::string &str)
+   {
+      putInt(int(str.length()));
+      put(str.c_str(), str.length());
+   }
+   
+private:
+   
+   std::string &m_buffer;
+};
+
+class Decoder
+{
+public:
+   
+   Decoder(const char *data, size_t size)
+      : m_cur(data)
+      , m_end(data + size)
+      , m_ok(true)
+   {
+   }
+   
+   bool ok() const { return m_ok; }
+   
+   size_t remaining() const { return size_t(m_end - m_cur); }
+   
+   void get(void *data, size_t size)
+   {
+      if (!m_ok || size_t(m_end - m_cur) < size)
+      {
+         m_ok = false;
+         memset(data, 0, size);
+         return;
+      }
+      
+      memcpy(data, m_cur, size);
+      m_cur += size;
+   }
+   
+   bool getBool()
+   {
+      unsigned char c = 0;
+      get(&c, 1);
+      return (c != 0);
+   }
+   
+   int getInt() { int val; get(&val, sizeof(int)); return val; }
+   long long getLong() { long long val; get(&val, sizeof(long long)); return val; }
+   float getFloat() { float val; get(&val, sizeof(float)); return val; }
+   double getDouble() { double val; get(&val, sizeof(double)); return val; }
+   
+   std::string getString()
+   {
+      int len = getInt();
+      
+      if (!m_ok || len < 0 || m_end - m_cur < len)
+      {
+         m_ok = false;
+         return std::string();
+      }
+      
+      std::string str(m_cur, size_t(len));
+      m_cur += len;
+      
+      return str;
+   }
+   
+private:
+   
+   const char *m_cur;
+   const char *m_end;
+   bool m_ok;
+};
+
+// smallest encoded layer : empty names and no matrix
+static const size_t kMinLayerSize = 2 * sizeof(int) + 1 + 4 * sizeof(int) + 1 + 6 * sizeof(double) + 2 + 6 * sizeof(float);
+
+static void encodeFrame(const FrameHeader &header, std::string &buffer)
+{
+   Encoder enc(buffer);
+   
+   enc.putString(header.file);
+   enc.putLong(header.stamp.size);
+   enc.putLong(header.stamp.mtime);
+   enc.putInt(int(header.layers.size()));
+   
+   for (size_t i=0; i<header.layers.size(); ++i)
+   {
+      const LayerHeader &layer = header.layers[i];
+      
+      enc.putString(layer.partition);
+      enc.putString(layer.name);
+      enc.putBool(layer.vector);
+      enc.putInt(int(layer.type));
+      
+      for (int j=0; j<3; ++j)
+      {
+         enc.putInt(layer.resolution[j]);
+      }
+      
+      enc.putBool(layer.hasMatrix);
+      
+      if (layer.hasMatrix)
+      {
+         for (int r=0; r<4; ++r)
+         {
+            for (int c=0; c<4; ++c)
+            {
+               enc.putDouble(layer.localToWorld[r][c]);
+            }
+         }
+      }
+      
+      for (int j=0; j<3; ++j)
+      {
+         enc.putDouble(layer.boxMin[j]);
+         enc.putDouble(layer.boxMax[j]);
+      }
+      
+      enc.putBool(layer.hasOffset);
+      enc.putBool(layer.hasDimension);
+      
+      for (int j=0; j<3; ++j)
+      {
+         enc.putFloat(layer.offset[j]);
+         enc.putFloat(layer.dimension[j]);
+      }
+   }
+}
+
+static bool decodeFrame(Decoder &dec, FrameHeader &header)
+{
+   header.file = dec.getString();
+   header.stamp.size = dec.getLong();
+   header.stamp.mtime = dec.getLong();
+   
+   int count = dec.getInt();
+   
+   // a corrupt count must not size the vector
+   if (!dec.ok() || count < 0 || size_t(count) > dec.remaining() / kMinLayerSize)
+   {
+      return false;
+   }
+   
+   header.layers.resize(size_t(count));
+   
+   for (size_t i=0; i<header.layers.size() && dec.ok(); ++i)
+   {
+      LayerHeader &layer = header.layers[i];
+      
+      layer.partition = dec.getString();
+      layer.name = dec.getString();
+      layer.vector = dec.getBool();
+      
+      int type = dec.getInt();
+      
+      layer.type = (type >= 0 && type < int(Field3DTools::TypeUnsupported) ? Field3DTools::SupportedFieldTypeEnum(type) : Field3DTools::TypeUnsupported);
+      
+      for (int j=0; j<3; ++j)
+      {
+         layer.resolution[j] = dec.getInt();
+      }
+      
+      layer.hasMatrix = dec.getBool();
+      
+      if (layer.hasMatrix)
+      {
+         for (int r=0; r<4; ++r)
+         {
+            for (int c=0; c<4; ++c)
+            {
+               layer.localToWorld[r][c] = dec.getDouble();
+            }
+         }
+      }
+      
+      for (int j=0; j<3; ++j)
+      {
+         layer.boxMin[j] = dec.getDouble();
+         layer.boxMax[j] = dec.getDouble();
+      }
+      
+      layer.hasOffset = dec.getBool();
+      layer.hasDimension = dec.getBool();
+      
+      for (int j=0; j<3; ++j)
+      {
+         layer.offset[j] = dec.getFloat();
+         layer.dimension[j] = dec.getFloat();
+      }
+   }
+   
+   return dec.ok();
+}
+
+// ---
+
+static std::string fileName(const std::string &path)
+{
+   size_t p = path.find_last_of("\\/");
+   
+   return (p == std::string::npos ? path : path.substr(p + 1));
+}
+
+static bool readFile(const std::string &path, std::vector<char> &data)
+{
+   FILE *f = fopen(path.c_str(), "rb");
+   
+   if (!f)
+   {
+      return false;
+   }
+   
+   char buffer[65536];
+   size_t n = 0;
+   
+   try
+   {
+      while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+      {
+         data.insert(data.end(), buffer, buffer + n);
+      }
+   }
+   catch (...)
+   {
+      fclose(f);
+      throw;
+   }
+   
+   fclose(f);
+   
+   return true;
+}
+
+static bool decodeIndex(const std::vector<char> &data, Index &index)
+{
+   size_t headerSize = sizeof(kMagic) + sizeof(unsigned int);
+   
+   if (data.size() < headerSize || memcmp(&data[0], kMagic, sizeof(kMagic)) != 0)
+   {
+      return false;
+   }
+   
+   unsigned int version = 0;
+   
+   memcpy(&version, &data[sizeof(kMagic)], sizeof(unsigned int));
+   
+   if (version != kVersion)
+   {
+      return false;
+   }
+   
+   index.records = 0;
+   index.frames.clear();
+   
+   size_t pos = headerSize;
+   
+   while (pos + sizeof(unsigned int) <= data.size())
+   {
+      unsigned int size = 0;
+      
+      memcpy(&size, &data[pos], sizeof(unsigned int));
+      
+      pos += sizeof(unsigned int);
+      
+      if (size > data.size() - pos)
+      {
+         // truncated
+         break;
+      }
+      
+      Decoder dec(&data[pos], size);
+      FrameHeader header;
+      
+      if (decodeFrame(dec, header))
+      {
+         // later records replace earlier ones
+         index.frames[header.file] = header;
+         ++index.records;
+      }
+      
+      pos += size;
+   }
+   
+   return true;
+}
+
+static bool loadIndex(const std::string &path, Index &index)
+{
+   // a corrupt or torn index reads as a missing one
+   try
+   {
+      std::vector<char> data;
+      
+      return (readFile(path, data) && decodeIndex(data, index));
+   }
+   catch (const std::exception &)
+   {
+      return false;
+   }
+}
+
+static void appendRecord(const FrameHeader &header, std::string &data)
+{
+   std::string record;
+   
+   encodeFrame(header, record);
+   
+   unsigned int size = (unsigned int) record.length();
+   
+   data.append((const char*) &size, sizeof(unsigned int));
+   data.append(record);
+}
+
+// advisory lock of the processes writing an index
+static std::string lockPath(const std::string &indexFile)
+{
+   return indexFile + ".lock";
+}
+
+static bool writeData(const std::string &path, const std::string &data, const char *mode)
+{
+   FILE *f = fopen(path.c_str(), mode);
+   
+   if (!f)
+   {
+      return false;
+   }
+   
+   bool ok = (fwrite(data.c_str(), 1, data.length(), f) == data.length());
+   
+   ok = (fclose(f) == 0 && ok);
+   
+   return ok;
+}
+
+// gMutex and the index file lock must be held
+static bool writeIndex(const std::string &path, const std::map<std::string, FrameHeader> &frames)
+{
+   std::string data(kMagic, sizeof(kMagic));
+   
+   data.append((const char*) &kVersion, sizeof(unsigned int));
+   
+   for (std::map<std::string, FrameHeader>::const_iterator it = frames.begin(); it != frames.end(); ++it)
+   {
+      appendRecord(it->second, data);
+   }
+   
+   // readers never see a partially written index
+   std::string tmpPath = path + ".tmp";
+   
+   if (!writeData(tmpPath, data, "wb"))
+   {
+      remove(tmpPath.c_str());
+      return false;
+   }
+   
+   if (!FileTools::replaceFile(tmpPath, path))
+   {
+      remove(tmpPath.c_str());
+      return false;
+   }
+   
+   gIndices.erase(path);
+   
+   return true;
+}
+
+static IndexPtr getIndex(const std::string &path)
+{
+   FileTools::FileStamp stamp;
+   
+   if (!FileTools::getFileStamp(path, stamp))
+   {
+      return IndexPtr();
+   }
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      std::map<std::string, IndexPtr>::iterator it = gIndices.find(path);
+      
+      // same one second mtime resolution caveat as the directory listings
+      if (it != gIndices.end() &&
+          it->second->stamp == stamp &&
+          it->second->stamp.mtime < it->second->loadTime)
+      {
+         return it->second;
+      }
+   }
+   
+   Index *index = new Index();
+   IndexPtr ptr(index);
+   
+   index->stamp = stamp;
+   index->loadTime = time(0);
+   
+   if (!loadIndex(path, *index))
+   {
+      return IndexPtr();
+   }
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gIndices[path] = ptr;
+   
+   return ptr;
+}
+
+// ---
+
+LayerHeader::LayerHeader()
+   : vector(false)
+   , type(Field3DTools::TypeUnsupported)
+   , hasMatrix(false)
+   , hasOffset(false)
+   , hasDimension(false)
+{
+   for (int i=0; i<3; ++i)
+   {
+      resolution[i] = 0;
+      boxMin[i] = 0.0;
+      boxMax[i] = 0.0;
+      offset[i] = 0.0f;
+      dimension[i] = 1.0f;
+   }
+   
+   for (int r=0; r<4; ++r)
+   {
+      for (int c=0; c<4; ++c)
+      {
+         localToWorld[r][c] = (r == c ? 1.0 : 0.0);
+      }
+   }
+}
+
+void FrameHeader::partitionNames(std::vector<std::string> &names) const
+{
+   names.clear();
+   
+   for (size_t i=0; i<layers.size(); ++i)
+   {
+      if (std::find(names.begin(), names.end(), layers[i].partition) == names.end())
+      {
+         names.push_back(layers[i].partition);
+      }
+   }
+}
+
+void FrameHeader::layerNames(const std::string &partition, bool scalar, bool vector, std::vector<std::string> &names) const
+{
+   size_t first = names.size();
+   
+   for (size_t i=0; i<layers.size(); ++i)
+   {
+      const LayerHeader &layer = layers[i];
+      
+      if (layer.partition != partition || (layer.vector ? !vector : !scalar))
+      {
+         continue;
+      }
+      
+      if (std::find(names.begin() + first, names.end(), layer.name) == names.end())
+      {
+         names.push_back(layer.name);
+      }
+   }
+}
+
+const LayerHeader* FrameHeader::find(const std::string &partition, const std::string &name) const
+{
+   for (size_t i=0; i<layers.size(); ++i)
+   {
+      if (layers[i].partition == partition && layers[i].name == name)
+      {
+         return &(layers[i]);
+      }
+   }
+   
+   return 0;
+}
+
+std::string indexPath(const std::string &filePattern)
+{
+   size_t p = filePattern.find_last_of("\\/");
+   
+   std::string dirname = (p == std::string::npos ? std::string(".") : filePattern.substr(0, p));
+   std::string basename = (p == std::string::npos ? filePattern : filePattern.substr(p + 1));
+   
+   FileTools::FramePattern pattern(basename);
+   
+   std::string stem = pattern.prefix();
+   
+   if (pattern.fields() == 0 && FileTools::endsWith(stem, ".f3d"))
+   {
+      // single file
+      stem = stem.substr(0, stem.length() - 4);
+   }
+   
+   // cache format frame names : <basename>Frame<frame>[Tick<tick>].f3d
+   if (pattern.fields() > 0 && FileTools::endsWith(stem, "Frame"))
+   {
+      stem = stem.substr(0, stem.length() - 5);
+   }
+   
+   while (stem.length() > 1 && (stem[stem.length()-1] == '.' || stem[stem.length()-1] == '_'))
+   {
+      stem.erase(stem.length()-1);
+   }
+   
+   return indexPath(dirname, stem);
+}
+
+std::string indexPath(const std::string &dirname, const std::string &basename)
+{
+   return (dirname.length() > 0 ? dirname : std::string(".")) + "/" + basename + ".f3dx";
+}
+
+void describeLayer(const Field3D::FieldRes::Ptr &field, LayerHeader &layer)
+{
+   static Field3D::V3f dv(std::numeric_limits<float>::max(),
+                          std::numeric_limits<float>::max(),
+                          std::numeric_limits<float>::max());
+   
+   Field3D::V3i res = field->dataResolution();
+   
+   layer.resolution[0] = res.x;
+   layer.resolution[1] = res.y;
+   layer.resolution[2] = res.z;
+   
+   Field3D::MatrixFieldMapping::Ptr mapping = Field3D::field_dynamic_cast<Field3D::MatrixFieldMapping>(field->mapping());
+   
+   layer.hasMatrix = bool(mapping);
+   
+   if (layer.hasMatrix)
+   {
+      Field3D::M44d m = mapping->localToWorld();
+      
+      for (int r=0; r<4; ++r)
+      {
+         for (int c=0; c<4; ++c)
+         {
+            layer.localToWorld[r][c] = m.x[r][c];
+         }
+      }
+   }
+   
+   Field3D::Box3d wBox;
+   Field3D::V3d wCorner;
+   
+   for (int c=0; c<8; ++c)
+   {
+      Field3D::V3d lCorner((c & 4) ? 1 : 0, (c & 2) ? 1 : 0, (c & 1) ? 1 : 0);
+      
+      field->mapping()->localToWorld(lCorner, wCorner);
+      wBox.extendBy(wCorner);
+   }
+   
+   for (int i=0; i<3; ++i)
+   {
+      layer.boxMin[i] = wBox.min[i];
+      layer.boxMax[i] = wBox.max[i];
+   }
+   
+   Field3D::V3f o = field->metadata().vecFloatMetadata("Offset", dv);
+   
+   layer.hasOffset = (o != dv);
+   
+   Field3D::V3f d = field->metadata().vecFloatMetadata("Dimension", dv);
+   
+   layer.hasDimension = (d != dv);
+   
+   for (int i=0; i<3; ++i)
+   {
+      layer.offset[i] = (layer.hasOffset ? o[i] : 0.0f);
+      layer.dimension[i] = (layer.hasDimension ? d[i] : 1.0f);
+   }
+}
+
+bool scanFile(const std::string &path, FrameHeader &header)
+{
+   header.file = fileName(path);
+   header.layers.clear();
+   
+   if (!FileTools::getFileStamp(path, header.stamp))
+   {
+      return false;
+   }
+   
+   Field3DTools::IOLock lock;
+   
+   FilePool::FilePtr in = FilePool::open(path);
+   
+   if (!in)
+   {
+      return false;
+   }
+   
+   std::vector<std::string> partitions;
+   
+   in->getPartitionNames(partitions);
+   
+   // types from the layers header, in a single pass over each partition
+   std::map<std::string, std::map<std::string, Field3DTools::SupportedFieldTypeEnum> > partitionTypes;
+   
+   {
+      Field3DTools::ScopedSilentErrors silent;
+      
+      hid_t h5 = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      
+      if (h5 < 0)
+      {
+         H5Eclear2(H5E_DEFAULT);
+         return false;
+      }
+      
+      for (size_t i=0; i<partitions.size(); ++i)
+      {
+         Field3DTools::probeFieldTypes(h5, partitions[i], partitionTypes[partitions[i]]);
+      }
+      
+      H5Fclose(h5);
+   }
+   
+   for (size_t i=0; i<partitions.size(); ++i)
+   {
+      const std::map<std::string, Field3DTools::SupportedFieldTypeEnum> &types = partitionTypes[partitions[i]];
+      
+      for (int v=0; v<2; ++v)
+      {
+         std::vector<std::string> names;
+         
+         if (v == 0)
+         {
+            in->getScalarLayerNames(names, partitions[i]);
+         }
+         else
+         {
+            in->getVectorLayerNames(names, partitions[i]);
+         }
+         
+         for (size_t j=0; j<names.size(); ++j)
+         {
+            std::map<std::string, Field3DTools::SupportedFieldTypeEnum>::const_iterator type = types.find(names[j]);
+            
+            // the proxy type doesn't matter
+            Field3D::EmptyField<Field3D::half>::Vec fields = in->readProxyLayer<Field3D::half>(partitions[i], names[j], (v == 1));
+            
+            for (size_t k=0; k<fields.size(); ++k)
+            {
+               LayerHeader layer;
+               
+               layer.partition = partitions[i];
+               layer.name = names[j];
+               layer.vector = (v == 1);
+               layer.type = (type != types.end() ? type->second : Field3DTools::TypeUnsupported);
+               
+               describeLayer(fields[k], layer);
+               
+               header.layers.push_back(layer);
+            }
+         }
+      }
+   }
+   
+   return true;
+}
+
+bool lookup(const std::string &indexFile, const std::string &path, FrameHeader &header)
+{
+   IndexPtr index = getIndex(indexFile);
+   
+   if (!index)
+   {
+      return false;
+   }
+   
+   std::map<std::string, FrameHeader>::const_iterator it = index->frames.find(fileName(path));
+   
+   FileTools::FileStamp stamp;
+   
+   if (it == index->frames.end() ||
+       !FileTools::getFileStamp(path, stamp) ||
+       stamp != it->second.stamp)
+   {
+      return false;
+   }
+   
+   header = it->second;
+   
+   return true;
+}
+
+void addLayer(FrameHeader &header, const std::string &partition, const std::string &name, const Field3D::FieldRes::Ptr &field)
+{
+   LayerHeader layer;
+   
+   layer.partition = partition;
+   layer.name = name;
+   layer.type = Field3DTools::fieldType(field);
+   layer.vector = Field3DTools::isVectorFieldType(layer.type);
+   
+   describeLayer(field, layer);
+   
+   header.layers.push_back(layer);
+}
+
+bool record(const std::string &indexFile, const std::string &path, const FrameHeader &layers)
+{
+   FrameHeader header;
+   
+   header.file = fileName(path);
+   header.layers = layers.layers;
+   
+   if (!FileTools::getFileStamp(path, header.stamp))
+   {
+      return false;
+   }
+   
+   // other processes write the same sequence
+   FileTools::FileLock fileLock(lockPath(indexFile));
+   
+   if (!fileLock.locked())
+   {
+      return false;
+   }
+   
+   IndexPtr index = getIndex(indexFile);
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   if (!index || index->records > 2 * index->frames.size() + 16)
+   {
+      // no valid index or too many replaced records : rewrite it
+      std::map<std::string, FrameHeader> frames;
+      
+      if (index)
+      {
+         frames = index->frames;
+      }
+      
+      frames[header.file] = header;
+      
+      return writeIndex(indexFile, frames);
+   }
+   
+   std::string data;
+   
+   appendRecord(header, data);
+   
+   gIndices.erase(indexFile);
+   
+   return writeData(indexFile, data, "ab");
+}
+
+size_t build(const std::string &indexFile, const std::vector<std::string> &files)
+{
+   std::map<std::string, FrameHeader> frames;
+   
+   for (size_t i=0; i<files.size(); ++i)
+   {
+      FrameHeader header;
+      
+      if (lookup(indexFile, files[i], header) || scanFile(files[i], header))
+      {
+         frames[header.file] = header;
+      }
+   }
+   
+   FileTools::FileLock fileLock(lockPath(indexFile));
+   
+   if (!fileLock.locked())
+   {
+      return 0;
+   }
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   if (!writeIndex(indexFile, frames))
+   {
+      return 0;
+   }
+   
+   return frames.size();
+}
+
+void clearCache()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gIndices.clear();
+}
+
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef FIELD3D_MAYA_SEQINDEX
+#define FIELD3D_MAYA_SEQINDEX
+
+#include <string>
+#include <vector>
+
+#include "field3D_Tools.h"
+#include "file_Tools.h"
+
+// Sequence sidecar index : a compact binary file (<sequence>.f3dx) next to
+// the frames holding, for every frame, the partitions and layers with their
+// type, resolution, mapping and Offset/Dimension metadata, so the header of a
+// frame can be known without opening it with HDF5.
+//
+// The index is append only, each frame record replaces the previous record
+// of the same file. A record is only used while the size and modification
+// time of its frame file are unchanged, otherwise the frame is read as usual.
+// Loaded indices are cached and read again when the index file changes.
+namespace SeqIndex
+{
+
+struct LayerHeader
+{
+   std::string partition;
+   std::string name;
+   bool vector;
+   Field3DTools::SupportedFieldTypeEnum type;
+   int resolution[3];
+   bool hasMatrix;
+   double localToWorld[4][4];
+   // world space bounds of the [0, 1] local space box
+   double boxMin[3];
+   double boxMax[3];
+   bool hasOffset;
+   float offset[3];
+   bool hasDimension;
+   float dimension[3];
+   
+   LayerHeader();
+};
+
+struct FrameHeader
+{
+   // frame file name, without directory
+   std::string file;
+   FileTools::FileStamp stamp;
+   std::vector<LayerHeader> layers;
+   
+   // partition names, in file order
+   void partitionNames(std::vector<std::string> &names) const;
+   
+   // layer names of a partition (appended to names)
+   void layerNames(const std::string &partition, bool scalar, bool vector, std::vector<std::string> &names) const;
+   
+   // first layer matching partition and name, 0 if none
+   const LayerHeader* find(const std::string &partition, const std::string &name) const;
+};
+
+// Index file of a frame sequence, from its printf like file pattern
+//   (dir/name.%04d.f3d or dir/nameFrame%d.f3d -> dir/name.f3dx)
+std::string indexPath(const std::string &filePattern);
+
+// Index file of a cache format sequence (dir/basename.f3dx, like the .xml)
+std::string indexPath(const std::string &dirname, const std::string &basename);
+
+// Fills geometry members of layer (resolution, mapping, box and metadata)
+//   from a field or a proxy
+void describeLayer(const Field3D::FieldRes::Ptr &field, LayerHeader &layer);
+
+// Reads the header of a frame file (proxies only, no voxel data)
+bool scanFile(const std::string &path, FrameHeader &header);
+
+// Looks up the header of frame file path in the index file indexFile.
+//   Fails if there's no index or the record is missing or out of date.
+bool lookup(const std::string &indexFile, const std::string &path, FrameHeader &header);
+
+// Appends the header of a layer about to be written to header
+void addLayer(FrameHeader &header, const std::string &partition, const std::string &name, const Field3D::FieldRes::Ptr &field);
+
+// Adds the header of a frame that was just written to the index, from the
+//   layers collected while writing it (see addLayer), the frame file itself
+//   is only stat'ed
+bool record(const std::string &indexFile, const std::string &path, const FrameHeader &layers);
+
+// (Re)writes the index for files, only reading the frames whose record is
+//   missing or out of date. Returns the number of frames indexed.
+size_t build(const std::string &indexFile, const std::vector<std::string> &files);
+
+// Drops the loaded indices
+void clearCache();
+
+}
+
+#endif
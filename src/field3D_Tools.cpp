@@ -32,12 +32,45 @@
 
 #include "field3D_Tools.h"
 
+#include <hdf5.h>
+#include <cstdlib>
+
 
 using namespace Field3D ;
 using namespace std     ;
 
 namespace Field3DTools {
 
+static boost::recursive_mutex gIOMutex;
+
+// IO lock recursion depth of each thread
+static boost::thread_specific_ptr<size_t> gIODepth;
+
+boost::recursive_mutex& ioMutex()
+{
+  return gIOMutex;
+}
+
+bool ioLockHeld()
+{
+  return (gIODepth.get() != 0 && *gIODepth > 0);
+}
+
+IOLock::IOLock()
+  : m_lock(gIOMutex)
+{
+  if (!gIODepth.get())
+  {
+    gIODepth.reset(new size_t(0));
+  }
+  ++(*gIODepth);
+}
+
+IOLock::~IOLock()
+{
+  --(*gIODepth);
+}
+
 void getFieldNames( Field3DInputFile *file, const std::string &partition, vector< string > &names)
 {
   // get all partition names ( should be only one present,
@@ -329,6 +362,12 @@ bool getFieldValueType( Field3DInputFile *inFile , const std::string &partition,
     return false;
   }
   
+  // quantized layers aren't readable by Field3D
+  if (readQuantizedPlaceholder(inFile, partition, name, fld))
+  {
+    return true;
+  }
+  
   // error
   ERROR( std::string("Type of data in field ") + name + " unknown : not a float field nor a half float field");
   
@@ -343,7 +382,1895 @@ bool getFieldValueType( Field3DInputFile *inFile , const std::string &name , Fld
   return getFieldValueType( inFile, "", name, fld );
 }
 
+// returns the first layer of the list that is a Field_T
+template <class Field_T, class FieldList>
+typename Field_T::Ptr firstLayerAs(const FieldList &layers)
+{
+  for (size_t i=0; i<layers.size(); ++i)
+  {
+    typename Field_T::Ptr field = Field3D::field_dynamic_cast<Field_T>(layers[i]);
+    if (field)
+    {
+      return field;
+    }
+  }
+  
+  return typename Field_T::Ptr();
+}
+
+bool getFieldValueType( Field3DInputFile *inFile , const std::string &partition, const std::string &name, SupportedFieldTypeEnum type, Fld &fld)
+{
+  typedef Field3D::half half;
+  
+  // quantized layers aren't readable by Field3D, they are half sparse fields
+  //   for the probe
+  if ((type == SparseScalarField_Half || type == SparseVectorField_Half) &&
+      readQuantizedPlaceholder(inFile, partition, name, fld))
+  {
+    return true;
+  }
+  
+  switch (type)
+  {
+  case DenseScalarField_Half:
+    fld.dhScalarField = firstLayerAs<Field3D::DenseField<half> >(readScalarLayers<half>(inFile, partition, name));
+    fld.baseField = fld.dhScalarField;
+    break;
+  case DenseScalarField_Float:
+    fld.dfScalarField = firstLayerAs<Field3D::DenseField<float> >(readScalarLayers<float>(inFile, partition, name));
+    fld.baseField = fld.dfScalarField;
+    break;
+  case DenseScalarField_Double:
+    fld.ddScalarField = firstLayerAs<Field3D::DenseField<double> >(readScalarLayers<double>(inFile, partition, name));
+    fld.baseField = fld.ddScalarField;
+    break;
+  case SparseScalarField_Half:
+    fld.shScalarField = firstLayerAs<Field3D::SparseField<half> >(readScalarLayers<half>(inFile, partition, name));
+    fld.baseField = fld.shScalarField;
+    break;
+  case SparseScalarField_Float:
+    fld.sfScalarField = firstLayerAs<Field3D::SparseField<float> >(readScalarLayers<float>(inFile, partition, name));
+    fld.baseField = fld.sfScalarField;
+    break;
+  case SparseScalarField_Double:
+    fld.sdScalarField = firstLayerAs<Field3D::SparseField<double> >(readScalarLayers<double>(inFile, partition, name));
+    fld.baseField = fld.sdScalarField;
+    break;
+  case DenseVectorField_Half:
+    fld.dhVectorField = firstLayerAs<Field3D::DenseField<Field3D::V3h> >(readVectorLayers<half>(inFile, partition, name));
+    fld.baseField = fld.dhVectorField;
+    break;
+  case DenseVectorField_Float:
+    fld.dfVectorField = firstLayerAs<Field3D::DenseField<Field3D::V3f> >(readVectorLayers<float>(inFile, partition, name));
+    fld.baseField = fld.dfVectorField;
+    break;
+  case DenseVectorField_Double:
+    fld.ddVectorField = firstLayerAs<Field3D::DenseField<Field3D::V3d> >(readVectorLayers<double>(inFile, partition, name));
+    fld.baseField = fld.ddVectorField;
+    break;
+  case SparseVectorField_Half:
+    fld.shVectorField = firstLayerAs<Field3D::SparseField<Field3D::V3h> >(readVectorLayers<half>(inFile, partition, name));
+    fld.baseField = fld.shVectorField;
+    break;
+  case SparseVectorField_Float:
+    fld.sfVectorField = firstLayerAs<Field3D::SparseField<Field3D::V3f> >(readVectorLayers<float>(inFile, partition, name));
+    fld.baseField = fld.sfVectorField;
+    break;
+  case SparseVectorField_Double:
+    fld.sdVectorField = firstLayerAs<Field3D::SparseField<Field3D::V3d> >(readVectorLayers<double>(inFile, partition, name));
+    fld.baseField = fld.sdVectorField;
+    break;
+  case MACField_Half:
+    fld.mhField = firstLayerAs<Field3D::MACField<Field3D::V3h> >(readVectorLayers<half>(inFile, partition, name));
+    fld.baseField = fld.mhField;
+    break;
+  case MACField_Float:
+    fld.mfField = firstLayerAs<Field3D::MACField<Field3D::V3f> >(readVectorLayers<float>(inFile, partition, name));
+    fld.baseField = fld.mfField;
+    break;
+  case MACField_Double:
+    fld.mdField = firstLayerAs<Field3D::MACField<Field3D::V3d> >(readVectorLayers<double>(inFile, partition, name));
+    fld.baseField = fld.mdField;
+    break;
+  default:
+    break;
+  }
+  
+  if (!fld.baseField)
+  {
+    ERROR( std::string("Could not read field ") + name + " as " + fieldTypeName(type));
+    
+    fld.fieldType = TypeUnsupported;
+    
+    return false;
+  }
+  
+  fld.fieldType = type;
+  
+  return true;
+}
+
+// ---------------------  Type probe
+//
+//   Field3D stores each partition in a root group named "<partition>.<index>",
+//   each layer is a sub group holding the "class_name", "components" and
+//   "bits_per_component" attributes written by the field's FieldIO.
+
+namespace
+{
+  bool readAttribute(hid_t loc, const char *name, std::string &value)
+  {
+    if (H5Aexists(loc, name) <= 0)
+    {
+      return false;
+    }
+    
+    hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+    if (attr < 0)
+    {
+      return false;
+    }
+    
+    bool rv = false;
+    hid_t type = H5Aget_type(attr);
+    
+    if (type >= 0 && H5Tget_class(type) == H5T_STRING && !H5Tis_variable_str(type))
+    {
+      std::vector<char> buffer(H5Tget_size(type) + 1, '\0');
+      
+      if (H5Aread(attr, type, &buffer[0]) >= 0)
+      {
+        value = &buffer[0];
+        rv = true;
+      }
+    }
+    
+    if (type >= 0)
+    {
+      H5Tclose(type);
+    }
+    H5Aclose(attr);
+    
+    return rv;
+  }
+  
+  bool readAttribute(hid_t loc, const char *name, int &value)
+  {
+    if (H5Aexists(loc, name) <= 0)
+    {
+      return false;
+    }
+    
+    hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+    if (attr < 0)
+    {
+      return false;
+    }
+    
+    bool rv = (H5Aread(attr, H5T_NATIVE_INT, &value) >= 0);
+    
+    H5Aclose(attr);
+    
+    return rv;
+  }
+  
+  // "<partition>.<digits>"
+  bool isInternalPartitionName(const std::string &groupName, const std::string &partition)
+  {
+    size_t p = groupName.rfind('.');
+    
+    if (p == std::string::npos || p + 1 >= groupName.length())
+    {
+      return false;
+    }
+    
+    if (groupName.find_first_not_of("0123456789", p + 1) != std::string::npos)
+    {
+      return false;
+    }
+    
+    return (partition.length() == 0 || (p == partition.length() && groupName.compare(0, p, partition) == 0));
+  }
+  
+  // class names may be decorated with the data type (ie: "DenseField<float>")
+  bool isClass(const std::string &className, const char *baseName)
+  {
+    return (className.compare(0, strlen(baseName), baseName) == 0);
+  }
+  
+  SupportedFieldTypeEnum layerType(const std::string &className, int components, int bitsPerComponent)
+  {
+    int precision = (bitsPerComponent == 16 ? 0 : (bitsPerComponent == 32 ? 1 : (bitsPerComponent == 64 ? 2 : -1)));
+    
+    if (precision < 0)
+    {
+      return TypeUnsupported;
+    }
+    
+    // empty half sparse field with the codes aside (see QuantizedField)
+    if (className == QUANTIZED_CLASS_NAME)
+    {
+      return (components == 1 ? SparseScalarField_Half : (components == 3 ? SparseVectorField_Half : TypeUnsupported));
+    }
+    
+    if (isClass(className, "DenseField"))
+    {
+      static const SupportedFieldTypeEnum scalarTypes[3] = {DenseScalarField_Half, DenseScalarField_Float, DenseScalarField_Double};
+      static const SupportedFieldTypeEnum vectorTypes[3] = {DenseVectorField_Half, DenseVectorField_Float, DenseVectorField_Double};
+      
+      return (components == 1 ? scalarTypes[precision] : (components == 3 ? vectorTypes[precision] : TypeUnsupported));
+    }
+    else if (isClass(className, "SparseField"))
+    {
+      static const SupportedFieldTypeEnum scalarTypes[3] = {SparseScalarField_Half, SparseScalarField_Float, SparseScalarField_Double};
+      static const SupportedFieldTypeEnum vectorTypes[3] = {SparseVectorField_Half, SparseVectorField_Float, SparseVectorField_Double};
+      
+      return (components == 1 ? scalarTypes[precision] : (components == 3 ? vectorTypes[precision] : TypeUnsupported));
+    }
+    else if (isClass(className, "MACField"))
+    {
+      static const SupportedFieldTypeEnum macTypes[3] = {MACField_Half, MACField_Float, MACField_Double};
+      
+      return (components == 3 ? macTypes[precision] : TypeUnsupported);
+    }
+    
+    return TypeUnsupported;
+  }
+  
+  SupportedFieldTypeEnum probeLayer(hid_t file, const std::string &layerPath)
+  {
+    if (H5Lexists(file, layerPath.c_str(), H5P_DEFAULT) <= 0)
+    {
+      H5Eclear2(H5E_DEFAULT);
+      return TypeUnsupported;
+    }
+    
+    hid_t layer = H5Gopen2(file, layerPath.c_str(), H5P_DEFAULT);
+    if (layer < 0)
+    {
+      return TypeUnsupported;
+    }
+    
+    SupportedFieldTypeEnum type = TypeUnsupported;
+    
+    std::string className;
+    int components = 0;
+    int bitsPerComponent = 0;
+    
+    if (readAttribute(layer, "class_name", className) &&
+        readAttribute(layer, "components", components) &&
+        readAttribute(layer, "bits_per_component", bitsPerComponent))
+    {
+      type = layerType(className, components, bitsPerComponent);
+    }
+    
+    H5Gclose(layer);
+    
+    return type;
+  }
+  
+  // names of the links of a group, in name order
+  void linkNames(hid_t file, const char *group, std::vector<std::string> &names)
+  {
+    names.clear();
+    
+    H5G_info_t info;
+    
+    if (H5Gget_info_by_name(file, group, &info, H5P_DEFAULT) < 0)
+    {
+      H5Eclear2(H5E_DEFAULT);
+      return;
+    }
+    
+    std::vector<char> name;
+    
+    for (hsize_t i=0; i<info.nlinks; ++i)
+    {
+      ssize_t len = H5Lget_name_by_idx(file, group, H5_INDEX_NAME, H5_ITER_INC, i, NULL, 0, H5P_DEFAULT);
+      if (len <= 0)
+      {
+        continue;
+      }
+      
+      name.resize(len + 1);
+      H5Lget_name_by_idx(file, group, H5_INDEX_NAME, H5_ITER_INC, i, &name[0], len + 1, H5P_DEFAULT);
+      
+      names.push_back(&name[0]);
+    }
+  }
+}
+
+SupportedFieldTypeEnum probeFieldType(hid_t file, const std::string &partition, const std::string &name)
+{
+  if (name.length() == 0)
+  {
+    return TypeUnsupported;
+  }
+  
+  // the first partition index is the common case, try it before scanning
+  //   the root group (single file caches hold a partition per frame)
+  SupportedFieldTypeEnum type = probeLayer(file, partition + ".0/" + name);
+  
+  if (type == TypeUnsupported)
+  {
+    std::vector<std::string> groups;
+    
+    linkNames(file, ".", groups);
+    
+    for (size_t i=0; i<groups.size() && type == TypeUnsupported; ++i)
+    {
+      if (isInternalPartitionName(groups[i], partition))
+      {
+        type = probeLayer(file, groups[i] + "/" + name);
+      }
+    }
+  }
+  
+  return type;
+}
+
+SupportedFieldTypeEnum probeFieldType(const std::string &filename, const std::string &partition, const std::string &name)
+{
+  if (name.length() == 0)
+  {
+    return TypeUnsupported;
+  }
+  
+  IOLock lock;
+  
+  ScopedSilentErrors silent;
+  
+  hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  
+  if (file < 0)
+  {
+    H5Eclear2(H5E_DEFAULT);
+    return TypeUnsupported;
+  }
+  
+  SupportedFieldTypeEnum type = probeFieldType(file, partition, name);
+  
+  H5Fclose(file);
+  
+  return type;
+}
+
+void probeFieldTypes(hid_t file, const std::string &partition, std::map<std::string, SupportedFieldTypeEnum> &types)
+{
+  std::vector<std::string> groups;
+  std::vector<std::string> layers;
+  
+  // partition indices in name order, the first holding a layer types it
+  //   (as probeFieldType does)
+  linkNames(file, ".", groups);
+  
+  for (size_t i=0; i<groups.size(); ++i)
+  {
+    if (!isInternalPartitionName(groups[i], partition))
+    {
+      continue;
+    }
+    
+    linkNames(file, groups[i].c_str(), layers);
+    
+    for (size_t j=0; j<layers.size(); ++j)
+    {
+      if (types.find(layers[j]) != types.end())
+      {
+        continue;
+      }
+      
+      // the partition mapping is not a layer
+      SupportedFieldTypeEnum type = probeLayer(file, groups[i] + "/" + layers[j]);
+      
+      if (type != TypeUnsupported)
+      {
+        types[layers[j]] = type;
+      }
+    }
+  }
+}
+
+bool probeFieldTypes(const std::string &filename, const std::string &partition, std::map<std::string, SupportedFieldTypeEnum> &types)
+{
+  IOLock lock;
+  
+  ScopedSilentErrors silent;
+  
+  hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  
+  if (file < 0)
+  {
+    H5Eclear2(H5E_DEFAULT);
+    return false;
+  }
+  
+  probeFieldTypes(file, partition, types);
+  
+  H5Fclose(file);
+  
+  return true;
+}
+
+const char* fieldTypeName(SupportedFieldTypeEnum type)
+{
+  switch (type)
+  {
+  case DenseScalarField_Half:    return "DenseScalarField_Half";
+  case DenseScalarField_Float:   return "DenseScalarField_Float";
+  case DenseScalarField_Double:  return "DenseScalarField_Double";
+  case SparseScalarField_Half:   return "SparseScalarField_Half";
+  case SparseScalarField_Float:  return "SparseScalarField_Float";
+  case SparseScalarField_Double: return "SparseScalarField_Double";
+  case DenseVectorField_Half:    return "DenseVectorField_Half";
+  case DenseVectorField_Float:   return "DenseVectorField_Float";
+  case DenseVectorField_Double:  return "DenseVectorField_Double";
+  case SparseVectorField_Half:   return "SparseVectorField_Half";
+  case SparseVectorField_Float:  return "SparseVectorField_Float";
+  case SparseVectorField_Double: return "SparseVectorField_Double";
+  case MACField_Half:            return "MACField_Half";
+  case MACField_Float:           return "MACField_Float";
+  case MACField_Double:          return "MACField_Double";
+  default:                       return "TypeUnsupported";
+  }
+}
+
+bool isVectorFieldType(SupportedFieldTypeEnum type)
+{
+  switch (type)
+  {
+  case DenseVectorField_Half:
+  case DenseVectorField_Float:
+  case DenseVectorField_Double:
+  case SparseVectorField_Half:
+  case SparseVectorField_Float:
+  case SparseVectorField_Double:
+  case MACField_Half:
+  case MACField_Float:
+  case MACField_Double:
+    return true;
+  default:
+    return false;
+  }
+}
+
+namespace
+{
+  template <typename Data_T>
+  bool isFieldOf(const Field3D::FieldRes::Ptr &field)
+  {
+    return (Field3D::field_dynamic_cast<Field3D::Field<Data_T> >(field) != 0);
+  }
+}
+
+SupportedFieldTypeEnum fieldType(const Field3D::FieldRes::Ptr &field)
+{
+  if (!field)
+  {
+    return TypeUnsupported;
+  }
+  
+  int components = 0;
+  int bitsPerComponent = 0;
+  
+  if (isFieldOf<half>(field))
+  {
+    components = 1;
+    bitsPerComponent = 16;
+  }
+  else if (isFieldOf<float>(field))
+  {
+    components = 1;
+    bitsPerComponent = 32;
+  }
+  else if (isFieldOf<double>(field))
+  {
+    components = 1;
+    bitsPerComponent = 64;
+  }
+  else if (isFieldOf<FIELD3D_VEC3_T<half> >(field))
+  {
+    components = 3;
+    bitsPerComponent = 16;
+  }
+  else if (isFieldOf<FIELD3D_VEC3_T<float> >(field))
+  {
+    components = 3;
+    bitsPerComponent = 32;
+  }
+  else if (isFieldOf<FIELD3D_VEC3_T<double> >(field))
+  {
+    components = 3;
+    bitsPerComponent = 64;
+  }
+  
+  return layerType(field->className(), components, bitsPerComponent);
+}
+
+// ---
+
+// voxel tests of the block masks
+template <typename T>
+struct ScalarMaskTest
+{
+  ScalarMaskTest(const T *data, double threshold)
+    : m_data(data), m_threshold(threshold)
+  {
+  }
+  
+  bool operator()(size_t i) const
+  {
+    return (m_data[i] > m_threshold);
+  }
+  
+  const T *m_data;
+  double m_threshold;
+};
+
+template <typename T>
+struct VectorMaskTest
+{
+  VectorMaskTest(const T *a, const T *b, const T *c, double threshold)
+    : m_a(a), m_b(b), m_c(c), m_threshold(threshold)
+  {
+  }
+  
+  bool operator()(size_t i) const
+  {
+    T c = (m_c ? m_c[i] : T(0));
+    
+    return (m_a[i]*m_a[i] + m_b[i]*m_b[i] + c*c > m_threshold);
+  }
+  
+  const T *m_a;
+  const T *m_b;
+  const T *m_c;
+  double m_threshold;
+};
 
+struct VoxelMaskTest
+{
+  VoxelMaskTest(const unsigned char *voxels)
+    : m_voxels(voxels)
+  {
+  }
+  
+  bool operator()(size_t i) const
+  {
+    return (m_voxels[i] != 0);
+  }
+  
+  const unsigned char *m_voxels;
+};
 
+// marks a range of z rows of blocks, rows never share a flag
+template <typename Test>
+struct MaskRows
+{
+  MaskRows(const V3i &res, int order, const V3i &blockRes, unsigned char *active, const Test &test)
+    : m_res(res), m_order(order), m_blockRes(blockRes), m_active(active), m_test(test)
+  {
+  }
+  
+  void operator()(size_t kbeg, size_t kend) const
+  {
+    int bsize = 1 << m_order;
+    size_t ystride = size_t(m_res.x);
+    size_t zstride = ystride * size_t(m_res.y);
+    
+    for (size_t bk=kbeg; bk<kend; ++bk)
+    {
+      int z0 = int(bk) * bsize;
+      int z1 = std::min(z0 + bsize, m_res.z);
+      
+      unsigned char *row = m_active + bk * size_t(m_blockRes.x) * size_t(m_blockRes.y);
+      
+      for (int z=z0; z<z1; ++z)
+      {
+        for (int y=0; y<m_res.y; ++y)
+        {
+          unsigned char *flags = row + (y >> m_order) * m_blockRes.x;
+          size_t off = z * zstride + y * ystride;
+          
+          for (int bi=0; bi<m_blockRes.x; ++bi)
+          {
+            // blocks already in use are not tested again
+            if (flags[bi])
+            {
+              continue;
+            }
+            
+            int x0 = bi * bsize;
+            int x1 = std::min(x0 + bsize, m_res.x);
+            
+            for (int x=x0; x<x1; ++x)
+            {
+              if (m_test(off + x))
+              {
+                flags[bi] = 1;
+                break;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  
+  V3i m_res;
+  int m_order;
+  V3i m_blockRes;
+  unsigned char *m_active;
+  Test m_test;
+};
+
+BlockMask::BlockMask()
+  : m_res(0)
+  , m_order(0)
+  , m_blockRes(0)
+{
+}
+
+void BlockMask::reset(const V3i &res, int blockOrder)
+{
+  int bsize = 1 << blockOrder;
+  
+  m_res = res;
+  m_order = blockOrder;
+  m_blockRes = V3i((res.x + bsize - 1) / bsize, (res.y + bsize - 1) / bsize, (res.z + bsize - 1) / bsize);
+  m_active.assign(size_t(m_blockRes.x) * size_t(m_blockRes.y) * size_t(m_blockRes.z), 0);
+}
+
+template <typename Test>
+void BlockMask::add(const Test &test)
+{
+  if (m_active.empty())
+  {
+    return;
+  }
+  
+  size_t rowSize = size_t(m_res.x) * size_t(m_res.y) << m_order;
+  
+  MaskRows<Test> rows(m_res, m_order, m_blockRes, &(m_active[0]), test);
+  
+  ParallelTools::parallelFor(0, size_t(m_blockRes.z), ParallelTools::grainSize(rowSize), rows);
+}
+
+void BlockMask::addScalar(const float *data, double threshold)
+{
+  if (data)
+  {
+    add(ScalarMaskTest<float>(data, threshold));
+  }
+}
+
+void BlockMask::addScalar(const double *data, double threshold)
+{
+  if (data)
+  {
+    add(ScalarMaskTest<double>(data, threshold));
+  }
+}
+
+void BlockMask::addVector(const float *a, const float *b, const float *c, double threshold)
+{
+  if (a && b)
+  {
+    add(VectorMaskTest<float>(a, b, c, threshold));
+  }
+}
+
+void BlockMask::addVector(const double *a, const double *b, const double *c, double threshold)
+{
+  if (a && b)
+  {
+    add(VectorMaskTest<double>(a, b, c, threshold));
+  }
+}
+
+void BlockMask::addVoxels(const VoxelMask &mask)
+{
+  if (mask.voxels() && mask.res() == m_res)
+  {
+    add(VoxelMaskTest(mask.voxels()));
+  }
+}
+
+size_t BlockMask::count() const
+{
+  return size_t(std::count(m_active.begin(), m_active.end(), (unsigned char) 1));
+}
+
+
+// ---
+
+struct BuildVoxelMask
+{
+  BuildVoxelMask(const float *data, double threshold, unsigned char *voxels, size_t sliceSize)
+    : m_data(data), m_threshold(threshold), m_voxels(voxels), m_sliceSize(sliceSize)
+  {
+  }
+  
+  void operator()(size_t kbeg, size_t kend) const
+  {
+    for (size_t i=kbeg*m_sliceSize; i<kend*m_sliceSize; ++i)
+    {
+      m_voxels[i] = (m_data[i] > m_threshold ? 1 : 0);
+    }
+  }
+  
+  const float *m_data;
+  double m_threshold;
+  unsigned char *m_voxels;
+  size_t m_sliceSize;
+};
+
+// one dilation pass along an axis : a voxel is set if a voxel of src at
+//   most n voxels away on the same line is. Lines are walked with a sliding
+//   window count, the parallel loop runs over z for the x and y passes and
+//   over y for the z pass.
+struct DilatePass
+{
+  DilatePass(const V3i &res, int axis, int n, const unsigned char *src, unsigned char *dst)
+    : m_res(res), m_axis(axis), m_n(n), m_src(src), m_dst(dst)
+  {
+  }
+  
+  void operator()(size_t obeg, size_t oend) const
+  {
+    size_t ystride = size_t(m_res.x);
+    size_t zstride = ystride * size_t(m_res.y);
+    
+    for (size_t o=obeg; o<oend; ++o)
+    {
+      if (m_axis == 0)
+      {
+        for (int y=0; y<m_res.y; ++y)
+        {
+          dilateLine(o * zstride + y * ystride, 1, m_res.x);
+        }
+      }
+      else if (m_axis == 1)
+      {
+        for (int x=0; x<m_res.x; ++x)
+        {
+          dilateLine(o * zstride + x, ystride, m_res.y);
+        }
+      }
+      else
+      {
+        for (int x=0; x<m_res.x; ++x)
+        {
+          dilateLine(o * ystride + x, zstride, m_res.z);
+        }
+      }
+    }
+  }
+  
+  void dilateLine(size_t first, size_t stride, int length) const
+  {
+    const unsigned char *src = m_src + first;
+    unsigned char *dst = m_dst + first;
+    
+    int count = 0;
+    
+    for (int i=0; i<=m_n && i<length; ++i)
+    {
+      count += src[i * stride];
+    }
+    
+    for (int i=0; i<length; ++i)
+    {
+      dst[i * stride] = (count > 0 ? 1 : 0);
+      
+      if (i + m_n + 1 < length)
+      {
+        count += src[(i + m_n + 1) * stride];
+      }
+      if (i - m_n >= 0)
+      {
+        count -= src[(i - m_n) * stride];
+      }
+    }
+  }
+  
+  V3i m_res;
+  int m_axis;
+  int m_n;
+  const unsigned char *m_src;
+  unsigned char *m_dst;
+};
+
+VoxelMask::VoxelMask()
+  : m_res(0)
+{
+}
+
+void VoxelMask::build(const V3i &res, const float *data, double threshold)
+{
+  m_res = res;
+  m_voxels.assign(size_t(res.x) * size_t(res.y) * size_t(res.z), 0);
+  
+  if (!data || m_voxels.empty())
+  {
+    return;
+  }
+  
+  size_t sliceSize = size_t(res.x) * size_t(res.y);
+  
+  ParallelTools::parallelFor(0, size_t(res.z), ParallelTools::grainSize(sliceSize),
+                             BuildVoxelMask(data, threshold, &(m_voxels[0]), sliceSize));
+}
+
+void VoxelMask::dilate(int n)
+{
+  if (n <= 0 || m_voxels.empty())
+  {
+    return;
+  }
+  
+  std::vector<unsigned char> tmp(m_voxels.size());
+  
+  size_t sliceSize = size_t(m_res.x) * size_t(m_res.y);
+  size_t rowSize = size_t(m_res.x) * size_t(m_res.z);
+  
+  // separable box dilation : x into tmp, y back, z into tmp
+  ParallelTools::parallelFor(0, size_t(m_res.z), ParallelTools::grainSize(sliceSize),
+                             DilatePass(m_res, 0, n, &(m_voxels[0]), &(tmp[0])));
+  ParallelTools::parallelFor(0, size_t(m_res.z), ParallelTools::grainSize(sliceSize),
+                             DilatePass(m_res, 1, n, &(tmp[0]), &(m_voxels[0])));
+  ParallelTools::parallelFor(0, size_t(m_res.y), ParallelTools::grainSize(rowSize),
+                             DilatePass(m_res, 2, n, &(m_voxels[0]), &(tmp[0])));
+  
+  m_voxels.swap(tmp);
+}
+
+size_t VoxelMask::count() const
+{
+  return size_t(std::count(m_voxels.begin(), m_voxels.end(), (unsigned char) 1));
+}
+
+
+// ---
+
+// Costs of a layout, in bytes. Per voxel, an allocated block costs its
+//   voxels times the stored value size, the other costs are per block.
+
+// SparseBlock bookkeeping in memory, whether allocated or not
+//   (Field3D's SparseBlock : allocation flag, empty value and data vector, 64 bits)
+static const double BLOCK_MEMORY_BYTES = 40.0;
+
+// block map entry of every block in the file, the empty value comes on top
+//   (the int of Field3D's "block_is_allocated" dataset)
+static const double BLOCK_FILE_BYTES = 4.0;
+
+// reading an allocated block costs as much as reading this many more bytes
+//   (estimate of the HDF5 selection and allocation set up for each block)
+static const double BLOCK_READ_BYTES = 1024.0;
+
+// orders tried, Field3D's default first so that it wins ties
+static const int BLOCK_ORDERS[] = { 4, 3, 5, 6 };
+
+template <typename T>
+int ChooseBlockOrder(const V3i &res, const T *a, const T *b, const T *c,
+                     double threshold, size_t valueSize, std::vector<BlockOrderCost> *costs)
+{
+  int best = BLOCK_ORDERS[0];
+  double bestCost = 0.0;
+  
+  for (size_t i=0; i<sizeof(BLOCK_ORDERS)/sizeof(BLOCK_ORDERS[0]); ++i)
+  {
+    BlockMask mask;
+    
+    mask.reset(res, BLOCK_ORDERS[i]);
+    
+    if (b)
+    {
+      mask.addVector(a, b, c, threshold);
+    }
+    else
+    {
+      mask.addScalar(a, threshold);
+    }
+    
+    const V3i &bres = mask.blockRes();
+    
+    BlockOrderCost cost;
+    
+    cost.order = BLOCK_ORDERS[i];
+    cost.activeBlocks = mask.count();
+    cost.totalBlocks = size_t(bres.x) * size_t(bres.y) * size_t(bres.z);
+    
+    double blockBytes = double(size_t(1) << (3 * BLOCK_ORDERS[i])) * double(valueSize);
+    double dataBytes = double(cost.activeBlocks) * blockBytes;
+    
+    cost.memoryBytes = dataBytes + double(cost.totalBlocks) * BLOCK_MEMORY_BYTES;
+    cost.fileBytes = dataBytes + double(cost.totalBlocks) * (BLOCK_FILE_BYTES + double(valueSize));
+    cost.readCost = cost.fileBytes + double(cost.activeBlocks) * BLOCK_READ_BYTES;
+    
+    if (costs)
+    {
+      costs->push_back(cost);
+    }
+    
+    if (i == 0 || cost.total() < bestCost)
+    {
+      best = BLOCK_ORDERS[i];
+      bestCost = cost.total();
+    }
+  }
+  
+  return best;
+}
+
+int chooseBlockOrder(const V3i &res, const float *a, const float *b, const float *c,
+                     double threshold, size_t valueSize, std::vector<BlockOrderCost> *costs)
+{
+  return ChooseBlockOrder(res, a, b, c, threshold, valueSize, costs);
+}
+
+int chooseBlockOrder(const V3i &res, const double *a, const double *b, const double *c,
+                     double threshold, size_t valueSize, std::vector<BlockOrderCost> *costs)
+{
+  return ChooseBlockOrder(res, a, b, c, threshold, valueSize, costs);
+}
+
+
+// ---------------------  Quantized channels
+//
+//   The codes are the "f3d_maya_codes" dataset of the layer group, with the
+//   resolution, components, bits, block order and measured error as
+//   attributes. The min and max of each block and component are the
+//   "f3d_maya_ranges" dataset. The layer is found by the id of the codes in
+//   its metadata.
+
+static const char* const QUANTIZED_CODES = "f3d_maya_codes";
+static const char* const QUANTIZED_RANGES = "f3d_maya_ranges";
+
+// codes per compressed chunk
+static const hsize_t QUANTIZED_CHUNK = 65536;
+
+// codes of a channel read back, well above any maya fluid : sizes read from
+//   a corrupt file are refused before anything is allocated
+static const double QUANTIZED_MAX_CODES = 4294967296.0;
+
+// group of the layer metadata written by Field3D
+static const char* const FIELD3D_METADATA_GROUP = "metadata";
+
+static boost::mutex gQuantizedIdMutex;
+static int gQuantizedId = 0;
+
+static int NextQuantizedId()
+{
+  boost::mutex::scoped_lock lock(gQuantizedIdMutex);
+  
+  return ++gQuantizedId;
+}
+
+// step between two codes of a block range, the same for encode and decode
+static inline float QuantizedStep(float lo, float hi, int levels)
+{
+  return (hi - lo) / float(levels - 1);
+}
+
+// decodes a run of codes into a maya array
+template <typename Code>
+static inline void DequantizeRun(const Code *codes, float lo, float step, float *dst, size_t n, float *)
+{
+  SimdTools::dequantize(codes, lo, step, dst, n);
+}
+
+template <typename Code>
+static inline void DequantizeRun(const Code *codes, float lo, float step, double *dst, size_t n, float *tmp)
+{
+  SimdTools::dequantize(codes, lo, step, tmp, n);
+  
+  for (size_t i=0; i<n; ++i)
+  {
+    dst[i] = tmp[i];
+  }
+}
+
+// block rows of a channel
+template <typename T>
+struct EncodeRows
+{
+  EncodeRows(QuantizedField &field, const T *a, const T *b, const T *c)
+    : m_field(field), m_a(a), m_b(b), m_c(c)
+  {
+  }
+  
+  void operator()(size_t bbeg, size_t bend) const
+  {
+    int bsize = 1 << m_field.blockOrder();
+    
+    for (size_t bk=bbeg; bk<bend; ++bk)
+    {
+      int z0 = int(bk) * bsize;
+      
+      m_field.encode(z0, std::min(z0 + bsize, m_field.res().z), m_a, m_b, m_c);
+    }
+  }
+  
+  QuantizedField &m_field;
+  const T *m_a;
+  const T *m_b;
+  const T *m_c;
+};
+
+template <typename T>
+struct DecodeRows
+{
+  DecodeRows(const QuantizedField &field, T *a, T *b, T *c)
+    : m_field(field), m_a(a), m_b(b), m_c(c)
+  {
+  }
+  
+  void operator()(size_t bbeg, size_t bend) const
+  {
+    int bsize = 1 << m_field.blockOrder();
+    
+    for (size_t bk=bbeg; bk<bend; ++bk)
+    {
+      int z0 = int(bk) * bsize;
+      
+      m_field.decode(z0, std::min(z0 + bsize, m_field.res().z), m_a, m_b, m_c);
+    }
+  }
+  
+  const QuantizedField &m_field;
+  T *m_a;
+  T *m_b;
+  T *m_c;
+};
+
+QuantizedField::QuantizedField()
+  : m_res(0)
+  , m_components(1)
+  , m_bits(8)
+  , m_order(0)
+  , m_blockRes(0)
+  , m_id(0)
+{
+}
+
+void QuantizedField::reset(const V3i &res, int components, int bits, int blockOrder)
+{
+  int bsize = 1 << blockOrder;
+  
+  m_res = res;
+  m_components = (components == 3 ? 3 : 1);
+  m_bits = (bits > 8 ? 16 : 8);
+  m_order = blockOrder;
+  m_blockRes = V3i((res.x + bsize - 1) / bsize, (res.y + bsize - 1) / bsize, (res.z + bsize - 1) / bsize);
+  
+  size_t nvoxels = size_t(res.x) * size_t(res.y) * size_t(res.z);
+  size_t nblocks = size_t(m_blockRes.x) * size_t(m_blockRes.y) * size_t(m_blockRes.z);
+  
+  m_codes.assign(nvoxels * m_components * (m_bits / 8), 0);
+  m_ranges.assign(2 * nblocks * m_components, 0.0f);
+  m_slabError.assign(size_t(m_blockRes.z), 0.0f);
+  m_id = NextQuantizedId();
+}
+
+template <typename T>
+void QuantizedField::encodeSlab(int z0, int z1, const T *a, const T *b, const T *c)
+{
+  if (m_codes.empty() || z0 >= z1)
+  {
+    return;
+  }
+  
+  const T *src[3] = {a, b, c};
+  
+  int bsize = 1 << m_order;
+  int levels = 1 << m_bits;
+  size_t ystride = size_t(m_res.x);
+  size_t zstride = ystride * size_t(m_res.y);
+  size_t nvoxels = zstride * size_t(m_res.z);
+  int bk = z0 >> m_order;
+  
+  unsigned char *codes8 = &(m_codes[0]);
+  unsigned short *codes16 = (unsigned short*) &(m_codes[0]);
+  
+  float slabError = 0.0f;
+  
+  for (int by=0; by<m_blockRes.y; ++by)
+  {
+    int y0 = by << m_order;
+    int y1 = std::min(y0 + bsize, m_res.y);
+    
+    for (int bx=0; bx<m_blockRes.x; ++bx)
+    {
+      int x0 = bx << m_order;
+      int x1 = std::min(x0 + bsize, m_res.x);
+      
+      size_t block = (size_t(bk) * size_t(m_blockRes.y) + size_t(by)) * size_t(m_blockRes.x) + size_t(bx);
+      
+      for (int cp=0; cp<m_components; ++cp)
+      {
+        const T *data = src[cp];
+        float *range = &(m_ranges[2 * (block * m_components + cp)]);
+        
+        // missing component : zero codes and range
+        if (!data)
+        {
+          range[0] = range[1] = 0.0f;
+          continue;
+        }
+        
+        T lo = data[z0 * zstride + y0 * ystride + x0];
+        T hi = lo;
+        
+        for (int z=z0; z<z1; ++z)
+        {
+          for (int y=y0; y<y1; ++y)
+          {
+            const T *row = data + z * zstride + y * ystride;
+            
+            for (int x=x0; x<x1; ++x)
+            {
+              lo = std::min(lo, row[x]);
+              hi = std::max(hi, row[x]);
+            }
+          }
+        }
+        
+        range[0] = float(lo);
+        range[1] = float(hi);
+        
+        float step = QuantizedStep(range[0], range[1], levels);
+        double scale = (step > 0.0f ? 1.0 / double(step) : 0.0);
+        
+        for (int z=z0; z<z1; ++z)
+        {
+          for (int y=y0; y<y1; ++y)
+          {
+            size_t off = z * zstride + y * ystride;
+            size_t dst = cp * nvoxels + off;
+            
+            for (int x=x0; x<x1; ++x)
+            {
+              double t = (double(data[off + x]) - double(range[0])) * scale + 0.5;
+              
+              // clamped, NaNs give 0
+              int code = (t > 0.0 ? (t < double(levels - 1) ? int(t) : levels - 1) : 0);
+              
+              if (m_bits == 8)
+              {
+                codes8[dst + x] = (unsigned char) code;
+              }
+              else
+              {
+                codes16[dst + x] = (unsigned short) code;
+              }
+              
+              float err = float(std::fabs(double(range[0] + step * float(code)) - double(data[off + x])));
+              
+              if (err > slabError)
+              {
+                slabError = err;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  
+  m_slabError[bk] = slabError;
+}
+
+template <typename Code, typename T>
+void QuantizedField::decodeSlab(int z0, int z1, T *a, T *b, T *c) const
+{
+  if (m_codes.empty() || z0 >= z1)
+  {
+    return;
+  }
+  
+  T *dst[3] = {a, b, c};
+  
+  int bsize = 1 << m_order;
+  int levels = 1 << m_bits;
+  size_t ystride = size_t(m_res.x);
+  size_t zstride = ystride * size_t(m_res.y);
+  size_t nvoxels = zstride * size_t(m_res.z);
+  
+  const Code *codes = (const Code*) &(m_codes[0]);
+  
+  std::vector<float> tmp(bsize);
+  
+  for (int cp=0; cp<m_components; ++cp)
+  {
+    if (!dst[cp])
+    {
+      continue;
+    }
+    
+    for (int z=z0; z<z1; ++z)
+    {
+      for (int y=0; y<m_res.y; ++y)
+      {
+        size_t off = z * zstride + y * ystride;
+        size_t block = (size_t(z >> m_order) * size_t(m_blockRes.y) + size_t(y >> m_order)) * size_t(m_blockRes.x);
+        
+        // a run of codes per block
+        for (int bx=0; bx<m_blockRes.x; ++bx)
+        {
+          int x0 = bx << m_order;
+          size_t n = size_t(std::min(x0 + bsize, m_res.x) - x0);
+          const float *range = &(m_ranges[2 * ((block + bx) * m_components + cp)]);
+          
+          DequantizeRun(codes + cp * nvoxels + off + x0, range[0], QuantizedStep(range[0], range[1], levels),
+                        dst[cp] + off + x0, n, &(tmp[0]));
+        }
+      }
+    }
+  }
+}
+
+void QuantizedField::encode(int z0, int z1, const float *a, const float *b, const float *c)
+{
+  encodeSlab(z0, z1, a, b, c);
+}
+
+void QuantizedField::encode(int z0, int z1, const double *a, const double *b, const double *c)
+{
+  encodeSlab(z0, z1, a, b, c);
+}
+
+bool QuantizedField::encode(const float *a, const float *b, const float *c)
+{
+  size_t rowSize = size_t(m_res.x) * size_t(m_res.y) << m_order;
+  
+  try
+  {
+    ParallelTools::parallelFor(0, size_t(m_blockRes.z), ParallelTools::grainSize(rowSize), EncodeRows<float>(*this, a, b, c));
+  }
+  catch (std::exception &e)
+  {
+    ERROR("Problem while quantizing field : " << e.what());
+    return false;
+  }
+  
+  return true;
+}
+
+bool QuantizedField::encode(const double *a, const double *b, const double *c)
+{
+  size_t rowSize = size_t(m_res.x) * size_t(m_res.y) << m_order;
+  
+  try
+  {
+    ParallelTools::parallelFor(0, size_t(m_blockRes.z), ParallelTools::grainSize(rowSize), EncodeRows<double>(*this, a, b, c));
+  }
+  catch (std::exception &e)
+  {
+    ERROR("Problem while quantizing field : " << e.what());
+    return false;
+  }
+  
+  return true;
+}
+
+void QuantizedField::decode(int z0, int z1, float *a, float *b, float *c) const
+{
+  if (m_bits == 8)
+  {
+    decodeSlab<unsigned char>(z0, z1, a, b, c);
+  }
+  else
+  {
+    decodeSlab<unsigned short>(z0, z1, a, b, c);
+  }
+}
+
+void QuantizedField::decode(int z0, int z1, double *a, double *b, double *c) const
+{
+  if (m_bits == 8)
+  {
+    decodeSlab<unsigned char>(z0, z1, a, b, c);
+  }
+  else
+  {
+    decodeSlab<unsigned short>(z0, z1, a, b, c);
+  }
+}
+
+bool QuantizedField::decode(float *a, float *b, float *c) const
+{
+  size_t rowSize = size_t(m_res.x) * size_t(m_res.y) << m_order;
+  
+  try
+  {
+    ParallelTools::parallelFor(0, size_t(m_blockRes.z), ParallelTools::grainSize(rowSize), DecodeRows<float>(*this, a, b, c));
+  }
+  catch (std::exception &e)
+  {
+    ERROR("Problem while decoding quantized field : " << e.what());
+    return false;
+  }
+  
+  return true;
+}
+
+bool QuantizedField::decode(double *a, double *b, double *c) const
+{
+  size_t rowSize = size_t(m_res.x) * size_t(m_res.y) << m_order;
+  
+  try
+  {
+    ParallelTools::parallelFor(0, size_t(m_blockRes.z), ParallelTools::grainSize(rowSize), DecodeRows<double>(*this, a, b, c));
+  }
+  catch (std::exception &e)
+  {
+    ERROR("Problem while decoding quantized field : " << e.what());
+    return false;
+  }
+  
+  return true;
+}
+
+double QuantizedField::errorBound() const
+{
+  int levels = 1 << m_bits;
+  double bound = 0.0;
+  
+  for (size_t i=0; i+1<m_ranges.size(); i+=2)
+  {
+    bound = std::max(bound, 0.5 * double(QuantizedStep(m_ranges[i], m_ranges[i+1], levels)));
+  }
+  
+  return bound;
+}
+
+double QuantizedField::maxError() const
+{
+  float err = 0.0f;
+  
+  for (size_t i=0; i<m_slabError.size(); ++i)
+  {
+    err = std::max(err, m_slabError[i]);
+  }
+  
+  return double(err);
+}
+
+size_t QuantizedField::bytes() const
+{
+  return m_codes.size() + m_ranges.size() * sizeof(float);
+}
+
+namespace
+{
+  bool writeAttribute(hid_t loc, const char *name, hid_t fileType, hid_t memType, const void *values, hsize_t n)
+  {
+    hid_t space = H5Screate_simple(1, &n, NULL);
+    if (space < 0)
+    {
+      return false;
+    }
+    
+    hid_t attr = H5Acreate2(loc, name, fileType, space, H5P_DEFAULT, H5P_DEFAULT);
+    
+    bool rv = (attr >= 0 && H5Awrite(attr, memType, values) >= 0);
+    
+    if (attr >= 0)
+    {
+      H5Aclose(attr);
+    }
+    H5Sclose(space);
+    
+    return rv;
+  }
+  
+  bool readAttribute(hid_t loc, const char *name, hid_t memType, void *values, hssize_t n)
+  {
+    if (H5Aexists(loc, name) <= 0)
+    {
+      return false;
+    }
+    
+    hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+    if (attr < 0)
+    {
+      return false;
+    }
+    
+    hid_t space = H5Aget_space(attr);
+    
+    bool rv = (space >= 0 && H5Sget_simple_extent_npoints(space) == n && H5Aread(attr, memType, values) >= 0);
+    
+    if (space >= 0)
+    {
+      H5Sclose(space);
+    }
+    H5Aclose(attr);
+    
+    return rv;
+  }
+  
+  // the open dataset, or a negative id
+  hid_t writeDataset(hid_t loc, const char *name, hid_t fileType, hid_t memType, const void *values, hsize_t n, hid_t plist)
+  {
+    hid_t space = H5Screate_simple(1, &n, NULL);
+    if (space < 0)
+    {
+      return -1;
+    }
+    
+    hid_t dataset = H5Dcreate2(loc, name, fileType, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+    
+    if (dataset >= 0 && n > 0 && H5Dwrite(dataset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, values) < 0)
+    {
+      H5Dclose(dataset);
+      dataset = -1;
+    }
+    
+    H5Sclose(space);
+    
+    return dataset;
+  }
+  
+  // number of values of a dataset, -1 if unknown
+  hssize_t datasetPoints(hid_t dataset)
+  {
+    hid_t space = H5Dget_space(dataset);
+    if (space < 0)
+    {
+      return -1;
+    }
+    
+    hssize_t n = H5Sget_simple_extent_npoints(space);
+    
+    H5Sclose(space);
+    
+    return n;
+  }
+  
+  // fixed length string attribute, as Field3D writes them (replaced if it exists)
+  bool writeAttribute(hid_t loc, const char *name, const std::string &value)
+  {
+    if (H5Aexists(loc, name) > 0 && H5Adelete(loc, name) < 0)
+    {
+      return false;
+    }
+    
+    hid_t type = H5Tcopy(H5T_C_S1);
+    if (type < 0)
+    {
+      return false;
+    }
+    
+    H5Tset_size(type, std::max(value.length(), size_t(1)));
+    
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attr = (space >= 0 ? H5Acreate2(loc, name, type, space, H5P_DEFAULT, H5P_DEFAULT) : -1);
+    
+    bool rv = (attr >= 0 && H5Awrite(attr, type, value.c_str()) >= 0);
+    
+    if (attr >= 0)
+    {
+      H5Aclose(attr);
+    }
+    if (space >= 0)
+    {
+      H5Sclose(space);
+    }
+    H5Tclose(type);
+    
+    return rv;
+  }
+  
+  // QUANTIZED_ID_METADATA of a layer group, 0 if none
+  int quantizedId(hid_t layer)
+  {
+    if (H5Lexists(layer, FIELD3D_METADATA_GROUP, H5P_DEFAULT) <= 0)
+    {
+      H5Eclear2(H5E_DEFAULT);
+      return 0;
+    }
+    
+    hid_t metadata = H5Gopen2(layer, FIELD3D_METADATA_GROUP, H5P_DEFAULT);
+    if (metadata < 0)
+    {
+      return 0;
+    }
+    
+    int id = 0;
+    
+    if (!readAttribute(metadata, QUANTIZED_ID_METADATA, id))
+    {
+      id = 0;
+    }
+    
+    H5Gclose(metadata);
+    
+    return id;
+  }
+  
+  bool readDataset(hid_t dataset, hid_t memType, void *values, hssize_t n)
+  {
+    hid_t space = H5Dget_space(dataset);
+    
+    bool rv = (space >= 0 && H5Sget_simple_extent_npoints(space) == n &&
+               (n == 0 || H5Dread(dataset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, values) >= 0));
+    
+    if (space >= 0)
+    {
+      H5Sclose(space);
+    }
+    
+    return rv;
+  }
+  
+  // "<partition>.<index>/<name>" of the partition groups holding the layer,
+  //   by index
+  void findLayerGroups(hid_t file, const std::string &partition, const std::string &name, std::vector<std::string> &layers)
+  {
+    H5G_info_t rootInfo;
+    
+    if (H5Gget_info(file, &rootInfo) < 0)
+    {
+      return;
+    }
+    
+    std::vector<std::pair<long, std::string> > found;
+    std::vector<char> groupName;
+    
+    for (hsize_t i=0; i<rootInfo.nlinks; ++i)
+    {
+      ssize_t len = H5Lget_name_by_idx(file, ".", H5_INDEX_NAME, H5_ITER_INC, i, NULL, 0, H5P_DEFAULT);
+      if (len <= 0)
+      {
+        continue;
+      }
+      
+      groupName.resize(len + 1);
+      H5Lget_name_by_idx(file, ".", H5_INDEX_NAME, H5_ITER_INC, i, &groupName[0], len + 1, H5P_DEFAULT);
+      
+      std::string group = &groupName[0];
+      
+      if (!isInternalPartitionName(group, partition))
+      {
+        continue;
+      }
+      
+      std::string path = group + "/" + name;
+      
+      if (H5Lexists(file, path.c_str(), H5P_DEFAULT) <= 0)
+      {
+        H5Eclear2(H5E_DEFAULT);
+        continue;
+      }
+      
+      found.push_back(std::make_pair(atol(group.c_str() + group.rfind('.') + 1), path));
+    }
+    
+    std::sort(found.begin(), found.end());
+    
+    for (size_t i=0; i<found.size(); ++i)
+    {
+      layers.push_back(found[i].second);
+    }
+  }
+}
+
+bool QuantizedField::write(hid_t layer) const
+{
+  hsize_t ncodes = hsize_t(m_codes.size() / (m_bits / 8));
+  hsize_t nranges = hsize_t(m_ranges.size());
+  
+  hid_t fileType = (m_bits == 8 ? H5T_STD_U8LE : H5T_STD_U16LE);
+  hid_t memType = (m_bits == 8 ? H5T_NATIVE_UCHAR : H5T_NATIVE_USHORT);
+  
+  hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+  
+  // codes are constant outside of the fluid : they compress well
+  if (ncodes > 0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0)
+  {
+    hsize_t chunk = std::min(ncodes, QUANTIZED_CHUNK);
+    
+    H5Pset_chunk(plist, 1, &chunk);
+    H5Pset_deflate(plist, 1);
+  }
+  
+  hid_t codes = writeDataset(layer, QUANTIZED_CODES, fileType, memType, (ncodes > 0 ? &(m_codes[0]) : 0), ncodes, plist);
+  
+  H5Pclose(plist);
+  
+  if (codes < 0)
+  {
+    return false;
+  }
+  
+  int res[3] = {m_res.x, m_res.y, m_res.z};
+  float maxErr = float(maxError());
+  
+  bool rv = (writeAttribute(codes, "resolution", H5T_STD_I32LE, H5T_NATIVE_INT, res, 3) &&
+             writeAttribute(codes, "components", H5T_STD_I32LE, H5T_NATIVE_INT, &m_components, 1) &&
+             writeAttribute(codes, "bits", H5T_STD_I32LE, H5T_NATIVE_INT, &m_bits, 1) &&
+             writeAttribute(codes, "block_order", H5T_STD_I32LE, H5T_NATIVE_INT, &m_order, 1) &&
+             writeAttribute(codes, "max_error", H5T_IEEE_F32LE, H5T_NATIVE_FLOAT, &maxErr, 1));
+  
+  H5Dclose(codes);
+  
+  hid_t ranges = writeDataset(layer, QUANTIZED_RANGES, H5T_IEEE_F32LE, H5T_NATIVE_FLOAT,
+                              (nranges > 0 ? &(m_ranges[0]) : 0), nranges, H5P_DEFAULT);
+  
+  if (ranges < 0)
+  {
+    return false;
+  }
+  
+  H5Dclose(ranges);
+  
+  return rv;
+}
+
+bool QuantizedField::read(hid_t layer)
+{
+  if (H5Lexists(layer, QUANTIZED_CODES, H5P_DEFAULT) <= 0 ||
+      H5Lexists(layer, QUANTIZED_RANGES, H5P_DEFAULT) <= 0)
+  {
+    H5Eclear2(H5E_DEFAULT);
+    return false;
+  }
+  
+  hid_t codes = H5Dopen2(layer, QUANTIZED_CODES, H5P_DEFAULT);
+  if (codes < 0)
+  {
+    return false;
+  }
+  
+  hid_t ranges = H5Dopen2(layer, QUANTIZED_RANGES, H5P_DEFAULT);
+  if (ranges < 0)
+  {
+    H5Dclose(codes);
+    return false;
+  }
+  
+  int res[3] = {0, 0, 0};
+  int components = 0;
+  int bits = 0;
+  int order = 0;
+  float maxErr = 0.0f;
+  
+  bool rv = (readAttribute(codes, "resolution", H5T_NATIVE_INT, res, 3) &&
+             readAttribute(codes, "components", components) &&
+             readAttribute(codes, "bits", bits) &&
+             readAttribute(codes, "block_order", order) &&
+             readAttribute(codes, "max_error", H5T_NATIVE_FLOAT, &maxErr, 1));
+  
+  rv = rv && (components == 1 || components == 3) && (bits == 8 || bits == 16) && order >= 0 && order < 16 &&
+       res[0] >= 0 && res[1] >= 0 && res[2] >= 0;
+  
+  // the attributes may come from a corrupt file : the datasets must hold as
+  //   many values before the arrays are sized from them
+  if (rv)
+  {
+    double bsize = double(1 << order);
+    double nvoxels = double(res[0]) * double(res[1]) * double(res[2]);
+    double nblocks = std::ceil(res[0] / bsize) * std::ceil(res[1] / bsize) * std::ceil(res[2] / bsize);
+    
+    rv = (nvoxels * components <= QUANTIZED_MAX_CODES &&
+          double(datasetPoints(codes)) == nvoxels * components &&
+          double(datasetPoints(ranges)) == 2.0 * nblocks * components);
+  }
+  
+  if (rv)
+  {
+    try
+    {
+      reset(V3i(res[0], res[1], res[2]), components, bits, order);
+    }
+    catch (std::exception &e)
+    {
+      ERROR("Problem while allocating quantized field : " << e.what());
+      rv = false;
+    }
+  }
+  
+  if (rv)
+  {
+    rv = (readDataset(codes, (bits == 8 ? H5T_NATIVE_UCHAR : H5T_NATIVE_USHORT),
+                      (m_codes.empty() ? 0 : &(m_codes[0])), hssize_t(m_codes.size() / (bits / 8))) &&
+          readDataset(ranges, H5T_NATIVE_FLOAT, (m_ranges.empty() ? 0 : &(m_ranges[0])), hssize_t(m_ranges.size())));
+    
+    // the measured error isn't known per block row anymore
+    m_slabError.assign(m_slabError.size(), maxErr);
+  }
+  
+  H5Dclose(ranges);
+  H5Dclose(codes);
+  
+  return rv;
+}
+
+bool writeQuantizedLayer(const std::string &filename, const std::string &partition, const std::string &name, const QuantizedField &field)
+{
+  IOLock lock;
+  
+  bool rv = false;
+  
+  {
+    ScopedSilentErrors silent;
+    
+    // Field3D may still hold the file : HDF5 shares it between both ids
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    
+    if (file >= 0)
+    {
+      std::vector<std::string> layers;
+      
+      findLayerGroups(file, partition, name, layers);
+      
+      // the layer just written carries the id of the codes
+      bool found = false;
+      
+      for (size_t i=0; i<layers.size() && !found; ++i)
+      {
+        hid_t layer = H5Gopen2(file, layers[i].c_str(), H5P_DEFAULT);
+        
+        if (layer < 0)
+        {
+          continue;
+        }
+        
+        found = (quantizedId(layer) == field.id() && H5Lexists(layer, QUANTIZED_CODES, H5P_DEFAULT) <= 0);
+        
+        if (found)
+        {
+          // Field3D readers refuse the layer instead of reading it as zeros
+          rv = (field.write(layer) && writeAttribute(layer, "class_name", QUANTIZED_CLASS_NAME));
+        }
+        
+        H5Gclose(layer);
+      }
+      
+      H5Fclose(file);
+    }
+    
+    H5Eclear2(H5E_DEFAULT);
+  }
+  
+  if (!rv)
+  {
+    ERROR("Could not write the codes of quantized layer " << partition << "." << name << " in " << filename);
+  }
+  
+  return rv;
+}
+
+bool readQuantizedLayer(const std::string &filename, const std::string &partition, const std::string &name, QuantizedField &field)
+{
+  IOLock lock;
+  
+  ScopedSilentErrors silent;
+  
+  hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  
+  if (file < 0)
+  {
+    H5Eclear2(H5E_DEFAULT);
+    return false;
+  }
+  
+  std::vector<std::string> layers;
+  
+  findLayerGroups(file, partition, name, layers);
+  
+  bool rv = false;
+  
+  // first layer with codes, as Field3D returns the first layer too
+  for (size_t i=0; i<layers.size() && !rv; ++i)
+  {
+    hid_t layer = H5Gopen2(file, layers[i].c_str(), H5P_DEFAULT);
+    
+    if (layer >= 0)
+    {
+      rv = field.read(layer);
+      H5Gclose(layer);
+    }
+  }
+  
+  H5Fclose(file);
+  
+  H5Eclear2(H5E_DEFAULT);
+  
+  return rv;
+}
+
+bool loadQuantizedLayer(const std::string &filename, const std::string &partition, const std::string &name, Fld &fld)
+{
+  if (!fld.baseField || fld.baseField->metadata().intMetadata(QUANTIZED_BITS_METADATA, 0) <= 0)
+  {
+    return true;
+  }
+  
+  boost::shared_ptr<QuantizedField> quantized;
+  
+  try
+  {
+    quantized.reset(new QuantizedField());
+    
+    if (!readQuantizedLayer(filename, partition, name, *quantized))
+    {
+      ERROR("Could not read the codes of quantized layer " << partition << "." << name << " in " << filename);
+      return false;
+    }
+  }
+  catch (std::exception &e)
+  {
+    ERROR("Could not read the codes of quantized layer " << partition << "." << name << " in " << filename << " : " << e.what());
+    return false;
+  }
+  
+  if (quantized->res() != fld.baseField->dataResolution())
+  {
+    ERROR("Codes of quantized layer " << partition << "." << name << " don't match its resolution");
+    return false;
+  }
+  
+  fld.quantized = quantized;
+  
+  return true;
+}
+
+void setQuantizedMetadata(Field3D::FieldRes::Ptr field, const QuantizedField &quantized)
+{
+  field->metadata().setIntMetadata(QUANTIZED_BITS_METADATA, quantized.bits());
+  field->metadata().setFloatMetadata(QUANTIZED_ERROR_BOUND_METADATA, float(quantized.errorBound()));
+  field->metadata().setFloatMetadata(QUANTIZED_MAX_ERROR_METADATA, float(quantized.maxError()));
+  field->metadata().setIntMetadata(QUANTIZED_ID_METADATA, quantized.id());
+}
+
+template <typename Data_T>
+static typename Field3D::SparseField<Data_T>::Ptr QuantizedPlaceholder(const typename Field3D::EmptyField<Data_T>::Vec &proxies)
+{
+  for (size_t i=0; i<proxies.size(); ++i)
+  {
+    if (proxies[i]->metadata().intMetadata(QUANTIZED_BITS_METADATA, 0) <= 0)
+    {
+      continue;
+    }
+    
+    typename Field3D::SparseField<Data_T>::Ptr field = new Field3D::SparseField<Data_T>();
+    
+    field->name = proxies[i]->name;
+    field->attribute = proxies[i]->attribute;
+    field->setMapping(proxies[i]->mapping());
+    field->copyMetadata(*proxies[i]);
+    field->setSize(proxies[i]->extents(), proxies[i]->dataWindow());
+    
+    return field;
+  }
+  
+  return typename Field3D::SparseField<Data_T>::Ptr();
+}
+
+bool readQuantizedPlaceholder(Field3D::Field3DInputFile *inFile, const std::string &partition, const std::string &name, Fld &fld)
+{
+  fld.shScalarField = QuantizedPlaceholder<Field3D::half>(readProxyScalarLayers<Field3D::half>(inFile, partition, name));
+  
+  if (fld.shScalarField)
+  {
+    fld.fieldType = SparseScalarField_Half;
+    fld.baseField = fld.shScalarField;
+    return true;
+  }
+  
+  fld.shVectorField = QuantizedPlaceholder<Field3D::V3h>(readProxyVectorLayers<Field3D::half>(inFile, partition, name));
+  
+  if (fld.shVectorField)
+  {
+    fld.fieldType = SparseVectorField_Half;
+    fld.baseField = fld.shVectorField;
+    return true;
+  }
+  
+  return false;
+}
 
 }
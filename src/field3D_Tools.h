@@ -33,8 +33,18 @@
 #ifndef FIELD3DTOOLS_H
 #define FIELD3DTOOLS_H
 
+#include <map>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <hdf5.h>
 
 #include <Field3D/Field3DFile.h>
 #include <Field3D/DenseField.h>
@@ -45,18 +55,39 @@
 #include <Field3D/InitIO.h>
 
 #include "tinyLogger.h"
+#include "parallel_Tools.h"
+#include "simd_Tools.h"
 
 namespace Field3DTools
 {
 
 const float SPARSE_THRESHOLD = 0.0000001f ;
 
+// layer metadata holding the block order picked by the automatic selection
+const char* const SPARSE_BLOCK_ORDER_METADATA = "SparseBlockOrder";
+
+// layer metadata of the quantized channels (see QuantizedField)
+const char* const QUANTIZED_BITS_METADATA = "QuantizedBits";
+const char* const QUANTIZED_ERROR_BOUND_METADATA = "QuantizedErrorBound";
+const char* const QUANTIZED_MAX_ERROR_METADATA = "QuantizedMaxError";
+// identifies the layer the codes of a QuantizedField are stored in
+const char* const QUANTIZED_ID_METADATA = "QuantizedId";
+
+// class name of the quantized layers once their codes are stored : Field3D
+//   doesn't know it and refuses them instead of reading an empty field
+const char* const QUANTIZED_CLASS_NAME = "f3d_maya_QuantizedField";
+
 
 template <typename FieldType>
 struct FieldTraits
 {
    static const bool IsSparse = false;
    
+   static int BlockOrder(typename FieldType::Ptr)
+   {
+      return 0;
+   }
+   
    static void SetSparseBlockOrder(typename FieldType::Ptr, int)
    {
    }
@@ -65,6 +96,11 @@ struct FieldTraits
    static void SetSparseBlockDefault(typename FieldType::Ptr, const DataType &)
    {
    }
+   
+   template <typename DataType>
+   static void SetBlockEmptyValue(typename FieldType::Ptr, int, int, int, const DataType &)
+   {
+   }
 };
 
 template <typename DataType>
@@ -74,6 +110,11 @@ struct FieldTraits<Field3D::SparseField<DataType> >
    
    static const bool IsSparse = true;
    
+   static int BlockOrder(typename FieldType::Ptr field)
+   {
+      return (field ? field->blockOrder() : 0);
+   }
+   
    static void SetSparseBlockOrder(typename FieldType::Ptr field, int order)
    {
       if (field && order > 0 && order != field->blockOrder())
@@ -102,6 +143,11 @@ struct FieldTraits<Field3D::SparseField<DataType> >
          }
       }
    }
+   
+   static void SetBlockEmptyValue(typename FieldType::Ptr field, int bi, int bj, int bk, const DataType &value)
+   {
+      field->setBlockEmptyValue(bi, bj, bk, value);
+   }
 };
 
 
@@ -126,8 +172,15 @@ enum SupportedFieldTypeEnum
    TypeUnsupported
 };
 
+class QuantizedField;
+
 struct Fld
 {
+   Fld()
+      : fieldType(TypeUnsupported)
+   {
+   }
+   
    SupportedFieldTypeEnum fieldType;
       
    Field3D::FieldRes::Ptr baseField;
@@ -149,6 +202,35 @@ struct Fld
    Field3D::MACField<Field3D::V3h>::Ptr mhField;
    Field3D::MACField<Field3D::V3f>::Ptr mfField;
    Field3D::MACField<Field3D::V3d>::Ptr mdField;
+   
+   // codes of a quantized layer, the typed pointer then holds its
+   //   placeholder (see loadQuantizedLayer)
+   boost::shared_ptr<const QuantizedField> quantized;
+   
+   // true when the typed pointer matching fieldType is set
+   //   (baseField may only hold a proxy)
+   bool isLoaded() const
+   {
+      switch (fieldType)
+      {
+      case DenseScalarField_Half:    return bool(dhScalarField);
+      case DenseScalarField_Float:   return bool(dfScalarField);
+      case DenseScalarField_Double:  return bool(ddScalarField);
+      case SparseScalarField_Half:   return bool(shScalarField);
+      case SparseScalarField_Float:  return bool(sfScalarField);
+      case SparseScalarField_Double: return bool(sdScalarField);
+      case DenseVectorField_Half:    return bool(dhVectorField);
+      case DenseVectorField_Float:   return bool(dfVectorField);
+      case DenseVectorField_Double:  return bool(ddVectorField);
+      case SparseVectorField_Half:   return bool(shVectorField);
+      case SparseVectorField_Float:  return bool(sfVectorField);
+      case SparseVectorField_Double: return bool(sdVectorField);
+      case MACField_Half:            return bool(mhField);
+      case MACField_Float:           return bool(mfField);
+      case MACField_Double:          return bool(mdField);
+      default:                       return false;
+      }
+   }
 };
 
 enum FieldTypeEnum
@@ -161,7 +243,62 @@ enum FieldDataTypeEnum
 {
    FLOAT,
    HALF,
-   DOUBLE
+   DOUBLE,
+   QUANT8,
+   QUANT16
+};
+
+// bits per code of the quantized data types, 0 for the others
+inline int quantizedBits(FieldDataTypeEnum dataType)
+{
+   return (dataType == QUANT8 ? 8 : (dataType == QUANT16 ? 16 : 0));
+}
+
+// ---------------------  File access
+//
+//   HDF5 is not thread safe : any access to a Field3D file (open, read,
+//   write, close) must hold the IO lock once more than one thread may do it
+//   (see the cache format prefetcher). The lock is recursive.
+
+boost::recursive_mutex& ioMutex();
+
+// true if the calling thread holds the IO lock
+//   (it must not wait on a thread that needs it)
+bool ioLockHeld();
+
+class IOLock
+{
+public:
+   
+   IOLock();
+   ~IOLock();
+   
+private:
+   
+   boost::recursive_mutex::scoped_lock m_lock;
+};
+
+// Disables the HDF5 error stack printing, for direct HDF5 accesses where a
+//   missing object is not an error
+class ScopedSilentErrors
+{
+public:
+   
+   ScopedSilentErrors()
+   {
+      H5Eget_auto2(H5E_DEFAULT, &m_func, &m_data);
+      H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+   }
+   
+   ~ScopedSilentErrors()
+   {
+      H5Eset_auto2(H5E_DEFAULT, m_func, m_data);
+   }
+   
+private:
+   
+   H5E_auto2_t m_func;
+   void *m_data;
 };
 
 // ---------------------  Infos
@@ -176,6 +313,29 @@ bool getFieldsResolution(Field3D::Field3DInputFile *inFile, const std::string &p
 bool getFieldValueType(Field3D::Field3DInputFile *inFile, const std::string &name, Fld &fld);
 bool getFieldValueType(Field3D::Field3DInputFile *inFile, const std::string &partition, const std::string &name, Fld &fld);
 
+// Reads the layer of a known type (as returned by probeFieldType) in a single pass
+bool getFieldValueType(Field3D::Field3DInputFile *inFile, const std::string &partition, const std::string &name, SupportedFieldTypeEnum type, Fld &fld);
+
+// Identifies the type of a layer from its HDF5 attributes (class name, components
+//   and bits per component) without reading any voxel data.
+//   Returns TypeUnsupported if the layer is not found or its type is not handled.
+//   An empty partition name matches any partition.
+SupportedFieldTypeEnum probeFieldType(const std::string &filename, const std::string &partition, const std::string &name);
+
+// Same on a file opened with H5Fopen, the IO lock must be held
+SupportedFieldTypeEnum probeFieldType(hid_t file, const std::string &partition, const std::string &name);
+
+// Identifies all the layers of a partition in a single pass over the file,
+//   types are added for the layers not already in the map
+void probeFieldTypes(hid_t file, const std::string &partition, std::map<std::string, SupportedFieldTypeEnum> &types);
+bool probeFieldTypes(const std::string &filename, const std::string &partition, std::map<std::string, SupportedFieldTypeEnum> &types);
+
+const char* fieldTypeName(SupportedFieldTypeEnum type);
+bool isVectorFieldType(SupportedFieldTypeEnum type);
+
+// Type of an in-memory field, as probeFieldType would identify it once written
+SupportedFieldTypeEnum fieldType(const Field3D::FieldRes::Ptr &field);
+
 template <typename Data_T>
 void setFieldProperties(Field3D::ResizableField<Data_T> &field,
                         const std::string &name,
@@ -277,6 +437,37 @@ typename Field3D::EmptyField<FIELD3D_VEC3_T<Data_T> >::Vec readProxyVectorLayers
    }
 }
 
+// Reads the proxy of a named layer, scalar or vector as identified by probeFieldType
+//   (falls back to trying both when the probe fails)
+template <class Data_T>
+typename Field3D::EmptyField<Data_T>::Vec readProbedProxyLayer(Field3D::Field3DInputFile *in,
+                                                               const std::string &filename,
+                                                               const std::string &partition,
+                                                               const std::string &name,
+                                                               SupportedFieldTypeEnum *type=0)
+{
+   SupportedFieldTypeEnum probed = probeFieldType(filename, partition, name);
+   
+   if (type)
+   {
+      *type = probed;
+   }
+   
+   if (probed != TypeUnsupported)
+   {
+      return in->readProxyLayer<Data_T>(partition, name, isVectorFieldType(probed));
+   }
+   
+   typename Field3D::EmptyField<Data_T>::Vec fields = in->readProxyLayer<Data_T>(partition, name, false);
+   
+   if (fields.empty())
+   {
+      fields = in->readProxyLayer<Data_T>(partition, name, true);
+   }
+   
+   return fields;
+}
+
 template <class Data_T>
 typename Field3D::Field<Data_T>::Vec readScalarLayers(Field3D::Field3DInputFile *in,
                                                       const std::string &partition,
@@ -355,6 +546,286 @@ typename Field3D::Field<FIELD3D_VEC3_T<Data_T> >::Vec readVectorLayers(Field3D::
    }
 }
 
+// ---------------------  Bulk copy helpers for the fast path readers
+//
+//   Dense fields and MAC components share the maya arrays layout, sparse
+//   blocks are contiguous in (k, j, i) order : copy whole runs instead of
+//   going through Field3D's generic iterators.
+//
+//   Note: these access the field storage directly, the plugin never turns
+//         on Field3D's dynamic sparse block loading.
+
+// Converts n values (plain copy when types match)
+template <typename SrcType, typename DstType>
+inline void convertRange(const SrcType *src, DstType *dst, size_t n)
+{
+   for (size_t i=0; i<n; ++i)
+   {
+      dst[i] = (DstType) src[i];
+   }
+}
+
+inline void convertRange(const float *src, float *dst, size_t n)
+{
+   memcpy(dst, src, n * sizeof(float));
+}
+
+inline void convertRange(const double *src, double *dst, size_t n)
+{
+   memcpy(dst, src, n * sizeof(double));
+}
+
+// Splits n vectors into planar x, y and z arrays (z may be null for 2D fluids)
+template <typename SrcType, typename DstType>
+inline void deinterleaveRange(const FIELD3D_VEC3_T<SrcType> *src, DstType *x, DstType *y, DstType *z, size_t n)
+{
+   if (z)
+   {
+      for (size_t i=0; i<n; ++i)
+      {
+         x[i] = (DstType) src[i].x;
+         y[i] = (DstType) src[i].y;
+         z[i] = (DstType) src[i].z;
+      }
+   }
+   else
+   {
+      for (size_t i=0; i<n; ++i)
+      {
+         x[i] = (DstType) src[i].x;
+         y[i] = (DstType) src[i].y;
+      }
+   }
+}
+
+// float and half triples into float arrays : vectorized kernels
+inline void deinterleaveRange(const Field3D::V3f *src, float *x, float *y, float *z, size_t n)
+{
+   if (z)
+   {
+      SimdTools::deinterleave3(&(src->x), x, y, z, n);
+   }
+   else
+   {
+      SimdTools::deinterleave2(&(src->x), x, y, n);
+   }
+}
+
+inline void deinterleaveRange(const Field3D::V3h *src, float *x, float *y, float *z, size_t n)
+{
+   if (z)
+   {
+      SimdTools::deinterleave3(&(src->x), x, y, z, n);
+   }
+   else
+   {
+      SimdTools::deinterleave2(&(src->x), x, y, n);
+   }
+}
+
+// Scalar destination : a single maya buffer
+template <typename ImportType, typename DstType>
+struct ScalarTarget
+{
+   typedef ImportType ValueType;
+   
+   ScalarTarget(DstType *dst)
+      : m_dst(dst)
+   {
+   }
+   
+   void copy(const ValueType *src, size_t off, size_t n) const
+   {
+      convertRange(src, m_dst + off, n);
+   }
+   
+   void fill(const ValueType &val, size_t off, size_t n) const
+   {
+      std::fill(m_dst + off, m_dst + off + n, (DstType) val);
+   }
+   
+   DstType *m_dst;
+};
+
+// Vector destination : planar x, y and z maya buffers
+template <typename ImportType, typename DstType>
+struct VectorTarget
+{
+   typedef FIELD3D_VEC3_T<ImportType> ValueType;
+   
+   VectorTarget(DstType *x, DstType *y, DstType *z)
+      : m_x(x), m_y(y), m_z(z)
+   {
+   }
+   
+   void copy(const ValueType *src, size_t off, size_t n) const
+   {
+      deinterleaveRange(src, m_x + off, m_y + off, (m_z ? m_z + off : 0), n);
+   }
+   
+   void fill(const ValueType &val, size_t off, size_t n) const
+   {
+      std::fill(m_x + off, m_x + off + n, (DstType) val.x);
+      std::fill(m_y + off, m_y + off + n, (DstType) val.y);
+      if (m_z)
+      {
+         std::fill(m_z + off, m_z + off + n, (DstType) val.z);
+      }
+   }
+   
+   DstType *m_x;
+   DstType *m_y;
+   DstType *m_z;
+};
+
+template <typename ImportType, typename DstType>
+ScalarTarget<ImportType, DstType> makeScalarTarget(DstType *dst)
+{
+   return ScalarTarget<ImportType, DstType>(dst);
+}
+
+template <typename ImportType, typename DstType>
+VectorTarget<ImportType, DstType> makeVectorTarget(DstType *x, DstType *y, DstType *z)
+{
+   return VectorTarget<ImportType, DstType>(x, y, z);
+}
+
+// Copies a range of a contiguous buffer
+template <typename Target>
+struct LinearRead
+{
+   typedef typename Target::ValueType ValueType;
+   
+   LinearRead(const ValueType *src, const Target &target)
+      : m_src(src), m_target(target)
+   {
+   }
+   
+   void operator()(size_t beg, size_t end) const
+   {
+      m_target.copy(m_src + beg, beg, end - beg);
+   }
+   
+   const ValueType *m_src;
+   Target m_target;
+};
+
+// Copies a range of sparse blocks (linear block indices), empty blocks
+//   are filled with their empty value
+template <typename Target>
+struct SparseBlockRead
+{
+   typedef typename Target::ValueType ValueType;
+   typedef Field3D::SparseField<ValueType> FieldType;
+   
+   SparseBlockRead(FieldType &field, const Target &target)
+      : m_field(field), m_target(target)
+   {
+      m_res = field.dataResolution();
+      m_min = field.dataWindow().min;
+      m_order = field.blockOrder();
+      m_blockRes = field.blockRes();
+   }
+   
+   void operator()(size_t bbeg, size_t bend) const
+   {
+      int bsize = 1 << m_order;
+      size_t sx = m_res.x;
+      size_t sxy = sx * m_res.y;
+      
+      for (size_t b=bbeg; b<bend; ++b)
+      {
+         int bi = int(b % m_blockRes.x);
+         int bj = int((b / m_blockRes.x) % m_blockRes.y);
+         int bk = int(b / (size_t(m_blockRes.x) * m_blockRes.y));
+         
+         int i0 = bi << m_order;
+         int j0 = bj << m_order;
+         int k0 = bk << m_order;
+         int i1 = std::min(i0 + bsize, m_res.x);
+         int j1 = std::min(j0 + bsize, m_res.y);
+         int k1 = std::min(k0 + bsize, m_res.z);
+         
+         if (m_field.blockIsAllocated(bi, bj, bk))
+         {
+            // block data is contiguous in (k, j, i) order
+            const ValueType *block = &(m_field.fastLValue(m_min.x + i0, m_min.y + j0, m_min.z + k0));
+            
+            for (int k=k0; k<k1; ++k)
+            {
+               for (int j=j0; j<j1; ++j)
+               {
+                  m_target.copy(block + (((k - k0) << (2 * m_order)) + ((j - j0) << m_order)),
+                                k * sxy + j * sx + i0, i1 - i0);
+               }
+            }
+         }
+         else
+         {
+            ValueType empty = m_field.getBlockEmptyValue(bi, bj, bk);
+            
+            for (int k=k0; k<k1; ++k)
+            {
+               if (i0 == 0 && i1 == m_res.x)
+               {
+                  // whole rows : fill the block slice at once
+                  m_target.fill(empty, k * sxy + j0 * sx, (j1 - j0) * sx);
+                  continue;
+               }
+               
+               for (int j=j0; j<j1; ++j)
+               {
+                  m_target.fill(empty, k * sxy + j * sx + i0, i1 - i0);
+               }
+            }
+         }
+      }
+   }
+   
+   FieldType &m_field;
+   Target m_target;
+   Field3D::V3i m_res;
+   Field3D::V3i m_min;
+   int m_order;
+   Field3D::V3i m_blockRes;
+};
+
+template <typename Target>
+bool readLinear(const typename Target::ValueType *src, size_t n, const Target &target)
+{
+   try
+   {
+      ParallelTools::parallelFor(0, n, ParallelTools::MIN_TASK_SIZE, LinearRead<Target>(src, target));
+   }
+   catch (std::exception &e)
+   {
+      ERROR( std::string("Problem while reading field : ") + e.what());
+      return false;
+   }
+   
+   return true;
+}
+
+template <typename Target>
+bool readSparseBlocks(Field3D::SparseField<typename Target::ValueType> &field, const Target &target)
+{
+   Field3D::V3i bres = field.blockRes();
+   size_t nblocks = size_t(bres.x) * size_t(bres.y) * size_t(bres.z);
+   size_t bsize = size_t(1) << (3 * field.blockOrder());
+   
+   try
+   {
+      ParallelTools::parallelFor(0, nblocks, ParallelTools::grainSize(bsize), SparseBlockRead<Target>(field, target));
+   }
+   catch (std::exception &e)
+   {
+      ERROR( std::string("Problem while reading sparse field : ") + e.what());
+      return false;
+   }
+   
+   return true;
+}
+
 // ---------------------  Read Field3d field into raw arrays
 
 template <typename ImportType, typename MayaArray>
@@ -479,94 +950,1277 @@ bool readMACField(typename Field3D::MACField<FIELD3D_VEC3_T<ImportType> >::Ptr f
    resolution[1] = (unsigned int) reso.y;
    resolution[2] = (unsigned int) reso.z;
    
-   // copy data into MAC field
-   Field3D::MACComponent compo[3] = {Field3D::MACCompU, Field3D::MACCompV, Field3D::MACCompW};
-   unsigned int off = 0;
-   unsigned int r[3] = {0, 0, 0};
+   if (resolution[0] * resolution[1] * resolution[2] == 0)
+   {
+      return true;
+   }
+   
+   Field3D::V3i dmin = field->dataWindow().min;
+   
+   // each component is stored contiguously in the same order as the maya array
+   const typename FieldType::real_t *comp[3] = {&(field->u(dmin.x, dmin.y, dmin.z)),
+                                                &(field->v(dmin.x, dmin.y, dmin.z)),
+                                                &(field->w(dmin.x, dmin.y, dmin.z))};
+   size_t size[3] = {size_t(resolution[0] + 1) * resolution[1] * resolution[2],
+                     size_t(resolution[0]) * (resolution[1] + 1) * resolution[2],
+                     size_t(resolution[0]) * resolution[1] * (resolution[2] + 1)};
+   size_t off = 0;
    
    for (unsigned int cp=0; cp<3; ++cp)
    {
-      if (cp == 0)
-      {
-         off = 0;
-         r[0] = resolution[0]+1;
-         r[1] = resolution[1];
-         r[2] = resolution[2];
-      }
-      else if (cp == 1)
-      {
-         off += r[0] * r[1] * r[2];
-         r[0] = resolution[0];
-         r[1] = resolution[1]+1;
-         r[2] = resolution[2];
-      }
-      else if (cp == 2)
-      {
-         off += r[0] * r[1] * r[2];
-         r[0] = resolution[0];
-         r[1] = resolution[1];
-         r[2] = resolution[2]+1;
-      }
-      
-      if (off + r[0] * r[1] * r[2] > data.length())
+      // 2D fluids don't have the last component
+      if (off + size[cp] > data.length())
       {
          break;
       }
-
-      typename FieldType::mac_comp_iterator it = field->begin_comp(compo[cp]);
-      typename FieldType::mac_comp_iterator itend = field->end_comp(compo[cp]);
       
-      for ( ; it != itend; ++it)
+      if (!readLinear(comp[cp], size[cp], makeScalarTarget<typename FieldType::real_t>(&data[0] + off)))
       {
-         data[off + it.x + r[0] * (it.y + r[1] * it.z)] = *it;
+         return false;
       }
-
+      
+      off += size[cp];
    }
 
    return true;
 }
 
 template <typename ImportType, typename MayaArray>
-bool readScalarFieldFromFile(Field3D::Field3DInputFile *in,
-                             const std::string &fluidName,
-                             const std::string &fieldName,
-                             MayaArray &data)
+bool readDenseScalarField(typename Field3D::DenseField<ImportType>::Ptr field,
+                          MayaArray &data)
 {
-   typename Field3D::Field<ImportType>::Vec sl = readScalarLayers<ImportType>(in, fluidName, fieldName);
+   if (!field)
+   {
+      return false;
+   }
    
-   return readScalarField(sl[0], data);
-}
-
-
-template <typename ImportType, typename MayaArray>
-bool readVectorFieldFromFile(Field3D::Field3DInputFile *in,
-                             const std::string &fluidName,
-                             const std::string &fieldName,
-                             MayaArray &data)
-{
-   typename Field3D::Field<FIELD3D_VEC3_T<ImportType> >::Vec sl = readVectorLayers<ImportType>(in, fluidName, fieldName)       ;
+   Field3D::V3i reso = field->dataResolution();
+   Field3D::V3i dmin = field->dataWindow().min;
    
-   return readVectorField(sl[0], data);
+   size_t nvoxels = size_t(reso.x) * size_t(reso.y) * size_t(reso.z);
+   
+   if (data.length() < nvoxels)
+   {
+      return false;
+   }
+   
+   if (nvoxels == 0)
+   {
+      return true;
+   }
+   
+   return readLinear(&(field->fastValue(dmin.x, dmin.y, dmin.z)), nvoxels,
+                     makeScalarTarget<ImportType>(&data[0]));
 }
 
 template <typename ImportType, typename MayaArray>
-bool readMACFieldFromFile(Field3D::Field3DInputFile *in,
-                             const std::string &fluidName,
-                             const std::string &fieldName,
-                             MayaArray &data)
+bool readSparseScalarField(typename Field3D::SparseField<ImportType>::Ptr field,
+                           MayaArray &data)
 {
-   typedef typename Field3D::Field<FIELD3D_VEC3_T<ImportType> > FieldType;
-   typedef typename Field3D::MACField<FIELD3D_VEC3_T<ImportType> > MACFieldType;
+   if (!field)
+   {
+      return false;
+   }
+   
+   Field3D::V3i reso = field->dataResolution();
+   
+   size_t nvoxels = size_t(reso.x) * size_t(reso.y) * size_t(reso.z);
+   
+   if (data.length() < nvoxels)
+   {
+      return false;
+   }
+   
+   if (nvoxels == 0)
+   {
+      return true;
+   }
+   
+   return readSparseBlocks(*field, makeScalarTarget<ImportType>(&data[0]));
+}
+
+template <typename ImportType, typename MayaArray>
+bool readDenseVectorField(typename Field3D::DenseField<FIELD3D_VEC3_T<ImportType> >::Ptr field,
+                          MayaArray &data)
+{
+   if (!field)
+   {
+      return false;
+   }
+   
+   Field3D::V3i reso = field->dataResolution();
+   Field3D::V3i dmin = field->dataWindow().min;
+   
+   size_t nvoxels = size_t(reso.x) * size_t(reso.y) * size_t(reso.z);
+   
+   if (data.length() < 2 * nvoxels)
+   {
+      return false;
+   }
+   
+   if (nvoxels == 0)
+   {
+      return true;
+   }
+   
+   bool is2D = (data.length() < 3 * nvoxels);
+   
+   return readLinear(&(field->fastValue(dmin.x, dmin.y, dmin.z)), nvoxels,
+                     makeVectorTarget<ImportType>(&data[0], &data[0] + nvoxels,
+                                                  (is2D ? 0 : &data[0] + 2 * nvoxels)));
+}
+
+template <typename ImportType, typename MayaArray>
+bool readSparseVectorField(typename Field3D::SparseField<FIELD3D_VEC3_T<ImportType> >::Ptr field,
+                           MayaArray &data)
+{
+   if (!field)
+   {
+      return false;
+   }
+   
+   Field3D::V3i reso = field->dataResolution();
+   
+   size_t nvoxels = size_t(reso.x) * size_t(reso.y) * size_t(reso.z);
+   
+   if (data.length() < 2 * nvoxels)
+   {
+      return false;
+   }
+   
+   if (nvoxels == 0)
+   {
+      return true;
+   }
+   
+   bool is2D = (data.length() < 3 * nvoxels);
+   
+   return readSparseBlocks(*field, makeVectorTarget<ImportType>(&data[0], &data[0] + nvoxels,
+                                                                (is2D ? 0 : &data[0] + 2 * nvoxels)));
+}
+
+template <typename ImportType, typename MayaArray>
+bool readScalarFieldFromFile(Field3D::Field3DInputFile *in,
+                             const std::string &fluidName,
+                             const std::string &fieldName,
+                             MayaArray &data)
+{
+   typename Field3D::Field<ImportType>::Vec sl = readScalarLayers<ImportType>(in, fluidName, fieldName);
+   
+   return readScalarField(sl[0], data);
+}
+
+
+template <typename ImportType, typename MayaArray>
+bool readVectorFieldFromFile(Field3D::Field3DInputFile *in,
+                             const std::string &fluidName,
+                             const std::string &fieldName,
+                             MayaArray &data)
+{
+   typename Field3D::Field<FIELD3D_VEC3_T<ImportType> >::Vec sl = readVectorLayers<ImportType>(in, fluidName, fieldName)       ;
+   
+   return readVectorField(sl[0], data);
+}
+
+template <typename ImportType, typename MayaArray>
+bool readMACFieldFromFile(Field3D::Field3DInputFile *in,
+                             const std::string &fluidName,
+                             const std::string &fieldName,
+                             MayaArray &data)
+{
+   typedef typename Field3D::Field<FIELD3D_VEC3_T<ImportType> > FieldType;
+   typedef typename Field3D::MACField<FIELD3D_VEC3_T<ImportType> > MACFieldType;
+   
+   typename FieldType::Vec sl = readVectorLayers<ImportType>(in, fluidName, fieldName);
+   
+   return readMACField(Field3D::field_dynamic_cast<MACFieldType>(sl[0]), data);
+}
+
+
+// ---------------------  Write raw arrays into Field3D files
+
+typedef void writeMetadataFunc(Field3D::FieldRes::Ptr field, void*);
+
+// Read only array over a raw buffer, usable as the MayaArray parameter of
+//   the writers below (they only need length() and operator[])
+template <typename T>
+class ArrayView
+{
+public:
+   
+   ArrayView(const T *data, unsigned int length)
+      : m_data(data), m_length(length)
+   {
+   }
+   
+   unsigned int length() const { return m_length; }
+   
+   const T& operator[](unsigned int i) const { return m_data[i]; }
+   
+private:
+   
+   const T *m_data;
+   unsigned int m_length;
+};
+
+// Converts a range of z slices of a maya array (starting at srcOffset) into
+//   a contiguous buffer. DenseField and MACField components storage have the
+//   same x fastest layout as maya arrays.
+template <typename ExportType, typename MayaArray>
+struct DenseSlabCopy
+{
+   DenseSlabCopy(const MayaArray &src, ExportType *dst, size_t sliceSize, size_t srcOffset=0)
+      : m_src(src), m_dst(dst), m_sliceSize(sliceSize), m_srcOffset(srcOffset)
+   {
+   }
+   
+   void operator()(size_t kbeg, size_t kend) const
+   {
+      size_t beg = kbeg * m_sliceSize;
+      size_t end = kend * m_sliceSize;
+      
+      ExportType *dst = m_dst + beg;
+      
+      for (size_t i=beg; i<end; ++i, ++dst)
+      {
+         *dst = (ExportType) m_src[(unsigned int) (m_srcOffset + i)];
+      }
+   }
+   
+   const MayaArray &m_src;
+   ExportType *m_dst;
+   size_t m_sliceSize;
+   size_t m_srcOffset;
+};
+
+// Scalar voxel source for the sparse block builder
+template <typename ExportType, typename MayaArray>
+struct SparseScalarSource
+{
+   typedef ExportType ValueType;
+   
+   SparseScalarSource(const MayaArray &data)
+      : m_data(data)
+   {
+   }
+   
+   ValueType operator()(size_t off) const
+   {
+      return (ExportType) m_data[(unsigned int) off];
+   }
+   
+   static bool IsSignificant(const ValueType &val)
+   {
+      return (val > SPARSE_THRESHOLD);
+   }
+   
+   static bool IsUniform(const ValueType &a, const ValueType &b, double tolerance)
+   {
+      return (std::fabs(double(a) - double(b)) <= tolerance);
+   }
+   
+   const MayaArray &m_data;
+};
+
+// Vector voxel source for the sparse block builder (planar maya layout)
+template <typename ExportType, typename MayaArray>
+struct SparseVectorSource
+{
+   typedef FIELD3D_VEC3_T<ExportType> ValueType;
+   
+   SparseVectorSource(const MayaArray &data, size_t ybase, size_t zbase, bool is3D)
+      : m_data(data), m_ybase(ybase), m_zbase(zbase), m_is3D(is3D)
+   {
+   }
+   
+   ValueType operator()(size_t off) const
+   {
+      // TODO : check conversion
+      ExportType a = (ExportType) m_data[(unsigned int) off];
+      ExportType b = (ExportType) m_data[(unsigned int) (m_ybase + off)];
+      ExportType c = (ExportType) (m_is3D ? m_data[(unsigned int) (m_zbase + off)] : 0.0f);
+      
+      return ValueType(a, b, c);
+   }
+   
+   static bool IsSignificant(const ValueType &val)
+   {
+      return (val.x*val.x + val.y*val.y + val.z*val.z > SPARSE_THRESHOLD);
+   }
+   
+   static bool IsUniform(const ValueType &a, const ValueType &b, double tolerance)
+   {
+      return (std::fabs(double(a.x) - double(b.x)) <= tolerance &&
+              std::fabs(double(a.y) - double(b.y)) <= tolerance &&
+              std::fabs(double(a.z) - double(b.z)) <= tolerance);
+   }
+   
+   const MayaArray &m_data;
+   size_t m_ybase;
+   size_t m_zbase;
+   bool m_is3D;
+};
+
+// Fills a range of sparse blocks (linear block indices) from a voxel source.
+//   A block is only allocated if one of its voxels is significant, it is then
+//   filled in one pass in block memory order. With a tolerance >= 0, a block
+//   whose voxels all are within it of its first voxel stays unallocated and
+//   gets that voxel as its empty value.
+template <typename Source>
+struct SparseBlockFill
+{
+   typedef typename Source::ValueType ValueType;
+   typedef Field3D::SparseField<ValueType> FieldType;
+   
+   SparseBlockFill(FieldType &field, const Source &src, unsigned int res[3], double tolerance)
+      : m_field(field), m_src(src), m_tolerance(tolerance)
+   {
+      m_res[0] = res[0];
+      m_res[1] = res[1];
+      m_res[2] = res[2];
+      m_order = field.blockOrder();
+      m_blockRes = field.blockRes();
+   }
+   
+   void operator()(size_t bbeg, size_t bend) const
+   {
+      int bsize = 1 << m_order;
+      size_t sx = m_res[0];
+      size_t sxy = sx * m_res[1];
+      
+      for (size_t b=bbeg; b<bend; ++b)
+      {
+         int bi = int(b % m_blockRes.x);
+         int bj = int((b / m_blockRes.x) % m_blockRes.y);
+         int bk = int(b / (size_t(m_blockRes.x) * m_blockRes.y));
+         
+         unsigned int i0 = bi << m_order;
+         unsigned int j0 = bj << m_order;
+         unsigned int k0 = bk << m_order;
+         unsigned int i1 = std::min(i0 + bsize, m_res[0]);
+         unsigned int j1 = std::min(j0 + bsize, m_res[1]);
+         unsigned int k1 = std::min(k0 + bsize, m_res[2]);
+         
+         // is there anything to store in this block ?
+         bool used = false;
+         
+         for (unsigned int k=k0; k<k1 && !used; ++k)
+         {
+            for (unsigned int j=j0; j<j1 && !used; ++j)
+            {
+               size_t off = k * sxy + j * sx;
+               
+               for (unsigned int i=i0; i<i1; ++i)
+               {
+                  if (Source::IsSignificant(m_src(off + i)))
+                  {
+                     used = true;
+                     break;
+                  }
+               }
+            }
+         }
+         
+         if (!used)
+         {
+            continue;
+         }
+         
+         if (m_tolerance >= 0.0)
+         {
+            ValueType first = m_src(k0 * sxy + j0 * sx + i0);
+            bool uniform = true;
+            
+            for (unsigned int k=k0; k<k1 && uniform; ++k)
+            {
+               for (unsigned int j=j0; j<j1 && uniform; ++j)
+               {
+                  size_t off = k * sxy + j * sx;
+                  
+                  for (unsigned int i=i0; i<i1; ++i)
+                  {
+                     if (!Source::IsUniform(m_src(off + i), first, m_tolerance))
+                     {
+                        uniform = false;
+                        break;
+                     }
+                  }
+               }
+            }
+            
+            if (uniform)
+            {
+               m_field.setBlockEmptyValue(bi, bj, bk, first);
+               continue;
+            }
+         }
+         
+         // allocates the block, its data is contiguous in (k, j, i) order
+         ValueType empty = m_field.getBlockEmptyValue(bi, bj, bk);
+         ValueType *block = &(m_field.fastLValue(i0, j0, k0));
+         
+         for (unsigned int k=k0; k<k1; ++k)
+         {
+            for (unsigned int j=j0; j<j1; ++j)
+            {
+               size_t off = k * sxy + j * sx;
+               ValueType *dst = block + (((k - k0) << (2 * m_order)) + ((j - j0) << m_order));
+               
+               for (unsigned int i=i0; i<i1; ++i, ++dst)
+               {
+                  ValueType val = m_src(off + i);
+                  
+                  *dst = (Source::IsSignificant(val) ? val : empty);
+               }
+            }
+         }
+      }
+   }
+   
+   FieldType &m_field;
+   Source m_src;
+   double m_tolerance;
+   unsigned int m_res[3];
+   int m_order;
+   Field3D::V3i m_blockRes;
+};
+
+// Builds the sparse field content block by block, in parallel. Uniform blocks
+//   are detected when uniformTolerance >= 0.
+template <typename Source>
+bool fillSparseField(Field3D::SparseField<typename Source::ValueType> &field,
+                     const Source &src,
+                     unsigned int res[3],
+                     const std::string &fieldName,
+                     double uniformTolerance=-1.0)
+{
+   Field3D::V3i bres = field.blockRes();
+   size_t nblocks = size_t(bres.x) * size_t(bres.y) * size_t(bres.z);
+   size_t bsize = size_t(1) << (3 * field.blockOrder());
+   
+   SparseBlockFill<Source> fill(field, src, res, uniformTolerance);
+   
+   try
+   {
+      ParallelTools::parallelFor(0, nblocks, ParallelTools::grainSize(bsize), fill);
+   }
+   catch (std::exception &e)
+   {
+      ERROR( std::string("Problem while filling sparse field ") + fieldName + " : " + e.what());
+      return false;
+   }
+   
+   return true;
+}
+
+// Voxels of a fluid where a mask channel is above a threshold, optionally
+//   dilated. The other channels are zeroed outside of it, so that sparse
+//   fields drop them.
+class VoxelMask
+{
+public:
+   
+   VoxelMask();
+   
+   // res is the fluid resolution
+   void build(const Field3D::V3i &res, const float *data, double threshold);
+   
+   // grows the mask by n voxels in every direction
+   void dilate(int n);
+   
+   bool empty() const
+   {
+      return m_voxels.empty();
+   }
+   
+   const Field3D::V3i& res() const
+   {
+      return m_res;
+   }
+   
+   const unsigned char* voxels() const
+   {
+      return (m_voxels.empty() ? 0 : &(m_voxels[0]));
+   }
+   
+   // zeroes the voxels of a channel outside of the mask, planar vector
+   //   channels are handled one component at a time
+   template <typename T>
+   void apply(T *data) const;
+   
+   // number of voxels in the mask
+   size_t count() const;
+   
+private:
+   
+   Field3D::V3i m_res;
+   std::vector<unsigned char> m_voxels;
+};
+
+template <typename T>
+struct ApplyVoxelMask
+{
+   ApplyVoxelMask(const unsigned char *voxels, T *data, size_t sliceSize)
+      : m_voxels(voxels), m_data(data), m_sliceSize(sliceSize)
+   {
+   }
+   
+   void operator()(size_t kbeg, size_t kend) const
+   {
+      for (size_t i=kbeg*m_sliceSize; i<kend*m_sliceSize; ++i)
+      {
+         if (!m_voxels[i])
+         {
+            m_data[i] = T(0);
+         }
+      }
+   }
+   
+   const unsigned char *m_voxels;
+   T *m_data;
+   size_t m_sliceSize;
+};
+
+template <typename T>
+void VoxelMask::apply(T *data) const
+{
+   if (!data || m_voxels.empty())
+   {
+      return;
+   }
+   
+   size_t sliceSize = size_t(m_res.x) * size_t(m_res.y);
+   
+   ParallelTools::parallelFor(0, size_t(m_res.z), ParallelTools::grainSize(sliceSize),
+                              ApplyVoxelMask<T>(&(m_voxels[0]), data, sliceSize));
+}
+
+// Sparse blocks of a fluid computed once per frame from one or more mask
+//   channels. Sparse channels filled with a mask allocate the same blocks,
+//   and copy them whole without testing their own voxels.
+class BlockMask
+{
+public:
+   
+   BlockMask();
+   
+   // clears the mask, res is the fluid resolution
+   void reset(const Field3D::V3i &res, int blockOrder);
+   
+   // marks the blocks holding a voxel above threshold
+   void addScalar(const float *data, double threshold);
+   void addScalar(const double *data, double threshold);
+   
+   // same on the squared length of (a, b, c), c may be 0 (2D fluids)
+   void addVector(const float *a, const float *b, const float *c, double threshold);
+   void addVector(const double *a, const double *b, const double *c, double threshold);
+   
+   // marks the blocks holding a voxel of the mask (same resolution)
+   void addVoxels(const VoxelMask &mask);
+   
+   bool active(int bi, int bj, int bk) const
+   {
+      return (m_active[bi + m_blockRes.x * (bj + m_blockRes.y * size_t(bk))] != 0);
+   }
+   
+   int blockOrder() const
+   {
+      return m_order;
+   }
+   
+   const Field3D::V3i& blockRes() const
+   {
+      return m_blockRes;
+   }
+   
+   // number of active blocks
+   size_t count() const;
+   
+private:
+   
+   template <typename Test>
+   void add(const Test &test);
+   
+   Field3D::V3i m_res;
+   int m_order;
+   Field3D::V3i m_blockRes;
+   std::vector<unsigned char> m_active;
+};
+
+// Estimated cost of storing a channel with sparse blocks of a given order
+struct BlockOrderCost
+{
+   int order;
+   size_t activeBlocks;
+   size_t totalBlocks;
+   double memoryBytes;
+   double fileBytes;
+   double readCost; // in bytes read, with a fixed cost per allocated block
+   
+   double total() const
+   {
+      return memoryBytes + fileBytes + readCost;
+   }
+};
+
+// Picks the block order (3 to 6) of the cheapest layout of a channel from
+//   its occupancy (voxels above threshold). b is 0 for scalar channels, c
+//   may be 0 for 2D vector channels. valueSize is the size of a stored
+//   voxel. The cost of every order tried is appended to costs if given.
+int chooseBlockOrder(const Field3D::V3i &res, const float *a, const float *b, const float *c,
+                     double threshold, size_t valueSize, std::vector<BlockOrderCost> *costs=0);
+int chooseBlockOrder(const Field3D::V3i &res, const double *a, const double *b, const double *c,
+                     double threshold, size_t valueSize, std::vector<BlockOrderCost> *costs=0);
+
+// ---------------------  Quantized channels
+//
+//   Lossy storage of a channel as 8 or 16 bit codes : each sparse block
+//   keeps the range of its voxels (per component) and the codes map
+//   linearly to it. Field3D has no integer layers : the codes are HDF5
+//   datasets stored in the group of a half SparseField layer without any
+//   allocated block, which holds the mapping, resolution and metadata.
+//   The layer class is then renamed (QUANTIZED_CLASS_NAME) so that Field3D
+//   refuses it, the plugin rebuilds the placeholder from its proxy.
+
+class QuantizedField
+{
+public:
+   
+   QuantizedField();
+   
+   // components : 1 or 3, bits : 8 or 16
+   void reset(const Field3D::V3i &res, int components, int bits, int blockOrder);
+   
+   // Encodes the slices [z0, z1) of a channel, z0 being a multiple of the
+   //   block size. b and c are 0 for scalar channels, c may be 0 (2D
+   //   fluids). Distinct block rows can be encoded concurrently.
+   void encode(int z0, int z1, const float *a, const float *b, const float *c);
+   void encode(int z0, int z1, const double *a, const double *b, const double *c);
+   
+   // whole channel, in parallel
+   bool encode(const float *a, const float *b, const float *c);
+   bool encode(const double *a, const double *b, const double *c);
+   
+   // Decodes the slices [z0, z1) into maya arrays, same sources as encode
+   void decode(int z0, int z1, float *a, float *b, float *c) const;
+   void decode(int z0, int z1, double *a, double *b, double *c) const;
+   
+   // whole channel, in parallel
+   bool decode(float *a, float *b, float *c) const;
+   bool decode(double *a, double *b, double *c) const;
+   
+   const Field3D::V3i& res() const
+   {
+      return m_res;
+   }
+   
+   int components() const
+   {
+      return m_components;
+   }
+   
+   int bits() const
+   {
+      return m_bits;
+   }
+   
+   int blockOrder() const
+   {
+      return m_order;
+   }
+   
+   // largest error allowed by the block ranges : half a code step (the
+   //   float rounding of the decoded values comes on top)
+   double errorBound() const;
+   
+   // largest error measured while encoding
+   double maxError() const;
+   
+   // codes and ranges
+   size_t bytes() const;
+   
+   // process wide identifier, new on each reset (see QUANTIZED_ID_METADATA)
+   int id() const
+   {
+      return m_id;
+   }
+   
+   // codes and ranges datasets in a layer group
+   bool write(hid_t layer) const;
+   bool read(hid_t layer);
+   
+private:
+   
+   template <typename T>
+   void encodeSlab(int z0, int z1, const T *a, const T *b, const T *c);
+   
+   template <typename Code, typename T>
+   void decodeSlab(int z0, int z1, T *a, T *b, T *c) const;
+   
+   Field3D::V3i m_res;
+   int m_components;
+   int m_bits;
+   int m_order;
+   Field3D::V3i m_blockRes;
+   std::vector<unsigned char> m_codes; // planar, maya layout, bits / 8 bytes per code
+   std::vector<float> m_ranges; // min and max per block and component
+   std::vector<float> m_slabError; // per block row
+   int m_id;
+};
+
+// Stores the codes of a channel in the layer "name" of partition written
+//   with the metadata of field (see setQuantizedMetadata), and renames its
+//   class to QUANTIZED_CLASS_NAME. The file may still be open in a
+//   Field3DOutputFile.
+bool writeQuantizedLayer(const std::string &filename, const std::string &partition, const std::string &name, const QuantizedField &field);
+
+// false if the layer has no codes
+bool readQuantizedLayer(const std::string &filename, const std::string &partition, const std::string &name, QuantizedField &field);
+
+// Reads the codes of a loaded layer into fld.quantized if the layer is
+//   quantized (see QUANTIZED_BITS_METADATA). False if they couldn't be read.
+bool loadQuantizedLayer(const std::string &filename, const std::string &partition, const std::string &name, Fld &fld);
+
+// Placeholder of a quantized layer (an empty half SparseField) built from
+//   its proxy, as Field3D can't read it. False if the layer isn't quantized.
+bool readQuantizedPlaceholder(Field3D::Field3DInputFile *inFile, const std::string &partition, const std::string &name, Fld &fld);
+
+// bits, errors and id of a channel in the metadata of its layer
+void setQuantizedMetadata(Field3D::FieldRes::Ptr field, const QuantizedField &quantized);
+
+template <typename MayaArray>
+bool readQuantizedField(const QuantizedField &field, MayaArray &data)
+{
+   Field3D::V3i res = field.res();
+   size_t nvoxels = size_t(res.x) * size_t(res.y) * size_t(res.z);
+   
+   if (data.length() < (field.components() == 1 ? 1 : 2) * nvoxels)
+   {
+      ERROR("Quantized field resolution doesn't match the array length");
+      return false;
+   }
+   
+   if (nvoxels == 0)
+   {
+      return true;
+   }
+   
+   if (field.components() == 1)
+   {
+      return field.decode(&data[0], 0, 0);
+   }
+   
+   bool is2D = (data.length() < 3 * nvoxels);
+   
+   return field.decode(&data[0], &data[0] + nvoxels, (is2D ? 0 : &data[0] + 2 * nvoxels));
+}
+
+// One channel of a fluid export, split in z slabs that are filled
+//   independently. Sources are maya arrays (x fastest, then y, then z) read
+//   row by row with precomputed strides. Sparse fields allocate their blocks
+//   on first write : a slab then spans a whole row of blocks so that two
+//   slabs never touch the same block.
+class ChannelFill
+{
+public:
+   
+   ChannelFill(int zres, int blockOrder)
+      : m_zres(zres)
+      , m_depth(1 << blockOrder)
+   {
+   }
+   
+   virtual ~ChannelFill()
+   {
+   }
+   
+   size_t slabs() const
+   {
+      return size_t((m_zres + m_depth - 1) / m_depth);
+   }
+   
+   void fillSlab(size_t slab) const
+   {
+      int z0 = int(slab) * m_depth;
+      int z1 = std::min(z0 + m_depth, m_zres);
+      
+      fill(z0, z1);
+   }
+   
+protected:
+   
+   virtual void fill(int z0, int z1) const = 0;
+   
+   int m_zres;
+   int m_depth;
+};
+
+// the mask if it matches the blocks of field, 0 otherwise
+template <typename FieldType>
+const BlockMask* UsableMask(typename FieldType::Ptr field, const BlockMask *mask)
+{
+   if (!mask || !FieldTraits<FieldType>::IsSparse ||
+       mask->blockOrder() != FieldTraits<FieldType>::BlockOrder(field))
+   {
+      return 0;
+   }
+   
+   return mask;
+}
+
+template <typename FieldType>
+class ScalarChannelFill : public ChannelFill
+{
+public:
+   
+   typedef typename FieldType::value_type ValueType;
+   
+   // a mask is only used by sparse fields of the same block order. Sparse
+   //   blocks whose voxels all are within uniformTolerance (if >= 0) of the
+   //   first one are left unallocated with that value as their empty value.
+   ScalarChannelFill(typename FieldType::Ptr field, const float *data,
+                     const Field3D::V3i &res, double threshold,
+                     const BlockMask *mask=0, double uniformTolerance=-1.0)
+      : ChannelFill(res.z, FieldTraits<FieldType>::BlockOrder(field))
+      , m_field(field)
+      , m_data(data)
+      , m_res(res)
+      , m_threshold(threshold)
+      , m_mask(UsableMask<FieldType>(field, mask))
+      , m_uniform(uniformTolerance)
+   {
+   }
+   
+protected:
+   
+   virtual void fill(int z0, int z1) const
+   {
+      size_t ystride = size_t(m_res.x);
+      size_t zstride = ystride * size_t(m_res.y);
+      
+      if (!FieldTraits<FieldType>::IsSparse)
+      {
+         // DenseField storage has the maya array layout : straight row copies
+         for (int z=z0; z<z1; ++z)
+         {
+            for (int y=0; y<m_res.y; ++y)
+            {
+               const float *src = m_data + z * zstride + y * ystride;
+               ValueType *dst = &(m_field->fastLValue(0, y, z));
+               
+               for (int x=0; x<m_res.x; ++x)
+               {
+                  dst[x] = (ValueType) src[x];
+               }
+            }
+         }
+         return;
+      }
+      
+      // one block tile at a time so that the block being written stays in cache
+      for (int by=0; by<m_res.y; by+=m_depth)
+      {
+         int y1 = std::min(by + m_depth, m_res.y);
+         
+         for (int bx=0; bx<m_res.x; bx+=m_depth)
+         {
+            int x1 = std::min(bx + m_depth, m_res.x);
+            
+            if (m_mask && !m_mask->active(bx / m_depth, by / m_depth, z0 / m_depth))
+            {
+               continue;
+            }
+            
+            float value = 0.0f;
+            
+            if (m_uniform >= 0.0 && uniformTile(bx, x1, by, y1, z0, z1, value) && value > m_threshold)
+            {
+               FieldTraits<FieldType>::SetBlockEmptyValue(m_field, bx / m_depth, by / m_depth, z0 / m_depth, (ValueType) value);
+               continue;
+            }
+            
+            if (m_mask)
+            {
+               for (int z=z0; z<z1; ++z)
+               {
+                  for (int y=by; y<y1; ++y)
+                  {
+                     const float *src = m_data + z * zstride + y * ystride;
+                     
+                     for (int x=bx; x<x1; ++x)
+                     {
+                        m_field->fastLValue(x, y, z) = (ValueType) src[x];
+                     }
+                  }
+               }
+               continue;
+            }
+            
+            for (int z=z0; z<z1; ++z)
+            {
+               for (int y=by; y<y1; ++y)
+               {
+                  const float *src = m_data + z * zstride + y * ystride;
+                  
+                  for (int x=bx; x<x1; ++x)
+                  {
+                     if (src[x] > m_threshold)
+                     {
+                        m_field->fastLValue(x, y, z) = (ValueType) src[x];
+                     }
+                  }
+               }
+            }
+         }
+      }
+   }
+   
+   // true if the voxels of the tile all are within m_uniform of its first
+   //   voxel, returned in value
+   bool uniformTile(int x0, int x1, int y0, int y1, int z0, int z1, float &value) const
+   {
+      size_t ystride = size_t(m_res.x);
+      size_t zstride = ystride * size_t(m_res.y);
+      
+      value = m_data[z0 * zstride + y0 * ystride + x0];
+      
+      for (int z=z0; z<z1; ++z)
+      {
+         for (int y=y0; y<y1; ++y)
+         {
+            const float *src = m_data + z * zstride + y * ystride;
+            
+            for (int x=x0; x<x1; ++x)
+            {
+               if (std::fabs(src[x] - value) > m_uniform)
+               {
+                  return false;
+               }
+            }
+         }
+      }
+      
+      return true;
+   }
+   
+   typename FieldType::Ptr m_field;
+   const float *m_data;
+   Field3D::V3i m_res;
+   double m_threshold;
+   const BlockMask *m_mask;
+   double m_uniform;
+};
+
+// Color and texture : the third component is optional (2D fluids)
+template <typename FieldType>
+class VectorChannelFill : public ChannelFill
+{
+public:
+   
+   typedef typename FieldType::value_type VectorType;
+   typedef typename VectorType::BaseType ComponentType;
+   
+   VectorChannelFill(typename FieldType::Ptr field,
+                     const float *a, const float *b, const float *c,
+                     const Field3D::V3i &res, double threshold,
+                     const BlockMask *mask=0, double uniformTolerance=-1.0)
+      : ChannelFill(res.z, FieldTraits<FieldType>::BlockOrder(field))
+      , m_field(field)
+      , m_a(a)
+      , m_b(b)
+      , m_c(c)
+      , m_res(res)
+      , m_threshold(threshold)
+      , m_mask(UsableMask<FieldType>(field, mask))
+      , m_uniform(uniformTolerance)
+   {
+   }
    
-   typename FieldType::Vec sl = readVectorLayers<ImportType>(in, fluidName, fieldName);
+protected:
    
-   return readMACField(Field3D::field_dynamic_cast<MACFieldType>(sl[0]), data);
-}
+   virtual void fill(int z0, int z1) const
+   {
+      size_t ystride = size_t(m_res.x);
+      size_t zstride = ystride * size_t(m_res.y);
+      
+      if (!FieldTraits<FieldType>::IsSparse)
+      {
+         for (int z=z0; z<z1; ++z)
+         {
+            for (int y=0; y<m_res.y; ++y)
+            {
+               size_t i = z * zstride + y * ystride;
+               VectorType *dst = &(m_field->fastLValue(0, y, z));
+               
+               for (int x=0; x<m_res.x; ++x, ++i)
+               {
+                  dst[x] = VectorType((ComponentType) m_a[i], (ComponentType) m_b[i], (ComponentType) (m_c ? m_c[i] : 0.0f));
+               }
+            }
+         }
+         return;
+      }
+      
+      for (int by=0; by<m_res.y; by+=m_depth)
+      {
+         int y1 = std::min(by + m_depth, m_res.y);
+         
+         for (int bx=0; bx<m_res.x; bx+=m_depth)
+         {
+            int x1 = std::min(bx + m_depth, m_res.x);
+            
+            if (m_mask && !m_mask->active(bx / m_depth, by / m_depth, z0 / m_depth))
+            {
+               continue;
+            }
+            
+            float value[3] = {0.0f, 0.0f, 0.0f};
+            
+            if (m_uniform >= 0.0 && uniformTile(bx, x1, by, y1, z0, z1, value) &&
+                value[0]*value[0] + value[1]*value[1] + value[2]*value[2] > m_threshold)
+            {
+               FieldTraits<FieldType>::SetBlockEmptyValue(m_field, bx / m_depth, by / m_depth, z0 / m_depth,
+                                                          VectorType((ComponentType) value[0], (ComponentType) value[1], (ComponentType) value[2]));
+               continue;
+            }
+            
+            if (m_mask)
+            {
+               for (int z=z0; z<z1; ++z)
+               {
+                  for (int y=by; y<y1; ++y)
+                  {
+                     size_t i = z * zstride + y * ystride + bx;
+                     
+                     for (int x=bx; x<x1; ++x, ++i)
+                     {
+                        m_field->fastLValue(x, y, z) = VectorType((ComponentType) m_a[i], (ComponentType) m_b[i], (ComponentType) (m_c ? m_c[i] : 0.0f));
+                     }
+                  }
+               }
+               continue;
+            }
+            
+            for (int z=z0; z<z1; ++z)
+            {
+               for (int y=by; y<y1; ++y)
+               {
+                  size_t i = z * zstride + y * ystride + bx;
+                  
+                  for (int x=bx; x<x1; ++x, ++i)
+                  {
+                     float c = (m_c ? m_c[i] : 0.0f);
+                     
+                     if (m_a[i]*m_a[i] + m_b[i]*m_b[i] + c*c > m_threshold)
+                     {
+                        m_field->fastLValue(x, y, z) = VectorType((ComponentType) m_a[i], (ComponentType) m_b[i], (ComponentType) c);
+                     }
+                  }
+               }
+            }
+         }
+      }
+   }
+   
+   bool uniformTile(int x0, int x1, int y0, int y1, int z0, int z1, float value[3]) const
+   {
+      size_t ystride = size_t(m_res.x);
+      size_t zstride = ystride * size_t(m_res.y);
+      size_t first = z0 * zstride + y0 * ystride + x0;
+      
+      value[0] = m_a[first];
+      value[1] = m_b[first];
+      value[2] = (m_c ? m_c[first] : 0.0f);
+      
+      for (int z=z0; z<z1; ++z)
+      {
+         for (int y=y0; y<y1; ++y)
+         {
+            size_t i = z * zstride + y * ystride + x0;
+            
+            for (int x=x0; x<x1; ++x, ++i)
+            {
+               if (std::fabs(m_a[i] - value[0]) > m_uniform ||
+                   std::fabs(m_b[i] - value[1]) > m_uniform ||
+                   (m_c && std::fabs(m_c[i] - value[2]) > m_uniform))
+               {
+                  return false;
+               }
+            }
+         }
+      }
+      
+      return true;
+   }
+   
+   typename FieldType::Ptr m_field;
+   const float *m_a;
+   const float *m_b;
+   const float *m_c;
+   Field3D::V3i m_res;
+   double m_threshold;
+   const BlockMask *m_mask;
+   double m_uniform;
+};
 
+// One face component of a MAC velocity, a missing component is zeroed.
+//   Each component is stored contiguously with the maya array layout.
+template <typename FieldType>
+class MACChannelFill : public ChannelFill
+{
+public:
+   
+   typedef typename FieldType::real_t ComponentType;
+   
+   MACChannelFill(typename FieldType::Ptr field, const float *data,
+                  const Field3D::V3i &res, int component)
+      : ChannelFill(res.z + (component == 2 ? 1 : 0), 0)
+      , m_field(field)
+      , m_data(data)
+      , m_res(res + Field3D::V3i(component == 0 ? 1 : 0, component == 1 ? 1 : 0, component == 2 ? 1 : 0))
+      , m_component(component)
+   {
+   }
+   
+protected:
+   
+   virtual void fill(int z0, int z1) const
+   {
+      size_t sliceSize = size_t(m_res.x) * size_t(m_res.y);
+      
+      ComponentType *dst = (m_component == 0 ? &(m_field->u(0, 0, z0)) :
+                            (m_component == 1 ? &(m_field->v(0, 0, z0)) : &(m_field->w(0, 0, z0))));
+      
+      size_t n = size_t(z1 - z0) * sliceSize;
+      
+      if (!m_data)
+      {
+         std::fill(dst, dst + n, ComponentType(0.0f));
+         return;
+      }
+      
+      const float *src = m_data + size_t(z0) * sliceSize;
+      
+      for (size_t i=0; i<n; ++i)
+      {
+         dst[i] = (ComponentType) src[i];
+      }
+   }
+   
+   typename FieldType::Ptr m_field;
+   const float *m_data;
+   Field3D::V3i m_res;
+   int m_component;
+};
 
-// ---------------------  Write raw arrays into Field3D files
+// Scalar channel (b and c are 0) or vector channel (c may be 0) encoded
+//   into a quantized field, which is reset to the channel's resolution
+class QuantizedChannelFill : public ChannelFill
+{
+public:
+   
+   QuantizedChannelFill(QuantizedField &field,
+                        const float *a, const float *b, const float *c,
+                        const Field3D::V3i &res, int bits, int blockOrder)
+      : ChannelFill(res.z, blockOrder)
+      , m_field(field)
+      , m_a(a)
+      , m_b(b)
+      , m_c(c)
+   {
+      m_field.reset(res, (b ? 3 : 1), bits, blockOrder);
+   }
+   
+protected:
+   
+   virtual void fill(int z0, int z1) const
+   {
+      m_field.encode(z0, z1, m_a, m_b, m_c);
+   }
+   
+   QuantizedField &m_field;
+   const float *m_a;
+   const float *m_b;
+   const float *m_c;
+};
 
-typedef void writeMetadataFunc(Field3D::FieldRes::Ptr field, void*);
+// The slabs of all the channels of an export, numbered channel after
+//   channel, so that a single parallel loop balances the work whatever the
+//   channels exported. Channels are owned by the list.
+class ChannelFillList
+{
+public:
+   
+   ChannelFillList()
+      : m_first(1, 0)
+   {
+   }
+   
+   ~ChannelFillList()
+   {
+      for (size_t i=0; i<m_channels.size(); ++i)
+      {
+         delete m_channels[i];
+      }
+   }
+   
+   void add(ChannelFill *channel)
+   {
+      m_channels.push_back(channel);
+      m_first.push_back(m_first.back() + channel->slabs());
+   }
+   
+   size_t size() const
+   {
+      return m_channels.size();
+   }
+   
+   // fills slabs [b, e)
+   void operator()(size_t b, size_t e) const
+   {
+      size_t c = std::upper_bound(m_first.begin(), m_first.end(), b) - m_first.begin() - 1;
+      
+      for (size_t s=b; s<e; ++s)
+      {
+         while (s >= m_first[c+1])
+         {
+            ++c;
+         }
+         
+         m_channels[c]->fillSlab(s - m_first[c]);
+      }
+   }
+   
+   // sliceSize : number of voxels in a z slice of the fluid
+   void run(size_t sliceSize) const
+   {
+      ParallelTools::parallelFor(0, m_first.back(), ParallelTools::grainSize(sliceSize), Slabs(*this));
+   }
+   
+private:
+   
+   ChannelFillList(const ChannelFillList&);
+   ChannelFillList& operator=(const ChannelFillList&);
+   
+   // handed to the workers instead of the list
+   struct Slabs
+   {
+      Slabs(const ChannelFillList &list)
+         : m_list(list)
+      {
+      }
+      
+      void operator()(size_t b, size_t e) const
+      {
+         m_list(b, e);
+      }
+      
+      const ChannelFillList &m_list;
+   };
+   
+   std::vector<ChannelFill*> m_channels;
+   std::vector<size_t> m_first;
+};
 
 template <typename ExportType, typename MayaArray>
 bool writeDenseScalarField(Field3D::Field3DOutputFile *out,
@@ -587,19 +2241,39 @@ bool writeDenseScalarField(Field3D::Field3DOutputFile *out,
    // copy channel into the scalar field
    field->setSize(Field3D::V3i(res[0], res[1], res[2]));
    
-   for (unsigned int k=0; k<res[2]; ++k)
+   if (ParallelTools::isSerial())
    {
-      for (unsigned int j=0; j<res[1]; ++j)
+      for (unsigned int k=0; k<res[2]; ++k)
       {
-         for (unsigned int i=0; i<res[0]; ++i)
+         for (unsigned int j=0; j<res[1]; ++j)
          {
-            // TODO : check conversion
-            ExportType val = (ExportType) data[i + res[0] * (j + res[1] * k)];
-            
-            field->fastLValue(i, j, k) = val;
+            for (unsigned int i=0; i<res[0]; ++i)
+            {
+               // TODO : check conversion
+               ExportType val = (ExportType) data[i + res[0] * (j + res[1] * k)];
+               
+               field->fastLValue(i, j, k) = val;
+            }
          }
       }
    }
+   else if (res[0] > 0 && res[1] > 0 && res[2] > 0)
+   {
+      // convert z slabs straight into the field storage
+      size_t sliceSize = size_t(res[0]) * size_t(res[1]);
+      
+      DenseSlabCopy<ExportType, MayaArray> copy(data, &(field->fastLValue(0, 0, 0)), sliceSize);
+      
+      try
+      {
+         ParallelTools::parallelFor(0, res[2], ParallelTools::grainSize(sliceSize), copy);
+      }
+      catch (std::exception &e)
+      {
+         ERROR( std::string("Problem while filling dense scalar field ") + fieldName + " : " + e.what());
+         return false;
+      }
+   }
    
    if (writeMetadata)
    {
@@ -607,6 +2281,8 @@ bool writeDenseScalarField(Field3D::Field3DOutputFile *out,
    }
 
    // write it onto disk
+   IOLock lock;
+   
    if (!out->writeScalarLayer<ExportType>(field))
    {
       ERROR( std::string("Problem while writing dense scalar field ") + fieldName + " : Unknown Reason ");
@@ -623,13 +2299,15 @@ bool writeSparseScalarField(Field3D::Field3DOutputFile *out,
                             unsigned int res[3],
                             double transform[4][4],
                             const MayaArray &data,
+                            int blockOrder=-1,
+                            double uniformTolerance=-1.0,
                             writeMetadataFunc writeMetadata=0,
                             void *writeMetadataUser=0)
 {
    // field declaration
    typename Field3D::SparseField<ExportType>::Ptr field = new Field3D::SparseField<ExportType>();
    
-   // leave block order and empty value to defaults
+   // leave the empty value to default, and the block order if not given
    
    // properties
    Field3DTools::setFieldProperties(*field.get(), fluidName, fieldName, transform);
@@ -637,21 +2315,40 @@ bool writeSparseScalarField(Field3D::Field3DOutputFile *out,
    // copy channel into the scalar field
    field->setSize(Field3D::V3i(res[0], res[1], res[2]));
    
-   for (unsigned int k=0; k<res[2]; ++k)
+   if (blockOrder > 0)
    {
-      for (unsigned int j=0; j<res[1]; ++j)
+      FieldTraits<Field3D::SparseField<ExportType> >::SetSparseBlockOrder(field, blockOrder);
+      field->metadata().setIntMetadata(SPARSE_BLOCK_ORDER_METADATA, blockOrder);
+   }
+   
+   // uniform blocks are only detected block by block
+   if (ParallelTools::isSerial() && uniformTolerance < 0.0)
+   {
+      for (unsigned int k=0; k<res[2]; ++k)
       {
-         for (unsigned int i=0; i<res[0]; ++i)
+         for (unsigned int j=0; j<res[1]; ++j)
          {
-            ExportType val = (ExportType) data[i + res[0] * (j + res[1] * k)];
-            
-            if (val > SPARSE_THRESHOLD)
+            for (unsigned int i=0; i<res[0]; ++i)
             {
-               field->fastLValue(i, j, k) = val;
+               ExportType val = (ExportType) data[i + res[0] * (j + res[1] * k)];
+               
+               if (val > SPARSE_THRESHOLD)
+               {
+                  field->fastLValue(i, j, k) = val;
+               }
             }
          }
       }
    }
+   else
+   {
+      SparseScalarSource<ExportType, MayaArray> src(data);
+      
+      if (!fillSparseField(*field, src, res, fieldName, uniformTolerance))
+      {
+         return false;
+      }
+   }
    
    if (writeMetadata)
    {
@@ -659,6 +2356,8 @@ bool writeSparseScalarField(Field3D::Field3DOutputFile *out,
    }
    
    // write it onto disk
+   IOLock lock;
+   
    if (!out->writeScalarLayer<ExportType>(field))
    {
       ERROR( std::string("Problem while writing sparse scalar field ") + fieldName + " : Unknown Reason ");
@@ -724,6 +2423,8 @@ bool writeDenseVectorField(Field3D::Field3DOutputFile *out,
    }
 
    // write it onto disk
+   IOLock lock;
+   
    if (!out->writeScalarLayer<FIELD3D_VEC3_T<ExportType> >(field))
    {
       ERROR( std::string("Problem while writing dense vector field ") + fieldName + " : Unknown Reason ");
@@ -740,13 +2441,15 @@ bool writeSparseVectorField(Field3D::Field3DOutputFile *out,
                             unsigned int res[3],
                             double transform[4][4],
                             const MayaArray &data,
+                            int blockOrder=-1,
+                            double uniformTolerance=-1.0,
                             writeMetadataFunc writeMetadata=0,
                             void *writeMetadataUser=0)
 {
    // field declaration
    typename Field3D::SparseField<FIELD3D_VEC3_T<ExportType> >::Ptr field = new Field3D::SparseField<FIELD3D_VEC3_T<ExportType> >();
    
-   // leave block order and empty value to defaults
+   // leave the empty value to default, and the block order if not given
    
    // setup X, Y and Z field base offsets
    unsigned int nvoxels = res[0] * res[1] * res[2];
@@ -768,26 +2471,44 @@ bool writeSparseVectorField(Field3D::Field3DOutputFile *out,
    // copy channel into the vector field
    field->setSize(Field3D::V3i(res[0], res[1], res[2]));
    
-   for (unsigned int k=0; k<res[2]; ++k)
+   if (blockOrder > 0)
    {
-      for (unsigned int j=0; j<res[1]; ++j)
+      FieldTraits<Field3D::SparseField<FIELD3D_VEC3_T<ExportType> > >::SetSparseBlockOrder(field, blockOrder);
+      field->metadata().setIntMetadata(SPARSE_BLOCK_ORDER_METADATA, blockOrder);
+   }
+   
+   if (ParallelTools::isSerial() && uniformTolerance < 0.0)
+   {
+      for (unsigned int k=0; k<res[2]; ++k)
       {
-         for (unsigned int i=0; i<res[0]; ++i)
+         for (unsigned int j=0; j<res[1]; ++j)
          {
-            size_t off = i + res[0] * (j + res[1] * k);
-            
-            // TODO : check conversion
-            ExportType a = (ExportType) data[xbase + off];
-            ExportType b = (ExportType) data[ybase + off];
-            ExportType c = (ExportType) (is3D ? data[zbase + off] : 0.0f);
-            
-            if (a*a + b*b + c*c > SPARSE_THRESHOLD)
+            for (unsigned int i=0; i<res[0]; ++i)
             {
-               field->fastLValue(i, j, k) = Imath::Vec3<ExportType>(a, b, c);
+               size_t off = i + res[0] * (j + res[1] * k);
+               
+               // TODO : check conversion
+               ExportType a = (ExportType) data[xbase + off];
+               ExportType b = (ExportType) data[ybase + off];
+               ExportType c = (ExportType) (is3D ? data[zbase + off] : 0.0f);
+               
+               if (a*a + b*b + c*c > SPARSE_THRESHOLD)
+               {
+                  field->fastLValue(i, j, k) = Imath::Vec3<ExportType>(a, b, c);
+               }
             }
          }
       }
    }
+   else
+   {
+      SparseVectorSource<ExportType, MayaArray> src(data, ybase, zbase, is3D);
+      
+      if (!fillSparseField(*field, src, res, fieldName, uniformTolerance))
+      {
+         return false;
+      }
+   }
    
    if (writeMetadata)
    {
@@ -795,6 +2516,8 @@ bool writeSparseVectorField(Field3D::Field3DOutputFile *out,
    }
    
    // write it onto disk
+   IOLock lock;
+   
    if (!out->writeScalarLayer<FIELD3D_VEC3_T<ExportType> >(field))
    {
       ERROR( std::string("Problem while writing sparse vector field ") + fieldName + " : Unknown Reason ");
@@ -839,50 +2562,88 @@ bool writeMACVectorField(Field3D::Field3DOutputFile *out,
    // copy channel into the vector field
    field->setSize(Field3D::V3i(res[0], res[1], res[2]));
    
-   unsigned int x, y, z;
-   
-   // do the common job for all components (instead of doing it per component)
-   for (x = 0; x < res[0]; ++x)
+   if (ParallelTools::isSerial())
    {
+      unsigned int x, y, z;
+   
+      // do the common job for all components (instead of doing it per component)
+      for (x = 0; x < res[0]; ++x)
+      {
+         for (y = 0; y < res[1]; ++y)
+         {
+            for (z = 0; z < res[2]; ++z)
+            {
+               // TODO : check conversion
+               field->u(x, y, z) = (ExportType) v[xbase + x + (res[0] + 1) * (y + res[1] * z)];
+               field->v(x, y, z) = (ExportType) v[ybase + x + res[0] * (y + (res[1] + 1) * z)];
+               field->w(x, y, z) = (ExportType) (is3D ? v[zbase + x + res[0] * (y + res[1] * z)] : 0.0f);
+            }
+         }
+      }
+
+      // and fill the remaining component :u
+      x = res[0];
       for (y = 0; y < res[1]; ++y)
       {
          for (z = 0; z < res[2]; ++z)
          {
-            // TODO : check conversion
-            field->u(x, y, z) = (ExportType) v[xbase + x + (res[0] + 1) * (y + res[1] * z)];
-            field->v(x, y, z) = (ExportType) v[ybase + x + res[0] * (y + (res[1] + 1) * z)];
-            field->w(x, y, z) = (ExportType) (is3D ? v[zbase + x + res[0] * (y + res[1] * z)] : 0.0f);
+            field->u(res[0], y, z) = (ExportType) v[xbase + x + (res[0] + 1) * (y + res[1] * z)];
          }
       }
-   }
 
-   // and fill the remaining component :u
-   x = res[0];
-   for (y = 0; y < res[1]; ++y)
-   {
-      for (z = 0; z < res[2]; ++z)
+      // and fill the remaining component : v
+      y = res[1];
+      for (x = 0; x < res[0]; ++x)
       {
-         field->u(res[0], y, z) = (ExportType) v[xbase + x + (res[0] + 1) * (y + res[1] * z)];
+         for (z = 0; z < res[2]; ++z)
+         {
+            field->v(x, res[1], z) = (ExportType) v[ybase + x + res[0] * (y + (res[1] + 1) * z)];
+         }
       }
-   }
-
-   // and fill the remaining component : v
-   y = res[1];
-   for (x = 0; x < res[0]; ++x)
-   {
-      for (z = 0; z < res[2]; ++z)
+   
+      // and fill the remaining component : w
+      z = res[2];
+      for (x = 0; x < res[0]; ++x)
       {
-         field->v(x, res[1], z) = (ExportType) v[ybase + x + res[0] * (y + (res[1] + 1) * z)];
+         for (y = 0; y < res[1]; ++y)
+         {
+            field->w(x, y, res[2]) = (ExportType) (is3D ? v[zbase + x + res[0] * (y + res[1] * z)] : 0.0f);
+         }
       }
    }
-   
-   // and fill the remaining component : w
-   z = res[2];
-   for (x = 0; x < res[0]; ++x)
+   else if (res[0] > 0 && res[1] > 0 && res[2] > 0)
    {
-      for (y = 0; y < res[1]; ++y)
+      // each component is stored contiguously in the same order as the maya
+      // array : stream them slice by slice, extra face included
+      typedef DenseSlabCopy<ExportType, MayaArray> CompCopy;
+      
+      size_t usize = size_t(res[0] + 1) * res[1];
+      size_t vsize = size_t(res[0]) * (res[1] + 1);
+      size_t wsize = size_t(res[0]) * res[1];
+      
+      try
+      {
+         ParallelTools::parallelFor(0, res[2], ParallelTools::grainSize(usize),
+                                    CompCopy(v, &(field->u(0, 0, 0)), usize, xbase));
+         
+         ParallelTools::parallelFor(0, res[2], ParallelTools::grainSize(vsize),
+                                    CompCopy(v, &(field->v(0, 0, 0)), vsize, ybase));
+         
+         if (is3D)
+         {
+            ParallelTools::parallelFor(0, res[2] + 1, ParallelTools::grainSize(wsize),
+                                       CompCopy(v, &(field->w(0, 0, 0)), wsize, zbase));
+         }
+         else
+         {
+            ExportType *w = &(field->w(0, 0, 0));
+            std::fill(w, w + wsize * (res[2] + 1), ExportType(0.0f));
+         }
+      }
+      catch (std::exception &e)
       {
-         field->w(x, y, res[2]) = (ExportType) (is3D ? v[zbase + x + res[0] * (y + res[1] * z)] : 0.0f);
+         ERROR( std::string("Problem while filling MAC vector field ") + fieldName + " : " + e.what());
+         return false;
       }
    }
    
@@ -892,6 +2653,8 @@ bool writeMACVectorField(Field3D::Field3DOutputFile *out,
    }
 
    // write it onto disk
+   IOLock lock;
+   
    if (!out->writeScalarLayer<FIELD3D_VEC3_T<ExportType> >(field))
    {
       ERROR( std::string("Problem while writing MAC vector field ") + fieldName + " : Unknown Reason ");
@@ -901,6 +2664,97 @@ bool writeMACVectorField(Field3D::Field3DOutputFile *out,
    return true;
 }
 
+// A half SparseField without any allocated block (the layer Field3D
+//   writes) and the codes of the channel next to it
+template <typename Data_T>
+bool writeQuantizedLayerAs(Field3D::Field3DOutputFile *out,
+                           const std::string &filename,
+                           typename Field3D::SparseField<Data_T>::Ptr field,
+                           QuantizedField &quantized,
+                           writeMetadataFunc writeMetadata,
+                           void *writeMetadataUser)
+{
+   setQuantizedMetadata(field, quantized);
+   
+   if (writeMetadata)
+   {
+      writeMetadata(field, writeMetadataUser);
+   }
+   
+   LOG("Quantized " << field->name << "." << field->attribute << " to " << quantized.bits()
+       << " bits : error bound " << quantized.errorBound() << ", max error " << quantized.maxError());
+   
+   // write it onto disk
+   IOLock lock;
+   
+   if (!out->writeScalarLayer<Data_T>(field))
+   {
+      ERROR( std::string("Problem while writing quantized field ") + field->attribute + " : Unknown Reason ");
+      return false;
+   }
+   
+   return writeQuantizedLayer(filename, field->name, field->attribute, quantized);
+}
+
+// Scalar or vector channel (planar components, the third one is optional)
+//   stored with bits per code. filename is the file out writes to.
+template <typename E>
+bool writeQuantizedField(Field3D::Field3DOutputFile *out,
+                         const std::string &filename,
+                         const std::string &fluidName,
+                         const std::string &fieldName,
+                         unsigned int res[3],
+                         double transform[4][4],
+                         const E *data,
+                         unsigned int length,
+                         bool isVector,
+                         int bits,
+                         int blockOrder=-1,
+                         writeMetadataFunc writeMetadata=0,
+                         void *writeMetadataUser=0)
+{
+   Field3D::V3i fres(res[0], res[1], res[2]);
+   size_t nvoxels = size_t(res[0]) * size_t(res[1]) * size_t(res[2]);
+   
+   if (length < (isVector ? 2 : 1) * nvoxels)
+   {
+      return false;
+   }
+   
+   QuantizedField quantized;
+   
+   if (!isVector)
+   {
+      typename Field3D::SparseField<Field3D::half>::Ptr field = new Field3D::SparseField<Field3D::half>();
+      
+      Field3DTools::setFieldProperties(*field, fluidName, fieldName, transform);
+      field->setSize(fres);
+      FieldTraits<Field3D::SparseField<Field3D::half> >::SetSparseBlockOrder(field, blockOrder);
+      
+      quantized.reset(fres, 1, bits, field->blockOrder());
+      if (!quantized.encode(data, (const E*) 0, (const E*) 0))
+      {
+         return false;
+      }
+      
+      return writeQuantizedLayerAs<Field3D::half>(out, filename, field, quantized, writeMetadata, writeMetadataUser);
+   }
+   
+   typename Field3D::SparseField<Field3D::V3h>::Ptr field = new Field3D::SparseField<Field3D::V3h>();
+   
+   Field3DTools::setFieldProperties(*field, fluidName, fieldName, transform);
+   field->setSize(fres);
+   FieldTraits<Field3D::SparseField<Field3D::V3h> >::SetSparseBlockOrder(field, blockOrder);
+   
+   quantized.reset(fres, 3, bits, field->blockOrder());
+   if (!quantized.encode(data, data + nvoxels, (length >= 3 * nvoxels ? data + 2 * nvoxels : (const E*) 0)))
+   {
+      return false;
+   }
+   
+   return writeQuantizedLayerAs<Field3D::V3h>(out, filename, field, quantized, writeMetadata, writeMetadataUser);
+}
+
 }
 
 #endif
@@ -0,0 +1,418 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+
+#include "field3D_WriteBehind.h"
+#include "field3D_Tools.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <cstdlib>
+#include <exception>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace WriteBehind
+{
+
+static boost::mutex gMutex;
+static boost::condition_variable gCond;
+static std::deque<Job*> gJobs;
+static boost::thread *gThread = 0;
+static bool gStop = false;
+static std::set<const void*> gFailed; // owners with a failed job since their last flush
+static size_t gPending = 0;     // queued or running jobs
+static std::map<const void*, size_t> gOwnerPending;
+static size_t gPendingBytes = 0;
+static size_t gBudget = 0;
+static bool gBudgetSet = false;
+static std::vector<Buffer*> gPool;
+static size_t gPoolBytes = 0;
+
+static size_t defaultBudget()
+{
+   const char *env = getenv("FIELD3D_MAYA_WRITE_BEHIND_MB");
+   
+   if (env)
+   {
+      int v = atoi(env);
+      
+      if (v >= 0)
+      {
+         return size_t(v) * 1024 * 1024;
+      }
+      
+      WARNING("Invalid FIELD3D_MAYA_WRITE_BEHIND_MB value \"" << env << "\", write behind disabled");
+   }
+   
+   return 0;
+}
+
+// gMutex must be held
+static void queued(const Job *job)
+{
+   gPending += 1;
+   gPendingBytes += job->bytes();
+   gOwnerPending[job->owner()] += 1;
+}
+
+// gMutex must be held
+static void finished(const void *owner, size_t bytes, bool ok)
+{
+   gPending -= 1;
+   gPendingBytes -= bytes;
+   
+   std::map<const void*, size_t>::iterator it = gOwnerPending.find(owner);
+   
+   if (it != gOwnerPending.end() && --(it->second) == 0)
+   {
+      gOwnerPending.erase(it);
+   }
+   
+   if (!ok)
+   {
+      gFailed.insert(owner);
+   }
+}
+
+// gMutex must be held
+static size_t lockedBudget()
+{
+   if (!gBudgetSet)
+   {
+      gBudget = defaultBudget();
+      gBudgetSet = true;
+   }
+   return gBudget;
+}
+
+size_t budget()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   return lockedBudget();
+}
+
+void setBudget(size_t bytes)
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gBudget = bytes;
+   gBudgetSet = true;
+   
+   // let blocked producers re-check against the new budget
+   gCond.notify_all();
+}
+
+static bool runJob(Job *job)
+{
+   bool ok = false;
+   
+   try
+   {
+      ok = job->run();
+   }
+   catch (std::exception &e)
+   {
+      ERROR("Write behind job failed : " << e.what());
+   }
+   
+   delete job;
+   
+   return ok;
+}
+
+static void work()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   while (true)
+   {
+      while (gJobs.empty() && !gStop)
+      {
+         gCond.wait(lock);
+      }
+      
+      if (gJobs.empty())
+      {
+         break;
+      }
+      
+      Job *job = gJobs.front();
+      size_t bytes = job->bytes();
+      const void *owner = job->owner();
+      
+      gJobs.pop_front();
+      
+      lock.unlock();
+      
+      bool ok = runJob(job);
+      
+      lock.lock();
+      
+      finished(owner, bytes, ok);
+      
+      gCond.notify_all();
+   }
+}
+
+void push(Job *job)
+{
+   if (!job)
+   {
+      return;
+   }
+   
+   if (!isEnabled() || Field3DTools::ioLockHeld())
+   {
+      const void *owner = job->owner();
+      
+      if (!runJob(job))
+      {
+         boost::mutex::scoped_lock lock(gMutex);
+         
+         gFailed.insert(owner);
+      }
+      return;
+   }
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   // an oversized job still goes through once the queue is empty
+   while (gPending > 0 && gPendingBytes + job->bytes() > lockedBudget())
+   {
+      gCond.wait(lock);
+   }
+   
+   if (!gThread)
+   {
+      gStop = false;
+      gThread = new boost::thread(work);
+   }
+   
+   gJobs.push_back(job);
+   
+   queued(job);
+   
+   gCond.notify_all();
+}
+
+void pushBounded(Job *job, size_t maxPending)
+{
+   if (!job)
+   {
+      return;
+   }
+   
+   if (maxPending == 0 || Field3DTools::ioLockHeld())
+   {
+      const void *owner = job->owner();
+      
+      if (!runJob(job))
+      {
+         boost::mutex::scoped_lock lock(gMutex);
+         
+         gFailed.insert(owner);
+      }
+      return;
+   }
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   while (gPending >= maxPending)
+   {
+      gCond.wait(lock);
+   }
+   
+   if (!gThread)
+   {
+      gStop = false;
+      gThread = new boost::thread(work);
+   }
+   
+   gJobs.push_back(job);
+   
+   queued(job);
+   
+   gCond.notify_all();
+}
+
+bool flush(const void *owner)
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   if (gOwnerPending.count(owner) > 0 && Field3DTools::ioLockHeld())
+   {
+      // the worker needs the IO lock to finish
+      ERROR("Write behind flush called with the IO lock held");
+      return false;
+   }
+   
+   while (gOwnerPending.count(owner) > 0)
+   {
+      gCond.wait(lock);
+   }
+   
+   return (gFailed.erase(owner) == 0);
+}
+
+bool flush()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   if (gPending > 0 && Field3DTools::ioLockHeld())
+   {
+      // the worker needs the IO lock to finish
+      ERROR("Write behind flush called with the IO lock held");
+      return false;
+   }
+   
+   while (gPending > 0)
+   {
+      gCond.wait(lock);
+   }
+   
+   bool ok = gFailed.empty();
+   
+   gFailed.clear();
+   
+   return ok;
+}
+
+void shutdown()
+{
+   if (!flush())
+   {
+      ERROR("Some cache writes failed before unload");
+   }
+   
+   boost::thread *thread = 0;
+   std::vector<Buffer*> pool;
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      gStop = true;
+      gCond.notify_all();
+      
+      thread = gThread;
+      gThread = 0;
+      
+      pool.swap(gPool);
+      gPoolBytes = 0;
+   }
+   
+   if (thread)
+   {
+      thread->join();
+      delete thread;
+   }
+   
+   for (size_t i=0; i<pool.size(); ++i)
+   {
+      delete pool[i];
+   }
+}
+
+Buffer* acquireBuffer(size_t bytes)
+{
+   Buffer *buffer = 0;
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      // reuse the smallest pooled buffer that fits, or the largest one
+      size_t best = gPool.size();
+      
+      for (size_t i=0; i<gPool.size(); ++i)
+      {
+         if (best == gPool.size())
+         {
+            best = i;
+         }
+         else
+         {
+            size_t cur = gPool[i]->capacity();
+            size_t bst = gPool[best]->capacity();
+            
+            if (bst >= bytes ? (cur >= bytes && cur < bst) : (cur > bst))
+            {
+               best = i;
+            }
+         }
+      }
+      
+      if (best < gPool.size())
+      {
+         buffer = gPool[best];
+         gPoolBytes -= buffer->capacity();
+         gPool.erase(gPool.begin() + best);
+      }
+   }
+   
+   if (!buffer)
+   {
+      buffer = new Buffer();
+   }
+   
+   buffer->resize(bytes);
+   
+   return buffer;
+}
+
+void releaseBuffer(Buffer *buffer)
+{
+   if (!buffer)
+   {
+      return;
+   }
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      // keep at most a budget worth of idle buffers
+      if (gPoolBytes + buffer->capacity() <= lockedBudget())
+      {
+         gPoolBytes += buffer->capacity();
+         gPool.push_back(buffer);
+         return;
+      }
+   }
+   
+   delete buffer;
+}
+
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+
+#ifndef FIELD3D_MAYA_WRITEBEHIND
+#define FIELD3D_MAYA_WRITEBEHIND
+
+#include <vector>
+#include <cstddef>
+
+// Asynchronous writes for the cache format : the arrays maya hands to
+// writeFloatArray/writeDoubleArray are copied into pooled buffers and a
+// single worker thread converts and writes them while the simulation moves
+// on to the next channel or frame. The queue is bounded in bytes, push()
+// blocks when it is full.
+namespace WriteBehind
+{
+
+typedef std::vector<char> Buffer;
+
+class Job
+{
+public:
+   
+   // owner : what the job writes to, its failures are reported by flush(owner)
+   Job(size_t bytes, const void *owner=0) : m_bytes(bytes), m_owner(owner) {}
+   virtual ~Job() {}
+   
+   // false on failure (reported by the next flush of its owner)
+   virtual bool run() = 0;
+   
+   size_t bytes() const { return m_bytes; }
+   const void* owner() const { return m_owner; }
+   
+private:
+   
+   size_t m_bytes;
+   const void *m_owner;
+};
+
+// Queue budget in bytes.
+//   Defaults to the FIELD3D_MAYA_WRITE_BEHIND_MB environment variable (in
+//   megabytes), 0 (the default) disables the pipeline and writes stay
+//   synchronous.
+size_t budget();
+void setBudget(size_t bytes);
+
+inline bool isEnabled()
+{
+   return (budget() > 0);
+}
+
+// Queues a job and takes its ownership. Blocks while the queued bytes exceed
+//   the budget. When the caller holds the IO lock the job is run immediately
+//   as the worker could not make progress.
+void push(Job *job);
+
+// Queues a job whatever the budget, blocking while maxPending jobs are
+//   queued or running. 0 runs the job immediately. Used by exportF3d which
+//   bounds its pipeline in frames rather than bytes.
+void pushBounded(Job *job, size_t maxPending);
+
+// Waits for the queued jobs of owner, returns false if any of them failed
+//   since the last flush of owner
+bool flush(const void *owner);
+
+// Waits for all queued jobs, returns false if any failed since the last flush
+bool flush();
+
+// Flushes and stops the worker (plugin unload)
+void shutdown();
+
+// Buffers for the queued arrays, released ones are kept for reuse
+Buffer* acquireBuffer(size_t bytes);
+void releaseBuffer(Buffer *buffer);
+
+}
+
+#endif
@@ -0,0 +1,410 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include "file_Tools.h"
+
+#include <map>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <boost/thread/mutex.hpp>
+
+namespace FileTools
+{
+
+struct Listing
+{
+   time_t mtime;
+   time_t scanTime;
+   NameList names;
+};
+
+static boost::mutex gMutex;
+static std::map<std::string, Listing> gListings;
+
+static bool readDirectory(const std::string &dirname, std::vector<std::string> &names)
+{
+#ifdef _WIN32
+   WIN32_FIND_DATAA data;
+   
+   HANDLE h = FindFirstFileA((dirname + "\\*").c_str(), &data);
+   
+   if (h == INVALID_HANDLE_VALUE)
+   {
+      return false;
+   }
+   
+   do
+   {
+      if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+      {
+         names.push_back(data.cFileName);
+      }
+   }
+   while (FindNextFileA(h, &data));
+   
+   FindClose(h);
+#else
+   DIR *dir = opendir(dirname.c_str());
+   
+   if (!dir)
+   {
+      return false;
+   }
+   
+   struct dirent *entry;
+   
+   while ((entry = readdir(dir)) != 0)
+   {
+      if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+      {
+         continue;
+      }
+      
+      names.push_back(entry->d_name);
+   }
+   
+   closedir(dir);
+#endif
+   
+   std::sort(names.begin(), names.end());
+   
+   return true;
+}
+
+NameList listDirectory(const std::string &dirname)
+{
+   std::string dn = (dirname.length() > 0 ? dirname : std::string("."));
+   
+   // "dir/" and "dir" share the same listing
+   while (dn.length() > 1 && (dn[dn.length()-1] == '/' || dn[dn.length()-1] == '\\'))
+   {
+      dn.erase(dn.length()-1);
+   }
+   
+   struct stat st;
+   
+   if (stat(dn.c_str(), &st) != 0)
+   {
+      return NameList();
+   }
+   
+   {
+      boost::mutex::scoped_lock lock(gMutex);
+      
+      std::map<std::string, Listing>::iterator it = gListings.find(dn);
+      
+      // mtime has a one second resolution : a listing made during the
+      // second the directory was last modified may miss later changes
+      if (it != gListings.end() &&
+          it->second.mtime == st.st_mtime &&
+          it->second.mtime < it->second.scanTime)
+      {
+         return it->second.names;
+      }
+   }
+   
+   Listing listing;
+   
+   listing.mtime = st.st_mtime;
+   listing.scanTime = time(0);
+   
+   std::vector<std::string> *names = new std::vector<std::string>();
+   
+   listing.names = NameList(names);
+   
+   if (!readDirectory(dn, *names))
+   {
+      return NameList();
+   }
+   
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gListings[dn] = listing;
+   
+   return listing.names;
+}
+
+void clearDirectoryCache()
+{
+   boost::mutex::scoped_lock lock(gMutex);
+   
+   gListings.clear();
+}
+
+bool getFileStamp(const std::string &path, FileStamp &stamp)
+{
+   struct stat st;
+   
+   if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+   {
+      return false;
+   }
+   
+   stamp.size = (long long) st.st_size;
+   stamp.mtime = (long long) st.st_mtime;
+   
+   return true;
+}
+
+bool replaceFile(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+   return (MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+   return (rename(from.c_str(), to.c_str()) == 0);
+#endif
+}
+
+// ---
+
+#ifdef _WIN32
+
+FileLock::FileLock(const std::string &path)
+   : m_handle(0)
+{
+   HANDLE h = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   
+   if (h == INVALID_HANDLE_VALUE)
+   {
+      return;
+   }
+   
+   OVERLAPPED ov;
+   
+   memset(&ov, 0, sizeof(ov));
+   
+   if (!LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov))
+   {
+      CloseHandle(h);
+      return;
+   }
+   
+   m_handle = h;
+}
+
+FileLock::~FileLock()
+{
+   if (m_handle)
+   {
+      OVERLAPPED ov;
+      
+      memset(&ov, 0, sizeof(ov));
+      
+      UnlockFileEx((HANDLE) m_handle, 0, 1, 0, &ov);
+      CloseHandle((HANDLE) m_handle);
+   }
+}
+
+bool FileLock::locked() const
+{
+   return (m_handle != 0);
+}
+
+#else
+
+FileLock::FileLock(const std::string &path)
+   : m_fd(-1)
+{
+   int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+   
+   if (fd < 0)
+   {
+      return;
+   }
+   
+   // fcntl locks also hold on network file systems
+   struct flock fl;
+   
+   memset(&fl, 0, sizeof(fl));
+   fl.l_type = F_WRLCK;
+   fl.l_whence = SEEK_SET;
+   
+   int rv;
+   
+   do
+   {
+      rv = fcntl(fd, F_SETLKW, &fl);
+   }
+   while (rv != 0 && errno == EINTR);
+   
+   if (rv != 0)
+   {
+      close(fd);
+      return;
+   }
+   
+   m_fd = fd;
+}
+
+FileLock::~FileLock()
+{
+   if (m_fd >= 0)
+   {
+      // closing the file releases the lock
+      close(m_fd);
+   }
+}
+
+bool FileLock::locked() const
+{
+   return (m_fd >= 0);
+}
+
+#endif
+
+// ---
+
+FramePattern::FramePattern()
+   : m_literals(1)
+   , m_fields(0)
+{
+}
+
+FramePattern::FramePattern(const std::string &pattern)
+   : m_literals(1)
+   , m_fields(0)
+{
+   size_t i = 0;
+   size_t n = pattern.length();
+   
+   while (i < n)
+   {
+      char c = pattern[i];
+      
+      if (c != '%')
+      {
+         m_literals.back().push_back(c);
+         ++i;
+         continue;
+      }
+      
+      if (i + 1 < n && pattern[i+1] == '%')
+      {
+         m_literals.back().push_back('%');
+         i += 2;
+         continue;
+      }
+      
+      // %[width]d
+      size_t j = i + 1;
+      
+      while (j < n && pattern[j] >= '0' && pattern[j] <= '9')
+      {
+         ++j;
+      }
+      
+      if (j >= n || pattern[j] != 'd')
+      {
+         // unsupported conversion, the pattern is used as a plain name
+         m_literals.assign(1, pattern);
+         m_fields = 0;
+         return;
+      }
+      
+      m_literals.push_back(std::string());
+      ++m_fields;
+      
+      i = j + 1;
+   }
+}
+
+bool FramePattern::match(const std::string &name, int *values, size_t *widths) const
+{
+   size_t p = 0;
+   
+   for (size_t f=0; f<=m_fields; ++f)
+   {
+      const std::string &lit = m_literals[f];
+      
+      if (name.compare(p, lit.length(), lit) != 0)
+      {
+         return false;
+      }
+      
+      p += lit.length();
+      
+      if (f == m_fields)
+      {
+         break;
+      }
+      
+      size_t beg = p;
+      
+      if (p < name.length() && name[p] == '-')
+      {
+         ++p;
+      }
+      
+      size_t digits = p;
+      
+      while (p < name.length() && name[p] >= '0' && name[p] <= '9')
+      {
+         ++p;
+      }
+      
+      if (p == digits)
+      {
+         return false;
+      }
+      
+      if (values)
+      {
+         values[f] = atoi(name.c_str() + beg);
+      }
+      
+      if (widths)
+      {
+         widths[f] = p - beg;
+      }
+   }
+   
+   return (p == name.length());
+}
+
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#ifndef FILETOOLS_H
+#define FILETOOLS_H
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+namespace FileTools
+{
+
+typedef boost::shared_ptr<const std::vector<std::string> > NameList;
+
+// Names of the files in a directory, sorted.
+//   Listings are cached per directory and read again when the directory
+//   modification time changes, so the commands and the cache formats share
+//   a single scan. Returns an empty pointer if the directory can't be read.
+NameList listDirectory(const std::string &dirname);
+
+// Drops the cached listings
+void clearDirectoryCache();
+
+// Size and modification time (in seconds) of a file
+struct FileStamp
+{
+   long long size;
+   long long mtime;
+   
+   FileStamp()
+      : size(-1)
+      , mtime(0)
+   {
+   }
+   
+   bool operator==(const FileStamp &rhs) const
+   {
+      return (size == rhs.size && mtime == rhs.mtime);
+   }
+   
+   bool operator!=(const FileStamp &rhs) const
+   {
+      return !operator==(rhs);
+   }
+};
+
+// Returns false if path can't be stat'ed or isn't a regular file
+bool getFileStamp(const std::string &path, FileStamp &stamp);
+
+// Moves from over to in a single step, readers see either file
+bool replaceFile(const std::string &from, const std::string &to);
+
+// Exclusive advisory lock on path (created if needed), held until destroyed.
+//   Serializes the processes sharing a file, not the threads of a process.
+class FileLock
+{
+public:
+   
+   FileLock(const std::string &path);
+   ~FileLock();
+   
+   bool locked() const;
+   
+private:
+   
+   FileLock(const FileLock&);
+   FileLock& operator=(const FileLock&);
+   
+#ifdef _WIN32
+   void *m_handle;
+#else
+   int m_fd;
+#endif
+};
+
+inline bool startsWith(const std::string &str, const std::string &prefix)
+{
+   return (str.length() >= prefix.length() && str.compare(0, prefix.length(), prefix) == 0);
+}
+
+inline bool endsWith(const std::string &str, const std::string &suffix)
+{
+   return (str.length() >= suffix.length() && str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0);
+}
+
+// printf like file name pattern with integer fields (%d, %4d, %04d),
+//   parsed once and matched against whole names (replaces sscanf that
+//   stops at the first unmatched character).
+class FramePattern
+{
+public:
+   
+   FramePattern();
+   FramePattern(const std::string &pattern);
+   
+   // number of integer fields, 0 if the pattern has none or is invalid
+   size_t fields() const { return m_fields; }
+   
+   // literal text before the first field and after the last one
+   const std::string& prefix() const { return m_literals.front(); }
+   const std::string& suffix() const { return m_literals.back(); }
+   
+   // true if name matches the whole pattern, the fields values are written
+   //   to values (which must hold fields() ints) and, if given, the number of
+   //   characters of each field to widths
+   bool match(const std::string &name, int *values, size_t *widths=0) const;
+   
+private:
+   
+   // literals around the fields : m_fields + 1 entries
+   std::vector<std::string> m_literals;
+   size_t m_fields;
+};
+
+}
+
+#endif
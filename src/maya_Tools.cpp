@@ -31,6 +31,7 @@
 
 
 #include "maya_Tools.h"
+#include "file_Tools.h"
 
 
 #include <maya/MGlobal.h>
@@ -43,12 +44,167 @@
 #include <maya/MItDag.h>
 #include <maya/MFnDagNode.h>
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 
 
 namespace MayaTools {
 
+struct FrameFilesEntry
+{
+  FileTools::NameList listing; // listing the files were picked from
+  MTime::Unit unit; // frame times depend on the ui unit
+  FrameFiles files;
+};
+
+static boost::mutex gFrameFilesMutex;
+static std::map<std::string, FrameFilesEntry> gFrameFiles;
+
+// basename as a literal FramePattern prefix
+static std::string patternLiteral( const std::string &str ) {
+  std::string rv;
+  
+  for (size_t i=0; i<str.length(); ++i)
+  {
+    rv.push_back(str[i]);
+    
+    if (str[i] == '%')
+    {
+      rv.push_back('%');
+    }
+  }
+  
+  return rv;
+}
+
+// <frame>.<subframe> read as a decimal number, like the name is written
+static double subFrameTime( int frame, int subframe, size_t width ) {
+  char text[64];
+  
+  sprintf(text, "%d.%0*d", frame, int(width), subframe);
+  
+  return atof(text);
+}
+
+static FrameFileMap* matchFrameFiles( const FileTools::NameList &names, const std::string &dirname, const std::string &basename,
+                                      const std::string &filePattern, bool useSubFrames ) {
+  FrameFileMap *files = new FrameFileMap();
+  
+  std::string prefix = patternLiteral(basename);
+  
+  // without a file pattern, the names identified by the cache formats
+  FileTools::FramePattern frame(prefix + ".%d.f3d");
+  FileTools::FramePattern subFrame(prefix + ".%d.%d.f3d");
+  FileTools::FramePattern mayaFrame(prefix + "Frame%d.f3d");
+  FileTools::FramePattern mayaTick(prefix + "Frame%dTick%d.f3d");
+  
+  FileTools::FramePattern pattern(filePattern);
+  size_t patternFields = (useSubFrames ? 2 : 1);
+  
+  double tickFrames = MTime(1.0, MTime::k6000FPS).asUnits(MTime::uiUnit());
+  
+  int values[2];
+  size_t widths[2];
+  
+  for (size_t i=0; i<names->size(); ++i)
+  {
+    const std::string &name = (*names)[i];
+    
+    if (!FileTools::startsWith(name, basename))
+    {
+      continue;
+    }
+    
+    MTime t;
+    
+    if (filePattern.length() > 0)
+    {
+      if (pattern.fields() != patternFields || !pattern.match(name, values, widths))
+      {
+        continue;
+      }
+      
+      t.setValue(useSubFrames ? subFrameTime(values[0], values[1], widths[1]) : double(values[0]));
+    }
+    else if (frame.match(name, values) || mayaFrame.match(name, values))
+    {
+      t.setValue(double(values[0]));
+    }
+    else if (subFrame.match(name, values, widths))
+    {
+      t.setValue(subFrameTime(values[0], values[1], widths[1]));
+    }
+    else if (mayaTick.match(name, values))
+    {
+      t.setValue(double(values[0]) + values[1] * tickFrames);
+    }
+    else
+    {
+      continue;
+    }
+    
+    (*files)[t] = dirname + name;
+  }
+  
+  return files;
+}
+
+FrameFiles listFrameFiles( const std::string &dirname, const std::string &basename,
+                           const std::string &filePattern, bool useSubFrames ) {
+  std::string dn = (dirname.length() > 0 ? dirname : std::string("."));
+  
+  char lc = dn[dn.length()-1];
+  
+  #ifdef _WIN32
+  if (lc != '\\' && lc != '/')
+  #else
+  if (lc != '/')
+  #endif
+  {
+    dn.push_back('/');
+  }
+  
+  // shared listing, only read again when the directory changes
+  FileTools::NameList names = FileTools::listDirectory(dn);
+  
+  if (!names)
+  {
+    return FrameFiles();
+  }
+  
+  std::string key = dn + "\n" + basename + "\n" + filePattern + (useSubFrames ? "\n2" : "\n1");
+  
+  MTime::Unit unit = MTime::uiUnit();
+  
+  {
+    boost::mutex::scoped_lock lock(gFrameFilesMutex);
+    
+    std::map<std::string, FrameFilesEntry>::iterator it = gFrameFiles.find(key);
+    
+    // the entry holds its listing : a new listing can't reuse its address
+    if (it != gFrameFiles.end() && it->second.listing == names && it->second.unit == unit)
+    {
+      return it->second.files;
+    }
+  }
+  
+  FrameFilesEntry entry;
+  
+  entry.listing = names;
+  entry.unit = unit;
+  entry.files = FrameFiles(matchFrameFiles(names, dn, basename, filePattern, useSubFrames));
+  
+  boost::mutex::scoped_lock lock(gFrameFilesMutex);
+  
+  gFrameFiles[key] = entry;
+  
+  return entry.files;
+}
+
 bool dirmap( std::string &path ) {
   MString rv = "";
   
@@ -36,9 +36,13 @@
 #include <maya/MFnFluid.h>
 #include <maya/MStatus.h>
 #include <maya/MFnDependencyNode.h>
+#include <maya/MTime.h>
 
+#include <map>
 #include <string>
 
+#include <boost/shared_ptr.hpp>
+
 namespace MayaTools {
 
 MStatus getTransform ( std::string nodeName  , double (&transform)[4][4] );
@@ -46,6 +50,19 @@ MStatus getFluidNode ( std::string fluidName , MFnFluid &fluid);
 MStatus getNodeValue ( MFnDependencyNode &node , const char *valueName, float &result );
 bool dirmap( std::string &path );
 
+// frame files of a sequence : time -> path
+typedef std::map<MTime, std::string> FrameFileMap;
+typedef boost::shared_ptr<const FrameFileMap> FrameFiles;
+
+// Frame files of dirname named basename.<frame>[.<subframe>].f3d or
+//   basenameFrame<frame>[Tick<ticks>].f3d, or starting with basename and
+//   matching filePattern when it isn't empty (printf like, one integer field
+//   or two with useSubFrames). Built once per sequence and again when the
+//   directory listing changes (see FileTools::listDirectory). Returns an empty
+//   pointer if the directory can't be read.
+FrameFiles listFrameFiles( const std::string &dirname, const std::string &basename,
+                           const std::string &filePattern, bool useSubFrames );
+
 }
 
 #endif
@@ -0,0 +1,85 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "parallel_Tools.h"
+#include "tinyLogger.h"
+
+#include <cstdlib>
+
+namespace ParallelTools
+{
+
+static size_t gNumThreads = 0;
+
+static size_t defaultNumThreads()
+{
+   size_t n = 0;
+   
+   const char *env = getenv("FIELD3D_MAYA_THREADS");
+   
+   if (env)
+   {
+      int v = atoi(env);
+      
+      if (v > 0)
+      {
+         n = (size_t) v;
+      }
+      else
+      {
+         WARNING("Invalid FIELD3D_MAYA_THREADS value \"" << env << "\", using hardware concurrency");
+      }
+   }
+   
+   if (n == 0)
+   {
+      n = (size_t) boost::thread::hardware_concurrency();
+   }
+   
+   return (n > 0 ? n : 1);
+}
+
+size_t numThreads()
+{
+   if (gNumThreads == 0)
+   {
+      gNumThreads = defaultNumThreads();
+   }
+   return gNumThreads;
+}
+
+void setNumThreads(size_t n)
+{
+   gNumThreads = n;
+}
+
+}
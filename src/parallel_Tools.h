@@ -0,0 +1,235 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef PARALLELTOOLS_H
+#define PARALLELTOOLS_H
+
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace ParallelTools
+{
+
+// Number of threads used by the parallel code paths.
+//   Defaults to the hardware concurrency, can be overridden with the
+//   FIELD3D_MAYA_THREADS environment variable. A value of 1 forces
+//   the original serial code paths. setNumThreads(0) restores the default.
+size_t numThreads();
+void setNumThreads(size_t n);
+
+inline bool isSerial()
+{
+   return (numThreads() <= 1);
+}
+
+// Minimum number of elements worth handing to a thread
+const size_t MIN_TASK_SIZE = 32768;
+
+// Number of items of 'itemSize' elements each a task should at least process
+inline size_t grainSize(size_t itemSize)
+{
+   if (itemSize == 0 || itemSize >= MIN_TASK_SIZE)
+   {
+      return 1;
+   }
+   return (MIN_TASK_SIZE + itemSize - 1) / itemSize;
+}
+
+// Hands out [begin, end) in chunks of 'grain' items to the workers
+class RangeQueue
+{
+public:
+   
+   RangeQueue(size_t begin, size_t end, size_t grain)
+      : m_next(begin), m_end(end), m_grain(grain > 0 ? grain : 1)
+   {
+   }
+   
+   bool pop(size_t &begin, size_t &end)
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      
+      if (m_next >= m_end)
+      {
+         return false;
+      }
+      
+      begin = m_next;
+      end = (m_end - m_next > m_grain ? m_next + m_grain : m_end);
+      m_next = end;
+      
+      return true;
+   }
+   
+   // stop handing out work (used when one of the workers failed)
+   void cancel(const std::string &msg)
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      
+      if (m_error.length() == 0)
+      {
+         m_error = msg;
+      }
+      m_next = m_end;
+   }
+   
+   const std::string& error() const
+   {
+      return m_error;
+   }
+   
+private:
+   
+   boost::mutex m_mutex;
+   size_t m_next;
+   size_t m_end;
+   size_t m_grain;
+   std::string m_error;
+};
+
+template <typename Func>
+struct RangeWorker
+{
+   RangeWorker(RangeQueue &queue, const Func &func)
+      : m_queue(queue), m_func(func)
+   {
+   }
+   
+   void operator()()
+   {
+      size_t b, e;
+      
+      try
+      {
+         while (m_queue.pop(b, e))
+         {
+            m_func(b, e);
+         }
+      }
+      catch (std::exception &ex)
+      {
+         m_queue.cancel(ex.what());
+      }
+      catch (...)
+      {
+         m_queue.cancel("Unknown error in worker thread");
+      }
+   }
+   
+   RangeQueue &m_queue;
+   Func m_func;
+};
+
+// Calls func(b, e) on sub-ranges of [begin, end), at most 'grain' items at once.
+//   The calling thread takes part in the work. Func is copied for each thread.
+//   Exceptions raised by func are re-thrown as std::runtime_error once all
+//   workers have joined.
+template <typename Func>
+void parallelFor(size_t begin, size_t end, size_t grain, const Func &func)
+{
+   if (end <= begin)
+   {
+      return;
+   }
+   
+   if (grain == 0)
+   {
+      grain = 1;
+   }
+   
+   size_t nchunks = (end - begin + grain - 1) / grain;
+   size_t nthreads = numThreads();
+   
+   if (nthreads > nchunks)
+   {
+      nthreads = nchunks;
+   }
+   
+   if (nthreads <= 1)
+   {
+      Func f(func);
+      f(begin, end);
+      return;
+   }
+   
+   RangeQueue queue(begin, end, grain);
+   boost::thread_group workers;
+   
+   for (size_t i=1; i<nthreads; ++i)
+   {
+      workers.create_thread(RangeWorker<Func>(queue, func));
+   }
+   
+   RangeWorker<Func> self(queue, func);
+   self();
+   
+   workers.join_all();
+   
+   if (queue.error().length() > 0)
+   {
+      throw std::runtime_error(queue.error());
+   }
+}
+
+// Wall clock timer, elapsed time in milliseconds
+class Timer
+{
+public:
+   
+   Timer()
+   {
+      reset();
+   }
+   
+   void reset()
+   {
+      m_start = boost::posix_time::microsec_clock::universal_time();
+   }
+   
+   double elapsed() const
+   {
+      return 0.001 * double((boost::posix_time::microsec_clock::universal_time() - m_start).total_microseconds());
+   }
+   
+private:
+   
+   boost::posix_time::ptime m_start;
+};
+
+}
+
+#endif
@@ -31,6 +31,9 @@
 
 
 #include "plugin.h"
+#include "field3D_WriteBehind.h"
+#include "field3D_OneFile.h"
+#include "field3D_FilePool.h"
 
 #ifdef _WIN32
 __declspec(dllexport)
@@ -47,6 +50,8 @@ MStatus initializePlugin( MObject obj )
   CHECK_MSTATUS_AND_RETURN_IT( plugin.registerCacheFormat("f3d_sparse_half" , Field3dCacheFormat::SHCreator) );
   CHECK_MSTATUS_AND_RETURN_IT( plugin.registerCacheFormat("f3d_sparse_float", Field3dCacheFormat::SFCreator) );
   CHECK_MSTATUS_AND_RETURN_IT( plugin.registerCacheFormat("f3d_sparse_double", Field3dCacheFormat::SDCreator) );
+  CHECK_MSTATUS_AND_RETURN_IT( plugin.registerCacheFormat("f3d_sparse_quant8", Field3dCacheFormat::SQ8Creator) );
+  CHECK_MSTATUS_AND_RETURN_IT( plugin.registerCacheFormat("f3d_sparse_quant16", Field3dCacheFormat::SQ16Creator) );
   CHECK_MSTATUS_AND_RETURN_IT( plugin.registerCommand("exportF3d", exportF3d::creator, exportF3d::newSyntax) );
   
   MStatus status = plugin.registerNode( "Field3DForceLoad",
@@ -103,6 +108,11 @@ MStatus uninitializePlugin( MObject obj )
 {
   MFnPlugin plugin( obj );
   
+  // pending cache writes must land before the code goes away
+  OneFile::finalizeAll();
+  WriteBehind::shutdown();
+  FilePool::clear();
+  
   MStatus status = plugin.deregisterCommand("importF3d");
   
   if (!status)
@@ -142,6 +152,8 @@ MStatus uninitializePlugin( MObject obj )
   CHECK_MSTATUS_AND_RETURN_IT( plugin.deregisterCacheFormat("f3d_sparse_half"  ) );
   CHECK_MSTATUS_AND_RETURN_IT( plugin.deregisterCacheFormat("f3d_sparse_float" ) );
   CHECK_MSTATUS_AND_RETURN_IT( plugin.deregisterCacheFormat("f3d_sparse_double") );
+  CHECK_MSTATUS_AND_RETURN_IT( plugin.deregisterCacheFormat("f3d_sparse_quant8") );
+  CHECK_MSTATUS_AND_RETURN_IT( plugin.deregisterCacheFormat("f3d_sparse_quant16") );
   CHECK_MSTATUS_AND_RETURN_IT( plugin.deregisterCommand("exportF3d") );
   
   return MStatus::kSuccess;
@@ -0,0 +1,796 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "simd_Tools.h"
+#include "tinyLogger.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// x86 kernels need per-function target attributes (gcc >= 4.9, clang) or
+// a compiler that exposes all intrinsics by default (msvc)
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#     define SIMDTOOLS_X86
+#     define SIMDTOOLS_TARGET(t) __attribute__((target(t)))
+#     include <cpuid.h>
+#     include <immintrin.h>
+#  elif defined(_MSC_VER) && _MSC_VER >= 1912
+#     define SIMDTOOLS_X86
+#     define SIMDTOOLS_TARGET(t)
+#     include <intrin.h>
+#     include <immintrin.h>
+#  endif
+#endif
+
+namespace SimdTools
+{
+
+// ---------------------  Scalar kernels
+
+static void deinterleave3Scalar(const float *src, float *x, float *y, float *z, size_t n)
+{
+   for (size_t i=0; i<n; ++i, src+=3)
+   {
+      x[i] = src[0];
+      y[i] = src[1];
+      z[i] = src[2];
+   }
+}
+
+static void deinterleave2Scalar(const float *src, float *x, float *y, size_t n)
+{
+   for (size_t i=0; i<n; ++i, src+=3)
+   {
+      x[i] = src[0];
+      y[i] = src[1];
+   }
+}
+
+static void deinterleave3Scalar(const half *src, float *x, float *y, float *z, size_t n)
+{
+   for (size_t i=0; i<n; ++i, src+=3)
+   {
+      x[i] = src[0];
+      y[i] = src[1];
+      z[i] = src[2];
+   }
+}
+
+static void deinterleave2Scalar(const half *src, float *x, float *y, size_t n)
+{
+   for (size_t i=0; i<n; ++i, src+=3)
+   {
+      x[i] = src[0];
+      y[i] = src[1];
+   }
+}
+
+static void dequantizeScalar(const unsigned char *codes, float offset, float scale, float *dst, size_t n)
+{
+   for (size_t i=0; i<n; ++i)
+   {
+      dst[i] = offset + scale * float(codes[i]);
+   }
+}
+
+static void dequantizeScalar(const unsigned short *codes, float offset, float scale, float *dst, size_t n)
+{
+   for (size_t i=0; i<n; ++i)
+   {
+      dst[i] = offset + scale * float(codes[i]);
+   }
+}
+
+#ifdef SIMDTOOLS_X86
+
+// ---------------------  SSE4.1 kernels (4 triples per iteration)
+
+// a0 = x0 y0 z0 x1, a1 = y1 z1 x2 y2, a2 = z2 x3 y3 z3
+#define SIMDTOOLS_SPLIT4(a0, a1, a2, x, y, z) \
+   { \
+      __m128 t0 = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(2, 1, 3, 2)); \
+      __m128 t1 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(1, 0, 2, 1)); \
+      x = _mm_shuffle_ps(a0, t0, _MM_SHUFFLE(2, 0, 3, 0)); \
+      y = _mm_shuffle_ps(t1, t0, _MM_SHUFFLE(3, 1, 2, 0)); \
+      z = _mm_shuffle_ps(t1, a2, _MM_SHUFFLE(3, 0, 3, 1)); \
+   }
+
+#define SIMDTOOLS_SPLIT4_XY(a0, a1, a2, x, y) \
+   { \
+      __m128 t0 = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(2, 1, 3, 2)); \
+      __m128 t1 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(1, 0, 2, 1)); \
+      x = _mm_shuffle_ps(a0, t0, _MM_SHUFFLE(2, 0, 3, 0)); \
+      y = _mm_shuffle_ps(t1, t0, _MM_SHUFFLE(3, 1, 2, 0)); \
+   }
+
+// 4 halfs (in the low 64 bits) to 4 floats, denormals, infinities and NaNs included
+SIMDTOOLS_TARGET("sse4.1")
+static inline __m128 halfToFloat4(__m128i h)
+{
+   const __m128i absMask = _mm_set1_epi32(0x7fff);
+   const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+   const __m128i infNaN = _mm_set1_epi32(0x7bff);
+   const __m128i expMask = _mm_set1_epi32(255 << 23);
+   
+   __m128i h32 = _mm_cvtepu16_epi32(h);
+   __m128i sign = _mm_slli_epi32(_mm_andnot_si128(absMask, h32), 16);
+   __m128i em = _mm_and_si128(h32, absMask);
+   
+   __m128 f = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(em, 13)), magic);
+   __m128i special = _mm_and_si128(_mm_cmpgt_epi32(em, infNaN), expMask);
+   
+   return _mm_castsi128_ps(_mm_or_si128(_mm_or_si128(_mm_castps_si128(f), special), sign));
+}
+
+SIMDTOOLS_TARGET("sse4.1")
+static void deinterleave3SSE4(const float *src, float *x, float *y, float *z, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+4<=n; i+=4, src+=12)
+   {
+      __m128 a0 = _mm_loadu_ps(src);
+      __m128 a1 = _mm_loadu_ps(src + 4);
+      __m128 a2 = _mm_loadu_ps(src + 8);
+      __m128 vx, vy, vz;
+      
+      SIMDTOOLS_SPLIT4(a0, a1, a2, vx, vy, vz);
+      
+      _mm_storeu_ps(x + i, vx);
+      _mm_storeu_ps(y + i, vy);
+      _mm_storeu_ps(z + i, vz);
+   }
+   
+   deinterleave3Scalar(src, x + i, y + i, z + i, n - i);
+}
+
+SIMDTOOLS_TARGET("sse4.1")
+static void deinterleave2SSE4(const float *src, float *x, float *y, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+4<=n; i+=4, src+=12)
+   {
+      __m128 a0 = _mm_loadu_ps(src);
+      __m128 a1 = _mm_loadu_ps(src + 4);
+      __m128 a2 = _mm_loadu_ps(src + 8);
+      __m128 vx, vy;
+      
+      SIMDTOOLS_SPLIT4_XY(a0, a1, a2, vx, vy);
+      
+      _mm_storeu_ps(x + i, vx);
+      _mm_storeu_ps(y + i, vy);
+   }
+   
+   deinterleave2Scalar(src, x + i, y + i, n - i);
+}
+
+SIMDTOOLS_TARGET("sse4.1")
+static void deinterleave3SSE4(const half *src, float *x, float *y, float *z, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+4<=n; i+=4, src+=12)
+   {
+      __m128i h0 = _mm_loadu_si128((const __m128i*) src);
+      __m128i h1 = _mm_loadl_epi64((const __m128i*) (src + 8));
+      __m128 a0 = halfToFloat4(h0);
+      __m128 a1 = halfToFloat4(_mm_srli_si128(h0, 8));
+      __m128 a2 = halfToFloat4(h1);
+      __m128 vx, vy, vz;
+      
+      SIMDTOOLS_SPLIT4(a0, a1, a2, vx, vy, vz);
+      
+      _mm_storeu_ps(x + i, vx);
+      _mm_storeu_ps(y + i, vy);
+      _mm_storeu_ps(z + i, vz);
+   }
+   
+   deinterleave3Scalar(src, x + i, y + i, z + i, n - i);
+}
+
+SIMDTOOLS_TARGET("sse4.1")
+static void deinterleave2SSE4(const half *src, float *x, float *y, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+4<=n; i+=4, src+=12)
+   {
+      __m128i h0 = _mm_loadu_si128((const __m128i*) src);
+      __m128i h1 = _mm_loadl_epi64((const __m128i*) (src + 8));
+      __m128 a0 = halfToFloat4(h0);
+      __m128 a1 = halfToFloat4(_mm_srli_si128(h0, 8));
+      __m128 a2 = halfToFloat4(h1);
+      __m128 vx, vy;
+      
+      SIMDTOOLS_SPLIT4_XY(a0, a1, a2, vx, vy);
+      
+      _mm_storeu_ps(x + i, vx);
+      _mm_storeu_ps(y + i, vy);
+   }
+   
+   deinterleave2Scalar(src, x + i, y + i, n - i);
+}
+
+// same operations as the scalar kernels (no fused multiply-add) : the
+//   decoded values don't depend on the instruction set
+SIMDTOOLS_TARGET("sse4.1")
+static void dequantizeSSE4(const unsigned char *codes, float offset, float scale, float *dst, size_t n)
+{
+   const __m128 vo = _mm_set1_ps(offset);
+   const __m128 vs = _mm_set1_ps(scale);
+   
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16)
+   {
+      __m128i c = _mm_loadu_si128((const __m128i*) (codes + i));
+      
+      for (int q=0; q<4; ++q)
+      {
+         __m128 f = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(c));
+         
+         _mm_storeu_ps(dst + i + 4 * q, _mm_add_ps(vo, _mm_mul_ps(vs, f)));
+         
+         c = _mm_srli_si128(c, 4);
+      }
+   }
+   
+   dequantizeScalar(codes + i, offset, scale, dst + i, n - i);
+}
+
+SIMDTOOLS_TARGET("sse4.1")
+static void dequantizeSSE4(const unsigned short *codes, float offset, float scale, float *dst, size_t n)
+{
+   const __m128 vo = _mm_set1_ps(offset);
+   const __m128 vs = _mm_set1_ps(scale);
+   
+   size_t i = 0;
+   
+   for (; i+8<=n; i+=8)
+   {
+      __m128i c = _mm_loadu_si128((const __m128i*) (codes + i));
+      __m128 f0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(c));
+      __m128 f1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(c, 8)));
+      
+      _mm_storeu_ps(dst + i, _mm_add_ps(vo, _mm_mul_ps(vs, f0)));
+      _mm_storeu_ps(dst + i + 4, _mm_add_ps(vo, _mm_mul_ps(vs, f1)));
+   }
+   
+   dequantizeScalar(codes + i, offset, scale, dst + i, n - i);
+}
+
+// ---------------------  AVX2 kernels (8 triples per iteration)
+
+// m0 = x0 y0 z0 x1 y1 z1 x2 y2, m1 = z2 x3 y3 z3 x4 y4 z4 x5, m2 = y5 z5 x6 y6 z6 x7 y7 z7 :
+//   each component sits at distinct lanes across the 3 registers, blend them
+//   together then put them back in order with a cross lane permutation
+#define SIMDTOOLS_SPLIT8_X(m0, m1, m2) \
+   _mm256_permutevar8x32_ps(_mm256_blend_ps(_mm256_blend_ps(m0, m1, 0x92), m2, 0x24), \
+                            _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5))
+#define SIMDTOOLS_SPLIT8_Y(m0, m1, m2) \
+   _mm256_permutevar8x32_ps(_mm256_blend_ps(_mm256_blend_ps(m0, m1, 0x24), m2, 0x49), \
+                            _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6))
+#define SIMDTOOLS_SPLIT8_Z(m0, m1, m2) \
+   _mm256_permutevar8x32_ps(_mm256_blend_ps(_mm256_blend_ps(m0, m1, 0x49), m2, 0x92), \
+                            _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7))
+
+SIMDTOOLS_TARGET("avx2")
+static void deinterleave3AVX2(const float *src, float *x, float *y, float *z, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+8<=n; i+=8, src+=24)
+   {
+      __m256 m0 = _mm256_loadu_ps(src);
+      __m256 m1 = _mm256_loadu_ps(src + 8);
+      __m256 m2 = _mm256_loadu_ps(src + 16);
+      
+      _mm256_storeu_ps(x + i, SIMDTOOLS_SPLIT8_X(m0, m1, m2));
+      _mm256_storeu_ps(y + i, SIMDTOOLS_SPLIT8_Y(m0, m1, m2));
+      _mm256_storeu_ps(z + i, SIMDTOOLS_SPLIT8_Z(m0, m1, m2));
+   }
+   
+   deinterleave3Scalar(src, x + i, y + i, z + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx2")
+static void deinterleave2AVX2(const float *src, float *x, float *y, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+8<=n; i+=8, src+=24)
+   {
+      __m256 m0 = _mm256_loadu_ps(src);
+      __m256 m1 = _mm256_loadu_ps(src + 8);
+      __m256 m2 = _mm256_loadu_ps(src + 16);
+      
+      _mm256_storeu_ps(x + i, SIMDTOOLS_SPLIT8_X(m0, m1, m2));
+      _mm256_storeu_ps(y + i, SIMDTOOLS_SPLIT8_Y(m0, m1, m2));
+   }
+   
+   deinterleave2Scalar(src, x + i, y + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx2,f16c")
+static void deinterleave3AVX2(const half *src, float *x, float *y, float *z, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+8<=n; i+=8, src+=24)
+   {
+      __m256 m0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) src));
+      __m256 m1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (src + 8)));
+      __m256 m2 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (src + 16)));
+      
+      _mm256_storeu_ps(x + i, SIMDTOOLS_SPLIT8_X(m0, m1, m2));
+      _mm256_storeu_ps(y + i, SIMDTOOLS_SPLIT8_Y(m0, m1, m2));
+      _mm256_storeu_ps(z + i, SIMDTOOLS_SPLIT8_Z(m0, m1, m2));
+   }
+   
+   deinterleave3Scalar(src, x + i, y + i, z + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx2,f16c")
+static void deinterleave2AVX2(const half *src, float *x, float *y, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+8<=n; i+=8, src+=24)
+   {
+      __m256 m0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) src));
+      __m256 m1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (src + 8)));
+      __m256 m2 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (src + 16)));
+      
+      _mm256_storeu_ps(x + i, SIMDTOOLS_SPLIT8_X(m0, m1, m2));
+      _mm256_storeu_ps(y + i, SIMDTOOLS_SPLIT8_Y(m0, m1, m2));
+   }
+   
+   deinterleave2Scalar(src, x + i, y + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx2")
+static void dequantizeAVX2(const unsigned char *codes, float offset, float scale, float *dst, size_t n)
+{
+   const __m256 vo = _mm256_set1_ps(offset);
+   const __m256 vs = _mm256_set1_ps(scale);
+   
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16)
+   {
+      __m128i c = _mm_loadu_si128((const __m128i*) (codes + i));
+      __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c));
+      __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(c, 8)));
+      
+      _mm256_storeu_ps(dst + i, _mm256_add_ps(vo, _mm256_mul_ps(vs, f0)));
+      _mm256_storeu_ps(dst + i + 8, _mm256_add_ps(vo, _mm256_mul_ps(vs, f1)));
+   }
+   
+   dequantizeSSE4(codes + i, offset, scale, dst + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx2")
+static void dequantizeAVX2(const unsigned short *codes, float offset, float scale, float *dst, size_t n)
+{
+   const __m256 vo = _mm256_set1_ps(offset);
+   const __m256 vs = _mm256_set1_ps(scale);
+   
+   size_t i = 0;
+   
+   for (; i+8<=n; i+=8)
+   {
+      __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (codes + i))));
+      
+      _mm256_storeu_ps(dst + i, _mm256_add_ps(vo, _mm256_mul_ps(vs, f)));
+   }
+   
+   dequantizeScalar(codes + i, offset, scale, dst + i, n - i);
+}
+
+// ---------------------  AVX-512 kernels (16 triples per iteration)
+
+// Two-register permutation indices : component c of triple i is at flat
+//   position p = 3i+c. First pass picks p < 32 from (m0, m1), second pass
+//   keeps those lanes and picks the remaining ones from m2.
+static int gSplit16[3][2][16];
+
+static void initSplit16()
+{
+   for (int c=0; c<3; ++c)
+   {
+      for (int i=0; i<16; ++i)
+      {
+         int p = 3 * i + c;
+         
+         gSplit16[c][0][i] = (p < 32 ? p : 0);
+         gSplit16[c][1][i] = (p < 32 ? i : 16 + (p - 32));
+      }
+   }
+}
+
+SIMDTOOLS_TARGET("avx512f")
+static inline __m512 split16(__m512 m0, __m512 m1, __m512 m2, int c)
+{
+   __m512i i0 = _mm512_loadu_si512(gSplit16[c][0]);
+   __m512i i1 = _mm512_loadu_si512(gSplit16[c][1]);
+   
+   return _mm512_permutex2var_ps(_mm512_permutex2var_ps(m0, i0, m1), i1, m2);
+}
+
+SIMDTOOLS_TARGET("avx512f")
+static void deinterleave3AVX512(const float *src, float *x, float *y, float *z, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16, src+=48)
+   {
+      __m512 m0 = _mm512_loadu_ps(src);
+      __m512 m1 = _mm512_loadu_ps(src + 16);
+      __m512 m2 = _mm512_loadu_ps(src + 32);
+      
+      _mm512_storeu_ps(x + i, split16(m0, m1, m2, 0));
+      _mm512_storeu_ps(y + i, split16(m0, m1, m2, 1));
+      _mm512_storeu_ps(z + i, split16(m0, m1, m2, 2));
+   }
+   
+   deinterleave3AVX2(src, x + i, y + i, z + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx512f")
+static void deinterleave2AVX512(const float *src, float *x, float *y, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16, src+=48)
+   {
+      __m512 m0 = _mm512_loadu_ps(src);
+      __m512 m1 = _mm512_loadu_ps(src + 16);
+      __m512 m2 = _mm512_loadu_ps(src + 32);
+      
+      _mm512_storeu_ps(x + i, split16(m0, m1, m2, 0));
+      _mm512_storeu_ps(y + i, split16(m0, m1, m2, 1));
+   }
+   
+   deinterleave2AVX2(src, x + i, y + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx512f")
+static void deinterleave3AVX512(const half *src, float *x, float *y, float *z, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16, src+=48)
+   {
+      __m512 m0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) src));
+      __m512 m1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) (src + 16)));
+      __m512 m2 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) (src + 32)));
+      
+      _mm512_storeu_ps(x + i, split16(m0, m1, m2, 0));
+      _mm512_storeu_ps(y + i, split16(m0, m1, m2, 1));
+      _mm512_storeu_ps(z + i, split16(m0, m1, m2, 2));
+   }
+   
+   deinterleave3AVX2(src, x + i, y + i, z + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx512f")
+static void deinterleave2AVX512(const half *src, float *x, float *y, size_t n)
+{
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16, src+=48)
+   {
+      __m512 m0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) src));
+      __m512 m1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) (src + 16)));
+      __m512 m2 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) (src + 32)));
+      
+      _mm512_storeu_ps(x + i, split16(m0, m1, m2, 0));
+      _mm512_storeu_ps(y + i, split16(m0, m1, m2, 1));
+   }
+   
+   deinterleave2AVX2(src, x + i, y + i, n - i);
+}
+
+// the explicit rounding forms keep gcc from fusing the multiply and add
+#define SIMDTOOLS_MULADD16(o, s, f) \
+   _mm512_add_round_ps(o, _mm512_mul_round_ps(s, f, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), \
+                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+
+SIMDTOOLS_TARGET("avx512f")
+static void dequantizeAVX512(const unsigned char *codes, float offset, float scale, float *dst, size_t n)
+{
+   const __m512 vo = _mm512_set1_ps(offset);
+   const __m512 vs = _mm512_set1_ps(scale);
+   
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16)
+   {
+      __m512 f = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (codes + i))));
+      
+      _mm512_storeu_ps(dst + i, SIMDTOOLS_MULADD16(vo, vs, f));
+   }
+   
+   dequantizeAVX2(codes + i, offset, scale, dst + i, n - i);
+}
+
+SIMDTOOLS_TARGET("avx512f")
+static void dequantizeAVX512(const unsigned short *codes, float offset, float scale, float *dst, size_t n)
+{
+   const __m512 vo = _mm512_set1_ps(offset);
+   const __m512 vs = _mm512_set1_ps(scale);
+   
+   size_t i = 0;
+   
+   for (; i+16<=n; i+=16)
+   {
+      __m512 f = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) (codes + i))));
+      
+      _mm512_storeu_ps(dst + i, SIMDTOOLS_MULADD16(vo, vs, f));
+   }
+   
+   dequantizeAVX2(codes + i, offset, scale, dst + i, n - i);
+}
+
+// ---------------------  CPU detection
+
+static void cpuid(unsigned int leaf, unsigned int (&regs)[4])
+{
+#ifdef _MSC_VER
+   int r[4];
+   __cpuidex(r, (int) leaf, 0);
+   for (int i=0; i<4; ++i)
+   {
+      regs[i] = (unsigned int) r[i];
+   }
+#else
+   regs[0] = regs[1] = regs[2] = regs[3] = 0;
+   __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// OS enabled register states (XCR0)
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+   return _xgetbv(0);
+#else
+   unsigned int eax, edx;
+   __asm__ __volatile__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+   return ((unsigned long long) edx << 32) | eax;
+#endif
+}
+
+static InstructionSetEnum detectInstructionSet()
+{
+   unsigned int regs[4];
+   
+   cpuid(0, regs);
+   unsigned int maxLeaf = regs[0];
+   
+   if (maxLeaf < 1)
+   {
+      return SCALAR;
+   }
+   
+   cpuid(1, regs);
+   
+   bool sse41 = (regs[2] & (1u << 19)) != 0;
+   bool osxsave = (regs[2] & (1u << 27)) != 0;
+   bool avx = (regs[2] & (1u << 28)) != 0;
+   bool f16c = (regs[2] & (1u << 29)) != 0;
+   
+   if (!sse41)
+   {
+      return SCALAR;
+   }
+   
+   if (!osxsave || !avx || maxLeaf < 7)
+   {
+      return SSE4;
+   }
+   
+   unsigned long long xcr0 = xgetbv0();
+   
+   if ((xcr0 & 0x6) != 0x6)
+   {
+      return SSE4;
+   }
+   
+   cpuid(7, regs);
+   
+   bool avx2 = (regs[1] & (1u << 5)) != 0;
+   bool avx512f = (regs[1] & (1u << 16)) != 0;
+   
+   if (!avx2 || !f16c)
+   {
+      return SSE4;
+   }
+   
+   if (!avx512f || (xcr0 & 0xe6) != 0xe6)
+   {
+      return AVX2;
+   }
+   
+   return AVX512;
+}
+
+#else
+
+static InstructionSetEnum detectInstructionSet()
+{
+   return SCALAR;
+}
+
+#endif
+
+// ---------------------  Dispatch
+
+struct Kernels
+{
+   InstructionSetEnum is;
+   
+   void (*d3f)(const float*, float*, float*, float*, size_t);
+   void (*d2f)(const float*, float*, float*, size_t);
+   void (*d3h)(const half*, float*, float*, float*, size_t);
+   void (*d2h)(const half*, float*, float*, size_t);
+   void (*dq8)(const unsigned char*, float, float, float*, size_t);
+   void (*dq16)(const unsigned short*, float, float, float*, size_t);
+};
+
+static Kernels selectKernels()
+{
+   Kernels k;
+   
+   k.is = detectInstructionSet();
+   
+   const char *env = getenv("FIELD3D_MAYA_SIMD");
+   
+   if (env)
+   {
+      std::string cap = env;
+      
+      for (int i=SCALAR; i<=AVX512; ++i)
+      {
+         if (cap == instructionSetName((InstructionSetEnum) i))
+         {
+            if (i < k.is)
+            {
+               k.is = (InstructionSetEnum) i;
+            }
+            break;
+         }
+      }
+   }
+   
+   k.d3f = deinterleave3Scalar;
+   k.d2f = deinterleave2Scalar;
+   k.d3h = deinterleave3Scalar;
+   k.d2h = deinterleave2Scalar;
+   k.dq8 = dequantizeScalar;
+   k.dq16 = dequantizeScalar;
+   
+#ifdef SIMDTOOLS_X86
+   switch (k.is)
+   {
+   case AVX512:
+      initSplit16();
+      k.d3f = deinterleave3AVX512;
+      k.d2f = deinterleave2AVX512;
+      k.d3h = deinterleave3AVX512;
+      k.d2h = deinterleave2AVX512;
+      k.dq8 = dequantizeAVX512;
+      k.dq16 = dequantizeAVX512;
+      break;
+   case AVX2:
+      k.d3f = deinterleave3AVX2;
+      k.d2f = deinterleave2AVX2;
+      k.d3h = deinterleave3AVX2;
+      k.d2h = deinterleave2AVX2;
+      k.dq8 = dequantizeAVX2;
+      k.dq16 = dequantizeAVX2;
+      break;
+   case SSE4:
+      k.d3f = deinterleave3SSE4;
+      k.d2f = deinterleave2SSE4;
+      k.d3h = deinterleave3SSE4;
+      k.d2h = deinterleave2SSE4;
+      k.dq8 = dequantizeSSE4;
+      k.dq16 = dequantizeSSE4;
+      break;
+   default:
+      break;
+   }
+#endif
+   
+   DEBUG("SIMD instruction set : " << instructionSetName(k.is));
+   
+   return k;
+}
+
+// selected once, when the plugin is loaded
+static const Kernels gKernels = selectKernels();
+
+InstructionSetEnum instructionSet()
+{
+   return gKernels.is;
+}
+
+const char* instructionSetName(InstructionSetEnum is)
+{
+   switch (is)
+   {
+   case SSE4:
+      return "sse4";
+   case AVX2:
+      return "avx2";
+   case AVX512:
+      return "avx512";
+   default:
+      return "scalar";
+   }
+}
+
+void deinterleave3(const float *src, float *x, float *y, float *z, size_t n)
+{
+   gKernels.d3f(src, x, y, z, n);
+}
+
+void deinterleave3(const half *src, float *x, float *y, float *z, size_t n)
+{
+   gKernels.d3h(src, x, y, z, n);
+}
+
+void deinterleave2(const float *src, float *x, float *y, size_t n)
+{
+   gKernels.d2f(src, x, y, n);
+}
+
+void deinterleave2(const half *src, float *x, float *y, size_t n)
+{
+   gKernels.d2h(src, x, y, n);
+}
+
+void dequantize(const unsigned char *codes, float offset, float scale, float *dst, size_t n)
+{
+   gKernels.dq8(codes, offset, scale, dst, n);
+}
+
+void dequantize(const unsigned short *codes, float offset, float scale, float *dst, size_t n)
+{
+   gKernels.dq16(codes, offset, scale, dst, n);
+}
+
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2011 Prime Focus Film.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the
+// distribution. Neither the name of Prime Focus Film nor the
+// names of its contributors may be used to endorse or promote
+// products derived from this software without specific prior written
+// permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SIMDTOOLS_H
+#define SIMDTOOLS_H
+
+#include <cstddef>
+
+#include <OpenEXR/half.h>
+
+namespace SimdTools
+{
+
+enum InstructionSetEnum
+{
+   SCALAR,
+   SSE4,
+   AVX2,
+   AVX512
+};
+
+// Instruction set used by the kernels below.
+//   Detected at plugin load time, can be capped with the FIELD3D_MAYA_SIMD
+//   environment variable (scalar, sse4, avx2 or avx512).
+InstructionSetEnum instructionSet();
+const char* instructionSetName(InstructionSetEnum is);
+
+// Splits n xyz triples into planar x, y and z arrays
+void deinterleave3(const float *src, float *x, float *y, float *z, size_t n);
+void deinterleave3(const half *src, float *x, float *y, float *z, size_t n);
+
+// Same for 2D fluids : the z component is dropped
+void deinterleave2(const float *src, float *x, float *y, size_t n);
+void deinterleave2(const half *src, float *x, float *y, size_t n);
+
+// Decodes n quantized values : dst[i] = offset + scale * codes[i]
+void dequantize(const unsigned char *codes, float offset, float scale, float *dst, size_t n);
+void dequantize(const unsigned short *codes, float offset, float scale, float *dst, size_t n);
+
+}
+
+#endif